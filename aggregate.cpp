@@ -0,0 +1,337 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "worker_pool.cpp"
+
+//--------------------------------------------------
+// Group By Results
+//--------------------------------------------------
+struct GroupAggregate {
+    int32_t key;
+    int64_t sum;
+    uint64_t count;
+    int32_t min;
+    int32_t max;
+
+    double avg() const { return count ? static_cast<double>(sum) / count : 0.0; }
+
+    bool operator==(const GroupAggregate& o) const {
+        return key == o.key && sum == o.sum && count == o.count && min == o.min && max == o.max;
+    }
+};
+
+// One entry per distinct key, sorted by key
+struct GroupByResult {
+    std::vector<GroupAggregate> groups;
+    bool dense = false;     // which path produced it
+
+    const GroupAggregate* find(int32_t key) const {
+        auto it = std::lower_bound(groups.begin(), groups.end(), key,
+                                   [](const GroupAggregate& g, int32_t k) { return g.key < k; });
+        return it != groups.end() && it->key == key ? &*it : nullptr;
+    }
+};
+
+//--------------------------------------------------
+// Hash Aggregator
+//--------------------------------------------------
+// SUM/COUNT/MIN/MAX (and so AVG) per int32 key with 64-bit accumulators.
+// Open addressing with linear probing: the slot array holds 4-byte group
+// numbers (0 = empty), the aggregates themselves live in column arrays in
+// order of first appearance. Input is consumed in batches: hashes for a
+// batch are computed in one tight loop before any probing.
+class HashAggregator {
+    static constexpr size_t BATCH = 256;
+
+    std::vector<uint32_t> slots;    // group + 1, 0 if empty
+    uint32_t shift;                 // 64 - log2(slots.size())
+    std::vector<int32_t> keys;
+    std::vector<int64_t> sums;
+    std::vector<uint64_t> counts;
+    std::vector<int32_t> mins;
+    std::vector<int32_t> maxs;
+
+    static uint64_t hash(int32_t key) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(key)) * 0x9E3779B97F4A7C15ull;
+    }
+
+    // Slots use the high hash bits, partitions the middle ones
+    static size_t partition_of(int32_t key, size_t partitions) {
+        return static_cast<size_t>((hash(key) >> 16) & 0xFFFFFFFF) % partitions;
+    }
+
+    void grow() {
+        std::vector<uint32_t> old = std::move(slots);
+        slots.assign(old.size() * 2, 0);
+        shift--;
+        size_t mask = slots.size() - 1;
+        for (uint32_t group : old) {
+            if (group == 0) continue;
+            size_t slot = hash(keys[group - 1]) >> shift;
+            while (slots[slot] != 0) slot = (slot + 1) & mask;
+            slots[slot] = group;
+        }
+    }
+
+    uint32_t find_or_insert(int32_t key, uint64_t h) {
+        size_t mask = slots.size() - 1;
+        size_t slot = h >> shift;
+        while (uint32_t group = slots[slot]) {
+            if (keys[group - 1] == key) return group - 1;
+            slot = (slot + 1) & mask;
+        }
+        uint32_t group = static_cast<uint32_t>(keys.size());
+        keys.push_back(key);
+        sums.push_back(0);
+        counts.push_back(0);
+        mins.push_back(std::numeric_limits<int32_t>::max());
+        maxs.push_back(std::numeric_limits<int32_t>::min());
+        slots[slot] = group + 1;
+        return group;
+    }
+
+    static uint32_t log2_capacity(size_t expected_groups) {
+        uint32_t bits = 4;
+        while ((size_t(1) << bits) < expected_groups * 2) bits++;
+        return bits;
+    }
+
+public:
+    explicit HashAggregator(size_t expected_groups = 1024) {
+        uint32_t bits = log2_capacity(expected_groups);
+        slots.assign(size_t(1) << bits, 0);
+        shift = 64 - bits;
+    }
+
+    size_t size() const { return keys.size(); }
+
+    void consume(const int32_t* in_keys, const int32_t* values, size_t n) {
+        uint64_t hashes[BATCH];
+        for (size_t base = 0; base < n; base += BATCH) {
+            size_t len = std::min(BATCH, n - base);
+            for (size_t i = 0; i < len; i++) {
+                hashes[i] = hash(in_keys[base + i]);
+            }
+            for (size_t i = 0; i < len; i++) {
+                // Keep the load factor at or below one half
+                if ((keys.size() + 1) * 2 > slots.size()) grow();
+                uint32_t group = find_or_insert(in_keys[base + i], hashes[i]);
+                int32_t v = values[base + i];
+                sums[group] += v;
+                counts[group]++;
+                mins[group] = std::min(mins[group], v);
+                maxs[group] = std::max(maxs[group], v);
+            }
+        }
+    }
+
+    // Fold another aggregator's groups into this one; with partitions > 1
+    // only the keys of one partition, so partitions can merge in parallel
+    void merge(const HashAggregator& other, size_t partition = 0, size_t partitions = 1) {
+        for (size_t g = 0; g < other.keys.size(); g++) {
+            if (partitions > 1 && partition_of(other.keys[g], partitions) != partition) continue;
+            if ((keys.size() + 1) * 2 > slots.size()) grow();
+            uint32_t group = find_or_insert(other.keys[g], hash(other.keys[g]));
+            sums[group] += other.sums[g];
+            counts[group] += other.counts[g];
+            mins[group] = std::min(mins[group], other.mins[g]);
+            maxs[group] = std::max(maxs[group], other.maxs[g]);
+        }
+    }
+
+    GroupByResult finish() const {
+        GroupByResult result;
+        result.groups.reserve(keys.size());
+        for (size_t g = 0; g < keys.size(); g++) {
+            result.groups.push_back(GroupAggregate{keys[g], sums[g], counts[g], mins[g], maxs[g]});
+        }
+        std::sort(result.groups.begin(), result.groups.end(),
+                  [](const GroupAggregate& a, const GroupAggregate& b) { return a.key < b.key; });
+        return result;
+    }
+};
+
+//--------------------------------------------------
+// Dense Aggregator
+//--------------------------------------------------
+// For keys in a small range [lo, lo + span): aggregates are arrays indexed
+// by key - lo, so there is no hashing or probing. Offsets for a batch are
+// computed in one loop the compiler vectorizes; the scatter into the
+// accumulators stays scalar (it would need conflict detection to vectorize).
+class DenseAggregator {
+    static constexpr size_t BATCH = 1024;
+
+    int32_t lo;
+    std::vector<int64_t> sums;
+    std::vector<uint64_t> counts;
+    std::vector<int32_t> mins;
+    std::vector<int32_t> maxs;
+
+public:
+    DenseAggregator(int32_t lo, size_t span) :
+        lo(lo), sums(span, 0), counts(span, 0),
+        mins(span, std::numeric_limits<int32_t>::max()),
+        maxs(span, std::numeric_limits<int32_t>::min()) {}
+
+    void consume(const int32_t* keys, const int32_t* values, size_t n) {
+        uint32_t offsets[BATCH];
+        for (size_t base = 0; base < n; base += BATCH) {
+            size_t len = std::min(BATCH, n - base);
+            for (size_t i = 0; i < len; i++) {
+                offsets[i] = static_cast<uint32_t>(keys[base + i]) - static_cast<uint32_t>(lo);
+            }
+            for (size_t i = 0; i < len; i++) {
+                uint32_t o = offsets[i];
+                int32_t v = values[base + i];
+                sums[o] += v;
+                counts[o]++;
+                mins[o] = std::min(mins[o], v);
+                maxs[o] = std::max(maxs[o], v);
+            }
+        }
+    }
+
+    // Fold in another aggregator over the same range, offsets [from, to) only
+    void merge(const DenseAggregator& other, size_t from, size_t to) {
+        for (size_t o = from; o < to; o++) {
+            sums[o] += other.sums[o];
+            counts[o] += other.counts[o];
+            mins[o] = std::min(mins[o], other.mins[o]);
+            maxs[o] = std::max(maxs[o], other.maxs[o]);
+        }
+    }
+
+    GroupByResult finish() const {
+        GroupByResult result;
+        result.dense = true;
+        for (size_t o = 0; o < sums.size(); o++) {
+            if (counts[o] == 0) continue;
+            int32_t key = static_cast<int32_t>(static_cast<uint32_t>(lo) + static_cast<uint32_t>(o));
+            result.groups.push_back(GroupAggregate{key, sums[o], counts[o], mins[o], maxs[o]});
+        }
+        return result;
+    }
+};
+
+//--------------------------------------------------
+// Group By
+//--------------------------------------------------
+struct GroupByOptions {
+    size_t dense_max_span = 1 << 20;    // widest key range aggregated densely
+    size_t morsel_rows = 64 << 10;      // unit of work for parallel_group_by
+};
+
+// Min and max of a column; a reduction the compiler vectorizes
+inline std::pair<int32_t, int32_t> key_range(const int32_t* keys, size_t n) {
+    int32_t lo = std::numeric_limits<int32_t>::max();
+    int32_t hi = std::numeric_limits<int32_t>::min();
+    for (size_t i = 0; i < n; i++) {
+        lo = std::min(lo, keys[i]);
+        hi = std::max(hi, keys[i]);
+    }
+    return {lo, hi};
+}
+
+// Dense when the key range is narrow and not much sparser than the input
+inline bool use_dense(int32_t lo, int32_t hi, size_t n, const GroupByOptions& options) {
+    uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(hi) - lo) + 1;
+    return n > 0 && span <= options.dense_max_span && span <= 2 * n + 1024;
+}
+
+// SELECT key, SUM(value), COUNT(*), MIN(value), MAX(value) ... GROUP BY key
+inline GroupByResult group_by(const int32_t* keys, const int32_t* values, size_t n,
+                              const GroupByOptions& options = GroupByOptions()) {
+    auto [lo, hi] = key_range(keys, n);
+    if (use_dense(lo, hi, n, options)) {
+        DenseAggregator agg(lo, static_cast<size_t>(static_cast<int64_t>(hi) - lo) + 1);
+        agg.consume(keys, values, n);
+        return agg.finish();
+    }
+    HashAggregator agg;
+    agg.consume(keys, values, n);
+    return agg.finish();
+}
+
+//--------------------------------------------------
+// Parallel Group By
+//--------------------------------------------------
+// Morsel-driven: workers pull morsel_rows-row chunks off a shared counter,
+// so a slow worker just takes fewer of them, and aggregate into a
+// thread-local partial. Partials are then merged in parallel: hash
+// partials by key partition (worker p merges partition p of every
+// partial), dense partials by offset range.
+
+// Calls fn(worker, begin, end) for every morsel of [0, n)
+template <typename Fn>
+inline void for_each_morsel(WorkerPool& pool, size_t n, size_t morsel_rows, Fn fn) {
+    std::atomic<size_t> next{0};
+    pool.run([&](size_t worker) {
+        while (true) {
+            size_t begin = next.fetch_add(morsel_rows, std::memory_order_relaxed);
+            if (begin >= n) return;
+            fn(worker, begin, std::min(n, begin + morsel_rows));
+        }
+    });
+}
+
+inline GroupByResult parallel_group_by(WorkerPool& pool, const int32_t* keys, const int32_t* values,
+                                       size_t n, const GroupByOptions& options = GroupByOptions()) {
+    size_t workers = pool.size();
+    size_t morsel = std::max<size_t>(options.morsel_rows, 1);
+    if (workers == 1 || n < 2 * morsel) {
+        return group_by(keys, values, n, options);
+    }
+
+    std::vector<std::pair<int32_t, int32_t>> ranges(workers, key_range(nullptr, 0));
+    for_each_morsel(pool, n, morsel, [&](size_t w, size_t begin, size_t end) {
+        auto [lo, hi] = key_range(keys + begin, end - begin);
+        ranges[w].first = std::min(ranges[w].first, lo);
+        ranges[w].second = std::max(ranges[w].second, hi);
+    });
+    int32_t lo = ranges[0].first, hi = ranges[0].second;
+    for (auto& r : ranges) {
+        lo = std::min(lo, r.first);
+        hi = std::max(hi, r.second);
+    }
+
+    // Every worker holds a full dense array, so cap their total size too
+    size_t span = static_cast<size_t>(static_cast<int64_t>(hi) - lo) + 1;
+    if (use_dense(lo, hi, n, options) && span * workers <= 8 * options.dense_max_span) {
+        std::vector<DenseAggregator> partials(workers, DenseAggregator(lo, span));
+        for_each_morsel(pool, n, morsel, [&](size_t w, size_t begin, size_t end) {
+            partials[w].consume(keys + begin, values + begin, end - begin);
+        });
+        pool.run([&](size_t w) {
+            size_t from = span * w / workers, to = span * (w + 1) / workers;
+            for (size_t i = 1; i < workers; i++) {
+                partials[0].merge(partials[i], from, to);
+            }
+        });
+        return partials[0].finish();
+    }
+
+    std::vector<HashAggregator> partials(workers);
+    for_each_morsel(pool, n, morsel, [&](size_t w, size_t begin, size_t end) {
+        partials[w].consume(keys + begin, values + begin, end - begin);
+    });
+    std::vector<GroupByResult> merged(workers);
+    pool.run([&](size_t p) {
+        HashAggregator partition;
+        for (const auto& partial : partials) {
+            partition.merge(partial, p, workers);
+        }
+        merged[p] = partition.finish();
+    });
+
+    GroupByResult result;
+    for (auto& part : merged) {
+        result.groups.insert(result.groups.end(), part.groups.begin(), part.groups.end());
+    }
+    std::sort(result.groups.begin(), result.groups.end(),
+              [](const GroupAggregate& a, const GroupAggregate& b) { return a.key < b.key; });
+    return result;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+//--------------------------------------------------
+// Counting Resource
+//--------------------------------------------------
+// Passes everything to `upstream`, counting calls and bytes on the way.
+// Not thread-safe, like the resources it is layered over.
+class CountingResource : public std::pmr::memory_resource {
+    std::pmr::memory_resource* upstream;
+
+public:
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t bytes = 0;   // currently allocated
+
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) :
+        upstream(upstream) {}
+
+private:
+    void* do_allocate(size_t size, size_t align) override {
+        void* p = upstream->allocate(size, align);
+        allocations++;
+        bytes += size;
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t size, size_t align) override {
+        upstream->deallocate(p, size, align);
+        deallocations++;
+        bytes -= size;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+//--------------------------------------------------
+// Arena
+//--------------------------------------------------
+// Bump allocator for short-lived objects that die together (one event-loop
+// tick, one batch). deallocate() is a no-op; reset() drops everything at
+// once. Allocations are carved out of one block that is kept across resets;
+// a burst that outgrows it spills into blocks from a pool resource, which
+// holds on to them for the next burst. Once warm, an arena makes no calls
+// to the heap at all. Single-threaded.
+class Arena {
+    CountingResource heap;                        // what reaches operator new
+    std::pmr::unsynchronized_pool_resource pool;  // recycles spill blocks
+    std::vector<char> block;
+    std::pmr::monotonic_buffer_resource bump;
+
+public:
+    static constexpr size_t DEFAULT_BLOCK_BYTES = 64 << 10;
+
+    explicit Arena(size_t block_bytes = DEFAULT_BLOCK_BYTES) :
+        pool(std::pmr::pool_options{0, 4 << 20}, &heap),
+        block(block_bytes),
+        bump(block.data(), block.size(), &pool) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    std::pmr::memory_resource* resource() { return &bump; }
+
+    // Everything allocated so far is gone; its storage is reused
+    void reset() { bump.release(); }
+
+    // Calls made on the heap, for measuring
+    const CountingResource& upstream() const { return heap; }
+};
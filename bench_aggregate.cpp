@@ -0,0 +1,69 @@
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "aggregate.cpp"
+
+// GROUP BY throughput for several key counts: the original std::map of
+// value vectors summed at query time, the open-addressing hash aggregator
+// alone, and group_by() picking the dense array path where the key range
+// allows it. Then morsel-parallel group_by for 1, 2, 4, ... threads up to
+// the core count.
+// Usage: bench_aggregate [rows]
+
+template <typename Run>
+static void measure(const std::string& name, size_t rows, Run run) {
+    auto start = std::chrono::steady_clock::now();
+    size_t groups = run();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": rows=" << rows << " groups=" << groups
+              << " ns_per_row=" << secs * 1e9 / rows
+              << " mrows_per_sec=" << static_cast<uint64_t>(rows / secs / 1e6) << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t rows = argc > 1 ? std::stoul(argv[1]) : 10000000;
+    std::mt19937 rng(1);
+    std::vector<int32_t> keys(rows), values(rows);
+    for (size_t i = 0; i < rows; i++) values[i] = static_cast<int32_t>(rng() % 100000);
+
+    for (uint32_t distinct : {16u, 1000u, 100000u, 2000000u}) {
+        for (size_t i = 0; i < rows; i++) keys[i] = static_cast<int32_t>(rng() % distinct);
+        std::string tag = " keys=" + std::to_string(distinct);
+
+        measure("map_of_vectors" + tag, rows, [&] {
+            std::map<int, std::vector<int>> index;
+            for (size_t i = 0; i < rows; i++) index[keys[i]].push_back(values[i]);
+            int64_t check = 0;
+            for (auto& pair : index) {
+                for (int v : pair.second) check += v;
+            }
+            return check ? index.size() : 0;
+        });
+
+        GroupByOptions hash_only;
+        hash_only.dense_max_span = 0;
+        measure("hash" + tag, rows, [&] {
+            return group_by(keys.data(), values.data(), rows, hash_only).groups.size();
+        });
+        bool dense = false;
+        measure("group_by" + tag, rows, [&] {
+            GroupByResult result = group_by(keys.data(), values.data(), rows);
+            dense = result.dense;
+            return result.groups.size();
+        });
+        std::cout << "    group_by path: " << (dense ? "dense" : "hash") << "\n";
+
+        size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t threads = 1; threads <= cores; threads *= 2) {
+            WorkerPool pool(threads);
+            measure("parallel threads=" + std::to_string(threads) + tag, rows, [&] {
+                return parallel_group_by(pool, keys.data(), values.data(), rows).groups.size();
+            });
+        }
+    }
+    return 0;
+}
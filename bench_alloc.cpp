@@ -0,0 +1,119 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "arena.cpp"
+#include "buzzdb.cpp"
+#include "messages.cpp"
+
+// Heap calls per operation on the short-lived paths, with the default
+// allocator against a per-batch Arena:
+//   replicate  the leader building one AppendEntries batch from its log and
+//              encoding it (owned copies vs views in the arena)
+//   decode     one AppendEntries datagram on a follower (owned vs view)
+//   tuple      materializing one BuzzDB row as a Tuple
+// Allocations are counted by replacing global operator new.
+// Usage: bench_alloc [entries_per_batch] [entry_bytes] [iterations]
+
+static std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+// GCC pairs the inlined free() with operator new and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// std::pmr::new_delete_resource() allocates through the aligned forms
+void* operator new(size_t size, std::align_val_t align) {
+    size_t a = static_cast<size_t>(align);
+    void* p = std::aligned_alloc(a, (size + a - 1) / a * a);
+    if (!p) throw std::bad_alloc();
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+static volatile size_t sink = 0;
+
+template <typename F>
+static void measure(const char* name, size_t iterations, F&& fn) {
+    fn();   // warm up buffers and arenas
+    size_t before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": allocs_per_op=" << static_cast<double>(allocations.load() - before) / iterations
+              << " ns_per_op=" << static_cast<uint64_t>(secs * 1e9 / iterations) << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t batch = argc > 1 ? std::stoul(argv[1]) : 64;
+    size_t entry_bytes = argc > 2 ? std::stoul(argv[2]) : 128;
+    size_t iterations = argc > 3 ? std::stoul(argv[3]) : 20000;
+
+    std::deque<LogEntry> log;
+    for (size_t i = 0; i < batch; i++) {
+        log.push_back(LogEntry{7, std::string(entry_bytes, 'a' + i % 26), 42, i});
+    }
+    std::vector<char> buffer(1 << 20);
+    Arena arena;
+
+    measure("replicate_copy", iterations, [&] {
+        AppendEntriesRequest req{7, 1, 100, 7, {}, 90};
+        for (const auto& entry : log) req.entries.push_back(entry);
+        sink = sink + wire_encode(req, buffer.data(), buffer.size());
+    });
+    measure("replicate_arena", iterations, [&] {
+        AppendEntriesBatch req(arena.resource());
+        req.term = 7;
+        req.leader_id = 1;
+        req.prev_log_index = 100;
+        req.prev_log_term = 7;
+        req.leader_commit = 90;
+        req.entries.reserve(log.size());
+        for (const auto& entry : log) req.entries.emplace_back(entry);
+        sink = sink + wire_encode(req, buffer.data(), buffer.size());
+        arena.reset();
+    });
+
+    AppendEntriesRequest encoded{7, 1, 100, 7, {log.begin(), log.end()}, 90};
+    size_t len = wire_encode(encoded, buffer.data(), buffer.size());
+    measure("decode_owned", iterations, [&] {
+        sink = sink + wire_decode<AppendEntriesRequest>(buffer.data(), len).entries.size();
+    });
+    measure("decode_view", iterations, [&] {
+        auto view = AppendEntriesView::decode(buffer.data(), len);
+        view.for_each_entry([&](const LogEntryView& e) { sink = sink + e.data.size(); });
+    });
+
+    BuzzDB db;
+    for (int i = 0; i < 1024; i++) db.insert(i, i * 2);
+    size_t row = 0;
+    measure("tuple_heap", iterations, [&] {
+        sink = sink + db.getTuple(row++ % 1024).fieldCount();
+    });
+    measure("tuple_arena", iterations, [&] {
+        sink = sink + db.getTuple(row++ % 1024, arena.resource()).fieldCount();
+        if (row % 1024 == 0) arena.reset();
+    });
+
+    std::cout << "arena: heap_allocations=" << arena.upstream().allocations
+              << " heap_bytes=" << arena.upstream().bytes << "\n";
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+#include "bench_report.cpp"
+#include "btree.cpp"
+
+// BTree against std::map as an index from int keys to row numbers:
+// insert, point lookup, short range scans and a full ordered scan.
+//   rows    the output.txt workload: few distinct keys, many rows each.
+//           std::map<int, std::vector<int>> is BuzzDB's old index shape.
+//   unique  one row per key, in random order: std::map<int, int>
+// Rows come from `input` (pairs of ints, like output.txt) or are generated
+// like it (key = i % 1000). Reports JSON.
+// Usage: bench_btree [rows] [input]
+
+using Index = BTree<int32_t, uint32_t>;
+
+static volatile uint64_t sink = 0;
+
+static double ns_per(BenchClock::time_point start, size_t ops) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / ops;
+}
+
+// Lookups of every probe; range queries start at a probed key and cover
+// `span` keys
+template <typename Map, typename Scan>
+static void bench_queries(nlohmann::json& r, const Map& map, size_t rows, const std::vector<int32_t>& probes,
+                          int32_t span, Scan scan_map) {
+    auto start = BenchClock::now();
+    for (int32_t key : probes) sink = sink + map.find(key);
+    r["lookup_ns"] = ns_per(start, probes.size());
+
+    // Each range visits thousands of rows, so fewer of them
+    size_t ranges = std::min<size_t>(probes.size(), 10000);
+    uint64_t visited = 0;
+    start = BenchClock::now();
+    for (size_t i = 0; i < ranges; i++) visited += scan_map(map, probes[i], probes[i] + span - 1);
+    r["range_ns"] = ns_per(start, ranges);
+    r["range_rows_avg"] = static_cast<double>(visited) / ranges;
+
+    start = BenchClock::now();
+    uint64_t sum = 0;
+    map.for_each([&](int32_t, uint32_t row) { sum += row; });
+    sink = sink + sum;
+    r["ordered_scan_ns_per_row"] = ns_per(start, rows);
+    r["memory_bytes"] = map.memory_bytes();
+}
+
+// Built one insert at a time, in input order
+template <typename Map, typename Scan>
+static nlohmann::json bench_index(const char* name, const std::vector<int32_t>& keys,
+                                  const std::vector<int32_t>& probes, int32_t span, Scan scan_map) {
+    Map map;
+    nlohmann::json r;
+    r["index"] = name;
+    auto start = BenchClock::now();
+    for (size_t row = 0; row < keys.size(); row++) map.insert(keys[row], static_cast<uint32_t>(row));
+    r["insert_ns"] = ns_per(start, keys.size());
+    bench_queries(r, map, keys.size(), probes, span, scan_map);
+    return r;
+}
+
+// Same interface over each candidate
+struct TreeIndex {
+    Index tree;
+    void insert(int32_t key, uint32_t row) { tree.insert(key, row); }
+    uint32_t find(int32_t key) const {
+        const uint32_t* row = tree.find(key);
+        return row ? *row : 0;
+    }
+    template <typename F> void for_each(F&& fn) const { tree.for_each(fn); }
+    size_t memory_bytes() const { return tree.memory_bytes(); }
+};
+
+// Node sizes are estimates: libstdc++ red-black nodes carry 32 bytes of links
+struct VectorMapIndex {
+    std::map<int32_t, std::vector<uint32_t>> map;
+    void insert(int32_t key, uint32_t row) { map[key].push_back(row); }
+    uint32_t find(int32_t key) const {
+        auto it = map.find(key);
+        return it != map.end() ? it->second.front() : 0;
+    }
+    template <typename F> void for_each(F&& fn) const {
+        for (const auto& [key, rows] : map) {
+            for (uint32_t row : rows) fn(key, row);
+        }
+    }
+    size_t memory_bytes() const {
+        size_t bytes = map.size() * (32 + sizeof(std::pair<const int32_t, std::vector<uint32_t>>));
+        for (const auto& kv : map) bytes += kv.second.capacity() * sizeof(uint32_t);
+        return bytes;
+    }
+};
+
+struct UniqueMapIndex {
+    std::map<int32_t, uint32_t> map;
+    void insert(int32_t key, uint32_t row) { map.emplace(key, row); }
+    uint32_t find(int32_t key) const {
+        auto it = map.find(key);
+        return it != map.end() ? it->second : 0;
+    }
+    template <typename F> void for_each(F&& fn) const {
+        for (const auto& [key, row] : map) fn(key, row);
+    }
+    size_t memory_bytes() const { return map.size() * (32 + sizeof(std::pair<const int32_t, uint32_t>)); }
+};
+
+static size_t scan_tree(const TreeIndex& index, int32_t lo, int32_t hi) {
+    uint64_t sum = 0;
+    size_t n = index.tree.scan(lo, hi, [&](int32_t, uint32_t row) { sum += row; });
+    sink = sink + sum;
+    return n;
+}
+
+static size_t scan_vectors(const VectorMapIndex& index, int32_t lo, int32_t hi) {
+    uint64_t sum = 0;
+    size_t n = 0;
+    for (auto it = index.map.lower_bound(lo); it != index.map.end() && it->first <= hi; ++it) {
+        for (uint32_t row : it->second) sum += row;
+        n += it->second.size();
+    }
+    sink = sink + sum;
+    return n;
+}
+
+static size_t scan_unique(const UniqueMapIndex& index, int32_t lo, int32_t hi) {
+    uint64_t sum = 0;
+    size_t n = 0;
+    for (auto it = index.map.lower_bound(lo); it != index.map.end() && it->first <= hi; ++it, n++) {
+        sum += it->second;
+    }
+    sink = sink + sum;
+    return n;
+}
+
+// Sorting (key, row) and building the tree bottom-up, as createKeyIndex does
+static nlohmann::json bench_bulk_load(const std::vector<int32_t>& keys, const std::vector<int32_t>& probes,
+                                      int32_t span) {
+    auto start = BenchClock::now();
+    std::vector<std::pair<int32_t, uint32_t>> pairs(keys.size());
+    for (size_t row = 0; row < keys.size(); row++) pairs[row] = {keys[row], static_cast<uint32_t>(row)};
+    std::sort(pairs.begin(), pairs.end());
+    std::vector<int32_t> sorted(keys.size());
+    std::vector<uint32_t> rows(keys.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        sorted[i] = pairs[i].first;
+        rows[i] = pairs[i].second;
+    }
+    TreeIndex index;
+    index.tree.bulk_load(sorted.data(), rows.data(), sorted.size());
+    nlohmann::json r;
+    r["index"] = "btree bulk loaded";
+    r["build_ns_per_row"] = ns_per(start, keys.size());
+    r["height"] = index.tree.height();
+    bench_queries(r, index, keys.size(), probes, span, scan_tree);
+    return r;
+}
+
+static nlohmann::json run(const char* workload, const std::vector<int32_t>& keys, bool unique) {
+    auto [lo, hi] = std::minmax_element(keys.begin(), keys.end());
+    int64_t key_span = static_cast<int64_t>(*hi) - *lo + 1;
+    // Ranges of 1/1000 of the keys; for the rows workload, about one key
+    int32_t span = static_cast<int32_t>(std::max<int64_t>(1, key_span / 1000));
+
+    std::mt19937 rng(17);
+    std::vector<int32_t> probes(std::min<size_t>(keys.size(), 1000000));
+    for (auto& p : probes) p = keys[rng() % keys.size()];
+
+    nlohmann::json results = nlohmann::json::array();
+    results.push_back(bench_index<TreeIndex>("btree", keys, probes, span, scan_tree));
+    if (unique) {
+        results.push_back(bench_index<UniqueMapIndex>("std::map<int, int>", keys, probes, span, scan_unique));
+    } else {
+        results.push_back(bench_index<VectorMapIndex>("std::map<int, std::vector<int>>", keys, probes, span,
+                                                      scan_vectors));
+    }
+    results.push_back(bench_bulk_load(keys, probes, span));
+
+    nlohmann::json r;
+    r["workload"] = workload;
+    r["rows"] = keys.size();
+    r["range_keys"] = span;
+    r["results"] = results;
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    size_t rows = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    std::vector<int32_t> keys;
+    if (argc > 2) {
+        std::ifstream file(argv[2]);
+        int key, value;
+        while (keys.size() < rows && file >> key >> value) keys.push_back(key);
+    } else {
+        for (size_t i = 0; i < rows; i++) keys.push_back(static_cast<int32_t>(i % 1000));
+    }
+
+    std::vector<int32_t> unique(keys.size());
+    for (size_t i = 0; i < unique.size(); i++) unique[i] = static_cast<int32_t>(i);
+    std::shuffle(unique.begin(), unique.end(), std::mt19937(3));
+
+    nlohmann::json results = nlohmann::json::array();
+    std::cerr << "rows workload\n";
+    results.push_back(run("rows", keys, false));
+    std::cerr << "unique workload\n";
+    results.push_back(run("unique", unique, true));
+    print_report("btree", results);
+    return 0;
+}
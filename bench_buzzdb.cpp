@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "buzzdb.cpp"
+
+// Insert cost and memory per row of BuzzDB's columnar table, against a row
+// layout (one Tuple holding four Fields by value per row).
+// Live heap bytes and allocation counts come from replacing global
+// operator new/delete. Rows come from `input` (pairs of ints, like
+// output.txt) or are generated. Then load throughput from a file: the
+// original `ifstream >> key >> value` loop against the mmap bulk loader,
+// serial and on every core. Last, the paged table: loading into a page
+// file through a 2 MiB buffer pool (flush included), and GROUP BY over it
+// after a reopen, against GROUP BY in memory.
+// Usage: bench_buzzdb [rows] [input]
+
+static std::atomic<size_t> live_bytes{0};
+static std::atomic<size_t> allocations{0};
+static constexpr size_t HEADER = alignof(std::max_align_t);
+
+// Start of the block behind a pointer we handed out. Computed as an integer
+// so GCC doesn't take it for indexing before the caller's object
+static char* block_of(void* p, size_t offset) {
+    return reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(p) - offset);
+}
+
+static size_t size_of(void* p) {
+    size_t size;
+    std::memcpy(&size, block_of(p, HEADER), sizeof(size));
+    return size;
+}
+
+void* operator new(size_t size) {
+    char* p = static_cast<char*>(std::malloc(size + HEADER));
+    if (!p) throw std::bad_alloc();
+    std::memcpy(p, &size, sizeof(size));
+    live_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return p + HEADER;
+}
+
+// GCC pairs the inlined free() with operator new and warns
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    live_bytes.fetch_sub(size_of(p), std::memory_order_relaxed);
+    std::free(block_of(p, HEADER));
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+// std::pmr::new_delete_resource() (Tuple's default) uses the aligned forms;
+// the size sits just below the returned pointer, as above
+void* operator new(size_t size, std::align_val_t align) {
+    size_t a = std::max(HEADER, static_cast<size_t>(align));
+    char* p = static_cast<char*>(std::aligned_alloc(a, (size + 2 * a - 1) / a * a));
+    if (!p) throw std::bad_alloc();
+    std::memcpy(p + a - HEADER, &size, sizeof(size));
+    live_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return p + a;
+}
+
+void operator delete(void* p, std::align_val_t align) noexcept {
+    if (!p) return;
+    size_t a = std::max(HEADER, static_cast<size_t>(align));
+    live_bytes.fetch_sub(size_of(p), std::memory_order_relaxed);
+    std::free(block_of(p, a));
+}
+
+void operator delete(void* p, size_t, std::align_val_t align) noexcept { operator delete(p, align); }
+
+// `load` builds a table and returns it, so its live size can be measured
+template <typename Load>
+static void measure(const char* name, size_t rows, Load load) {
+    size_t bytes_before = live_bytes.load();
+    size_t allocs_before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    auto table = load();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": rows=" << rows
+              << " ns_per_row=" << static_cast<uint64_t>(secs * 1e9 / rows)
+              << " bytes_per_row=" << (live_bytes.load() - bytes_before) / rows
+              << " allocs_per_row=" << static_cast<double>(allocations.load() - allocs_before) / rows
+              << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t rows = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    std::vector<std::pair<int, int>> input;
+    if (argc > 2) {
+        std::ifstream file(argv[2]);
+        int key, value;
+        while (input.size() < rows && file >> key >> value) input.emplace_back(key, value);
+    } else {
+        for (size_t i = 0; i < rows; i++) {
+            input.emplace_back(static_cast<int>(i % 1000), static_cast<int>(i));
+        }
+    }
+    rows = input.size();
+
+    measure("columnar", rows, [&] {
+        ColumnTable table(BuzzDB().table.schema());
+        for (auto [key, value] : input) {
+            table.append(key, value, 132.04f, "buzzdb");
+        }
+        return table;
+    });
+
+    // Through BuzzDB::insert
+    measure("buzzdb_insert", rows, [&] {
+        auto db = std::make_unique<BuzzDB>();
+        for (auto [key, value] : input) {
+            db->insert(key, value);
+        }
+        return db;
+    });
+
+    measure("row_tuples", rows, [&] {
+        std::vector<Tuple> table;
+        for (auto [key, value] : input) {
+            Tuple tuple(4);
+            tuple.addField(key);
+            tuple.addField(value);
+            tuple.addField(132.04f);
+            tuple.addField("buzzdb");
+            table.push_back(std::move(tuple));
+        }
+        return table;
+    });
+
+    std::string path = argc > 2 ? argv[2] : "";
+    if (path.empty()) {
+        char tmp[] = "/tmp/bench_buzzdb_XXXXXX";
+        int fd = mkstemp(tmp);
+        if (fd < 0) return 1;
+        close(fd);
+        path = tmp;
+        std::ofstream out(path);
+        for (auto [key, value] : input) out << key << " " << value << "\n";
+    }
+    auto report = [&](const char* name, size_t loaded, double secs, size_t bytes) {
+        std::cout << name << ": rows=" << loaded << " mb_per_sec=" << static_cast<uint64_t>(bytes / secs / 1e6)
+                  << " ns_per_row=" << static_cast<uint64_t>(secs * 1e9 / loaded) << "\n";
+    };
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        BuzzDB db;
+        std::ifstream file(path);
+        int key, value;
+        while (file >> key >> value) db.insert(key, value);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report("load_ifstream", db.table.rows(), secs, MappedFile(path).size());
+    }
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t threads : {size_t(1), cores}) {
+        BuzzDB db;
+        db.setThreads(threads);
+        LoadStats stats = db.loadFile(path);
+        std::string name = "load_mmap threads=" + std::to_string(threads);
+        report(name.c_str(), stats.rows, stats.seconds, stats.bytes);
+        if (cores == 1) break;
+    }
+
+    std::string pages = path + ".pages";
+    const size_t pool_pages = 256;
+    {
+        BuzzDB db;
+        db.open(pages, pool_pages);
+        LoadStats stats = db.loadFile(path);
+        auto start = std::chrono::steady_clock::now();
+        db.flush();
+        double secs = stats.seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report("load_paged pool_pages=256", stats.rows, secs, stats.bytes);
+    }
+    auto group_by = [&](const char* name, const BuzzDB& db) {
+        auto start = std::chrono::steady_clock::now();
+        GroupByResult result = db.selectGroupBySum();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": rows=" << db.rows() << " groups=" << result.groups.size()
+                  << " ns_per_row=" << secs * 1e9 / db.rows() << "\n";
+    };
+    {
+        BuzzDB db;
+        db.loadFile(path);
+        group_by("group_by memory", db);
+    }
+    {
+        BuzzDB db;
+        db.open(pages, pool_pages);
+        group_by("group_by paged", db);
+        BufferPool::Stats stats = db.pagedTable()->buffer_pool().stats();
+        std::cout << "paged pool: pages=" << db.pagedTable()->data_pages() << " hits=" << stats.hits
+                  << " misses=" << stats.misses << " read_ahead=" << stats.read_ahead
+                  << " evictions=" << stats.evictions << "\n";
+    }
+    unlink(pages.c_str());
+    if (argc <= 2) unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "bench_report.cpp"
+#include "kv_state_machine.cpp"
+#include "raft.cpp"
+
+// End-to-end load against a local cluster of 3 and 5 nodes, all in this
+// process on loopback (base port 7300), each applying to its own BuzzDB
+// through KvStateMachine. Commit latency is measured at the leader from
+// submit to the commit answer.
+//   closed  `clients` clients, each with one request outstanding
+//   open    requests issued at a fixed rate whatever the answers do;
+//           latency counts from when a request was due, so a stalled
+//           cluster shows up in the tail instead of slowing the load
+// Reports JSON. Usage: bench_cluster [seconds_per_run] [value_bytes] [udp|tcp] [data_dir]
+
+using Clock = BenchClock;
+
+struct BenchNode {
+    NetworkManager network;
+    RaftNode raft;
+    BuzzDB db;          // loop thread only
+    KvStateMachine state{db};
+
+    BenchNode(const ClusterConfig& config, int id, TransportKind kind, RaftOptions options) :
+        network(config, id, WireFormat::BINARY, kind), raft(network, options) {
+        raft.set_on_apply_batch([this](uint64_t first, const LogEntry* const* entries, size_t count) {
+            state.apply(first, entries, count);
+        });
+    }
+
+    ~BenchNode() { network.stop(); }
+};
+
+struct RunConfig {
+    size_t nodes;
+    TransportKind kind;
+    bool open_loop;
+    size_t clients;         // closed loop
+    double rate;            // open loop, requests per second
+    double seconds;
+    size_t value_bytes;
+    std::string data_dir;   // empty: no WAL
+};
+
+// Loop thread only, once the run has started
+struct LoadState {
+    LatencyRecorder latency;
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+    uint64_t outstanding = 0;
+    bool stopping = false;
+    std::promise<void> drained;
+};
+
+static ClientRequest make_request(uint64_t client, uint64_t request, const std::string& value) {
+    return ClientRequest{ClientRequest::Type::INSERT, "user:" + std::to_string(client * 1000003 + request),
+                         value, client, request};
+}
+
+static nlohmann::json run(const RunConfig& rc) {
+    ClusterConfig config = ClusterConfig::local(rc.nodes, 7300);
+    std::vector<std::unique_ptr<BenchNode>> nodes;
+    for (size_t id = 0; id < rc.nodes; id++) {
+        RaftOptions options;
+        if (!rc.data_dir.empty()) {
+            options.data_dir = rc.data_dir + "/node" + std::to_string(id);
+            std::string reset = "rm -rf '" + options.data_dir + "'";
+            if (std::system(reset.c_str()) != 0) throw std::runtime_error("cannot clear " + options.data_dir);
+        }
+        nodes.push_back(std::make_unique<BenchNode>(config, static_cast<int>(id), rc.kind, options));
+    }
+    for (auto& n : nodes) n->network.start();
+
+    BenchNode* leader = nullptr;
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (!leader && Clock::now() < deadline) {
+        for (auto& n : nodes) {
+            if (n->raft.status().leader) leader = n.get();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (!leader) throw std::runtime_error("no leader elected");
+    uint64_t first_index = leader->raft.status().last_index;
+
+    std::string value(rc.value_bytes, 'v');
+    LoadState load;
+    load.latency.reserve(static_cast<size_t>(rc.open_loop ? rc.rate * rc.seconds : 1 << 20));
+    RaftNode& raft = leader->raft;
+
+    // Everything the answers touch lives until the nodes are stopped
+    auto finish = [&load](const ClientResponse& res, Clock::time_point start) {
+        load.latency.add(start, Clock::now());
+        load.completed++;
+        if (!res.success) load.errors++;
+        if (--load.outstanding == 0 && load.stopping) load.drained.set_value();
+    };
+
+    // Closed loop: each client issues its next request from the previous
+    // one's answer
+    std::vector<uint64_t> next(rc.clients, 1);
+    std::function<void(uint64_t)> issue = [&](uint64_t client) {
+        auto sent = Clock::now();
+        load.outstanding++;
+        raft.submit(make_request(client + 1, next[client]++, value), [&, client, sent](const ClientResponse& res) {
+            finish(res, sent);
+            if (!load.stopping) issue(client);
+        });
+    };
+
+    auto start = Clock::now();
+    auto stop_at = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(rc.seconds));
+    if (rc.open_loop) {
+        // Request k is due at start + k / rate, client ids round-robin
+        const uint64_t clients = 64;
+        uint64_t k = 0;
+        for (;; k++) {
+            auto due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(k / rc.rate));
+            if (due >= stop_at) break;
+            std::this_thread::sleep_until(due);
+            leader->network.loop().post([&load] { load.outstanding++; });
+            raft.submit(make_request(k % clients + 1, k / clients + 1, value),
+                        [&finish, due](const ClientResponse& res) { finish(res, due); });
+        }
+    } else {
+        leader->network.loop().post([&] {
+            for (uint64_t c = 0; c < rc.clients; c++) issue(c);
+        });
+        std::this_thread::sleep_until(stop_at);
+    }
+
+    leader->network.loop().post([&load] {
+        load.stopping = true;
+        if (load.outstanding == 0) load.drained.set_value();
+    });
+    bool drained = load.drained.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    uint64_t last_index = raft.status().last_index;
+    for (auto& n : nodes) n->network.stop();
+
+    nlohmann::json r;
+    r["nodes"] = rc.nodes;
+    r["transport"] = transport_kind_name(rc.kind);
+    r["durable"] = !rc.data_dir.empty();
+    r["mode"] = rc.open_loop ? "open" : "closed";
+    if (rc.open_loop) {
+        r["target_rate"] = rc.rate;
+    } else {
+        r["clients"] = rc.clients;
+    }
+    r["value_bytes"] = rc.value_bytes;
+    r["ops"] = load.completed;
+    r["errors"] = load.errors;
+    r["unanswered"] = drained ? 0 : load.outstanding;
+    r["ops_per_sec"] = load.completed / secs;
+    r["log_entries"] = last_index - first_index;
+    r["commit_latency"] = load.latency.summary();
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? std::stod(argv[1]) : 2;
+    size_t value_bytes = argc > 2 ? std::stoul(argv[2]) : 64;
+    TransportKind kind = argc > 3 && std::string(argv[3]) == "tcp" ? TransportKind::STREAM : TransportKind::UDP;
+    std::string data_dir = argc > 4 ? argv[4] : "";
+    if (!std::getenv("BUZZ_LOG")) Logger::instance().set_level(LogLevel::WARN);
+
+    nlohmann::json results = nlohmann::json::array();
+    for (size_t n : {3, 5}) {
+        for (size_t clients : {1, 64}) {
+            std::cerr << n << " nodes, closed loop, " << clients << " clients\n";
+            results.push_back(run(RunConfig{n, kind, false, clients, 0, seconds, value_bytes, data_dir}));
+        }
+        for (double rate : {5000.0, 20000.0}) {
+            std::cerr << n << " nodes, open loop, " << rate << " ops/s\n";
+            results.push_back(run(RunConfig{n, kind, true, 0, rate, seconds, value_bytes, data_dir}));
+        }
+    }
+    print_report("cluster", results);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <vector>
+#include "arena.cpp"
+#include "bench_report.cpp"
+#include "messages.cpp"
+
+// JSON against binary encode/decode for every message in messages.cpp, plus
+// the zero-copy paths (AppendEntriesView decode, AppendEntriesBatch encode)
+// on a typical replication batch. Every binary round trip is checked by
+// re-encoding the decoded message. Reports JSON.
+// Usage: bench_codec [entries_per_batch] [entry_bytes] [iterations]
+
+// Sink to keep the optimizer honest
+static volatile size_t sink = 0;
+static int mismatches = 0;
+
+template <typename T>
+static nlohmann::json bench_message(const char* name, const T& msg, size_t iterations) {
+    std::string json = msg.serialize();
+    std::vector<char> buffer(wire_encoded_size(msg));
+    size_t len = wire_encode(msg, buffer.data(), buffer.size());
+
+    nlohmann::json r;
+    r["message"] = name;
+    r["json_bytes"] = json.size();
+    r["json_encode_ns"] = time_ns_per_op(iterations, [&] { sink = sink + msg.serialize().size(); });
+    r["json_decode_ns"] = time_ns_per_op(iterations, [&] {
+        T decoded = T::deserialize(json);
+        sink = sink + sizeof(decoded);
+    });
+    r["binary_bytes"] = len;
+    r["binary_encode_ns"] = time_ns_per_op(iterations, [&] {
+        sink = sink + wire_encode(msg, buffer.data(), buffer.size());
+    });
+    r["binary_decode_ns"] = time_ns_per_op(iterations, [&] {
+        T decoded = wire_decode<T>(buffer.data(), len);
+        sink = sink + sizeof(decoded);
+    });
+
+    std::vector<char> again(wire_encoded_size(msg));
+    T decoded = wire_decode<T>(buffer.data(), len);
+    if (wire_encode(decoded, again.data(), again.size()) != len ||
+        !std::equal(buffer.begin(), buffer.begin() + len, again.begin())) {
+        std::cerr << name << ": binary round trip mismatch\n";
+        mismatches++;
+    }
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    size_t batch = argc > 1 ? std::stoul(argv[1]) : 64;
+    size_t entry_bytes = argc > 2 ? std::stoul(argv[2]) : 128;
+    size_t iterations = argc > 3 ? std::stoul(argv[3]) : 20000;
+
+    AppendEntriesRequest append;
+    append.term = 7;
+    append.leader_id = 1;
+    append.prev_log_index = 123456;
+    append.prev_log_term = 6;
+    append.leader_commit = 123400;
+    append.round = 99;
+    for (size_t i = 0; i < batch; i++) {
+        append.entries.push_back(LogEntry{7, std::string(entry_bytes, 'a' + i % 26), 42, i});
+    }
+    InstallSnapshotRequest chunk{7, 1, 123000, 6, 0, std::string(64 << 10, 's'), false};
+
+    nlohmann::json results = nlohmann::json::array();
+    results.push_back(bench_message("RequestVoteRequest", RequestVoteRequest{7, 1, 123456, 6}, iterations));
+    results.push_back(bench_message("RequestVoteResponse", RequestVoteResponse{7, true}, iterations));
+    results.push_back(bench_message("AppendEntriesRequest", append, iterations));
+    results.push_back(bench_message("AppendEntriesResponse",
+                                    AppendEntriesResponse{7, true, 0, 123520, 99}, iterations));
+    results.push_back(bench_message("InstallSnapshotRequest", chunk, iterations));
+    results.push_back(bench_message("InstallSnapshotResponse",
+                                    InstallSnapshotResponse{7, 123000, 65536}, iterations));
+    results.push_back(bench_message("ReadIndexRequest", ReadIndexRequest{7, 12}, iterations));
+    results.push_back(bench_message("ReadIndexResponse", ReadIndexResponse{7, 12, true, 123400}, iterations));
+    results.push_back(bench_message("ClientRequest",
+                                    ClientRequest{ClientRequest::Type::INSERT, "user:12345",
+                                                  std::string(entry_bytes, 'v'), 42, 1001},
+                                    iterations));
+    results.push_back(bench_message("ClientResponse",
+                                    ClientResponse{true, false, 1, "", 1001, std::string(entry_bytes, 'v'), 123400},
+                                    iterations));
+
+    // The paths replication actually takes
+    std::vector<char> buffer(wire_encoded_size(append));
+    size_t len = wire_encode(append, buffer.data(), buffer.size());
+    Arena arena;
+    nlohmann::json zero_copy;
+    zero_copy["message"] = "AppendEntries zero-copy";
+    zero_copy["entries"] = batch;
+    zero_copy["entry_bytes"] = entry_bytes;
+    zero_copy["view_decode_ns"] = time_ns_per_op(iterations, [&] {
+        auto view = AppendEntriesView::decode(buffer.data(), len);
+        view.for_each_entry([&](const LogEntryView& e) { sink = sink + e.data.size(); });
+    });
+    zero_copy["batch_encode_ns"] = time_ns_per_op(iterations, [&] {
+        AppendEntriesBatch req(arena.resource());
+        req.term = append.term;
+        req.leader_id = append.leader_id;
+        req.prev_log_index = append.prev_log_index;
+        req.prev_log_term = append.prev_log_term;
+        req.leader_commit = append.leader_commit;
+        req.round = append.round;
+        req.entries.reserve(append.entries.size());
+        for (const auto& entry : append.entries) req.entries.emplace_back(entry);
+        sink = sink + wire_encode(req, buffer.data(), buffer.size());
+        arena.reset();
+    });
+    results.push_back(zero_copy);
+
+    print_report("codec", results);
+    return mismatches == 0 ? 0 : 1;
+}
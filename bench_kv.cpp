@@ -0,0 +1,75 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "kv_state_machine.cpp"
+
+// KvStore against std::unordered_map<std::string, std::string> on put, get
+// and erase over the same keys, then the state machine applying committed
+// INSERTs in batches (decode included), to see how much of apply is the
+// container.
+// Usage: bench_kv [keys] [value_bytes] [batch]
+
+template <typename F>
+static void measure(const char* name, size_t ops, F&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": ops=" << ops << " ns_per_op=" << static_cast<uint64_t>(secs * 1e9 / ops)
+              << " mops_per_sec=" << ops / secs / 1e6 << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t keys = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t value_bytes = argc > 2 ? std::stoul(argv[2]) : 32;
+    size_t batch = argc > 3 ? std::stoul(argv[3]) : 1024;
+
+    std::vector<std::string> names;
+    names.reserve(keys);
+    for (size_t i = 0; i < keys; i++) names.push_back("user:" + std::to_string(i * 2654435761ull % keys));
+    std::string value(value_bytes, 'v');
+    volatile size_t sink = 0;
+
+    {
+        std::unordered_map<std::string, std::string> map;
+        measure("unordered_map_put", keys, [&] { for (const auto& k : names) map[k] = value; });
+        measure("unordered_map_get", keys, [&] {
+            for (const auto& k : names) sink = sink + map.find(k)->second.size();
+        });
+        measure("unordered_map_erase", keys, [&] { for (const auto& k : names) map.erase(k); });
+    }
+    {
+        KvStore kv;
+        measure("kvstore_put", keys, [&] { for (const auto& k : names) kv.put(k, value); });
+        measure("kvstore_get", keys, [&] { for (const auto& k : names) sink = sink + kv.get(k)->size(); });
+        std::cout << "kvstore: bytes_per_key=" << kv.memory_bytes() / keys << "\n";
+        measure("kvstore_erase", keys, [&] { for (const auto& k : names) kv.erase(k); });
+    }
+
+    // Committed log entries, as the apply loop sees them
+    std::vector<LogEntry> log;
+    log.reserve(keys);
+    for (size_t i = 0; i < keys; i++) {
+        ClientRequest req{ClientRequest::Type::INSERT, names[i], value, 1, i};
+        std::string data(wire_encoded_size(req), '\0');
+        wire_encode(req, &data[0], data.size());
+        log.push_back(LogEntry{1, std::move(data), 1, i});
+    }
+    std::vector<const LogEntry*> entries;
+    for (const auto& e : log) entries.push_back(&e);
+
+    BuzzDB db;
+    KvStateMachine state(db);
+    measure("apply_batch", keys, [&] {
+        for (size_t first = 0; first < keys; first += batch) {
+            state.apply(first + 1, entries.data() + first, std::min(batch, keys - first));
+        }
+    });
+    measure("decode_only", keys, [&] {
+        for (const auto& e : log) {
+            sink = sink + wire_decode<ClientRequestView>(e.data.data(), e.data.size()).key.size();
+        }
+    });
+    return 0;
+}
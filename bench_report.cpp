@@ -0,0 +1,74 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+//--------------------------------------------------
+// Benchmark reports
+//--------------------------------------------------
+// Shared by the benchmarks that report JSON (bench_codec, bench_udp,
+// bench_cluster), so runs can be saved and compared across changes. Each
+// program prints one JSON document on stdout; progress goes to stderr.
+
+using BenchClock = std::chrono::steady_clock;
+
+// Latency samples in nanoseconds, summarized as percentiles. Not
+// thread-safe; keep one per thread or add from a single thread.
+class LatencyRecorder {
+    std::vector<uint64_t> samples;
+
+public:
+    void reserve(size_t n) { samples.reserve(n); }
+
+    void add(uint64_t ns) { samples.push_back(ns); }
+
+    void add(BenchClock::time_point start, BenchClock::time_point end) {
+        add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+
+    size_t count() const { return samples.size(); }
+
+    // Nearest-rank percentile; sorts the samples
+    uint64_t percentile(double p) {
+        if (samples.empty()) return 0;
+        std::sort(samples.begin(), samples.end());
+        size_t rank = static_cast<size_t>(p / 100.0 * samples.size());
+        return samples[std::min(rank, samples.size() - 1)];
+    }
+
+    // Microseconds, which is the scale every path here works at
+    nlohmann::json summary() {
+        nlohmann::json j;
+        j["count"] = samples.size();
+        if (samples.empty()) return j;
+        uint64_t total = 0;
+        for (uint64_t ns : samples) total += ns;
+        j["mean_us"] = total / 1e3 / samples.size();
+        j["p50_us"] = percentile(50) / 1e3;
+        j["p99_us"] = percentile(99) / 1e3;
+        j["p999_us"] = percentile(99.9) / 1e3;
+        j["max_us"] = samples.back() / 1e3;
+        return j;
+    }
+};
+
+// Mean nanoseconds per call of fn over `iterations` calls
+template <typename F>
+double time_ns_per_op(size_t iterations, F&& fn) {
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / iterations;
+}
+
+inline void print_report(const std::string& bench, nlohmann::json results) {
+    nlohmann::json report;
+    report["bench"] = bench;
+    report["results"] = std::move(results);
+    std::cout << report.dump(2) << std::endl;
+}
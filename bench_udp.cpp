@@ -0,0 +1,138 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <vector>
+#include "bench_report.cpp"
+#include "network_manager.cpp"
+
+// Loopback benchmarks through NetworkManager, reported as JSON:
+//   throughput  one-way packets/second for several batch depths. Depth 1 is
+//               the recvfrom()/sendto() baseline; larger depths use
+//               recvmmsg()/sendmmsg().
+//   latency     request/response round trips between two managers with a
+//               fixed number outstanding, over UDP and TCP
+// Usage: bench_udp [packets] [base_port]
+
+using Clock = BenchClock;
+
+struct Result {
+    size_t depth;
+    size_t sent;
+    size_t received;
+    double send_pps;
+    double recv_pps;
+};
+
+Result run(size_t depth, size_t packets, int base_port) {
+    NetworkManager receiver(1, base_port);
+    NetworkManager sender(0, base_port);
+    receiver.set_batch_depth(depth);
+    sender.set_batch_depth(depth);
+
+    std::atomic<size_t> received{0};
+    std::atomic<int64_t> last_receive_ns{0};
+    receiver.set_on_client_request([&](int, const ClientRequest&) {
+        received.fetch_add(1, std::memory_order_relaxed);
+        last_receive_ns.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    });
+    receiver.start();
+
+    ClientRequest req{ClientRequest::Type::INSERT, "key", std::string(64, 'v'), 1, 0};
+    std::vector<int> peers(depth, 1);
+
+    auto start = Clock::now();
+    size_t sent = 0;
+    while (sent < packets) {
+        req.request_id = sent;
+        if (depth == 1) {
+            sender.send_to(1, req);
+        } else {
+            sender.broadcast(peers, req);
+        }
+        sent += depth;
+    }
+    auto send_end = Clock::now();
+
+    // Wait until the receiver goes quiet
+    size_t seen = 0;
+    do {
+        seen = received.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    } while (received.load() != seen);
+    receiver.stop();
+
+    double send_secs = std::chrono::duration<double>(send_end - start).count();
+    double recv_secs = std::chrono::duration<double>(
+        Clock::time_point(Clock::duration(last_receive_ns.load())) - start).count();
+    return Result{depth, sent, seen, sent / send_secs, recv_secs > 0 ? seen / recv_secs : 0};
+}
+
+// Node 1 answers every ClientRequest with a ClientResponse; node 0 keeps
+// `window` requests outstanding, sending the next from its loop thread as
+// each answer arrives
+nlohmann::json run_latency(TransportKind kind, size_t window, size_t requests, int base_port) {
+    NetworkManager server(1, base_port, WireFormat::BINARY, kind);
+    NetworkManager client(0, base_port, WireFormat::BINARY, kind);
+    server.set_on_client_request([&](int from, const ClientRequest& req) {
+        server.send_to(from, ClientResponse{true, false, 1, "", req.request_id, "", 0});
+    });
+
+    std::vector<Clock::time_point> sent_at(requests);
+    LatencyRecorder latency;
+    latency.reserve(requests);
+    size_t next = 0;            // client loop thread only
+    std::promise<void> finished;
+    ClientRequest req{ClientRequest::Type::INSERT, "key", std::string(64, 'v'), 1, 0};
+    auto send_next = [&] {
+        req.request_id = next;
+        sent_at[next++] = Clock::now();
+        client.send_to(1, req);
+    };
+    client.set_on_client_response([&](int, const ClientResponse& res) {
+        latency.add(sent_at[res.request_id], Clock::now());
+        if (next < requests) send_next();
+        if (latency.count() == requests) finished.set_value();
+    });
+    server.start();
+    client.start();
+
+    auto start = Clock::now();
+    client.loop().post([&] {
+        while (next < std::min(window, requests)) send_next();
+    });
+    bool complete = finished.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    client.stop();
+    server.stop();
+
+    nlohmann::json r = latency.summary();
+    r["transport"] = transport_kind_name(kind);
+    r["window"] = window;
+    r["ops_per_sec"] = latency.count() / secs;
+    r["lost"] = complete ? 0 : requests - latency.count();
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    size_t packets = argc > 1 ? std::stoul(argv[1]) : 200000;
+    int base_port = argc > 2 ? std::stoi(argv[2]) : 7000;
+
+    nlohmann::json throughput = nlohmann::json::array();
+    for (size_t depth : {1, 8, 32, 64}) {
+        Result r = run(depth, packets, base_port);
+        throughput.push_back({{"depth", r.depth}, {"sent", r.sent}, {"received", r.received},
+                              {"send_pps", static_cast<uint64_t>(r.send_pps)},
+                              {"recv_pps", static_cast<uint64_t>(r.recv_pps)}});
+    }
+
+    nlohmann::json latency = nlohmann::json::array();
+    for (TransportKind kind : {TransportKind::UDP, TransportKind::STREAM}) {
+        for (size_t window : {1, 16}) {
+            latency.push_back(run_latency(kind, window, packets / 4, base_port));
+        }
+    }
+
+    print_report("loopback", {{"throughput", throughput}, {"latency", latency}});
+    return 0;
+}
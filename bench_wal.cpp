@@ -0,0 +1,49 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "wal.cpp"
+
+// Durable entries/second through the WAL for several group-commit sizes:
+// `batch` entries are appended, then one sync() makes them durable.
+// Batch 1 is an fdatasync per entry. Run it on the disk you care about;
+// on tmpfs fdatasync is free.
+// Usage: bench_wal [entries] [entry_bytes] [dir]
+
+int main(int argc, char* argv[]) {
+    size_t entries = argc > 1 ? std::stoul(argv[1]) : 20000;
+    size_t entry_bytes = argc > 2 ? std::stoul(argv[2]) : 128;
+    std::string base = argc > 3 ? argv[3] : ".";
+
+    for (size_t batch : {1, 8, 64, 512}) {
+        std::string dir = base + "/bench_wal_" + std::to_string(batch);
+        std::string cleanup = "rm -rf '" + dir + "'";
+        if (std::system(cleanup.c_str()) != 0) return 1;
+
+        // Fewer entries for the fsync-per-entry case so it finishes
+        size_t count = batch == 1 ? std::min<size_t>(entries, 2000) : entries;
+        double secs;
+        uint64_t syncs;
+        {
+            Wal wal(dir);
+            wal.recover();
+            LogEntry entry{1, std::string(entry_bytes, 'x'), 42, 0};
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 1; i <= count; i++) {
+                entry.request_id = i;
+                wal.append_entry(i, entry);
+                if (i % batch == 0) wal.sync();
+            }
+            wal.sync();
+            secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            syncs = wal.syncs();
+        }
+
+        std::cout << "batch=" << batch << " entries=" << count << " syncs=" << syncs
+                  << " entries_per_sec=" << static_cast<uint64_t>(count / secs)
+                  << " us_per_sync=" << static_cast<uint64_t>(secs * 1e6 / syncs) << "\n";
+        if (std::system(cleanup.c_str()) != 0) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,407 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//--------------------------------------------------
+// B+-Tree
+//--------------------------------------------------
+// Ordered in-memory index of Key -> Value pairs; duplicate keys are kept in
+// insertion order. Nodes are NodeBytes wide (a few cache lines) and hold
+// their keys packed in one array, so a search reads a node's keys
+// contiguously before touching any child pointer. Values sit only in the
+// leaves, which are linked left to right: a range scan descends once and
+// then walks leaves without going back up.
+//
+// Nodes are allocated in chunks and freed all at once by clear(); there is
+// no erase. Inserts past a node's last key (ascending keys, runs of one
+// key) leave full nodes behind, and bulk_load() builds a tree of full nodes from sorted input
+// bottom-up without any searching.
+//
+// Key and Value must be trivially copyable; keys are compared with <.
+template <typename Key, typename Value, size_t NodeBytes = 512>
+class BTree {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "BTree moves keys and values with memmove");
+
+    struct Node {
+        uint32_t count = 0;
+        bool leaf;
+        explicit Node(bool leaf) : leaf(leaf) {}
+    };
+
+public:
+    static constexpr size_t LEAF_CAPACITY = (NodeBytes - 2 * sizeof(void*)) / (sizeof(Key) + sizeof(Value));
+    static constexpr size_t INNER_CAPACITY = (NodeBytes - 2 * sizeof(void*)) / (sizeof(Key) + sizeof(Node*));
+    static_assert(LEAF_CAPACITY >= 4 && INNER_CAPACITY >= 4, "NodeBytes too small for Key and Value");
+
+private:
+    struct alignas(64) Leaf : Node {
+        Leaf* next = nullptr;
+        Key keys[LEAF_CAPACITY];
+        Value values[LEAF_CAPACITY];
+        Leaf() : Node(true) {}
+    };
+
+    // Child i holds keys in [keys[i - 1], keys[i]]; keys[i] is the first key
+    // of child i + 1 when it was split off
+    struct alignas(64) Inner : Node {
+        Key keys[INNER_CAPACITY];
+        Node* children[INNER_CAPACITY + 1];
+        Inner() : Node(false) {}
+    };
+
+    struct Split {
+        Key separator;
+        Node* right;
+    };
+
+    // Nodes in chunks, so a bulk-loaded tree's leaves are contiguous
+    template <typename T>
+    class Pool {
+        static constexpr size_t CHUNK = 64;
+        std::vector<std::unique_ptr<T[]>> chunks;
+        size_t used = CHUNK;
+
+    public:
+        T* make() {
+            if (used == CHUNK) {
+                chunks.emplace_back(new T[CHUNK]);
+                used = 0;
+            }
+            return &chunks.back()[used++];
+        }
+
+        size_t bytes() const { return chunks.size() * CHUNK * sizeof(T); }
+
+        void clear() {
+            chunks.clear();
+            used = CHUNK;
+        }
+    };
+
+    Pool<Leaf> leaves;
+    Pool<Inner> inners;
+    Node* root = nullptr;
+    Leaf* first = nullptr;
+    size_t count = 0;
+    size_t levels = 0;
+
+    static const Inner* as_inner(const Node* n) { return static_cast<const Inner*>(n); }
+    static Inner* as_inner(Node* n) { return static_cast<Inner*>(n); }
+    static const Leaf* as_leaf(const Node* n) { return static_cast<const Leaf*>(n); }
+    static Leaf* as_leaf(Node* n) { return static_cast<Leaf*>(n); }
+
+    static size_t lower(const Key* keys, size_t n, const Key& key) {
+        return std::lower_bound(keys, keys + n, key) - keys;
+    }
+
+    static size_t upper(const Key* keys, size_t n, const Key& key) {
+        return std::upper_bound(keys, keys + n, key) - keys;
+    }
+
+    // Leftmost leaf that may hold `key`
+    const Leaf* find_leaf(const Key& key) const {
+        const Node* node = root;
+        while (!node->leaf) {
+            const Inner* inner = as_inner(node);
+            node = inner->children[lower(inner->keys, inner->count, key)];
+        }
+        return as_leaf(node);
+    }
+
+    // Inserts after any equal keys. Returns true and fills `split` if `node`
+    // had to split; the right half is new.
+    bool insert_into(Node* node, const Key& key, const Value& value, Split& split) {
+        if (node->leaf) {
+            return insert_leaf(as_leaf(node), key, value, split);
+        }
+        Inner* inner = as_inner(node);
+        size_t i = upper(inner->keys, inner->count, key);
+        Split below;
+        if (!insert_into(inner->children[i], key, value, below)) return false;
+        return insert_inner(inner, i, below, split);
+    }
+
+    bool insert_leaf(Leaf* leaf, const Key& key, const Value& value, Split& split) {
+        size_t n = leaf->count;
+        size_t pos = upper(leaf->keys, n, key);
+        if (n < LEAF_CAPACITY) {
+            std::copy_backward(leaf->keys + pos, leaf->keys + n, leaf->keys + n + 1);
+            std::copy_backward(leaf->values + pos, leaf->values + n, leaf->values + n + 1);
+            leaf->keys[pos] = key;
+            leaf->values[pos] = value;
+            leaf->count++;
+            return false;
+        }
+
+        // Appending past the last key keeps the left leaf full, so ascending
+        // keys fill leaves instead of halving them. Extending a run of equal
+        // keys splits right after it: later copies of the key append to
+        // the left leaf, and the keys after the run are left alone.
+        size_t left = (n + 1) / 2;
+        if (pos == n) {
+            left = n;
+        } else if (pos > 0 && !(leaf->keys[pos - 1] < key)) {
+            left = pos + 1;
+        }
+        Key keys[LEAF_CAPACITY + 1];
+        Value values[LEAF_CAPACITY + 1];
+        std::copy(leaf->keys, leaf->keys + pos, keys);
+        std::copy(leaf->values, leaf->values + pos, values);
+        keys[pos] = key;
+        values[pos] = value;
+        std::copy(leaf->keys + pos, leaf->keys + n, keys + pos + 1);
+        std::copy(leaf->values + pos, leaf->values + n, values + pos + 1);
+
+        Leaf* right = leaves.make();
+        std::copy(keys, keys + left, leaf->keys);
+        std::copy(values, values + left, leaf->values);
+        std::copy(keys + left, keys + n + 1, right->keys);
+        std::copy(values + left, values + n + 1, right->values);
+        leaf->count = static_cast<uint32_t>(left);
+        right->count = static_cast<uint32_t>(n + 1 - left);
+        right->next = leaf->next;
+        leaf->next = right;
+        split = Split{right->keys[0], right};
+        return true;
+    }
+
+    // Adds child `below.right` after child i
+    bool insert_inner(Inner* inner, size_t i, const Split& below, Split& split) {
+        size_t n = inner->count;
+        if (n < INNER_CAPACITY) {
+            std::copy_backward(inner->keys + i, inner->keys + n, inner->keys + n + 1);
+            std::copy_backward(inner->children + i + 1, inner->children + n + 1, inner->children + n + 2);
+            inner->keys[i] = below.separator;
+            inner->children[i + 1] = below.right;
+            inner->count++;
+            return false;
+        }
+
+        Key keys[INNER_CAPACITY + 1];
+        Node* children[INNER_CAPACITY + 2];
+        std::copy(inner->keys, inner->keys + i, keys);
+        keys[i] = below.separator;
+        std::copy(inner->keys + i, inner->keys + n, keys + i + 1);
+        std::copy(inner->children, inner->children + i + 1, children);
+        children[i + 1] = below.right;
+        std::copy(inner->children + i + 1, inner->children + n + 1, children + i + 2);
+
+        // A key moves up; n + 1 keys become left + 1 + right. As for leaves,
+        // a new last child leaves the left node (nearly) full.
+        size_t left = i == n ? n - 1 : n / 2;
+        Inner* right = inners.make();
+        std::copy(keys, keys + left, inner->keys);
+        std::copy(children, children + left + 1, inner->children);
+        std::copy(keys + left + 1, keys + n + 1, right->keys);
+        std::copy(children + left + 1, children + n + 2, right->children);
+        inner->count = static_cast<uint32_t>(left);
+        right->count = static_cast<uint32_t>(n - left);
+        split = Split{keys[left], right};
+        return true;
+    }
+
+public:
+    BTree() = default;
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    // Nodes stay where they are; the source is left empty
+    BTree(BTree&& other) noexcept { *this = std::move(other); }
+
+    BTree& operator=(BTree&& other) noexcept {
+        if (&other != this) {
+            leaves = std::move(other.leaves);
+            inners = std::move(other.inners);
+            other.leaves.clear();
+            other.inners.clear();
+            root = std::exchange(other.root, nullptr);
+            first = std::exchange(other.first, nullptr);
+            count = std::exchange(other.count, 0);
+            levels = std::exchange(other.levels, 0);
+        }
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Levels from root to leaves; 0 when empty
+    size_t height() const { return levels; }
+
+    size_t memory_bytes() const {
+        return leaves.bytes() + inners.bytes();
+    }
+
+    void clear() {
+        leaves.clear();
+        inners.clear();
+        root = nullptr;
+        first = nullptr;
+        count = 0;
+        levels = 0;
+    }
+
+    void insert(const Key& key, const Value& value) {
+        if (!root) {
+            first = leaves.make();
+            root = first;
+            levels = 1;
+        }
+        Split split;
+        if (insert_into(root, key, value, split)) {
+            Inner* top = inners.make();
+            top->count = 1;
+            top->keys[0] = split.separator;
+            top->children[0] = root;
+            top->children[1] = split.right;
+            root = top;
+            levels++;
+        }
+        count++;
+    }
+
+    // Replaces the contents with n pairs sorted by key
+    void bulk_load(const Key* keys, const Value* values, size_t n) {
+        for (size_t i = 1; i < n; i++) {
+            if (keys[i] < keys[i - 1]) {
+                throw std::invalid_argument("BTree bulk load input is not sorted at " + std::to_string(i));
+            }
+        }
+        clear();
+        if (n == 0) return;
+
+        // Full leaves, left to right; `level` holds each node and its lowest key
+        std::vector<std::pair<Key, Node*>> level;
+        level.reserve((n + LEAF_CAPACITY - 1) / LEAF_CAPACITY);
+        Leaf* prev = nullptr;
+        for (size_t i = 0; i < n; i += LEAF_CAPACITY) {
+            Leaf* leaf = leaves.make();
+            size_t take = std::min(LEAF_CAPACITY, n - i);
+            std::copy(keys + i, keys + i + take, leaf->keys);
+            std::copy(values + i, values + i + take, leaf->values);
+            leaf->count = static_cast<uint32_t>(take);
+            (prev ? prev->next : first) = leaf;
+            prev = leaf;
+            level.emplace_back(leaf->keys[0], leaf);
+        }
+        levels = 1;
+
+        // Each level up takes INNER_CAPACITY + 1 children per node, keyed by
+        // their lowest keys
+        while (level.size() > 1) {
+            std::vector<std::pair<Key, Node*>> parents;
+            parents.reserve(level.size() / (INNER_CAPACITY + 1) + 1);
+            for (size_t i = 0; i < level.size(); i += INNER_CAPACITY + 1) {
+                Inner* inner = inners.make();
+                size_t take = std::min(INNER_CAPACITY + 1, level.size() - i);
+                // A lone last child would make a node without keys; borrow one
+                if (take == 1) {
+                    Inner* left = as_inner(parents.back().second);
+                    left->count--;
+                    inner->children[0] = left->children[INNER_CAPACITY];
+                    parents.emplace_back(left->keys[INNER_CAPACITY - 1], inner);
+                    inner->children[1] = level[i].second;
+                    inner->keys[0] = level[i].first;
+                    inner->count = 1;
+                    continue;
+                }
+                for (size_t c = 0; c < take; c++) {
+                    inner->children[c] = level[i + c].second;
+                    if (c > 0) inner->keys[c - 1] = level[i + c].first;
+                }
+                inner->count = static_cast<uint32_t>(take - 1);
+                parents.emplace_back(level[i].first, inner);
+            }
+            level.swap(parents);
+            levels++;
+        }
+        root = level[0].second;
+        count = n;
+    }
+
+    //--------------------------------------------------
+    // Lookup
+    //--------------------------------------------------
+    // Position in the leaf chain; invalid past the last pair
+    class Cursor {
+        const Leaf* leaf = nullptr;
+        size_t pos = 0;
+
+        friend class BTree;
+        Cursor(const Leaf* leaf, size_t pos) : leaf(leaf), pos(pos) { settle(); }
+
+        void settle() {
+            while (leaf && pos == leaf->count) {
+                leaf = leaf->next;
+                pos = 0;
+            }
+        }
+
+    public:
+        Cursor() = default;
+
+        bool valid() const { return leaf != nullptr; }
+        const Key& key() const { return leaf->keys[pos]; }
+        const Value& value() const { return leaf->values[pos]; }
+
+        void next() {
+            pos++;
+            settle();
+        }
+    };
+
+    Cursor begin() const { return Cursor(first, 0); }
+
+    // First pair with a key not below `key`
+    Cursor lower_bound(const Key& key) const {
+        if (!root) return Cursor();
+        const Leaf* leaf = find_leaf(key);
+        return Cursor(leaf, lower(leaf->keys, leaf->count, key));
+    }
+
+    // Value of the first pair with `key`, or null
+    const Value* find(const Key& key) const {
+        Cursor c = lower_bound(key);
+        return c.valid() && !(key < c.key()) ? &c.value() : nullptr;
+    }
+
+    // fn(key, value) for every pair with lo <= key <= hi, in key order;
+    // returns how many there were
+    template <typename F>
+    size_t scan(const Key& lo, const Key& hi, F&& fn) const {
+        if (!root || hi < lo) return 0;
+        const Leaf* leaf = find_leaf(lo);
+        size_t pos = lower(leaf->keys, leaf->count, lo);
+        size_t visited = 0;
+        for (; leaf; leaf = leaf->next, pos = 0) {
+            __builtin_prefetch(leaf->next);
+            size_t n = leaf->count;
+            size_t end = !(hi < leaf->keys[n - 1]) ? n : upper(leaf->keys + pos, n - pos, hi) + pos;
+            for (size_t i = pos; i < end; i++) {
+                fn(leaf->keys[i], leaf->values[i]);
+            }
+            visited += end - pos;
+            if (end < n) break;
+        }
+        return visited;
+    }
+
+    // fn(key, value) for every pair in key order
+    template <typename F>
+    void for_each(F&& fn) const {
+        for (const Leaf* leaf = first; leaf; leaf = leaf->next) {
+            __builtin_prefetch(leaf->next);
+            for (size_t i = 0; i < leaf->count; i++) {
+                fn(leaf->keys[i], leaf->values[i]);
+            }
+        }
+    }
+};
@@ -0,0 +1,401 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "crc32c.cpp"
+#include "wire.cpp"
+
+//--------------------------------------------------
+// Page File
+//--------------------------------------------------
+// A file of PAGE_SIZE pages addressed by number. Every page starts with the
+// CRC32C of the rest of it, set on write and checked on read, so a torn or
+// corrupt page is reported instead of being parsed.
+constexpr size_t PAGE_SIZE = 8192;
+using PageId = uint32_t;
+constexpr PageId INVALID_PAGE = UINT32_MAX;
+
+class PageFile {
+    std::string path;
+    int fd;
+    PageId pages;
+
+    static uint32_t checksum(const char* page) {
+        return crc32c::compute(page + sizeof(uint32_t), PAGE_SIZE - sizeof(uint32_t));
+    }
+
+    void verify(PageId id, const char* page) const {
+        uint32_t stored;
+        std::memcpy(&stored, page, sizeof(stored));
+        if (wire::to_le(stored) != checksum(page)) {
+            throw std::runtime_error("Page " + std::to_string(id) + " of " + path + " is corrupt");
+        }
+    }
+
+public:
+    // Opens or creates `path`; a partial last page is ignored
+    explicit PageFile(std::string path) : path(std::move(path)) {
+        fd = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open page file " + this->path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat page file " + this->path + ": " + strerror(errno));
+        }
+        pages = static_cast<PageId>(static_cast<uint64_t>(st.st_size) / PAGE_SIZE);
+    }
+
+    ~PageFile() { close(fd); }
+
+    PageFile(const PageFile&) = delete;
+    PageFile& operator=(const PageFile&) = delete;
+
+    const std::string& name() const { return path; }
+
+    // Pages allocated so far, written or not
+    PageId page_count() const { return pages; }
+
+    // The file grows when the page is first written
+    PageId allocate() { return pages++; }
+
+    // Drops pages from `count` on
+    void truncate(PageId count) {
+        if (ftruncate(fd, static_cast<off_t>(count) * PAGE_SIZE) < 0) {
+            throw std::runtime_error("Cannot truncate page file " + path + ": " + strerror(errno));
+        }
+        pages = count;
+    }
+
+    // Pages [first, first + count) into count separate buffers, one preadv
+    void read(PageId first, char* const* buffers, size_t count) {
+        std::vector<iovec> iov(count);
+        for (size_t i = 0; i < count; i++) iov[i] = iovec{buffers[i], PAGE_SIZE};
+        size_t done = 0;
+        size_t want = count * PAGE_SIZE;
+        off_t offset = static_cast<off_t>(first) * PAGE_SIZE;
+        while (done < want) {
+            // Resume mid-vector after a short read
+            size_t skip = done / PAGE_SIZE;
+            iovec* v = iov.data() + skip;
+            size_t part = done % PAGE_SIZE;
+            v->iov_base = buffers[skip] + part;
+            v->iov_len = PAGE_SIZE - part;
+            ssize_t n = preadv(fd, v, static_cast<int>(std::min<size_t>(count - skip, IOV_MAX)),
+                               offset + static_cast<off_t>(done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                throw std::runtime_error("Cannot read page " + std::to_string(first + skip) + " of " + path +
+                                         (n < 0 ? std::string(": ") + strerror(errno) : ": past end of file"));
+            }
+            done += static_cast<size_t>(n);
+        }
+        for (size_t i = 0; i < count; i++) verify(first + static_cast<PageId>(i), buffers[i]);
+    }
+
+    // Stamps the checksum into `page` and writes it
+    void write(PageId id, char* page) {
+        uint32_t crc = wire::to_le(checksum(page));
+        std::memcpy(page, &crc, sizeof(crc));
+        size_t done = 0;
+        while (done < PAGE_SIZE) {
+            ssize_t n = pwrite(fd, page + done, PAGE_SIZE - done, static_cast<off_t>(id) * PAGE_SIZE + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                throw std::runtime_error("Cannot write page " + std::to_string(id) + " of " + path + ": " +
+                                         strerror(errno));
+            }
+            done += static_cast<size_t>(n);
+        }
+    }
+
+    void sync() {
+        if (fdatasync(fd) < 0) {
+            throw std::runtime_error("Cannot sync page file " + path + ": " + strerror(errno));
+        }
+    }
+};
+
+//--------------------------------------------------
+// Buffer Pool
+//--------------------------------------------------
+// A fixed number of page frames caching a PageFile. fetch() pins a page in
+// a frame and latches it, shared or exclusive, until the returned guard
+// goes away; pinned frames are never evicted. Latches are per page, so
+// threads reading or writing different pages, or reading the same one,
+// don't wait on each other. The pool mutex covers only the page table and
+// frame assignment (misses read the page under it).
+//
+// Eviction is CLOCK: a hit sets the frame's reference bit, and the hand
+// skips pinned frames and clears set bits until it finds an unpinned,
+// unreferenced frame. A dirty victim is written back first.
+//
+// read_ahead() loads a run of pages with one preadv without pinning them.
+// Their reference bits start clear, so pages read ahead but never used are
+// the first to go.
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t read_ahead = 0;    // pages loaded ahead of use
+        uint64_t evictions = 0;
+        uint64_t writes = 0;
+    };
+
+private:
+    struct Frame {
+        PageId page = INVALID_PAGE;
+        std::atomic<uint32_t> pins{0};
+        std::atomic<bool> dirty{false};
+        bool referenced = false;
+        std::shared_mutex latch;
+    };
+
+    PageFile& file;
+    size_t frame_count;
+    std::unique_ptr<char, decltype(&std::free)> memory{nullptr, &std::free};
+    std::unique_ptr<Frame[]> frames;
+    std::unordered_map<PageId, size_t> page_table;
+    size_t hand = 0;
+    mutable std::mutex mutex;
+    Stats counters;
+
+    char* data_of(size_t frame) const { return memory.get() + frame * PAGE_SIZE; }
+
+    // Pool mutex held. An unpinned frame to reuse, written back if dirty.
+    size_t victim() {
+        for (size_t step = 0; step < 2 * frame_count + 1; step++) {
+            size_t f = hand;
+            hand = (hand + 1) % frame_count;
+            Frame& frame = frames[f];
+            if (frame.pins.load(std::memory_order_acquire) > 0) continue;
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            if (frame.page != INVALID_PAGE) {
+                if (frame.dirty.load(std::memory_order_acquire)) {
+                    file.write(frame.page, data_of(f));
+                    frame.dirty = false;
+                    counters.writes++;
+                }
+                page_table.erase(frame.page);
+                frame.page = INVALID_PAGE;
+                counters.evictions++;
+            }
+            return f;
+        }
+        throw std::runtime_error("Buffer pool of " + std::to_string(frame_count) + " pages has every page pinned");
+    }
+
+    void release(size_t frame, bool exclusive) {
+        if (exclusive) {
+            frames[frame].latch.unlock();
+        } else {
+            frames[frame].latch.unlock_shared();
+        }
+        frames[frame].pins.fetch_sub(1, std::memory_order_release);
+    }
+
+public:
+    // A pinned, latched page; movable, released on destruction
+    class PageGuard {
+        BufferPool* pool = nullptr;
+        size_t frame = 0;
+        PageId page = INVALID_PAGE;
+        bool exclusive = false;
+
+        friend class BufferPool;
+        PageGuard(BufferPool* pool, size_t frame, PageId page, bool exclusive) :
+            pool(pool), frame(frame), page(page), exclusive(exclusive) {}
+
+    public:
+        PageGuard() = default;
+        PageGuard(PageGuard&& other) noexcept { *this = std::move(other); }
+
+        PageGuard& operator=(PageGuard&& other) noexcept {
+            if (&other != this) {
+                reset();
+                pool = std::exchange(other.pool, nullptr);
+                frame = other.frame;
+                page = other.page;
+                exclusive = other.exclusive;
+            }
+            return *this;
+        }
+
+        ~PageGuard() { reset(); }
+
+        void reset() {
+            if (pool) pool->release(frame, exclusive);
+            pool = nullptr;
+        }
+
+        PageId id() const { return page; }
+        const char* data() const { return pool->data_of(frame); }
+
+        // Exclusive guards only; the page is written back before eviction
+        char* mutable_data() {
+            pool->frames[frame].dirty.store(true, std::memory_order_relaxed);
+            return pool->data_of(frame);
+        }
+    };
+
+    BufferPool(PageFile& file, size_t frame_count) :
+        file(file), frame_count(std::max<size_t>(frame_count, 2)) {
+        memory.reset(static_cast<char*>(std::aligned_alloc(4096, this->frame_count * PAGE_SIZE)));
+        if (!memory) throw std::bad_alloc();
+        frames = std::make_unique<Frame[]>(this->frame_count);
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    size_t size() const { return frame_count; }
+    PageFile& page_file() { return file; }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    PageGuard fetch(PageId page, bool exclusive = false) {
+        size_t f;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = page_table.find(page);
+            if (it != page_table.end()) {
+                f = it->second;
+                counters.hits++;
+            } else {
+                if (page >= file.page_count()) {
+                    throw std::out_of_range("Page " + std::to_string(page) + " is past the end of " + file.name());
+                }
+                f = victim();
+                char* buffer = data_of(f);
+                file.read(page, &buffer, 1);
+                frames[f].page = page;
+                page_table.emplace(page, f);
+                counters.misses++;
+            }
+            frames[f].referenced = true;
+            frames[f].pins.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (exclusive) {
+            frames[f].latch.lock();
+        } else {
+            frames[f].latch.lock_shared();
+        }
+        return PageGuard(this, f, page, exclusive);
+    }
+
+    // A new zeroed page at the end of the file, latched exclusive
+    PageGuard create() {
+        size_t f;
+        PageId page;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            f = victim();
+            page = file.allocate();
+            std::memset(data_of(f), 0, PAGE_SIZE);
+            frames[f].page = page;
+            frames[f].dirty = true;
+            frames[f].referenced = true;
+            frames[f].pins.fetch_add(1, std::memory_order_relaxed);
+            page_table.emplace(page, f);
+        }
+        frames[f].latch.lock();
+        return PageGuard(this, f, page, true);
+    }
+
+    // Loads whichever of [first, first + count) aren't cached, each
+    // contiguous run with one read. At most a quarter of the pool is used.
+    void read_ahead(PageId first, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        PageId end = static_cast<PageId>(std::min<uint64_t>(uint64_t(first) + std::min(count, frame_count / 4),
+                                                            file.page_count()));
+        // Frames claimed for the current run stay pinned so victim() skips them
+        std::vector<size_t> run;
+        std::vector<char*> buffers;
+        PageId run_start = first;
+        auto load = [&] {
+            if (run.empty()) return;
+            bool loaded = true;
+            try {
+                file.read(run_start, buffers.data(), run.size());
+            } catch (const std::exception&) {
+                // Nobody asked for these pages yet; leave the frames free
+                loaded = false;
+            }
+            for (size_t i = 0; i < run.size(); i++) {
+                Frame& frame = frames[run[i]];
+                if (loaded) {
+                    frame.page = run_start + static_cast<PageId>(i);
+                    frame.referenced = false;
+                    page_table.emplace(frame.page, run[i]);
+                }
+                frame.pins.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (loaded) counters.read_ahead += run.size();
+            run.clear();
+            buffers.clear();
+        };
+        for (PageId page = first; page < end; page++) {
+            if (page_table.count(page)) {
+                load();
+                continue;
+            }
+            size_t f;
+            try {
+                f = victim();
+            } catch (const std::runtime_error&) {
+                break;    // everything pinned: read ahead is best effort
+            }
+            if (run.empty()) run_start = page;
+            frames[f].pins.fetch_add(1, std::memory_order_relaxed);
+            run.push_back(f);
+            buffers.push_back(data_of(f));
+        }
+        load();
+    }
+
+    // Writes every dirty page back, then syncs the file
+    void flush() {
+        for (size_t f = 0; f < frame_count; f++) {
+            PageId page;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                page = frames[f].page;
+                if (page == INVALID_PAGE || !frames[f].dirty.load(std::memory_order_acquire)) continue;
+                frames[f].pins.fetch_add(1, std::memory_order_relaxed);
+            }
+            {
+                std::shared_lock<std::shared_mutex> latch(frames[f].latch);
+                frames[f].dirty = false;
+                file.write(page, data_of(f));
+            }
+            frames[f].pins.fetch_sub(1, std::memory_order_release);
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.writes++;
+        }
+        file.sync();
+    }
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "worker_pool.cpp"
+
+//--------------------------------------------------
+// Mapped File
+//--------------------------------------------------
+// Read-only mapping of a whole file
+class MappedFile {
+    const char* base = nullptr;
+    size_t length = 0;
+
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat " + path + ": " + strerror(errno));
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map " + path + ": " + strerror(errno));
+            }
+            base = static_cast<const char*>(p);
+            madvise(p, length, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (base) munmap(const_cast<char*>(base), length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+//--------------------------------------------------
+// Bulk Loader
+//--------------------------------------------------
+struct LoadStats {
+    size_t rows = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+
+    double mb_per_sec() const { return seconds > 0 ? bytes / seconds / 1e6 : 0; }
+};
+
+// Loads "<key> <value>" lines of ints. The mapped file is cut into chunks
+// that end on a newline; workers parse whole chunks with a hand-rolled
+// scanner (no locale, no allocation) into per-chunk column buffers, which
+// are handed to `sink` in file order as (keys, values, rows) batches.
+// `reserve` gets a row-count estimate before the first batch.
+class BulkLoader {
+public:
+    using Sink = std::function<void(const int32_t* keys, const int32_t* values, size_t rows)>;
+    using Reserve = std::function<void(size_t rows)>;
+
+    static constexpr size_t DEFAULT_CHUNK_BYTES = 8 << 20;
+
+private:
+    struct Chunk {
+        size_t begin, end;
+        std::vector<int32_t> keys;
+        std::vector<int32_t> values;
+    };
+
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    // Optional sign and up to 10 digits; nullptr if that's not an int32
+    static const char* parse_int(const char* p, const char* end, int32_t& out) {
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+') p++;
+        const char* digits = p;
+        uint64_t v = 0;
+        while (p < end && static_cast<unsigned>(*p - '0') < 10 && p - digits < 11) {
+            v = v * 10 + static_cast<unsigned>(*p - '0');
+            p++;
+        }
+        if (p == digits || v > (negative ? 2147483648ull : 2147483647ull)) return nullptr;
+        out = negative ? static_cast<int32_t>(-static_cast<int64_t>(v)) : static_cast<int32_t>(v);
+        return p;
+    }
+
+    // Parse [begin, end) of the file; fields may be separated by any whitespace
+    static void parse(const char* file, Chunk& chunk) {
+        const char* p = file + chunk.begin;
+        const char* end = file + chunk.end;
+        chunk.keys.clear();
+        chunk.values.clear();
+        int32_t fields[2];
+        while (true) {
+            for (int f = 0; f < 2; f++) {
+                while (p < end && is_space(*p)) p++;
+                if (p == end) {
+                    if (f == 1) malformed(file, p);
+                    return;
+                }
+                const char* next = parse_int(p, end, fields[f]);
+                if (!next || (next < end && !is_space(*next))) malformed(file, p);
+                p = next;
+            }
+            chunk.keys.push_back(fields[0]);
+            chunk.values.push_back(fields[1]);
+        }
+    }
+
+    [[noreturn]] static void malformed(const char* file, const char* at) {
+        throw std::runtime_error("Malformed input at byte " + std::to_string(at - file));
+    }
+
+    // Chunk boundaries, each moved forward to just past a newline
+    static std::vector<Chunk> split(const char* file, size_t size, size_t chunk_bytes) {
+        std::vector<Chunk> chunks;
+        size_t begin = 0;
+        while (begin < size) {
+            size_t end = std::min(size, begin + std::max<size_t>(chunk_bytes, 1));
+            if (end < size) {
+                const void* nl = std::memchr(file + end, '\n', size - end);
+                end = nl ? static_cast<const char*>(nl) - file + 1 : size;
+            }
+            chunks.push_back(Chunk{begin, end, {}, {}});
+            begin = end;
+        }
+        return chunks;
+    }
+
+public:
+    // With a pool, chunks are parsed in parallel; batches still arrive in order
+    static LoadStats load(const std::string& path, const Sink& sink, WorkerPool* pool = nullptr,
+                          size_t chunk_bytes = DEFAULT_CHUNK_BYTES, const Reserve& reserve = nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        MappedFile file(path);
+        std::vector<Chunk> chunks = split(file.data(), file.size(), chunk_bytes);
+
+        LoadStats stats;
+        stats.bytes = file.size();
+        auto emit = [&](Chunk& chunk) {
+            sink(chunk.keys.data(), chunk.values.data(), chunk.keys.size());
+            stats.rows += chunk.keys.size();
+        };
+
+        if (pool && pool->size() > 1 && chunks.size() > 1) {
+            std::atomic<size_t> next{0};
+            pool->run([&](size_t) {
+                for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < chunks.size();) {
+                    parse(file.data(), chunks[i]);
+                }
+            });
+            if (reserve) {
+                size_t rows = 0;
+                for (auto& chunk : chunks) rows += chunk.keys.size();
+                reserve(rows);
+            }
+            for (auto& chunk : chunks) {
+                emit(chunk);
+                chunk = Chunk();
+            }
+        } else {
+            // One set of buffers, reused for every chunk
+            Chunk scratch;
+            for (auto& chunk : chunks) {
+                scratch.begin = chunk.begin;
+                scratch.end = chunk.end;
+                parse(file.data(), scratch);
+                if (reserve && chunk.begin == 0) {
+                    // Extrapolate from the first chunk
+                    reserve(scratch.keys.size() * (file.size() / (chunk.end - chunk.begin)));
+                }
+                emit(scratch);
+            }
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+};
@@ -5,6 +5,7 @@
     with RAFT distributed consensus algorithm.
     Complete credits goes to Prof. Joy Arulraj https://github.com/jarulraj
  */
+#pragma once
 #include <iostream>
 #include <map>
 #include <vector>
@@ -12,65 +13,132 @@
 #include <iostream>
 #include <chrono>
 
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <memory>
-
-enum FieldType { INT, FLOAT, STRING };
-
-// Define a basic Field variant class that can hold different types
+#include <memory_resource>
+#include "aggregate.cpp"
+#include "btree.cpp"
+#include "bulk_loader.cpp"
+#include "column_table.cpp"
+#include "kv_store.cpp"
+#include "paged_table.cpp"
+
+// Define a basic Field variant class that can hold different types.
+// A compact tagged value: ints, floats and strings of up to
+// INLINE_CAPACITY bytes live inside the Field itself; only longer strings
+// own a heap buffer. Moves never allocate and leave the source an empty
+// INT field.
 class Field {
 public:
+    static constexpr size_t INLINE_CAPACITY = 15;
+
+private:
+    union Storage {
+        int32_t i;
+        float f;
+        char chars[INLINE_CAPACITY + 1];    // null-terminated
+        char* heap;                         // null-terminated, length + 1 bytes
+    };
+
+    Storage value;
+    uint32_t length = 0;    // string length, excluding the terminator
     FieldType type;
 
-    std::unique_ptr<char[]> data;
-    size_t data_length;
+    bool onHeap() const { return type == STRING && length > INLINE_CAPACITY; }
 
-public:
-    Field(int i) : type(INT) {
-        data_length = sizeof(int);
-        data = std::make_unique<char[]>(data_length);
-        std::memcpy(data.get(), &i, data_length);
+    void setString(const char* s, size_t n) {
+        if (n > UINT32_MAX) {
+            throw std::length_error("Field string too long");
+        }
+        length = static_cast<uint32_t>(n);
+        char* dst = value.chars;
+        if (n > INLINE_CAPACITY) {
+            dst = value.heap = new char[n + 1];
+        }
+        std::memcpy(dst, s, n);
+        dst[n] = '\0';
     }
 
-    Field(float f) : type(FLOAT) {
-        data_length = sizeof(float);
-        data = std::make_unique<char[]>(data_length);
-        std::memcpy(data.get(), &f, data_length);
+    void release() noexcept {
+        if (onHeap()) delete[] value.heap;
+    }
+
+    // Take other's value (and buffer); other becomes INT 0
+    void steal(Field& other) noexcept {
+        type = other.type;
+        length = other.length;
+        value = other.value;
+        other.type = INT;
+        other.length = 0;
+        other.value.i = 0;
     }
 
-    Field(const std::string& s) : type(STRING) {
-        data_length = s.size() + 1;  // include null-terminator
-        data = std::make_unique<char[]>(data_length);
-        std::memcpy(data.get(), s.c_str(), data_length);
+public:
+    Field(int i) : type(INT) { value.i = i; }
+
+    Field(float f) : type(FLOAT) { value.f = f; }
+
+    Field(std::string_view s) : type(STRING) { setString(s.data(), s.size()); }
+    Field(const std::string& s) : Field(std::string_view(s)) {}
+    Field(const char* s) : Field(std::string_view(s)) {}
+
+    Field(const Field& other) : length(0), type(other.type) {
+        if (other.type == STRING) {
+            setString(other.c_str(), other.length);
+        } else {
+            value = other.value;
+        }
     }
 
+    Field(Field&& other) noexcept { steal(other); }
+
     Field& operator=(const Field& other) {
-        if (&other == this) {
-            return *this;
+        if (&other != this) {
+            Field copy(other);      // may throw; *this is untouched if it does
+            release();
+            steal(copy);
         }
-        type = other.type;
-        data_length = other.data_length;
-        std::memcpy(data.get(), other.data.get(), data_length);
         return *this;
     }
 
-    Field(Field&& other){
-        type = other.type;
-        data_length = other.data_length;
-        std::memcpy(data.get(), other.data.get(), data_length);
+    Field& operator=(Field&& other) noexcept {
+        if (&other != this) {
+            release();
+            steal(other);
+        }
+        return *this;
     }
 
+    ~Field() { release(); }
+
     FieldType getType() const { return type; }
     int asInt() const {
-        return *reinterpret_cast<int*>(data.get());
+        return value.i;
     }
     float asFloat() const {
-        return *reinterpret_cast<float*>(data.get());
+        return value.f;
+    }
+    std::string_view asStringView() const {
+        return std::string_view(c_str(), length);
     }
     std::string asString() const {
-        return std::string(data.get());
+        return std::string(asStringView());
+    }
+    const char* c_str() const { return onHeap() ? value.heap : value.chars; }
+
+    bool operator==(const Field& other) const {
+        if (type != other.type) return false;
+        switch (type) {
+            case INT: return value.i == other.value.i;
+            case FLOAT: return value.f == other.value.f;
+            case STRING: return asStringView() == other.asStringView();
+        }
+        return false;
     }
 
     void print() const{
@@ -82,18 +150,32 @@ public:
     }
 };
 
+static_assert(std::is_nothrow_move_constructible_v<Field> && std::is_nothrow_move_assignable_v<Field>,
+              "Field moves must not throw, so vectors of them move instead of copy");
+
+// The field list comes from `mem`; pass an Arena's resource when
+// materializing many short-lived tuples
 class Tuple {
-    std::vector<std::unique_ptr<Field>> fields;
+    std::pmr::vector<Field> fields;
 
 public:
+    Tuple() = default;
+    explicit Tuple(size_t capacity, std::pmr::memory_resource* mem = std::pmr::get_default_resource()) :
+        fields(mem) {
+        fields.reserve(capacity);
+    }
 
-    void addField(std::unique_ptr<Field> field) {
+    void addField(Field field) {
         fields.push_back(std::move(field));
     }
 
+    size_t fieldCount() const { return fields.size(); }
+
+    const Field& getField(size_t i) const { return fields[i]; }
+
     void print() const {
         for (const auto& field : fields) {
-            field->print();
+            field.print();
             std::cout << " ";
         }
         std::cout << "\n";
@@ -101,75 +183,305 @@ public:
 };
 
 class BuzzDB {
+public:
+    // Ordered index on the key column: key -> row, equal keys in row order
+    using KeyIndex = BTree<int32_t, uint32_t>;
+
 private:
-    // a map is an ordered key-value container
-    std::map<int, std::vector<int>> index;
+    std::unique_ptr<WorkerPool> pool;   // null: queries run on the caller's thread
+    KeyIndex key_index;
+    bool indexed = false;
+    std::unique_ptr<PagedTable> store;  // null: rows live in `table`
+
+    static constexpr uint64_t SNAPSHOT_CHUNK = 65536;
+
+    void requireIndex() const {
+        if (!indexed) {
+            throw std::runtime_error("No index on key; call createKeyIndex() first");
+        }
+    }
+
+    void requireInMemory(const char* what) const {
+        if (store) {
+            throw std::runtime_error(std::string(what) + " needs the in-memory table; this one is paged");
+        }
+    }
+
+    // The table part of a snapshot into the empty store, SNAPSHOT_CHUNK rows
+    // at a time; leaves `in` just past it
+    void loadPaged(std::istream& in) {
+        uint64_t rows = ColumnTable::load_header(in, table.schema());
+        std::streamoff keys_at = in.tellg();
+        if (keys_at < 0) {
+            throw std::runtime_error("Loading a paged table needs a seekable snapshot stream");
+        }
+        std::streamoff tags_at = keys_at + static_cast<std::streamoff>(3 * sizeof(uint32_t) * rows);
+
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(rows, SNAPSHOT_CHUNK));
+        std::vector<uint32_t> buffer(chunk);
+        std::vector<int32_t> keys(chunk), values(chunk);
+        std::vector<float> scores(chunk);
+        std::vector<std::string> tags(chunk);
+        // n u32s of column `column`, from row `first`
+        auto read_column = [&](int column, uint64_t first, size_t n) {
+            in.seekg(keys_at + static_cast<std::streamoff>(sizeof(uint32_t) * (column * rows + first)));
+            in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(n * sizeof(uint32_t)));
+            snapshot_io::require(in);
+            for (size_t i = 0; i < n; i++) buffer[i] = wire::to_le(buffer[i]);
+        };
+
+        for (uint64_t first = 0; first < rows; first += chunk) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(chunk, rows - first));
+            read_column(0, first, n);
+            std::memcpy(keys.data(), buffer.data(), n * sizeof(uint32_t));
+            read_column(1, first, n);
+            std::memcpy(values.data(), buffer.data(), n * sizeof(uint32_t));
+            read_column(2, first, n);
+            std::memcpy(scores.data(), buffer.data(), n * sizeof(uint32_t));
+            in.seekg(tags_at);
+            for (size_t i = 0; i < n; i++) tags[i] = snapshot_io::get_bytes(in);
+            tags_at = in.tellg();
+
+            // Runs of rows sharing score and tag go in as one batch
+            for (size_t i = 0, j; i < n; i = j) {
+                for (j = i + 1; j < n && scores[j] == scores[i] && tags[j] == tags[i]; j++) {}
+                store->insert_batch(keys.data() + i, values.data() + i, j - i, scores[i], tags[i]);
+            }
+        }
+        in.seekg(tags_at);
+    }
 
 public:
-    size_t number_of_tuples = 4;
+    // Rows live in typed columns: no per-row objects or allocations
+    ColumnTable table{Schema{{"key", INT}, {"value", INT}, {"score", FLOAT}, {"tag", STRING}}};
 
-    // a vector of Tuple unique pointers acting as a table
-    std::vector<std::unique_ptr<Tuple>> table;
+    // String key-value state, kept by the replicated state machine
+    KvStore kv;
 
-    // insert function
-    void insert(int key, int value) {
-        auto newTuple = std::make_unique<Tuple>();
+    // Worker threads for queries, the calling thread included
+    void setThreads(size_t threads) {
+        pool = threads > 1 ? std::make_unique<WorkerPool>(threads) : nullptr;
+    }
 
-        auto key_field = std::make_unique<Field>(key);
-        auto value_field = std::make_unique<Field>(value);
-        float float_val = 132.04;
-        auto float_field = std::make_unique<Field>(float_val);
-        auto string_field = std::make_unique<Field>("buzzdb");
+    size_t threads() const { return pool ? pool->size() : 1; }
+
+    //--------------------------------------------------
+    // Paged storage
+    //--------------------------------------------------
+    // Keeps rows in the page file at `path` instead of `table`, caching
+    // `pool_pages` pages of it, so the data may outgrow memory. Rows already
+    // in the file are back: a warm restart. Until close(), inserts, loads,
+    // snapshots and GROUP BY use the file; the key index, selectRange and
+    // getTuple stay in-memory only.
+    void open(const std::string& path, size_t pool_pages) {
+        requireInMemory("open");
+        if (table.rows() > 0 || indexed) {
+            throw std::runtime_error("open() needs an empty, unindexed database");
+        }
+        store = std::make_unique<PagedTable>(path, pool_pages);
+    }
 
-        newTuple->addField(std::move(key_field));
-        newTuple->addField(std::move(value_field));
-        newTuple->addField(std::move(float_field));
-        newTuple->addField(std::move(string_field));
+    // Flushes and detaches the file
+    void close() {
+        if (store) store->flush();
+        store.reset();
+    }
 
-        //newTuple->print();
+    bool paged() const { return store != nullptr; }
+    PagedTable* pagedTable() { return store.get(); }
 
-        table.push_back(std::move(newTuple));
-        index[key].push_back(value);
+    // Durable up to here (paged only; a no-op otherwise)
+    void flush() {
+        if (store) store->flush();
     }
 
-    // perform a SELECT ... GROUP BY ... SUM query
-    void selectGroupBySum() {
-        for (auto const& pair : index) { // for each unique key
-            int sum = 0;
-            for (auto const& value : pair.second) {
-                sum += value; // sum all values for the key
-            }
-            std::cout << "key: " << pair.first << ", sum: " << sum << '\n';
+    size_t rows() const { return store ? store->rows() : table.rows(); }
+
+    // insert function
+    void insert(int key, int value) {
+        if (store) {
+            store->insert(key, value, 132.04f, "buzzdb");
+            return;
         }
+        size_t row = table.rows();
+        table.append(key, value, 132.04f, "buzzdb");
+        if (indexed) key_index.insert(key, static_cast<uint32_t>(row));
     }
-};
 
-int main() {
-    // Get the start time
-    auto start = std::chrono::high_resolution_clock::now();
+    // n rows straight into the columns
+    void insertBatch(const int32_t* keys, const int32_t* values, size_t n) {
+        if (store) {
+            store->insert_batch(keys, values, n, 132.04f, "buzzdb");
+            return;
+        }
+        size_t row = table.rows();
+        table.append_columns(n, keys, values, 132.04f, "buzzdb");
+        if (indexed) {
+            for (size_t i = 0; i < n; i++) key_index.insert(keys[i], static_cast<uint32_t>(row + i));
+        }
+    }
 
-    BuzzDB db;
+    // Bulk load "<key> <value>" lines, parsed in parallel with setThreads().
+    // An index is rebuilt once at the end rather than kept up per row.
+    LoadStats loadFile(const std::string& path, size_t chunk_bytes = BulkLoader::DEFAULT_CHUNK_BYTES) {
+        bool reindex = indexed;
+        indexed = false;
+        LoadStats stats = BulkLoader::load(
+            path, [this](const int32_t* keys, const int32_t* values, size_t n) { insertBatch(keys, values, n); },
+            pool.get(), chunk_bytes, [this](size_t rows) {
+                if (!store) table.reserve(table.rows() + rows);
+            });
+        if (reindex) createKeyIndex();
+        return stats;
+    }
 
-    std::ifstream inputFile("output.txt");
+    //--------------------------------------------------
+    // Key index
+    //--------------------------------------------------
+    // Sorts (key, row) of every row and bulk-loads the tree; rows inserted
+    // afterwards are added as they come
+    void createKeyIndex() {
+        requireInMemory("createKeyIndex");
+        size_t n = table.rows();
+        if (n > UINT32_MAX) {
+            throw std::length_error("Key index holds at most 2^32 rows");
+        }
+        // Key (sign flipped, so it sorts unsigned) above row: one integer sort
+        const int32_t* keys = table.ints(0).data();
+        std::vector<uint64_t> order(n);
+        for (size_t row = 0; row < n; row++) {
+            order[row] = uint64_t(static_cast<uint32_t>(keys[row]) ^ 0x80000000u) << 32 | row;
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<int32_t> sorted_keys(n);
+        std::vector<uint32_t> rows(n);
+        for (size_t i = 0; i < n; i++) {
+            sorted_keys[i] = static_cast<int32_t>(static_cast<uint32_t>(order[i] >> 32) ^ 0x80000000u);
+            rows[i] = static_cast<uint32_t>(order[i]);
+        }
+        key_index.bulk_load(sorted_keys.data(), rows.data(), n);
+        indexed = true;
+    }
 
-    if (!inputFile) {
-        std::cerr << "Unable to open file" << std::endl;
-        return 1;
+    void dropKeyIndex() {
+        key_index.clear();
+        indexed = false;
     }
 
-    int field1, field2;
-    while (inputFile >> field1 >> field2) {
-        db.insert(field1, field2);
+    bool hasKeyIndex() const { return indexed; }
+    const KeyIndex& keyIndex() const { requireIndex(); return key_index; }
+
+    // SELECT key, value WHERE lo <= key <= hi ORDER BY key: fn(key, value)
+    // per row, equal keys in insertion order. Returns the number of rows.
+    template <typename F>
+    size_t selectRange(int32_t lo, int32_t hi, F&& fn) const {
+        requireIndex();
+        const int32_t* values = table.ints(1).data();
+        return key_index.scan(lo, hi, [&](int32_t key, uint32_t row) { fn(key, values[row]); });
     }
 
-    db.selectGroupBySum();
+    // Every row ordered by key: fn(key, value)
+    template <typename F>
+    void scanOrdered(F&& fn) const {
+        requireIndex();
+        const int32_t* values = table.ints(1).data();
+        key_index.for_each([&](int32_t key, uint32_t row) { fn(key, values[row]); });
+    }
 
-    // Get the end time
-    auto end = std::chrono::high_resolution_clock::now();
+    // Materialize one row, for printing and tests
+    Tuple getTuple(size_t row, std::pmr::memory_resource* mem = std::pmr::get_default_resource()) const {
+        requireInMemory("getTuple");
+        Tuple tuple(table.schema().size(), mem);
+        for (size_t col = 0; col < table.schema().size(); col++) {
+            switch (table.column(col).getType()) {
+                case INT: tuple.addField(table.ints(col)[row]); break;
+                case FLOAT: tuple.addField(table.floats(col)[row]); break;
+                case STRING: tuple.addField(table.strings(col)[row]); break;
+            }
+        }
+        return tuple;
+    }
 
-    // Calculate and print the elapsed time
-    std::chrono::duration<double> elapsed = end - start;
-    std::cout << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
+    //--------------------------------------------------
+    // Snapshots
+    //--------------------------------------------------
+    // Streams the table (see ColumnTable::save), then the key-value pairs;
+    // load() replaces the current contents. A paged table is written in the
+    // same format, one column per pass over its pages, and loaded back
+    // SNAPSHOT_CHUNK rows at a time, so neither holds the table in memory.
+    void save(std::ostream& out) const {
+        if (store) {
+            uint64_t rows = store->rows();
+            ColumnTable::save_header(out, table.schema(), rows);
+            store->scan([&](int32_t key, int32_t, float, std::string_view) {
+                snapshot_io::put_u32(out, static_cast<uint32_t>(key));
+            }, rows);
+            store->scan([&](int32_t, int32_t value, float, std::string_view) {
+                snapshot_io::put_u32(out, static_cast<uint32_t>(value));
+            }, rows);
+            store->scan([&](int32_t, int32_t, float score, std::string_view) {
+                uint32_t bits;
+                std::memcpy(&bits, &score, sizeof(bits));
+                snapshot_io::put_u32(out, bits);
+            }, rows);
+            store->scan([&](int32_t, int32_t, float, std::string_view tag) {
+                snapshot_io::put_bytes(out, tag.data(), static_cast<uint32_t>(tag.size()));
+            }, rows);
+        } else {
+            table.save(out);
+        }
+        kv.save(out);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    // Keeps an index, rebuilt over the loaded rows. A paged table can only
+    // be loaded while empty (pages are appended, never rewritten), and from
+    // a seekable stream: each chunk reads its slice of every column.
+    void load(std::istream& in) {
+        if (store) {
+            if (store->rows() > 0) {
+                throw std::runtime_error("Cannot load a snapshot into a non-empty paged table");
+            }
+            loadPaged(in);
+            kv.load(in);
+            return;
+        }
+        table.load(in);
+        kv.load(in);
+        if (indexed) createKeyIndex();
+    }
+
+    // SELECT key, SUM(value), COUNT(*), MIN(value), MAX(value) GROUP BY key,
+    // straight off the key and value columns, in parallel with setThreads()
+    GroupByResult selectGroupBySum(const GroupByOptions& options = GroupByOptions()) const {
+        if (store) return pagedGroupBySum(options);
+        const int32_t* keys = table.ints(0).data();
+        const int32_t* values = table.ints(1).data();
+        if (pool) {
+            return parallel_group_by(*pool, keys, values, table.rows(), options);
+        }
+        return group_by(keys, values, table.rows(), options);
+    }
+
+    // Paged: page by page through the buffer pool into hash partials, one
+    // per worker; workers take runs of pages so each reads ahead
+    // sequentially within its run
+    GroupByResult pagedGroupBySum(const GroupByOptions& options) const {
+        size_t workers = pool ? pool->size() : 1;
+        size_t pages = store->data_pages();
+        size_t morsel_pages = std::max<size_t>(options.morsel_rows / PagedTable::MAX_PAGE_ROWS,
+                                               PagedTable::READ_AHEAD_PAGES);
+        std::vector<HashAggregator> partials(workers);
+        auto consume = [&](size_t w, size_t begin, size_t end) {
+            store->scan_columns([&](const int32_t* keys, const int32_t* values, size_t n) {
+                partials[w].consume(keys, values, n);
+            }, begin, end);
+        };
+        if (pool && pages >= 2 * morsel_pages) {
+            for_each_morsel(*pool, pages, morsel_pages, consume);
+        } else {
+            consume(0, 0, pages);
+        }
+        for (size_t w = 1; w < workers; w++) partials[0].merge(partials[w]);
+        return partials[0].finish();
+    }
+};
@@ -0,0 +1,72 @@
+#include <thread>
+#include "buzzdb.cpp"
+
+// Loads <key> <value> pairs and prints SUM(value) GROUP BY key.
+// With --pages, rows are kept in that page file through a buffer pool of
+// --pool-pages pages (default 1024, 8 MiB); if the file already holds rows
+// the input is not loaded again.
+// Usage: buzzdb [--threads N] [--pages FILE [--pool-pages N]] [input_file]
+//   (defaults: all cores, in memory, output.txt)
+int main(int argc, char* argv[]) {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string path = "output.txt";
+    std::string pages;
+    size_t pool_pages = 1024;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--threads" || arg == "-t") && i + 1 < argc) {
+            threads = std::stoul(argv[++i]);
+        } else if (arg == "--pages" && i + 1 < argc) {
+            pages = argv[++i];
+        } else if (arg == "--pool-pages" && i + 1 < argc) {
+            pool_pages = std::stoul(argv[++i]);
+        } else if (arg[0] == '-') {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--pages FILE [--pool-pages N]] [input_file]\n";
+            return 1;
+        } else {
+            path = arg;
+        }
+    }
+
+    // Get the start time
+    auto start = std::chrono::high_resolution_clock::now();
+
+    BuzzDB db;
+    db.setThreads(threads);
+
+    LoadStats stats;
+    try {
+        if (!pages.empty()) db.open(pages, pool_pages);
+        if (db.rows() == 0) {
+            stats = db.loadFile(path);
+            db.flush();
+        } else {
+            stats.rows = db.rows();
+            std::cerr << "Reopened " << db.rows() << " rows from " << pages << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    auto loaded = std::chrono::high_resolution_clock::now();
+
+    GroupByResult result = db.selectGroupBySum();
+    auto queried = std::chrono::high_resolution_clock::now();
+    for (const auto& group : result.groups) {
+        std::cout << "key: " << group.key << ", sum: " << group.sum << '\n';
+    }
+
+    // Get the end time
+    auto end = std::chrono::high_resolution_clock::now();
+
+    // Calculate and print the elapsed time
+    std::chrono::duration<double> load_time = loaded - start;
+    std::chrono::duration<double> query_time = queried - loaded;
+    std::chrono::duration<double> elapsed = end - start;
+    std::cerr << "Loaded " << stats.rows << " rows in " << load_time.count() << " s ("
+              << static_cast<uint64_t>(stats.mb_per_sec()) << " MB/s), "
+              << "GROUP BY on " << db.threads() << " threads in " << query_time.count() << " s\n";
+    std::cout << "Elapsed time: " << elapsed.count() << " seconds" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+//--------------------------------------------------
+// Cluster Membership
+//--------------------------------------------------
+// The set of nodes in a cluster. Members are kept sorted by node id and each
+// one's position in that order is its peer slot; every node loads the same
+// membership, so slots agree cluster-wide and per-peer state can live in
+// flat arrays indexed by slot.
+//
+// Config file format, one member per line ('#' starts a comment):
+//     <node_id> <host> <port>
+struct NodeInfo {
+    int id;
+    std::string host;
+    int port;
+    sockaddr_in address;
+};
+
+class ClusterConfig {
+    std::vector<NodeInfo> members;
+
+    static sockaddr_in resolve(const std::string& host, int port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1) {
+            return addr;
+        }
+
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result) {
+            throw std::runtime_error("Cannot resolve host '" + host + "'");
+        }
+        addr.sin_addr = reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr;
+        freeaddrinfo(result);
+        return addr;
+    }
+
+public:
+    void add(int id, const std::string& host, int port) {
+        if (id < 0) {
+            throw std::runtime_error("Invalid node ID " + std::to_string(id));
+        }
+        if (port <= 0 || port > 65535) {
+            throw std::runtime_error("Invalid port " + std::to_string(port) +
+                                     " for node " + std::to_string(id));
+        }
+        if (slot_of(id) >= 0) {
+            throw std::runtime_error("Duplicate node ID " + std::to_string(id));
+        }
+        NodeInfo info{id, host, port, resolve(host, port)};
+        auto pos = std::lower_bound(members.begin(), members.end(), id,
+                                    [](const NodeInfo& n, int key) { return n.id < key; });
+        members.insert(pos, info);
+    }
+
+    static ClusterConfig load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Unable to open cluster config '" + path + "'");
+        }
+
+        ClusterConfig config;
+        std::string line;
+        int line_no = 0;
+        while (std::getline(in, line)) {
+            line_no++;
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            int id, port;
+            std::string host;
+            if (!(fields >> id)) continue;   // blank or comment line
+            if (!(fields >> host >> port)) {
+                throw std::runtime_error(path + ":" + std::to_string(line_no) +
+                                         ": expected '<node_id> <host> <port>'");
+            }
+            config.add(id, host, port);
+        }
+        if (config.size() == 0) {
+            throw std::runtime_error("Cluster config '" + path + "' has no members");
+        }
+        return config;
+    }
+
+    // Nodes 0..size-1 on 127.0.0.1, ports base_port+id
+    static ClusterConfig local(int size, int base_port = 5000) {
+        ClusterConfig config;
+        for (int i = 0; i < size; i++) {
+            config.add(i, "127.0.0.1", base_port + i);
+        }
+        return config;
+    }
+
+    size_t size() const { return members.size(); }
+
+    const NodeInfo& at(int slot) const { return members.at(slot); }
+
+    int id_of(int slot) const { return members[slot].id; }
+
+    // Binary search over the sorted members; -1 if unknown
+    int slot_of(int node_id) const {
+        auto pos = std::lower_bound(members.begin(), members.end(), node_id,
+                                    [](const NodeInfo& n, int key) { return n.id < key; });
+        if (pos == members.end() || pos->id != node_id) return -1;
+        return static_cast<int>(pos - members.begin());
+    }
+};
@@ -0,0 +1,351 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "snapshot.cpp"
+
+enum FieldType { INT, FLOAT, STRING };
+
+inline const char* field_type_name(FieldType type) {
+    switch (type) {
+        case INT: return "int";
+        case FLOAT: return "float";
+        case STRING: return "string";
+    }
+    return "?";
+}
+
+//--------------------------------------------------
+// Schema
+//--------------------------------------------------
+struct ColumnDef {
+    std::string name;
+    FieldType type;
+};
+
+class Schema {
+    std::vector<ColumnDef> columns;
+
+public:
+    Schema() = default;
+    Schema(std::initializer_list<ColumnDef> defs) : columns(defs) {}
+
+    size_t size() const { return columns.size(); }
+    const ColumnDef& operator[](size_t i) const { return columns[i]; }
+
+    // -1 if there is no such column
+    int index_of(const std::string& name) const {
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].name == name) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    bool operator==(const Schema& other) const {
+        if (columns.size() != other.columns.size()) return false;
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].name != other.columns[i].name || columns[i].type != other.columns[i].type) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+//--------------------------------------------------
+// String Column
+//--------------------------------------------------
+// All strings of a column back to back in one arena; row i spans
+// [offsets[i], offsets[i + 1])
+class StringColumn {
+    std::vector<char> arena;
+    std::vector<uint32_t> offsets{0};
+
+public:
+    size_t size() const { return offsets.size() - 1; }
+
+    void push_back(std::string_view s) {
+        if (arena.size() + s.size() > UINT32_MAX) {
+            throw std::length_error("String column arena exceeds 4 GiB");
+        }
+        arena.insert(arena.end(), s.begin(), s.end());
+        offsets.push_back(static_cast<uint32_t>(arena.size()));
+    }
+
+    // The same string n times
+    void push_back_n(std::string_view s, size_t n) {
+        size_t start = arena.size();
+        if (start + s.size() * n > UINT32_MAX) {
+            throw std::length_error("String column arena exceeds 4 GiB");
+        }
+        arena.resize(start + s.size() * n);
+        offsets.reserve(offsets.size() + n);
+        for (size_t i = 0; i < n; i++) {
+            std::memcpy(arena.data() + start + i * s.size(), s.data(), s.size());
+            offsets.push_back(static_cast<uint32_t>(start + (i + 1) * s.size()));
+        }
+    }
+
+    std::string_view operator[](size_t row) const {
+        return std::string_view(arena.data() + offsets[row], offsets[row + 1] - offsets[row]);
+    }
+
+    void reserve(size_t rows, size_t bytes) {
+        offsets.reserve(rows + 1);
+        arena.reserve(bytes);
+    }
+
+    void clear() {
+        arena.clear();
+        offsets.assign(1, 0);
+    }
+
+    size_t arena_bytes() const { return arena.size(); }
+
+    size_t memory_bytes() const {
+        return arena.capacity() + offsets.capacity() * sizeof(uint32_t);
+    }
+};
+
+//--------------------------------------------------
+// Column
+//--------------------------------------------------
+// One typed, contiguous vector; only the one matching `type` is used
+class Column {
+    FieldType type;
+    std::vector<int32_t> int_values;
+    std::vector<float> float_values;
+    StringColumn string_values;
+
+    void expect(FieldType wanted) const {
+        if (type != wanted) {
+            throw std::invalid_argument(std::string("Column holds ") + field_type_name(type) +
+                                        ", not " + field_type_name(wanted));
+        }
+    }
+
+public:
+    explicit Column(FieldType type) : type(type) {}
+
+    FieldType getType() const { return type; }
+
+    void push(int32_t v) { expect(INT); int_values.push_back(v); }
+    void push(float v) { expect(FLOAT); float_values.push_back(v); }
+    void push(std::string_view v) { expect(STRING); string_values.push_back(v); }
+    void push(const char* v) { push(std::string_view(v)); }
+    void push(const std::string& v) { push(std::string_view(v)); }
+
+    // n values at once: copied from an array, or one value repeated
+    void push_n(const int32_t* v, size_t n) { expect(INT); int_values.insert(int_values.end(), v, v + n); }
+    void push_n(const float* v, size_t n) { expect(FLOAT); float_values.insert(float_values.end(), v, v + n); }
+    void push_n(int32_t v, size_t n) { expect(INT); int_values.insert(int_values.end(), n, v); }
+    void push_n(float v, size_t n) { expect(FLOAT); float_values.insert(float_values.end(), n, v); }
+    void push_n(std::string_view v, size_t n) {
+        expect(STRING);
+        string_values.push_back_n(v, n);
+    }
+    void push_n(const char* v, size_t n) { push_n(std::string_view(v), n); }
+
+    const std::vector<int32_t>& ints() const { expect(INT); return int_values; }
+    const std::vector<float>& floats() const { expect(FLOAT); return float_values; }
+    const StringColumn& strings() const { expect(STRING); return string_values; }
+
+    void reserve(size_t rows) {
+        switch (type) {
+            case INT: int_values.reserve(rows); break;
+            case FLOAT: float_values.reserve(rows); break;
+            case STRING: string_values.reserve(rows, rows * 8); break;
+        }
+    }
+
+    void clear() {
+        int_values.clear();
+        float_values.clear();
+        string_values.clear();
+    }
+
+    size_t memory_bytes() const {
+        return int_values.capacity() * sizeof(int32_t) + float_values.capacity() * sizeof(float) +
+               string_values.memory_bytes();
+    }
+};
+
+//--------------------------------------------------
+// Column Table
+//--------------------------------------------------
+// Rows are appended straight into the columns; there are no per-row
+// objects. Scans read one column as a plain array.
+class ColumnTable {
+    Schema table_schema;
+    std::vector<Column> columns;
+    size_t row_count = 0;
+
+    // Arrays of a type count as that type (for append_columns)
+    template <typename T>
+    static constexpr FieldType field_type_of() {
+        using V = std::remove_const_t<std::remove_pointer_t<std::decay_t<T>>>;
+        if constexpr (std::is_same_v<V, int32_t>) return INT;
+        else if constexpr (std::is_same_v<V, float>) return FLOAT;
+        else return STRING;
+    }
+
+    template <typename... Values>
+    void check_row(size_t count) const {
+        if (count != columns.size()) {
+            throw std::invalid_argument("Row has " + std::to_string(count) +
+                                        " values, schema has " + std::to_string(columns.size()));
+        }
+        const FieldType types[] = {field_type_of<Values>()...};
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (types[i] != columns[i].getType()) {
+                throw std::invalid_argument("Column '" + table_schema[i].name + "' holds " +
+                                            field_type_name(columns[i].getType()));
+            }
+        }
+    }
+
+    template <typename Value, typename... Rest>
+    void push_values(size_t col, const Value& value, const Rest&... rest) {
+        columns[col].push(value);
+        if constexpr (sizeof...(rest) > 0) {
+            push_values(col + 1, rest...);
+        }
+    }
+
+public:
+    explicit ColumnTable(Schema schema) : table_schema(std::move(schema)) {
+        for (size_t i = 0; i < table_schema.size(); i++) {
+            columns.emplace_back(table_schema[i].type);
+        }
+    }
+
+    const Schema& schema() const { return table_schema; }
+    size_t rows() const { return row_count; }
+
+    // One value per column, in schema order. Types are checked up front so a
+    // bad row never leaves the columns with different lengths.
+    template <typename... Values>
+    void append(const Values&... values) {
+        check_row<Values...>(sizeof...(values));
+        push_values(0, values...);
+        row_count++;
+    }
+
+    // n rows at once, one source per column: a pointer to n values, or a
+    // single value that every row gets
+    template <typename... Sources>
+    void append_columns(size_t n, const Sources&... sources) {
+        check_row<Sources...>(sizeof...(sources));
+        size_t col = 0;
+        (columns[col++].push_n(sources, n), ...);
+        row_count += n;
+    }
+
+    const Column& column(size_t col) const { return columns.at(col); }
+    const std::vector<int32_t>& ints(size_t col) const { return columns.at(col).ints(); }
+    const std::vector<float>& floats(size_t col) const { return columns.at(col).floats(); }
+    const StringColumn& strings(size_t col) const { return columns.at(col).strings(); }
+
+    void reserve(size_t rows) {
+        for (auto& column : columns) column.reserve(rows);
+    }
+
+    void clear() {
+        for (auto& column : columns) column.clear();
+        row_count = 0;
+    }
+
+    size_t memory_bytes() const {
+        size_t bytes = 0;
+        for (const auto& column : columns) bytes += column.memory_bytes();
+        return bytes;
+    }
+
+    // Snapshots hold the schema, then each column in turn:
+    //   u32 columns, each u8 type + name | u64 rows | column data...
+    // save_header() writes what precedes the column data, so other row
+    // stores can write the same format.
+    static void save_header(std::ostream& out, const Schema& schema, uint64_t rows) {
+        snapshot_io::put_u32(out, static_cast<uint32_t>(schema.size()));
+        for (size_t i = 0; i < schema.size(); i++) {
+            snapshot_io::put_u8(out, static_cast<uint8_t>(schema[i].type));
+            snapshot_io::put_bytes(out, schema[i].name.data(), static_cast<uint32_t>(schema[i].name.size()));
+        }
+        snapshot_io::put_u64(out, rows);
+    }
+
+    // Reads the prefix, which must hold `schema`; returns the row count
+    static uint64_t load_header(std::istream& in, const Schema& schema) {
+        uint32_t count = snapshot_io::get_u32(in);
+        bool same = count == schema.size();
+        for (uint32_t i = 0; i < count; i++) {
+            auto type = static_cast<FieldType>(snapshot_io::get_u8(in));
+            std::string name = snapshot_io::get_bytes(in);
+            same = same && type == schema[i].type && name == schema[i].name;
+        }
+        if (!same) {
+            throw std::runtime_error("Snapshot schema does not match the table");
+        }
+        return snapshot_io::get_u64(in);
+    }
+
+    void save(std::ostream& out) const {
+        save_header(out, table_schema, row_count);
+        for (const auto& column : columns) {
+            switch (column.getType()) {
+                case INT:
+                    for (int32_t v : column.ints()) snapshot_io::put_u32(out, static_cast<uint32_t>(v));
+                    break;
+                case FLOAT:
+                    for (float v : column.floats()) {
+                        uint32_t bits;
+                        std::memcpy(&bits, &v, sizeof(bits));
+                        snapshot_io::put_u32(out, bits);
+                    }
+                    break;
+                case STRING: {
+                    const StringColumn& strings = column.strings();
+                    for (size_t row = 0; row < strings.size(); row++) {
+                        std::string_view s = strings[row];
+                        snapshot_io::put_bytes(out, s.data(), static_cast<uint32_t>(s.size()));
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // Replaces the contents; the stored schema must match ours
+    void load(std::istream& in) {
+        clear();
+        uint64_t rows = load_header(in, table_schema);
+        for (auto& column : columns) {
+            column.reserve(rows);
+            for (uint64_t row = 0; row < rows; row++) {
+                switch (column.getType()) {
+                    case INT:
+                        column.push(static_cast<int32_t>(snapshot_io::get_u32(in)));
+                        break;
+                    case FLOAT: {
+                        uint32_t bits = snapshot_io::get_u32(in);
+                        float v;
+                        std::memcpy(&v, &bits, sizeof(v));
+                        column.push(v);
+                        break;
+                    }
+                    case STRING:
+                        column.push(snapshot_io::get_bytes(in));
+                        break;
+                }
+            }
+        }
+        row_count = rows;
+    }
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include "wire.cpp"
+
+//--------------------------------------------------
+// CRC32C
+//--------------------------------------------------
+// Castagnoli polynomial, slicing-by-8 tables built on first use
+namespace crc32c {
+    inline const uint32_t (&tables())[8][256] {
+        static uint32_t t[8][256];
+        static bool ready = [] {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int s = 1; s < 8; s++) {
+                    t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+                }
+            }
+            return true;
+        }();
+        (void)ready;
+        return t;
+    }
+
+    inline uint32_t compute(const char* data, size_t len, uint32_t crc = 0) {
+        const auto& t = tables();
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        crc = ~crc;
+        while (len >= 8) {
+            uint32_t lo, hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+            lo = wire::to_le(lo) ^ crc;
+            hi = wire::to_le(hi);
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+                  t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+                  t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+            p += 8;
+            len -= 8;
+        }
+        while (len--) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        }
+        return ~crc;
+    }
+}
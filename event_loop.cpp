@@ -0,0 +1,246 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "arena.cpp"
+#include "logger.cpp"
+#include "metrics.cpp"
+
+//--------------------------------------------------
+// Event Loop
+//--------------------------------------------------
+// Single-threaded epoll loop. Sockets, timerfd-backed timers and an eventfd
+// for cross-thread wakeups are all multiplexed on one thread, so everything
+// that runs as a callback here (message handlers, Raft timers) is serialized
+// without locks. Other threads talk to the loop through post(). Linux only.
+class EventLoop {
+public:
+    using Callback = std::function<void()>;
+    using IoCallback = std::function<void(uint32_t events)>;
+    using TimerId = int;
+    using Millis = std::chrono::milliseconds;
+
+private:
+    int epoll_fd;
+    int wake_fd;
+    std::atomic<bool> running{false};
+    std::thread loop_thread;
+    std::atomic<std::thread::id> loop_id;
+
+    // Shared so a callback can remove its own fd while it runs
+    std::unordered_map<int, std::shared_ptr<IoCallback>> handlers;
+    std::unordered_set<int> timers;
+
+    std::mutex posted_mutex;
+    std::vector<Callback> posted;
+    std::vector<Callback> deferred;
+    Arena tick_arena;
+
+    // Shared by every loop in the process
+    Histogram& tick_ns = Metrics::instance().histogram("loop.tick_ns");
+    Histogram& posted_depth = Metrics::instance().histogram("loop.posted_depth");
+
+    static constexpr int MAX_EVENTS = 64;
+
+public:
+    EventLoop() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            throw std::runtime_error("epoll_create1 failed");
+        }
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            close(epoll_fd);
+            throw std::runtime_error("eventfd failed");
+        }
+        add_fd(wake_fd, EPOLLIN, [this](uint32_t) {
+            uint64_t n;
+            while (read(wake_fd, &n, sizeof(n)) > 0) {}
+        });
+    }
+
+    ~EventLoop() {
+        stop();
+        for (int fd : timers) {
+            close(fd);
+        }
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    // Run on a dedicated thread
+    void start() {
+        running = true;
+        loop_thread = std::thread([this] { loop(); });
+    }
+
+    // Run on the calling thread until stop()
+    void run() {
+        running = true;
+        loop();
+    }
+
+    // Returns as soon as the loop thread has left epoll_wait
+    void stop() {
+        running = false;
+        wakeup();
+        if (loop_thread.joinable() && std::this_thread::get_id() != loop_thread.get_id()) {
+            loop_thread.join();
+        }
+    }
+
+    bool in_loop_thread() const {
+        return std::this_thread::get_id() == loop_id.load(std::memory_order_relaxed);
+    }
+
+    //--------------------------------------------------
+    // File descriptors
+    //--------------------------------------------------
+    void add_fd(int fd, uint32_t events, IoCallback cb) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            throw std::runtime_error("epoll_ctl ADD failed");
+        }
+        handlers[fd] = std::make_shared<IoCallback>(std::move(cb));
+    }
+
+    void modify_fd(int fd, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void remove_fd(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        handlers.erase(fd);
+    }
+
+    //--------------------------------------------------
+    // Timers
+    //--------------------------------------------------
+    // Fires once after `delay`, then every `interval` if it is non-zero
+    TimerId add_timer(Millis delay, Millis interval, Callback cb) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("timerfd_create failed");
+        }
+        add_fd(fd, EPOLLIN, [fd, cb = std::move(cb)](uint32_t) {
+            uint64_t expirations;
+            if (read(fd, &expirations, sizeof(expirations)) > 0) {
+                cb();
+            }
+        });
+        timers.insert(fd);
+        reset_timer(fd, delay, interval);
+        return fd;
+    }
+
+    // Re-arm a timer; a zero delay disarms it
+    void reset_timer(TimerId id, Millis delay, Millis interval = Millis(0)) {
+        itimerspec spec{};
+        spec.it_value = to_timespec(delay);
+        spec.it_interval = to_timespec(interval);
+        timerfd_settime(id, 0, &spec, nullptr);
+    }
+
+    void cancel_timer(TimerId id) {
+        remove_fd(id);
+        timers.erase(id);
+        close(id);
+    }
+
+    //--------------------------------------------------
+    // Tasks
+    //--------------------------------------------------
+    // Thread-safe; runs cb on the loop thread
+    void post(Callback cb) {
+        {
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            posted.push_back(std::move(cb));
+        }
+        wakeup();
+    }
+
+    // Loop thread only; runs cb once the current batch of events is handled
+    void defer(Callback cb) {
+        deferred.push_back(std::move(cb));
+    }
+
+    // Loop thread only; scratch memory for the current tick, reset once all
+    // of its callbacks (deferred ones included) have run
+    Arena& arena() { return tick_arena; }
+
+private:
+    void loop() {
+        loop_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        epoll_event events[MAX_EVENTS];
+        std::vector<Callback> tasks;
+
+        while (running) {
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (n < 0 && errno != EINTR) {
+                LOG_ERROR("epoll_wait failed: " << strerror(errno));
+                break;
+            }
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) {
+                auto it = handlers.find(events[i].data.fd);
+                if (it == handlers.end()) continue;
+                auto handler = it->second;
+                (*handler)(events[i].events);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(posted_mutex);
+                tasks.swap(posted);
+            }
+            if (!tasks.empty()) posted_depth.record(tasks.size());
+            for (auto& task : tasks) {
+                task();
+            }
+            tasks.clear();
+
+            // End of tick: deferred work may defer more, run until quiet
+            while (!deferred.empty()) {
+                std::vector<Callback> batch;
+                batch.swap(deferred);
+                for (auto& task : batch) {
+                    task();
+                }
+            }
+            tick_arena.reset();
+            tick_ns.record_since(start);
+        }
+        loop_id.store(std::thread::id(), std::memory_order_relaxed);
+    }
+
+    void wakeup() {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    static timespec to_timespec(Millis ms) {
+        timespec ts;
+        ts.tv_sec = ms.count() / 1000;
+        ts.tv_nsec = (ms.count() % 1000) * 1000000;
+        return ts;
+    }
+};
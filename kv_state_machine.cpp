@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include "buzzdb.cpp"
+#include "logger.cpp"
+#include "messages.cpp"
+
+//--------------------------------------------------
+// KV State Machine
+//--------------------------------------------------
+// Applies committed ClientRequests to a BuzzDB's key-value store. INSERT
+// writes the key, UPDATE writes it only if it exists, DELETE removes it.
+// Entries are decoded in place, so keys and values are never copied on the
+// way to the store. Entries are applied a batch at a time, the way
+// RaftNode::set_on_apply_batch hands them over. Every replica applies the
+// same entries in the same order. Requests that change nothing (UPDATE or
+// DELETE of a missing key, undecodable data) are only counted.
+class KvStateMachine {
+public:
+    struct Stats {
+        uint64_t applied = 0;       // commands; leader no-ops are skipped
+        uint64_t inserts = 0;
+        uint64_t updates = 0;
+        uint64_t deletes = 0;
+        uint64_t misses = 0;        // UPDATE or DELETE of a missing key
+        uint64_t malformed = 0;
+    };
+
+private:
+    BuzzDB& db;
+    Stats counters;
+
+public:
+    explicit KvStateMachine(BuzzDB& db) : db(db) {}
+
+    // entries[i] is at index first_index + i
+    void apply(uint64_t first_index, const LogEntry* const* entries, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            apply(first_index + i, *entries[i]);
+        }
+    }
+
+    void apply(uint64_t index, const LogEntry& entry) {
+        if (entry.data.empty()) return;   // leader no-op
+        ClientRequestView req;
+        try {
+            req = wire_decode<ClientRequestView>(entry.data.data(), entry.data.size());
+        } catch (const std::exception& e) {
+            counters.malformed++;
+            LOG_WARN("Skipped entry " << index << ": " << e.what());
+            return;
+        }
+
+        counters.applied++;
+        switch (req.type) {
+            case ClientRequest::Type::INSERT:
+                db.kv.put(req.key, req.value);
+                counters.inserts++;
+                break;
+            case ClientRequest::Type::UPDATE:
+                if (db.kv.contains(req.key)) {
+                    db.kv.put(req.key, req.value);
+                    counters.updates++;
+                } else {
+                    counters.misses++;
+                }
+                break;
+            case ClientRequest::Type::DELETE:
+                if (db.kv.erase(req.key)) {
+                    counters.deletes++;
+                } else {
+                    counters.misses++;
+                }
+                break;
+            case ClientRequest::Type::GET:
+                break;      // reads are served by RaftNode, never logged
+        }
+        LOG_TRACE("Applied " << index << ": " << ClientRequest::type_to_string(req.type) << " " << req.key);
+    }
+
+    // Valid until the next apply
+    std::optional<std::string_view> get(std::string_view key) const {
+        return db.kv.get(key);
+    }
+
+    const Stats& stats() const { return counters; }
+};
@@ -0,0 +1,251 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "snapshot.cpp"
+
+//--------------------------------------------------
+// KV Store
+//--------------------------------------------------
+// String keys to string values. Records (a small header, then the key and
+// value bytes) are appended to one arena. The index is an open-addressing
+// table of 8-byte slots: a 32-bit hash tag and the record's arena offset,
+// probed linearly. A lookup touches one or two slots, compares tags and
+// then reads a single record. Erase shifts later slots back instead of
+// leaving tombstones, and growing rehashes from the tags alone.
+//
+// A value is overwritten in place when it fits the record's capacity;
+// otherwise, and on erase, the old record becomes garbage. The arena is
+// compacted once garbage makes up more than half of it.
+class KvStore {
+    struct Slot {
+        uint32_t tag;
+        uint32_t offset;    // EMPTY if the slot is free
+    };
+
+    // u32 key length | u32 value length | u32 value capacity | key | value
+    struct Header {
+        uint32_t key_len;
+        uint32_t value_len;
+        uint32_t value_cap;
+    };
+
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+    static constexpr size_t MIN_COMPACT_BYTES = 1 << 20;
+
+    std::vector<Slot> slots;
+    uint32_t shift;                 // 32 - log2(slots.size())
+    size_t count = 0;
+    std::vector<char> arena;
+    size_t garbage = 0;             // arena bytes no slot points at
+
+    // High hash bits pick the home slot, all 32 are compared
+    static uint32_t hash(std::string_view key) {
+        return static_cast<uint32_t>((std::hash<std::string_view>{}(key) * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    Header header(uint32_t offset) const {
+        Header h;
+        std::memcpy(&h, arena.data() + offset, sizeof(h));
+        return h;
+    }
+
+    std::string_view key_at(uint32_t offset, const Header& h) const {
+        return std::string_view(arena.data() + offset + sizeof(Header), h.key_len);
+    }
+
+    std::string_view value_at(uint32_t offset, const Header& h) const {
+        return std::string_view(arena.data() + offset + sizeof(Header) + h.key_len, h.value_len);
+    }
+
+    static size_t record_bytes(const Header& h) {
+        return sizeof(Header) + h.key_len + h.value_cap;
+    }
+
+    uint32_t append_record(std::string_view key, std::string_view value) {
+        size_t offset = arena.size();
+        size_t bytes = sizeof(Header) + key.size() + value.size();
+        if (offset + bytes >= EMPTY) {
+            throw std::length_error("KV store arena exceeds 4 GiB");
+        }
+        Header h{static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size()),
+                 static_cast<uint32_t>(value.size())};
+        arena.resize(offset + bytes);
+        char* p = arena.data() + offset;
+        std::memcpy(p, &h, sizeof(h));
+        std::memcpy(p + sizeof(h), key.data(), key.size());
+        std::memcpy(p + sizeof(h) + key.size(), value.data(), value.size());
+        return static_cast<uint32_t>(offset);
+    }
+
+    // Slot holding `key`, or the free slot where it would go
+    size_t find(std::string_view key, uint32_t tag) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = tag >> shift;
+        while (slots[slot].offset != EMPTY) {
+            if (slots[slot].tag == tag && key_at(slots[slot].offset, header(slots[slot].offset)) == key) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(old.size() * 2, Slot{0, EMPTY});
+        shift--;
+        size_t mask = slots.size() - 1;
+        for (const Slot& s : old) {
+            if (s.offset == EMPTY) continue;
+            size_t slot = s.tag >> shift;
+            while (slots[slot].offset != EMPTY) slot = (slot + 1) & mask;
+            slots[slot] = s;
+        }
+    }
+
+    // Copy live records into a fresh arena, in slot order
+    void compact() {
+        std::vector<char> fresh;
+        fresh.reserve(arena.size() - garbage);
+        for (Slot& s : slots) {
+            if (s.offset == EMPTY) continue;
+            Header h = header(s.offset);
+            h.value_cap = h.value_len;
+            size_t offset = fresh.size();
+            fresh.resize(offset + record_bytes(h));
+            std::memcpy(fresh.data() + offset, &h, sizeof(h));
+            std::memcpy(fresh.data() + offset + sizeof(h), arena.data() + s.offset + sizeof(h),
+                        h.key_len + h.value_len);
+            s.offset = static_cast<uint32_t>(offset);
+        }
+        arena = std::move(fresh);
+        garbage = 0;
+    }
+
+    void maybe_compact() {
+        if (garbage > MIN_COMPACT_BYTES && garbage * 2 > arena.size()) compact();
+    }
+
+public:
+    explicit KvStore(size_t expected_keys = 1024) {
+        uint32_t bits = 4;
+        while ((size_t(1) << bits) < expected_keys * 2) bits++;
+        slots.assign(size_t(1) << bits, Slot{0, EMPTY});
+        shift = 32 - bits;
+    }
+
+    size_t size() const { return count; }
+
+    // Valid until the next put or erase
+    std::optional<std::string_view> get(std::string_view key) const {
+        const Slot& s = slots[find(key, hash(key))];
+        if (s.offset == EMPTY) return std::nullopt;
+        return value_at(s.offset, header(s.offset));
+    }
+
+    bool contains(std::string_view key) const { return get(key).has_value(); }
+
+    // Insert or overwrite. Returns true if the key is new.
+    bool put(std::string_view key, std::string_view value) {
+        uint32_t tag = hash(key);
+        size_t slot = find(key, tag);
+        if (slots[slot].offset != EMPTY) {
+            uint32_t offset = slots[slot].offset;
+            Header h = header(offset);
+            if (value.size() <= h.value_cap) {
+                h.value_len = static_cast<uint32_t>(value.size());
+                std::memcpy(arena.data() + offset, &h, sizeof(h));
+                std::memcpy(arena.data() + offset + sizeof(h) + h.key_len, value.data(), value.size());
+            } else {
+                slots[slot].offset = append_record(key, value);
+                garbage += record_bytes(h);
+                maybe_compact();
+            }
+            return false;
+        }
+
+        // Keep the load factor at or below one half
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+            slot = find(key, tag);
+        }
+        slots[slot] = Slot{tag, append_record(key, value)};
+        count++;
+        return true;
+    }
+
+    // Returns false if the key was not there
+    bool erase(std::string_view key) {
+        size_t slot = find(key, hash(key));
+        if (slots[slot].offset == EMPTY) return false;
+        garbage += record_bytes(header(slots[slot].offset));
+        count--;
+
+        // Backward shift: pull later entries of the run into the hole unless
+        // that would move them before their home slot
+        size_t mask = slots.size() - 1;
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & mask; slots[next].offset != EMPTY; next = (next + 1) & mask) {
+            size_t home = slots[next].tag >> shift;
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+        }
+        slots[hole].offset = EMPTY;
+        maybe_compact();
+        return true;
+    }
+
+    // fn(key, value) for every pair, in no particular order
+    template <typename F>
+    void for_each(F&& fn) const {
+        for (const Slot& s : slots) {
+            if (s.offset == EMPTY) continue;
+            Header h = header(s.offset);
+            fn(key_at(s.offset, h), value_at(s.offset, h));
+        }
+    }
+
+    void clear() {
+        slots.assign(slots.size(), Slot{0, EMPTY});
+        arena.clear();
+        count = 0;
+        garbage = 0;
+    }
+
+    size_t arena_bytes() const { return arena.size(); }
+    size_t garbage_bytes() const { return garbage; }
+
+    size_t memory_bytes() const {
+        return slots.capacity() * sizeof(Slot) + arena.capacity();
+    }
+
+    //   u64 pairs | each key, then value (u32 length + bytes)
+    void save(std::ostream& out) const {
+        snapshot_io::put_u64(out, count);
+        for_each([&](std::string_view key, std::string_view value) {
+            snapshot_io::put_bytes(out, key.data(), static_cast<uint32_t>(key.size()));
+            snapshot_io::put_bytes(out, value.data(), static_cast<uint32_t>(value.size()));
+        });
+    }
+
+    // Replaces the contents
+    void load(std::istream& in) {
+        clear();
+        uint64_t pairs = snapshot_io::get_u64(in);
+        for (uint64_t i = 0; i < pairs; i++) {
+            std::string key = snapshot_io::get_bytes(in);
+            std::string value = snapshot_io::get_bytes(in);
+            put(key, value);
+        }
+    }
+};
@@ -0,0 +1,192 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+//--------------------------------------------------
+// Async Leveled Logger
+//--------------------------------------------------
+// Log lines are formatted into a fixed-size record on the calling thread and
+// pushed onto a bounded lock-free ring; a background thread drains the ring
+// to stdout/stderr. Producers never block: if the ring is full the line is
+// dropped and counted.
+//
+// Levels below BUZZ_LOG_LEVEL are compiled out entirely, so per-message
+// TRACE lines cost nothing in a default build. Compile with
+// -DBUZZ_LOG_LEVEL=0 to get them back. The runtime level defaults to INFO and
+// can be changed with Logger::set_level() or the BUZZ_LOG environment
+// variable (trace, debug, info, warn, error, off).
+enum class LogLevel : int { TRACE = 0, DEBUG, INFO, WARN, ERROR, OFF };
+
+#ifndef BUZZ_LOG_LEVEL
+#define BUZZ_LOG_LEVEL 1
+#endif
+
+class Logger {
+public:
+    static constexpr size_t RECORD_SIZE = 256;
+    static constexpr size_t RING_SIZE = 8192;   // power of two
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        uint16_t length;
+        char text[RECORD_SIZE];
+    };
+
+    Slot* ring;
+    std::atomic<size_t> head{0};    // next slot to claim (producers)
+    size_t tail = 0;                // next slot to drain (consumer only)
+    std::atomic<int> level{static_cast<int>(LogLevel::INFO)};
+    std::atomic<size_t> dropped{0};
+    std::atomic<bool> running{true};
+    std::thread drain_thread;
+
+    Logger() {
+        ring = new Slot[RING_SIZE];
+        for (size_t i = 0; i < RING_SIZE; i++) {
+            ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        if (const char* env = std::getenv("BUZZ_LOG")) {
+            level = static_cast<int>(parse_level(env));
+        }
+        drain_thread = std::thread([this] { drain_loop(); });
+    }
+
+    ~Logger() {
+        running = false;
+        drain_thread.join();
+        delete[] ring;
+    }
+
+    // Pops one record; consumer thread only
+    bool drain_one() {
+        Slot& slot = ring[tail & (RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+            return false;
+        }
+        FILE* out = slot.level >= LogLevel::WARN ? stderr : stdout;
+        std::fwrite(slot.text, 1, slot.length, out);
+        slot.sequence.store(tail + RING_SIZE, std::memory_order_release);
+        tail++;
+        return true;
+    }
+
+    void drain_loop() {
+        while (true) {
+            bool any = false;
+            while (drain_one()) {
+                any = true;
+            }
+            if (any) {
+                std::fflush(stdout);
+            }
+            size_t lost = dropped.exchange(0, std::memory_order_relaxed);
+            if (lost > 0) {
+                std::fprintf(stderr, "[logger] dropped %zu lines\n", lost);
+            }
+            if (!running.load(std::memory_order_relaxed)) {
+                // Final drain so nothing logged before shutdown is lost
+                while (drain_one()) {}
+                std::fflush(stdout);
+                return;
+            }
+            if (!any) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+public:
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    static LogLevel parse_level(const std::string& name) {
+        if (name == "trace") return LogLevel::TRACE;
+        if (name == "debug") return LogLevel::DEBUG;
+        if (name == "warn") return LogLevel::WARN;
+        if (name == "error") return LogLevel::ERROR;
+        if (name == "off") return LogLevel::OFF;
+        return LogLevel::INFO;
+    }
+
+    void set_level(LogLevel l) { level.store(static_cast<int>(l), std::memory_order_relaxed); }
+
+    bool enabled(LogLevel l) const {
+        return static_cast<int>(l) >= level.load(std::memory_order_relaxed);
+    }
+
+    // Multi-producer push (Vyukov bounded queue); drops when full
+    void push(LogLevel l, const char* text, size_t length) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &ring[pos & (RING_SIZE - 1)];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->level = l;
+        slot->length = static_cast<uint16_t>(length);
+        std::memcpy(slot->text, text, length);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+};
+
+// Formats one line into a stack buffer; the record is queued on destruction.
+// Lines longer than a record are truncated.
+class LogLine {
+    class FixedBuf : public std::streambuf {
+    public:
+        FixedBuf(char* buf, size_t size) { setp(buf, buf + size); }
+        size_t size() const { return pptr() - pbase(); }
+    };
+
+    LogLevel level;
+    char buffer[Logger::RECORD_SIZE];
+    FixedBuf buf;
+    std::ostream stream;
+
+public:
+    explicit LogLine(LogLevel level) :
+        level(level), buf(buffer, sizeof(buffer) - 1), stream(&buf) {}
+
+    ~LogLine() {
+        size_t n = buf.size();
+        buffer[n++] = '\n';
+        Logger::instance().push(level, buffer, n);
+    }
+
+    std::ostream& out() { return stream; }
+};
+
+#define BUZZ_LOG(level, expr)                                                   \
+    do {                                                                        \
+        if (static_cast<int>(level) >= BUZZ_LOG_LEVEL &&                        \
+            Logger::instance().enabled(level)) {                                \
+            LogLine buzz_log_line(level);                                       \
+            buzz_log_line.out() << expr;                                        \
+        }                                                                       \
+    } while (0)
+
+#define LOG_TRACE(expr) BUZZ_LOG(LogLevel::TRACE, expr)
+#define LOG_DEBUG(expr) BUZZ_LOG(LogLevel::DEBUG, expr)
+#define LOG_INFO(expr) BUZZ_LOG(LogLevel::INFO, expr)
+#define LOG_WARN(expr) BUZZ_LOG(LogLevel::WARN, expr)
+#define LOG_ERROR(expr) BUZZ_LOG(LogLevel::ERROR, expr)
@@ -1,6 +1,10 @@
+#pragma once
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <nlohmann/json.hpp>
+#include "wire.cpp"
 
 // Forward declarations
 struct LogEntry;
@@ -41,6 +45,29 @@ struct LogEntry {
             j["request_id"].get<uint64_t>()
         };
     }
+
+    size_t wire_size() const {
+        return 3 * sizeof(uint64_t) + wire_string_size(data);
+    }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_string(data);
+        w.put_u64(client_id);
+        w.put_u64(request_id);
+    }
+
+    // Encoded size of an entry with no data; bounds entry counts on decode
+    static constexpr size_t MIN_WIRE_SIZE = 3 * sizeof(uint64_t) + sizeof(uint32_t);
+
+    static LogEntry read(WireReader& r) {
+        LogEntry entry;
+        entry.term = r.get_u64();
+        entry.data = std::string(r.get_string());
+        entry.client_id = r.get_u64();
+        entry.request_id = r.get_u64();
+        return entry;
+    }
 };
 
 // Single definition of adl_serializer for LogEntry
@@ -65,14 +92,58 @@ namespace nlohmann {
     };
 }
 
+//--------------------------------------------------
+// Log Entry View
+//--------------------------------------------------
+// Non-owning LogEntry whose data points into a receive buffer. Call
+// to_entry() only when the entry is actually kept.
+struct LogEntryView {
+    uint64_t term;
+    std::string_view data;
+    uint64_t client_id;
+    uint64_t request_id;
+
+    LogEntryView() = default;
+
+    LogEntryView(uint64_t term, std::string_view data, uint64_t client_id, uint64_t request_id) :
+        term(term), data(data), client_id(client_id), request_id(request_id) {}
+
+    LogEntryView(const LogEntry& entry) :
+        term(entry.term), data(entry.data), client_id(entry.client_id), request_id(entry.request_id) {}
+
+    LogEntry to_entry() const {
+        return LogEntry{term, std::string(data), client_id, request_id};
+    }
+
+    size_t wire_size() const {
+        return 3 * sizeof(uint64_t) + wire_string_size(data);
+    }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_string(data);
+        w.put_u64(client_id);
+        w.put_u64(request_id);
+    }
+
+    static LogEntryView read(WireReader& r) {
+        LogEntryView entry;
+        entry.term = r.get_u64();
+        entry.data = r.get_string();
+        entry.client_id = r.get_u64();
+        entry.request_id = r.get_u64();
+        return entry;
+    }
+};
+
 //--------------------------------------------------
 // RequestVote RPC
 //--------------------------------------------------
 struct RequestVoteRequest {
-    int term;
+    uint64_t term;
     int candidate_id;
-    int last_log_index;
-    int last_log_term;
+    uint64_t last_log_index;
+    uint64_t last_log_term;
 
     std::string serialize() const {
         nlohmann::json j;
@@ -86,12 +157,30 @@ struct RequestVoteRequest {
     static RequestVoteRequest deserialize(const std::string& data) {
         auto j = nlohmann::json::parse(data);
         return RequestVoteRequest{
-            j["term"].get<int>(),
+            j["term"].get<uint64_t>(),
             j["candidate_id"].get<int>(),
-            j["last_log_index"].get<int>(),
-            j["last_log_term"].get<int>()
+            j["last_log_index"].get<uint64_t>(),
+            j["last_log_term"].get<uint64_t>()
         };
     }
+
+    size_t wire_size() const { return 3 * sizeof(uint64_t) + sizeof(uint32_t); }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u32(static_cast<uint32_t>(candidate_id));
+        w.put_u64(last_log_index);
+        w.put_u64(last_log_term);
+    }
+
+    static RequestVoteRequest read(WireReader& r) {
+        RequestVoteRequest req;
+        req.term = r.get_u64();
+        req.candidate_id = static_cast<int>(r.get_u32());
+        req.last_log_index = r.get_u64();
+        req.last_log_term = r.get_u64();
+        return req;
+    }
 };
 
 //--------------------------------------------------
@@ -115,6 +204,20 @@ struct RequestVoteResponse {
             j["vote_granted"].get<bool>()
         };
     }
+
+    size_t wire_size() const { return sizeof(uint64_t) + 1; }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_bool(vote_granted);
+    }
+
+    static RequestVoteResponse read(WireReader& r) {
+        RequestVoteResponse res;
+        res.term = r.get_u64();
+        res.vote_granted = r.get_bool();
+        return res;
+    }
 };
 
 //--------------------------------------------------
@@ -127,6 +230,8 @@ struct AppendEntriesRequest {
     uint64_t prev_log_term;
     std::vector<LogEntry> entries;
     uint64_t leader_commit;
+    uint64_t round = 0;     // leader's heartbeat round, echoed back (see RaftNode reads)
+    bool pipelined = false; // counts toward the leader's max_inflight; echoed back
 
     std::string serialize() const {
         nlohmann::json j;
@@ -136,6 +241,8 @@ struct AppendEntriesRequest {
         j["prev_log_term"] = prev_log_term;
         j["entries"] = entries;
         j["leader_commit"] = leader_commit;
+        j["round"] = round;
+        j["pipelined"] = pipelined;
         return j.dump();
     }
 
@@ -147,6 +254,8 @@ struct AppendEntriesRequest {
         req.prev_log_index = j["prev_log_index"].get<uint64_t>();
         req.prev_log_term = j["prev_log_term"].get<uint64_t>();
         req.leader_commit = j["leader_commit"].get<uint64_t>();
+        req.round = j["round"].get<uint64_t>();
+        req.pipelined = j["pipelined"].get<bool>();
 
         for (const auto& entry : j["entries"]) {
             req.entries.push_back(entry.get<LogEntry>());
@@ -154,21 +263,215 @@ struct AppendEntriesRequest {
 
         return req;
     }
+
+    size_t wire_size() const {
+        size_t n = 6 * sizeof(uint64_t) + 1 + sizeof(uint32_t);
+        for (const auto& entry : entries) {
+            n += entry.wire_size();
+        }
+        return n;
+    }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u64(leader_id);
+        w.put_u64(prev_log_index);
+        w.put_u64(prev_log_term);
+        w.put_u64(leader_commit);
+        w.put_u64(round);
+        w.put_bool(pipelined);
+        w.put_u32(static_cast<uint32_t>(entries.size()));
+        for (const auto& entry : entries) {
+            entry.write(w);
+        }
+    }
+
+    static AppendEntriesRequest read(WireReader& r) {
+        AppendEntriesRequest req;
+        req.term = r.get_u64();
+        req.leader_id = r.get_u64();
+        req.prev_log_index = r.get_u64();
+        req.prev_log_term = r.get_u64();
+        req.leader_commit = r.get_u64();
+        req.round = r.get_u64();
+        req.pipelined = r.get_bool();
+        uint32_t count = r.get_u32();
+        if (count > r.remaining() / LogEntry::MIN_WIRE_SIZE) {
+            throw std::runtime_error("Truncated wire message");
+        }
+        req.entries.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            req.entries.push_back(LogEntry::read(r));
+        }
+        return req;
+    }
+};
+
+//--------------------------------------------------
+// AppendEntries Batch
+//--------------------------------------------------
+// Leader-side AppendEntries whose entries point into the leader's log rather
+// than copying it. Encodes (binary or JSON) exactly like AppendEntriesRequest.
+// The entry list comes from `mem`, normally the event loop's tick arena, so
+// building and sending a batch makes no heap allocations.
+struct AppendEntriesBatch {
+    uint64_t term = 0;
+    uint64_t leader_id = 0;
+    uint64_t prev_log_index = 0;
+    uint64_t prev_log_term = 0;
+    std::pmr::vector<LogEntryView> entries;
+    uint64_t leader_commit = 0;
+    uint64_t round = 0;
+    bool pipelined = false;
+
+    explicit AppendEntriesBatch(std::pmr::memory_resource* mem = std::pmr::get_default_resource()) :
+        entries(mem) {}
+
+    std::string serialize() const {
+        nlohmann::json j;
+        j["term"] = term;
+        j["leader_id"] = leader_id;
+        j["prev_log_index"] = prev_log_index;
+        j["prev_log_term"] = prev_log_term;
+        j["entries"] = nlohmann::json::array();
+        for (const auto& entry : entries) {
+            j["entries"].push_back(nlohmann::json{
+                {"term", entry.term},
+                {"data", std::string(entry.data)},
+                {"client_id", entry.client_id},
+                {"request_id", entry.request_id}
+            });
+        }
+        j["leader_commit"] = leader_commit;
+        j["round"] = round;
+        j["pipelined"] = pipelined;
+        return j.dump();
+    }
+
+    size_t wire_size() const {
+        size_t n = 6 * sizeof(uint64_t) + 1 + sizeof(uint32_t);
+        for (const auto& entry : entries) {
+            n += entry.wire_size();
+        }
+        return n;
+    }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u64(leader_id);
+        w.put_u64(prev_log_index);
+        w.put_u64(prev_log_term);
+        w.put_u64(leader_commit);
+        w.put_u64(round);
+        w.put_bool(pipelined);
+        w.put_u32(static_cast<uint32_t>(entries.size()));
+        for (const auto& entry : entries) {
+            entry.write(w);
+        }
+    }
+};
+
+//--------------------------------------------------
+// AppendEntries View
+//--------------------------------------------------
+// Zero-copy AppendEntries. For binary payloads the entries stay encoded in the
+// receive buffer and are decoded lazily as LogEntryViews; for JSON payloads
+// the view wraps an already decoded AppendEntriesRequest. Either way the
+// backing storage must outlive the view.
+struct AppendEntriesView {
+    uint64_t term;
+    uint64_t leader_id;
+    uint64_t prev_log_index;
+    uint64_t prev_log_term;
+    uint64_t leader_commit;
+    uint64_t round;
+    bool pipelined;
+
+private:
+    uint32_t count = 0;
+    std::string_view encoded_entries;
+    const std::vector<LogEntry>* owned_entries = nullptr;
+
+public:
+    size_t entry_count() const { return count; }
+
+    template <typename F>
+    void for_each_entry(F&& fn) const {
+        if (owned_entries) {
+            for (const auto& entry : *owned_entries) {
+                fn(LogEntryView(entry));
+            }
+            return;
+        }
+        WireReader r(encoded_entries.data(), encoded_entries.size());
+        for (uint32_t i = 0; i < count; i++) {
+            fn(LogEntryView::read(r));
+        }
+    }
+
+    // Binary decode; all entry bounds are validated here so iteration can't fail
+    static AppendEntriesView decode(const char* data, size_t len) {
+        WireReader r(data, len);
+        r.expect_version();
+        AppendEntriesView view;
+        view.term = r.get_u64();
+        view.leader_id = r.get_u64();
+        view.prev_log_index = r.get_u64();
+        view.prev_log_term = r.get_u64();
+        view.leader_commit = r.get_u64();
+        view.round = r.get_u64();
+        view.pipelined = r.get_bool();
+        view.count = r.get_u32();
+        if (view.count > r.remaining() / LogEntry::MIN_WIRE_SIZE) {
+            throw std::runtime_error("Truncated wire message");
+        }
+
+        const char* begin = data + (len - r.remaining());
+        for (uint32_t i = 0; i < view.count; i++) {
+            LogEntryView::read(r);
+        }
+        view.encoded_entries = std::string_view(begin, (data + len - r.remaining()) - begin);
+        return view;
+    }
+
+    static AppendEntriesView of(const AppendEntriesRequest& req) {
+        AppendEntriesView view;
+        view.term = req.term;
+        view.leader_id = req.leader_id;
+        view.prev_log_index = req.prev_log_index;
+        view.prev_log_term = req.prev_log_term;
+        view.leader_commit = req.leader_commit;
+        view.round = req.round;
+        view.pipelined = req.pipelined;
+        view.count = static_cast<uint32_t>(req.entries.size());
+        view.owned_entries = &req.entries;
+        return view;
+    }
 };
 
 //--------------------------------------------------
 // AppendEntries Response
 //--------------------------------------------------
+// On success match_index is the last index known to match the leader
+// (prev_log_index + entries); responses to pipelined requests may arrive out
+// of order, so the leader takes the max. On failure conflict_index is where
+// the leader should resume.
 struct AppendEntriesResponse {
     uint64_t term;
     bool success;
     uint64_t conflict_index;
+    uint64_t match_index;
+    uint64_t round = 0;     // the request's round
+    bool pipelined = false; // the request's
 
     std::string serialize() const {
         nlohmann::json j;
         j["term"] = term;
         j["success"] = success;
         j["conflict_index"] = conflict_index;
+        j["match_index"] = match_index;
+        j["round"] = round;
+        j["pipelined"] = pipelined;
         return j.dump();
     }
 
@@ -177,21 +480,269 @@ struct AppendEntriesResponse {
         return AppendEntriesResponse{
             j["term"].get<uint64_t>(),
             j["success"].get<bool>(),
-            j["conflict_index"].get<uint64_t>()
+            j["conflict_index"].get<uint64_t>(),
+            j["match_index"].get<uint64_t>(),
+            j["round"].get<uint64_t>(),
+            j["pipelined"].get<bool>()
         };
     }
+
+    size_t wire_size() const { return 4 * sizeof(uint64_t) + 2; }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_bool(success);
+        w.put_u64(conflict_index);
+        w.put_u64(match_index);
+        w.put_u64(round);
+        w.put_bool(pipelined);
+    }
+
+    static AppendEntriesResponse read(WireReader& r) {
+        AppendEntriesResponse res;
+        res.term = r.get_u64();
+        res.success = r.get_bool();
+        res.conflict_index = r.get_u64();
+        res.match_index = r.get_u64();
+        res.round = r.get_u64();
+        res.pipelined = r.get_bool();
+        return res;
+    }
+};
+
+//--------------------------------------------------
+// InstallSnapshot RPC
+//--------------------------------------------------
+// One chunk of the leader's snapshot file, sent to a follower whose next
+// entry has already been compacted away. Chunks are raw file bytes at
+// `offset`; `done` marks the last one.
+struct InstallSnapshotRequest {
+    uint64_t term;
+    uint64_t leader_id;
+    uint64_t last_included_index;
+    uint64_t last_included_term;
+    uint64_t offset;
+    std::string data;
+    bool done;
+
+    // JSON strings must be UTF-8, so chunk bytes travel hex-encoded there
+    std::string serialize() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(data.size() * 2);
+        for (unsigned char c : data) {
+            hex.push_back(digits[c >> 4]);
+            hex.push_back(digits[c & 0xF]);
+        }
+        nlohmann::json j;
+        j["term"] = term;
+        j["leader_id"] = leader_id;
+        j["last_included_index"] = last_included_index;
+        j["last_included_term"] = last_included_term;
+        j["offset"] = offset;
+        j["data"] = hex;
+        j["done"] = done;
+        return j.dump();
+    }
+
+    static InstallSnapshotRequest deserialize(const std::string& text) {
+        auto j = nlohmann::json::parse(text);
+        InstallSnapshotRequest req;
+        req.term = j["term"].get<uint64_t>();
+        req.leader_id = j["leader_id"].get<uint64_t>();
+        req.last_included_index = j["last_included_index"].get<uint64_t>();
+        req.last_included_term = j["last_included_term"].get<uint64_t>();
+        req.offset = j["offset"].get<uint64_t>();
+        req.done = j["done"].get<bool>();
+
+        std::string hex = j["data"].get<std::string>();
+        if (hex.size() % 2 != 0) {
+            throw std::runtime_error("Odd-length snapshot chunk");
+        }
+        auto nibble = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            throw std::runtime_error("Bad hex in snapshot chunk");
+        };
+        req.data.resize(hex.size() / 2);
+        for (size_t i = 0; i < req.data.size(); i++) {
+            req.data[i] = static_cast<char>(nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]));
+        }
+        return req;
+    }
+
+    size_t wire_size() const {
+        return 5 * sizeof(uint64_t) + wire_string_size(data) + 1;
+    }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u64(leader_id);
+        w.put_u64(last_included_index);
+        w.put_u64(last_included_term);
+        w.put_u64(offset);
+        w.put_string(data);
+        w.put_bool(done);
+    }
+
+    static InstallSnapshotRequest read(WireReader& r) {
+        InstallSnapshotRequest req;
+        req.term = r.get_u64();
+        req.leader_id = r.get_u64();
+        req.last_included_index = r.get_u64();
+        req.last_included_term = r.get_u64();
+        req.offset = r.get_u64();
+        req.data = std::string(r.get_string());
+        req.done = r.get_bool();
+        return req;
+    }
+};
+
+//--------------------------------------------------
+// InstallSnapshot Response
+//--------------------------------------------------
+// next_offset is how many bytes of that snapshot the follower holds, so lost
+// or reordered chunks are resent from there. Once the snapshot is installed
+// it equals the snapshot's size.
+struct InstallSnapshotResponse {
+    uint64_t term;
+    uint64_t last_included_index;
+    uint64_t next_offset;
+
+    std::string serialize() const {
+        nlohmann::json j;
+        j["term"] = term;
+        j["last_included_index"] = last_included_index;
+        j["next_offset"] = next_offset;
+        return j.dump();
+    }
+
+    static InstallSnapshotResponse deserialize(const std::string& data) {
+        auto j = nlohmann::json::parse(data);
+        return InstallSnapshotResponse{
+            j["term"].get<uint64_t>(),
+            j["last_included_index"].get<uint64_t>(),
+            j["next_offset"].get<uint64_t>()
+        };
+    }
+
+    size_t wire_size() const { return 3 * sizeof(uint64_t); }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u64(last_included_index);
+        w.put_u64(next_offset);
+    }
+
+    static InstallSnapshotResponse read(WireReader& r) {
+        InstallSnapshotResponse res;
+        res.term = r.get_u64();
+        res.last_included_index = r.get_u64();
+        res.next_offset = r.get_u64();
+        return res;
+    }
+};
+
+//--------------------------------------------------
+// ReadIndex RPC
+//--------------------------------------------------
+// A follower asking the leader for a read index on behalf of the reads in
+// one of its batches. The leader confirms its leadership as it would for
+// its own reads and answers with the index they must wait for.
+struct ReadIndexRequest {
+    uint64_t term;
+    uint64_t batch;
+
+    std::string serialize() const {
+        nlohmann::json j;
+        j["term"] = term;
+        j["batch"] = batch;
+        return j.dump();
+    }
+
+    static ReadIndexRequest deserialize(const std::string& data) {
+        auto j = nlohmann::json::parse(data);
+        return ReadIndexRequest{j["term"].get<uint64_t>(), j["batch"].get<uint64_t>()};
+    }
+
+    size_t wire_size() const { return 2 * sizeof(uint64_t); }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u64(batch);
+    }
+
+    static ReadIndexRequest read(WireReader& r) {
+        ReadIndexRequest req;
+        req.term = r.get_u64();
+        req.batch = r.get_u64();
+        return req;
+    }
+};
+
+//--------------------------------------------------
+// ReadIndex Response
+//--------------------------------------------------
+// success is false if the node asked is not (or stopped being) the leader
+struct ReadIndexResponse {
+    uint64_t term;
+    uint64_t batch;
+    bool success;
+    uint64_t read_index;
+
+    std::string serialize() const {
+        nlohmann::json j;
+        j["term"] = term;
+        j["batch"] = batch;
+        j["success"] = success;
+        j["read_index"] = read_index;
+        return j.dump();
+    }
+
+    static ReadIndexResponse deserialize(const std::string& data) {
+        auto j = nlohmann::json::parse(data);
+        return ReadIndexResponse{
+            j["term"].get<uint64_t>(),
+            j["batch"].get<uint64_t>(),
+            j["success"].get<bool>(),
+            j["read_index"].get<uint64_t>()
+        };
+    }
+
+    size_t wire_size() const { return 3 * sizeof(uint64_t) + 1; }
+
+    void write(WireWriter& w) const {
+        w.put_u64(term);
+        w.put_u64(batch);
+        w.put_bool(success);
+        w.put_u64(read_index);
+    }
+
+    static ReadIndexResponse read(WireReader& r) {
+        ReadIndexResponse res;
+        res.term = r.get_u64();
+        res.batch = r.get_u64();
+        res.success = r.get_bool();
+        res.read_index = r.get_u64();
+        return res;
+    }
 };
 
 //--------------------------------------------------
 // Client Request
 //--------------------------------------------------
 struct ClientRequest {
-    enum class Type { INSERT, DELETE, UPDATE };
+    enum class Type { INSERT, DELETE, UPDATE, GET };   // GET is a read and never logged
     Type type;
     std::string key;
     std::string value;
     uint64_t client_id;
     uint64_t request_id;
+    // GET only: how many entries the answer may trail the leader's commit
+    // index by, so any node can serve it from its own state
+    uint64_t max_lag = LINEARIZABLE;
+
+    static constexpr uint64_t LINEARIZABLE = UINT64_MAX;
 
     std::string serialize() const {
         nlohmann::json j;
@@ -200,6 +751,7 @@ struct ClientRequest {
         j["value"] = value;
         j["client_id"] = client_id;
         j["request_id"] = request_id;
+        j["max_lag"] = max_lag;
         return j.dump();
     }
 
@@ -208,6 +760,7 @@ struct ClientRequest {
             case Type::INSERT: return "INSERT";
             case Type::DELETE: return "DELETE";
             case Type::UPDATE: return "UPDATE";
+            case Type::GET: return "GET";
             default: return "UNKNOWN";
         }
     }
@@ -219,10 +772,69 @@ struct ClientRequest {
         if(type_str == "INSERT") req.type = Type::INSERT;
         else if(type_str == "DELETE") req.type = Type::DELETE;
         else if(type_str == "UPDATE") req.type = Type::UPDATE;
+        else if(type_str == "GET") req.type = Type::GET;
         j.at("key").get_to(req.key);
         j.at("value").get_to(req.value);
         j.at("client_id").get_to(req.client_id);
         j.at("request_id").get_to(req.request_id);
+        j.at("max_lag").get_to(req.max_lag);
+        return req;
+    }
+
+    size_t wire_size() const {
+        return 1 + wire_string_size(key) + wire_string_size(value) + 3 * sizeof(uint64_t);
+    }
+
+    void write(WireWriter& w) const {
+        w.put_u8(static_cast<uint8_t>(type));
+        w.put_string(key);
+        w.put_string(value);
+        w.put_u64(client_id);
+        w.put_u64(request_id);
+        w.put_u64(max_lag);
+    }
+
+    static ClientRequest read(WireReader& r) {
+        ClientRequest req;
+        uint8_t t = r.get_u8();
+        if (t > static_cast<uint8_t>(Type::GET)) {
+            throw std::runtime_error("Unknown client request type");
+        }
+        req.type = static_cast<Type>(t);
+        req.key = std::string(r.get_string());
+        req.value = std::string(r.get_string());
+        req.client_id = r.get_u64();
+        req.request_id = r.get_u64();
+        req.max_lag = r.get_u64();
+        return req;
+    }
+};
+
+//--------------------------------------------------
+// Client Request View
+//--------------------------------------------------
+// Non-owning ClientRequest decoded straight from a binary payload (such as
+// a log entry's data); key and value point into it
+struct ClientRequestView {
+    ClientRequest::Type type;
+    std::string_view key;
+    std::string_view value;
+    uint64_t client_id;
+    uint64_t request_id;
+    uint64_t max_lag;
+
+    static ClientRequestView read(WireReader& r) {
+        ClientRequestView req;
+        uint8_t t = r.get_u8();
+        if (t > static_cast<uint8_t>(ClientRequest::Type::GET)) {
+            throw std::runtime_error("Unknown client request type");
+        }
+        req.type = static_cast<ClientRequest::Type>(t);
+        req.key = r.get_string();
+        req.value = r.get_string();
+        req.client_id = r.get_u64();
+        req.request_id = r.get_u64();
+        req.max_lag = r.get_u64();
         return req;
     }
 };
@@ -230,11 +842,15 @@ struct ClientRequest {
 //--------------------------------------------------
 // Client Response
 //--------------------------------------------------
+// request_id echoes the request so pipelining clients can match replies
 struct ClientResponse {
     bool success;
     bool leader_hint;
     uint64_t leader_id;
     std::string error;
+    uint64_t request_id;
+    std::string value;      // GET only
+    uint64_t applied_index = 0;     // GET: the state the answer reflects; writes: where applied
 
     std::string serialize() const {
         nlohmann::json j;
@@ -242,6 +858,9 @@ struct ClientResponse {
         j["leader_hint"] = leader_hint;
         j["leader_id"] = leader_id;
         j["error"] = error;
+        j["request_id"] = request_id;
+        j["value"] = value;
+        j["applied_index"] = applied_index;
         return j.dump();
     }
 
@@ -251,7 +870,36 @@ struct ClientResponse {
             j["success"].get<bool>(),
             j["leader_hint"].get<bool>(),
             j["leader_id"].get<uint64_t>(),
-            j["error"].get<std::string>()
+            j["error"].get<std::string>(),
+            j["request_id"].get<uint64_t>(),
+            j["value"].get<std::string>(),
+            j["applied_index"].get<uint64_t>()
         };
     }
+
+    size_t wire_size() const {
+        return 2 + 3 * sizeof(uint64_t) + wire_string_size(error) + wire_string_size(value);
+    }
+
+    void write(WireWriter& w) const {
+        w.put_bool(success);
+        w.put_bool(leader_hint);
+        w.put_u64(leader_id);
+        w.put_string(error);
+        w.put_u64(request_id);
+        w.put_string(value);
+        w.put_u64(applied_index);
+    }
+
+    static ClientResponse read(WireReader& r) {
+        ClientResponse res;
+        res.success = r.get_bool();
+        res.leader_hint = r.get_bool();
+        res.leader_id = r.get_u64();
+        res.error = std::string(r.get_string());
+        res.request_id = r.get_u64();
+        res.value = std::string(r.get_string());
+        res.applied_index = r.get_u64();
+        return res;
+    }
 };
\ No newline at end of file
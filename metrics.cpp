@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+//--------------------------------------------------
+// Metrics
+//--------------------------------------------------
+// Process-wide counters, gauges and histograms, named like
+// "net.sent.APPREQ" or "wal.fsync_ns". Updates are relaxed atomic adds and
+// take no locks. Counters are split into per-thread shards on separate
+// cache lines, so threads bumping the same counter don't contend.
+// Registering a name takes a lock, so hot paths look a metric up once and
+// keep the reference (a static local or a member). Metrics live as long as
+// the process, and nodes sharing a process share them.
+//
+// Metrics::instance().dump() writes them all as text, one per line, sorted
+// by name. With BUZZ_STATS_FILE set, a background thread rewrites that file
+// every BUZZ_STATS_INTERVAL_MS (default 10000) milliseconds.
+
+class Counter {
+public:
+    static constexpr size_t SHARDS = 16;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, SHARDS> shards;
+
+    // Threads take shards round-robin as they first touch any counter
+    static size_t shard() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t mine = next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return mine;
+    }
+
+public:
+    void add(uint64_t n = 1) {
+        shards[shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const Shard& s : shards) total += s.value.load(std::memory_order_relaxed);
+        return total;
+    }
+};
+
+// A level that goes up and down: queue depths, sizes
+class Gauge {
+    std::atomic<int64_t> current{0};
+
+public:
+    void set(int64_t v) { current.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { current.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+};
+
+// HDR-style histogram of non-negative integers (nanoseconds, sizes): 8
+// linear sub-buckets per power of two, so any recorded value is reported
+// within 12.5% over the whole 64-bit range, in 4 KiB of buckets.
+class Histogram {
+public:
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    struct Summary {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t p999;
+    };
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> largest{0};
+
+public:
+    // Values below SUB get a bucket each; above, the top SUB_BITS + 1 bits
+    // (leading one included) pick the bucket
+    static size_t bucket_of(uint64_t v) {
+        if (v < SUB) return static_cast<size_t>(v);
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(v));
+        return (msb - SUB_BITS + 1) * SUB + ((v >> (msb - SUB_BITS)) & (SUB - 1));
+    }
+
+    // Smallest value that lands in `bucket`
+    static uint64_t bucket_floor(size_t bucket) {
+        if (bucket < SUB) return bucket;
+        size_t exponent = bucket / SUB;
+        return (SUB + bucket % SUB) << (exponent - 1);
+    }
+
+    void record(uint64_t v) {
+        buckets[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (v > seen && !largest.compare_exchange_weak(seen, v, std::memory_order_relaxed)) {}
+    }
+
+    // Nanoseconds since `start`
+    void record_since(std::chrono::steady_clock::time_point start) {
+        record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    // Percentiles are the top of their bucket, capped at the largest value
+    // recorded. Concurrent updates may be half counted.
+    Summary summary() const {
+        std::array<uint64_t, BUCKETS> counts;
+        uint64_t n = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            counts[i] = buckets[i].load(std::memory_order_relaxed);
+            n += counts[i];
+        }
+        uint64_t max = largest.load(std::memory_order_relaxed);
+        auto percentile = [&](double p) -> uint64_t {
+            if (n == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(p / 100.0 * (n - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    return i + 1 < BUCKETS ? std::min(bucket_floor(i + 1) - 1, max) : max;
+                }
+            }
+            return max;
+        };
+        return Summary{n, sum.load(std::memory_order_relaxed), max,
+                       percentile(50), percentile(99), percentile(99.9)};
+    }
+};
+
+class Metrics {
+    mutable std::mutex mutex;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+
+    // Periodic dump
+    std::thread dump_thread;
+    std::mutex dump_mutex;
+    std::condition_variable dump_wakeup;
+    bool stopping = false;
+
+    Metrics() {
+        if (const char* path = std::getenv("BUZZ_STATS_FILE")) {
+            const char* interval = std::getenv("BUZZ_STATS_INTERVAL_MS");
+            start_dump(path, std::chrono::milliseconds(interval ? std::atoi(interval) : 10000));
+        }
+    }
+
+    ~Metrics() {
+        {
+            std::lock_guard<std::mutex> lock(dump_mutex);
+            stopping = true;
+        }
+        dump_wakeup.notify_all();
+        if (dump_thread.joinable()) dump_thread.join();
+    }
+
+    template <typename T>
+    T& lookup(std::map<std::string, std::unique_ptr<T>>& metrics, const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& slot = metrics[name];
+        if (!slot) slot = std::make_unique<T>();
+        return *slot;
+    }
+
+public:
+    static Metrics& instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    // Created on first use; the reference stays valid
+    Counter& counter(const std::string& name) { return lookup(counters, name); }
+    Gauge& gauge(const std::string& name) { return lookup(gauges, name); }
+    Histogram& histogram(const std::string& name) { return lookup(histograms, name); }
+
+    //   counter <name> <value>
+    //   gauge <name> <value>
+    //   histogram <name> count=<n> mean=<v> p50=<v> p99=<v> p999=<v> max=<v>
+    void dump(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& c : counters) {
+            out << "counter " << c.first << " " << c.second->value() << "\n";
+        }
+        for (const auto& g : gauges) {
+            out << "gauge " << g.first << " " << g.second->value() << "\n";
+        }
+        for (const auto& h : histograms) {
+            Histogram::Summary s = h.second->summary();
+            out << "histogram " << h.first << " count=" << s.count
+                << " mean=" << (s.count ? s.sum / s.count : 0) << " p50=" << s.p50
+                << " p99=" << s.p99 << " p999=" << s.p999 << " max=" << s.max << "\n";
+        }
+    }
+
+    std::string dump() const {
+        std::ostringstream out;
+        dump(out);
+        return out.str();
+    }
+
+    // Rewrites `path` (through a rename, so readers never see half a dump)
+    // every `interval` until the process exits
+    void start_dump(const std::string& path, std::chrono::milliseconds interval) {
+        if (dump_thread.joinable()) return;
+        dump_thread = std::thread([this, path, interval] {
+            std::unique_lock<std::mutex> lock(dump_mutex);
+            while (!dump_wakeup.wait_for(lock, interval, [this] { return stopping; })) {
+                std::string tmp = path + ".tmp";
+                {
+                    std::ofstream out(tmp, std::ios::trunc);
+                    dump(out);
+                }
+                std::rename(tmp.c_str(), path.c_str());
+            }
+        });
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "raft.cpp"
+
+//--------------------------------------------------
+// Multi-Raft
+//--------------------------------------------------
+// Many independent Raft groups in one process, each owning a shard of the
+// key space (CRC32C of the key, modulo the group count), so writes to
+// different shards are ordered and committed by different leaders.
+//
+// The groups share:
+//  - the NetworkManager: every message carries its group id, and each
+//    group registers handlers for its own. Coalescing is on, so what the
+//    groups send a peer during one tick leaves as one bundle.
+//  - one heartbeat timer: every leader heartbeats in the same tick, so a
+//    node's heartbeats to a peer, and the peer's answers, travel together.
+//  - one WAL (data_dir/wal; snapshots in data_dir/group-<n>): appends from
+//    every group during a tick are made durable by one sync.
+//
+// Leadership is spread by staggering election timeouts. Every node has a
+// rank in each group (see rank_of) and waits rank * election_timeout_max_ms
+// longer than usual before campaigning. The rank-0 node of each group
+// usually wins the first election, so leaders start out round-robin over
+// the nodes. When a leader fails, its groups go to their next-ranked
+// nodes, which differ from group to group. Leadership does not move back
+// when a node returns. Leases and the vote refusal that protects them keep
+// the unstaggered timeout (lease_base_ms), the same for every rank.
+struct MultiRaftOptions {
+    size_t groups = 8;
+    RaftOptions raft;                   // per group; group, shared_wal and heartbeats are set here
+    bool coalesce = true;
+};
+
+class MultiRaft {
+public:
+    // Attaches state machine handlers to a group's node; runs before the
+    // network starts
+    using Setup = std::function<void(uint32_t group, RaftNode& node)>;
+
+private:
+    NetworkManager& network;
+    MultiRaftOptions options;
+    std::unique_ptr<Wal> wal;
+    std::vector<std::unique_ptr<RaftNode>> nodes;
+    EventLoop::TimerId heartbeat_timer;
+
+    // 0 for the group's preferred leader (slot group % nodes); the others
+    // follow in an order rotated by group / nodes, so the groups one node
+    // leads fail over to different nodes
+    static int rank_of(size_t slot, uint32_t group, size_t nodes) {
+        size_t first = group % nodes;
+        if (slot == first) return 0;
+        size_t distance = (slot + nodes - first) % nodes;
+        return static_cast<int>(1 + (distance - 1 + group / nodes) % (nodes - 1));
+    }
+
+    // The group's options at this node: its id, the shared log, and the
+    // election delay of this node's rank for it
+    RaftOptions group_options(uint32_t group) const {
+        RaftOptions o = options.raft;
+        o.group = group;
+        o.external_heartbeats = true;
+        if (o.lease_base_ms == 0) o.lease_base_ms = options.raft.election_timeout_min_ms;
+        int rank = rank_of(static_cast<size_t>(network.slot()), group, network.config().size());
+        o.election_timeout_min_ms += rank * options.raft.election_timeout_max_ms;
+        o.election_timeout_max_ms += rank * options.raft.election_timeout_max_ms;
+        if (wal) {
+            o.shared_wal = wal.get();
+            o.data_dir = options.raft.data_dir + "/group-" + std::to_string(group);
+        }
+        return o;
+    }
+
+public:
+    // Builds every group's node; call before network.start()
+    MultiRaft(NetworkManager& network, MultiRaftOptions options, const Setup& setup = nullptr) :
+        network(network), options(std::move(options)) {
+        if (this->options.groups == 0) {
+            throw std::invalid_argument("Multi-Raft needs at least one group");
+        }
+        const std::string& dir = this->options.raft.data_dir;
+        if (!dir.empty()) {
+            if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+                throw std::runtime_error("Cannot create '" + dir + "': " + strerror(errno));
+            }
+            wal = std::make_unique<Wal>(dir + "/wal", this->options.raft.wal_segment_size);
+        }
+        if (this->options.coalesce) network.set_coalescing(true);
+
+        for (uint32_t g = 0; g < this->options.groups; g++) {
+            nodes.push_back(std::make_unique<RaftNode>(network, group_options(g)));
+            if (setup) setup(g, *nodes.back());
+        }
+
+        EventLoop::Millis interval(this->options.raft.heartbeat_interval_ms);
+        heartbeat_timer = network.loop().add_timer(interval, interval, [this] {
+            for (auto& node : nodes) node->heartbeat();
+        });
+    }
+
+    MultiRaft(const MultiRaft&) = delete;
+    MultiRaft& operator=(const MultiRaft&) = delete;
+
+    size_t groups() const { return nodes.size(); }
+    RaftNode& group(uint32_t g) { return *nodes.at(g); }
+
+    // Shard of a key; the same on every node and build
+    static uint32_t group_of(std::string_view key, size_t groups) {
+        return crc32c::compute(key.data(), key.size()) % static_cast<uint32_t>(groups);
+    }
+
+    uint32_t group_of(std::string_view key) const { return group_of(key, nodes.size()); }
+
+    // Safe to call from any thread; see RaftNode::submit. Goes to the
+    // key's group, and from there to that group's leader.
+    void submit(ClientRequest req, RaftNode::ResponseCallback done = nullptr) {
+        uint32_t g = group_of(req.key);
+        nodes[g]->submit(std::move(req), std::move(done));
+    }
+
+    // Safe to call from any thread; see RaftNode::get
+    void get(std::string key, RaftNode::ResponseCallback done, uint64_t max_lag = ClientRequest::LINEARIZABLE) {
+        uint32_t g = group_of(key);
+        nodes[g]->get(std::move(key), std::move(done), max_lag);
+    }
+
+    // Safe to call from any thread while the loop is running; by group
+    std::vector<RaftStatus> status() {
+        std::vector<RaftStatus> all;
+        for (auto& node : nodes) all.push_back(node->status());
+        return all;
+    }
+
+    // Groups this node leads right now
+    size_t leading() {
+        size_t n = 0;
+        for (const RaftStatus& st : status()) n += st.leader;
+        return n;
+    }
+};
@@ -1,230 +1,619 @@
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <cstring>
+#include <memory>
+#include <string_view>
 #include <thread>
-#include <unordered_map>
 #include <functional>
-#include <arpa/inet.h>
 #include <unistd.h>
+#include "cluster_config.cpp"
+#include "logger.cpp"
 #include "messages.cpp"
+#include "metrics.cpp"
+#include "transport.cpp"
+
+// Message tag per type, used for headers and logging
+template <typename T> struct MessageTag;
+template <> struct MessageTag<RequestVoteRequest> { static constexpr const char* value = "VTEREQ"; };
+template <> struct MessageTag<RequestVoteResponse> { static constexpr const char* value = "VTERES"; };
+template <> struct MessageTag<AppendEntriesRequest> { static constexpr const char* value = "APPREQ"; };
+template <> struct MessageTag<AppendEntriesBatch> { static constexpr const char* value = "APPREQ"; };
+template <> struct MessageTag<AppendEntriesResponse> { static constexpr const char* value = "APPRES"; };
+template <> struct MessageTag<InstallSnapshotRequest> { static constexpr const char* value = "SNPREQ"; };
+template <> struct MessageTag<InstallSnapshotResponse> { static constexpr const char* value = "SNPRES"; };
+template <> struct MessageTag<ReadIndexRequest> { static constexpr const char* value = "RIXREQ"; };
+template <> struct MessageTag<ReadIndexResponse> { static constexpr const char* value = "RIXRES"; };
+template <> struct MessageTag<ClientRequest> { static constexpr const char* value = "CLIREQ"; };
+template <> struct MessageTag<ClientResponse> { static constexpr const char* value = "CLIRES"; };
 
 class NetworkManager {
-    int sockfd;
+    ClusterConfig cluster;
     int node_id;
-    bool running;
-    std::thread receiver_thread;
-    const int base_port;
-
-    // Updated handlers with sender_id parameter
-    std::function<void(int, const RequestVoteRequest&)> vote_request_handler;
-    std::function<void(int, const RequestVoteResponse&)> vote_response_handler;
-    std::function<void(int, const AppendEntriesRequest&)> append_entries_handler;
-    std::function<void(int, const AppendEntriesResponse&)> append_response_handler;
-    std::function<void(int, const ClientRequest&)> client_request_handler;
-    std::function<void(int, const ClientResponse&)> client_response_handler;
-
-public:
-    struct NodeConfig {
-        sockaddr_in address;
-        int id;
+    int self_slot;
+    std::vector<int> peer_slots;    // every slot but our own
+    WireFormat format;
+    EventLoop event_loop;
+    std::unique_ptr<Transport> transport;
+
+    // Every message starts with a 6-byte message tag ("VTEREQ", ...)
+    // followed by the sender's node id and the Raft group it is for, both
+    // little-endian u32s
+    static constexpr size_t TAG_SIZE = 6;
+    static constexpr size_t HEADER_SIZE = TAG_SIZE + 2 * sizeof(uint32_t);
+
+    // Handlers receive the sender's peer slot
+    struct Handlers {
+        std::function<void(int, const RequestVoteRequest&)> vote_request;
+        std::function<void(int, const RequestVoteResponse&)> vote_response;
+        std::function<void(int, const AppendEntriesView&)> append_entries;
+        std::function<void(int, const AppendEntriesResponse&)> append_response;
+        std::function<void(int, const InstallSnapshotRequest&)> snapshot_request;
+        std::function<void(int, const InstallSnapshotResponse&)> snapshot_response;
+        std::function<void(int, const ReadIndexRequest&)> read_index_request;
+        std::function<void(int, const ReadIndexResponse&)> read_index_response;
+        std::function<void(int, const ClientRequest&)> client_request;
+        std::function<void(int, const ClientResponse&)> client_response;
     };
+    std::vector<Handlers> groups{1};    // by group id; messages for unknown groups are dropped
 
-    std::unordered_map<int, NodeConfig> nodes;
+    // Coalescing: messages sent on the loop thread wait in a per-peer
+    // outbox until the end of the tick, then go out as one BUNDLE of
+    // length-prefixed messages (or alone, if there is just one)
+    bool coalescing = false;
+    std::vector<std::vector<char>> outboxes;    // by slot; HEADER_SIZE bytes reserved up front
+    std::vector<size_t> outbox_counts;
+    bool flush_scheduled = false;
 
-    NetworkManager(int node_id, int base_port = 5000) : 
-        node_id(node_id), base_port(base_port), running(false) {
-        
-        if (node_id < 0 || node_id > 2) {
-            throw std::runtime_error("Invalid node ID (0-2 allowed)");
-        }
+    std::atomic<bool> isolated{false};
 
-        // Create and configure UDP socket
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd < 0) {
-            throw std::runtime_error("Socket creation failed");
-        }
+    Handlers& handlers(uint32_t group) {
+        if (group >= groups.size()) groups.resize(group + 1);
+        return groups[group];
+    }
 
-        // Configure all nodes
-        for (int i = 0; i < 3; i++) {
-            NodeConfig cfg;
-            cfg.id = i;
-            cfg.address.sin_family = AF_INET;
-            cfg.address.sin_port = htons(base_port + i);
-            inet_pton(AF_INET, "127.0.0.1", &cfg.address.sin_addr);
-            nodes[i] = cfg;
+public:
+    NetworkManager(ClusterConfig config, int node_id, WireFormat format = WireFormat::BINARY,
+                   TransportKind kind = TransportKind::UDP) :
+        cluster(std::move(config)), node_id(node_id), format(format) {
+
+        self_slot = cluster.slot_of(node_id);
+        if (self_slot < 0) {
+            throw std::runtime_error("Node ID " + std::to_string(node_id) +
+                                     " is not a cluster member");
         }
-
-        // Bind to configured port
-        sockaddr_in servaddr{};
-        servaddr.sin_family = AF_INET;
-        servaddr.sin_port = nodes[node_id].address.sin_port;
-        servaddr.sin_addr.s_addr = nodes[node_id].address.sin_addr.s_addr;
-
-        if (bind(sockfd, (sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
-            close(sockfd);
-            throw std::runtime_error("Bind failed");
+        for (int slot = 0; slot < static_cast<int>(cluster.size()); slot++) {
+            if (slot != self_slot) peer_slots.push_back(slot);
         }
 
-        // Set receive timeout
-        timeval tv{.tv_sec = 1, .tv_usec = 0};
-        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        transport = make_transport(kind, cluster, self_slot);
     }
 
+    // Three local nodes on 127.0.0.1, ports base_port..base_port+2
+    NetworkManager(int node_id, int base_port = 5000, WireFormat format = WireFormat::BINARY,
+                   TransportKind kind = TransportKind::UDP) :
+        NetworkManager(ClusterConfig::local(3, base_port), node_id, format, kind) {}
+
     ~NetworkManager() {
         stop();
-        close(sockfd);
     }
 
+    // Handlers and timers all run on the event loop thread
     void start() {
-        running = true;
-        receiver_thread = std::thread([this] { receiver_loop(); });
+        transport->start(event_loop, [this](const char* data, size_t len) {
+            dispatch(data, len);
+        });
+        event_loop.start();
     }
 
     void stop() {
-        running = false;
-        if (receiver_thread.joinable()) {
-            receiver_thread.join();
-        }
+        event_loop.stop();
+        transport->stop();
     }
 
+    EventLoop& loop() { return event_loop; }
+
+    const ClusterConfig& config() const { return cluster; }
+    int id() const { return node_id; }
+    int slot() const { return self_slot; }
+    const std::vector<int>& peers() const { return peer_slots; }
+    int id_of(int slot) const { return cluster.id_of(slot); }
+
     // Updated message sending with better logging
-    void send_to(int node_id, const RequestVoteRequest& msg) {
-        std::string data = "VTEREQ" + msg.serialize();
-        send_raw(node_id, data);
-        std::cout << "Node " << this->node_id << " -> Node " << node_id 
-                  << " | VoteRequest: term=" << msg.term << "\n";
+    void send_to(int slot, const RequestVoteRequest& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | VoteRequest: term=" << msg.term);
+    }
+
+    void send_to(int slot, const RequestVoteResponse& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | VoteResponse: granted=" << msg.vote_granted);
+    }
+
+    void send_to(int slot, const AppendEntriesRequest& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | AppendEntries: entries=" << msg.entries.size());
+    }
+
+    void send_to(int slot, const AppendEntriesBatch& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | AppendEntries: entries=" << msg.entries.size());
+    }
+
+    void send_to(int slot, const AppendEntriesResponse& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | AppendResponse: success=" << msg.success);
+    }
+
+    void send_to(int slot, const InstallSnapshotRequest& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot)
+                  << " | InstallSnapshot: offset=" << msg.offset << " bytes=" << msg.data.size());
+    }
+
+    void send_to(int slot, const InstallSnapshotResponse& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot)
+                  << " | SnapshotResponse: next_offset=" << msg.next_offset);
+    }
+
+    void send_to(int slot, const ReadIndexRequest& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot)
+                  << " | ReadIndex: batch=" << msg.batch);
     }
 
-    void send_to(int node_id, const RequestVoteResponse& msg) {
-        std::string data = "VTERES" + msg.serialize();
-        send_raw(node_id, data);
-        std::cout << "Node " << this->node_id << " -> Node " << node_id 
-                  << " | VoteResponse: granted=" << msg.vote_granted << "\n";
+    void send_to(int slot, const ReadIndexResponse& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot)
+                  << " | ReadIndexResponse: read_index=" << msg.read_index);
     }
 
-    void send_to(int node_id, const AppendEntriesRequest& msg) {
-        std::string data = "APPREQ" + msg.serialize();
-        send_raw(node_id, data);
-        std::cout << "Node " << this->node_id << " -> Node " << node_id 
-                  << " | AppendEntries: entries=" << msg.entries.size() << "\n";
+    void send_to(int slot, const ClientRequest& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | ClientRequest: " << msg.key << "=" << msg.value);
     }
 
-    void send_to(int node_id, const AppendEntriesResponse& msg) {
-        std::string data = "APPRES" + msg.serialize();
-        send_raw(node_id, data);
-        std::cout << "Node " << this->node_id << " -> Node " << node_id 
-                  << " | AppendResponse: success=" << msg.success << "\n";
+    void send_to(int slot, const ClientResponse& msg, uint32_t group = 0) {
+        send_message(slot, msg, group);
+        LOG_TRACE("Node " << node_id << " -> Node " << cluster.id_of(slot) 
+                  << " | ClientResponse: " << (msg.success ? "OK" : "ERROR"));
+    }
+
+    // Send one message to several peer slots; encoded once, sent with one
+    // sendmmsg() (or added to each peer's outbox when coalescing)
+    template <typename T>
+    void broadcast(const std::vector<int>& peers, const T& msg, uint32_t group = 0) {
+        if (isolated) return;
+        std::string_view data = encode(msg, group);
+        if (coalescing && event_loop.in_loop_thread()) {
+            // Bytes are counted when the outboxes go out
+            for (int slot : peers) enqueue(slot, data.data(), data.size());
+        } else {
+            transport->send_many(peers, data.data(), data.size());
+            net_metrics().sent_bytes.add(data.size() * peers.size());
+        }
+        type_metrics<T>().sent.add(peers.size());
+        LOG_TRACE("Node " << node_id << " -> " << peers.size() << " peers | "
+                  << MessageTag<T>::value << " broadcast");
     }
 
-    void send_to(int node_id, const ClientRequest& msg) {
-        std::string data = "CLIREQ" + msg.serialize();
-        send_raw(node_id, data);
-        std::cout << "Node " << this->node_id << " -> Node " << node_id 
-                  << " | ClientRequest: " << msg.key << "=" << msg.value << "\n";
+    // Drop everything sent and received, as if the node were partitioned
+    // away; for tests
+    void set_isolated(bool on) { isolated = on; }
+
+    // Syscall batching for transports that support it; set before start()
+    void set_batch_depth(size_t depth) { transport->set_batch_depth(depth); }
+    size_t get_batch_depth() const { return transport->get_batch_depth(); }
+
+    // Largest encoded message (header included) the transport can carry
+    size_t max_message_size() const { return transport->max_message_size(); }
+
+    // Coalesce messages to the same peer within a tick (heartbeats of many
+    // Raft groups, say) into one transport message; set before start().
+    // Receivers always accept bundles.
+    void set_coalescing(bool on) {
+        coalescing = on;
+        outboxes.assign(cluster.size(), std::vector<char>(HEADER_SIZE));
+        outbox_counts.assign(cluster.size(), 0);
     }
 
-    void send_to(int node_id, const ClientResponse& msg) {
-        std::string data = "CLIRES" + msg.serialize();
-        send_raw(node_id, data);
-        std::cout << "Node " << this->node_id << " -> Node " << node_id 
-                  << " | ClientResponse: " << (msg.success ? "OK" : "ERROR") << "\n";
+    bool coalesced() const { return coalescing; }
+
+    // Sends every outbox now instead of at the end of the tick; loop
+    // thread only
+    void flush() {
+        for (size_t slot = 0; slot < outboxes.size(); slot++) flush_outbox(static_cast<int>(slot));
     }
 
-    // Updated handler registration with sender_id parameter
-    void set_on_request_vote(std::function<void(int, const RequestVoteRequest&)> handler) {
-        vote_request_handler = handler;
+    // All nodes of a cluster must agree on the format; receivers accept both
+    void set_wire_format(WireFormat f) { format = f; }
+    WireFormat wire_format() const { return format; }
+
+    // Handlers are called with the sender's peer slot; each Raft group
+    // registers its own
+    void set_on_request_vote(std::function<void(int, const RequestVoteRequest&)> handler, uint32_t group = 0) {
+        handlers(group).vote_request = handler;
     }
 
-    void set_on_vote_reply(std::function<void(int, const RequestVoteResponse&)> handler) {
-        vote_response_handler = handler;
+    void set_on_vote_reply(std::function<void(int, const RequestVoteResponse&)> handler, uint32_t group = 0) {
+        handlers(group).vote_response = handler;
     }
 
-    void set_on_append_entries(std::function<void(int, const AppendEntriesRequest&)> handler) {
-        append_entries_handler = handler;
+    void set_on_append_entries(std::function<void(int, const AppendEntriesView&)> handler, uint32_t group = 0) {
+        handlers(group).append_entries = handler;
     }
 
-    void set_on_append_reply(std::function<void(int, const AppendEntriesResponse&)> handler) {
-        append_response_handler = handler;
+    void set_on_append_reply(std::function<void(int, const AppendEntriesResponse&)> handler, uint32_t group = 0) {
+        handlers(group).append_response = handler;
     }
 
-    void set_on_client_request(std::function<void(int, const ClientRequest&)> handler) {
-        client_request_handler = handler;
+    void set_on_install_snapshot(std::function<void(int, const InstallSnapshotRequest&)> handler, uint32_t group = 0) {
+        handlers(group).snapshot_request = handler;
     }
 
-    void set_on_client_response(std::function<void(int, const ClientResponse&)> handler) {
-        client_response_handler = handler;
+    void set_on_snapshot_reply(std::function<void(int, const InstallSnapshotResponse&)> handler, uint32_t group = 0) {
+        handlers(group).snapshot_response = handler;
+    }
+
+    void set_on_read_index(std::function<void(int, const ReadIndexRequest&)> handler, uint32_t group = 0) {
+        handlers(group).read_index_request = handler;
+    }
+
+    void set_on_read_index_reply(std::function<void(int, const ReadIndexResponse&)> handler, uint32_t group = 0) {
+        handlers(group).read_index_response = handler;
+    }
+
+    void set_on_client_request(std::function<void(int, const ClientRequest&)> handler, uint32_t group = 0) {
+        handlers(group).client_request = handler;
+    }
+
+    void set_on_client_response(std::function<void(int, const ClientResponse&)> handler, uint32_t group = 0) {
+        handlers(group).client_response = handler;
     }
 
 private:
-    void send_raw(int node_id, const std::string& data) {
-        const auto& dest = nodes.at(node_id).address;
-        sendto(sockfd, data.c_str(), data.size(), 0,
-              (sockaddr*)&dest, sizeof(dest));
+    //--------------------------------------------------
+    // Metrics
+    //--------------------------------------------------
+    // Per message type, named by tag: net.sent.APPREQ and so on. Handler
+    // time covers decode to return, so it includes the Raft work a message
+    // triggers.
+    struct TypeMetrics {
+        Counter& sent;
+        Counter& received;
+        Histogram& handle_ns;
+    };
+
+    template <typename T>
+    static TypeMetrics& type_metrics() {
+        static TypeMetrics m{
+            Metrics::instance().counter(std::string("net.sent.") + MessageTag<T>::value),
+            Metrics::instance().counter(std::string("net.received.") + MessageTag<T>::value),
+            Metrics::instance().histogram(std::string("net.handle_ns.") + MessageTag<T>::value)};
+        return m;
+    }
+
+    struct NetMetrics {
+        Metrics& r = Metrics::instance();
+        Counter& sent_bytes = r.counter("net.sent_bytes");
+        Counter& received_bytes = r.counter("net.received_bytes");
+        Counter& dropped = r.counter("net.dropped");            // unknown sender or tag
+        Counter& errors = r.counter("net.errors");             // decode or handler threw
+        Counter& json_encoded = r.counter("codec.json.encoded");
+        Counter& binary_encoded = r.counter("codec.binary.encoded");
+        Counter& json_decoded = r.counter("codec.json.decoded");
+        Counter& binary_decoded = r.counter("codec.binary.decoded");
+        Counter& decode_errors = r.counter("codec.decode_errors");
+        Counter& bundles = r.counter("net.bundles");           // coalesced sends
+        Counter& bundled = r.counter("net.bundled");           // messages they carried
+    };
+
+    static NetMetrics& net_metrics() {
+        static NetMetrics m;
+        return m;
+    }
+
+    // Counts a decoded message; decode failures are counted and rethrown
+    template <typename T, typename Decode>
+    static auto decode_counted(const char* payload, size_t len, Decode&& decode) {
+        NetMetrics& m = net_metrics();
+        bool json = len > 0 && payload[0] == '{';
+        try {
+            auto msg = decode();
+            (json ? m.json_decoded : m.binary_decoded).add();
+            type_metrics<T>().received.add();
+            return msg;
+        } catch (...) {
+            m.decode_errors.add();
+            throw;
+        }
+    }
+
+    template <typename T, typename Handler, typename Msg>
+    static void handle(const Handler& handler, int sender, const Msg& msg) {
+        if (!handler) return;
+        auto start = std::chrono::steady_clock::now();
+        handler(sender, msg);
+        type_metrics<T>().handle_ns.record_since(start);
     }
 
-    void receiver_loop() {
-        char buffer[4096];
-        sockaddr_in cliaddr;
-        socklen_t len = sizeof(cliaddr);
+    // Encode header + payload into a per-thread scratch buffer, valid until
+    // the thread's next encode
+    template <typename T>
+    std::string_view encode(const T& msg, uint32_t group) {
+        thread_local std::vector<char> buffer;
+        std::string json;
+        size_t len;
+        if (format == WireFormat::JSON) {
+            json = msg.serialize();
+            len = HEADER_SIZE + json.size();
+        } else {
+            len = HEADER_SIZE + wire_encoded_size(msg);
+        }
+        if (buffer.size() < len) {
+            buffer.resize(len);
+        }
 
-        while (running) {
-            ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer), 0,
-                                (sockaddr*)&cliaddr, &len);
-            if (n <= 0) continue;
+        write_header(buffer.data(), MessageTag<T>::value, group);
 
-            // Extract sender information
-            int sender_port = ntohs(cliaddr.sin_port);
-            int sender_id = sender_port - base_port;
+        if (format == WireFormat::JSON) {
+            std::memcpy(buffer.data() + HEADER_SIZE, json.data(), json.size());
+            net_metrics().json_encoded.add();
+        } else {
+            wire_encode(msg, buffer.data() + HEADER_SIZE, buffer.size() - HEADER_SIZE);
+            net_metrics().binary_encoded.add();
+        }
+        return std::string_view(buffer.data(), len);
+    }
 
-            if (sender_id < 0 || sender_id > 2) {
-                std::cerr << "Received message from invalid node: " << sender_port << "\n";
-                continue;
+    void write_header(char* out, const char* tag, uint32_t group) const {
+        std::memcpy(out, tag, TAG_SIZE);
+        WireWriter header(out + TAG_SIZE, 2 * sizeof(uint32_t));
+        header.put_u32(static_cast<uint32_t>(node_id));
+        header.put_u32(group);
+    }
+
+    template <typename T>
+    void send_message(int slot, const T& msg, uint32_t group) {
+        if (isolated) return;
+        std::string_view data = encode(msg, group);
+        if (coalescing && event_loop.in_loop_thread()) {
+            enqueue(slot, data.data(), data.size());
+        } else {
+            transport->send(slot, data.data(), data.size());
+            net_metrics().sent_bytes.add(data.size());
+        }
+        type_metrics<T>().sent.add();
+    }
+
+    // Adds a message to the peer's outbox, sending what is there first if
+    // the bundle would outgrow the transport
+    void enqueue(int slot, const char* data, size_t len) {
+        std::vector<char>& box = outboxes[slot];
+        size_t limit = transport->max_message_size();
+        if (box.size() + sizeof(uint32_t) + len > limit) {
+            flush_outbox(slot);
+            if (HEADER_SIZE + sizeof(uint32_t) + len > limit) {
+                transport->send(slot, data, len);
+                net_metrics().sent_bytes.add(len);
+                return;
             }
+        }
+        size_t at = box.size();
+        box.resize(at + sizeof(uint32_t) + len);
+        WireWriter(box.data() + at, sizeof(uint32_t)).put_u32(static_cast<uint32_t>(len));
+        std::memcpy(box.data() + at + sizeof(uint32_t), data, len);
+        outbox_counts[slot]++;
+        if (!flush_scheduled) {
+            flush_scheduled = true;
+            event_loop.defer([this] {
+                flush_scheduled = false;
+                flush();
+            });
+        }
+    }
 
-            std::string data(buffer, n);
-            if (data.size() < 6) continue;
+    void flush_outbox(int slot) {
+        std::vector<char>& box = outboxes[slot];
+        size_t count = outbox_counts[slot];
+        if (count == 0) return;
+        NetMetrics& m = net_metrics();
+        if (count == 1) {
+            const char* data = box.data() + HEADER_SIZE + sizeof(uint32_t);
+            size_t len = box.size() - HEADER_SIZE - sizeof(uint32_t);
+            transport->send(slot, data, len);
+            m.sent_bytes.add(len);
+        } else {
+            write_header(box.data(), "BUNDLE", 0);
+            transport->send(slot, box.data(), box.size());
+            m.sent_bytes.add(box.size());
+            m.bundles.add();
+            m.bundled.add(count);
+        }
+        box.resize(HEADER_SIZE);
+        outbox_counts[slot] = 0;
+    }
+
+    // JSON payloads always start with '{', binary ones with WIRE_VERSION
+    template <typename T>
+    static T decode_payload(const char* payload, size_t len) {
+        return decode_counted<T>(payload, len, [&] {
+            if (len > 0 && payload[0] == '{') {
+                return T::deserialize(std::string(payload, len));
+            }
+            return wire_decode<T>(payload, len);
+        });
+    }
 
-            std::string header = data.substr(0, 6);
-            std::string payload = data.substr(6);
+    // Called on the event loop thread for every inbound message
+    void dispatch(const char* buffer, size_t n, bool bundled = false) {
+        NetMetrics& m = net_metrics();
+        if (isolated) return;
+        if (n < HEADER_SIZE) {
+            m.dropped.add();
+            return;
+        }
+        if (!bundled) m.received_bytes.add(n);
+
+        // Header and payload are views into the receive buffer
+        std::string_view header(buffer, TAG_SIZE);
+        WireReader ids(buffer + TAG_SIZE, 2 * sizeof(uint32_t));
+        int sender_id = static_cast<int>(ids.get_u32());
+        uint32_t group = ids.get_u32();
+        int sender = cluster.slot_of(sender_id);
+        if (sender < 0) {
+            LOG_WARN("Received message from invalid node: " << sender_id);
+            m.dropped.add();
+            return;
+        }
+        const char* payload = buffer + HEADER_SIZE;
+        size_t payload_len = n - HEADER_SIZE;
 
+        if (header == "BUNDLE" && !bundled) {
+            // Each part is a whole message, header included
+            WireReader parts(payload, payload_len);
             try {
-                if (header == "VTEREQ") {
-                    auto msg = RequestVoteRequest::deserialize(payload);
-                    std::cout << "Node " << node_id << " <- Node " << sender_id 
-                              << " | VoteRequest: term=" << msg.term << "\n";
-                    if (vote_request_handler) vote_request_handler(sender_id, msg);
-                }
-                else if (header == "VTERES") {
-                    auto msg = RequestVoteResponse::deserialize(payload);
-                    std::cout << "Node " << node_id << " <- Node " << sender_id 
-                              << " | VoteResponse: granted=" << msg.vote_granted << "\n";
-                    if (vote_response_handler) vote_response_handler(sender_id, msg);
-                }
-                else if (header == "APPREQ") {
-                    auto msg = AppendEntriesRequest::deserialize(payload);
-                    std::cout << "Node " << node_id << " <- Node " << sender_id 
-                              << " | AppendEntries: entries=" << msg.entries.size() << "\n";
-                    if (append_entries_handler) append_entries_handler(sender_id, msg);
-                }
-                else if (header == "APPRES") {
-                    auto msg = AppendEntriesResponse::deserialize(payload);
-                    std::cout << "Node " << node_id << " <- Node " << sender_id 
-                              << " | AppendResponse: success=" << msg.success << "\n";
-                    if (append_response_handler) append_response_handler(sender_id, msg);
-                }
-                else if (header == "CLIREQ") {
-                    auto msg = ClientRequest::deserialize(payload);
-                    std::cout << "Node " << node_id << " <- Node " << sender_id 
-                              << " | ClientRequest: " << msg.key << "=" << msg.value << "\n";
-                    if (client_request_handler) client_request_handler(sender_id, msg);
-                }
-                else if (header == "CLIRES") {
-                    auto msg = ClientResponse::deserialize(payload);
-                    std::cout << "Node " << node_id << " <- Node " << sender_id 
-                              << " | ClientResponse: " << (msg.success ? "OK" : "ERROR") << "\n";
-                    if (client_response_handler) client_response_handler(sender_id, msg);
+                while (parts.remaining() > 0) {
+                    std::string_view part = parts.get_string();
+                    dispatch(part.data(), part.size(), true);
                 }
             } catch (const std::exception& e) {
-                std::cerr << "Message processing error: " << e.what() << "\n";
+                m.errors.add();
+                LOG_WARN("Malformed bundle: " << e.what());
             }
+            return;
+        }
+        if (group >= groups.size()) {
+            m.dropped.add();
+            return;
+        }
+        const Handlers& h = groups[group];
+
+        try {
+            if (header == "VTEREQ") {
+                auto msg = decode_payload<RequestVoteRequest>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id 
+                          << " | VoteRequest: term=" << msg.term);
+                handle<RequestVoteRequest>(h.vote_request, sender, msg);
+            }
+            else if (header == "VTERES") {
+                auto msg = decode_payload<RequestVoteResponse>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id 
+                          << " | VoteResponse: granted=" << msg.vote_granted);
+                handle<RequestVoteResponse>(h.vote_response, sender, msg);
+            }
+            else if (header == "APPREQ") {
+                // Binary entries are handed out as views into the receive buffer
+                AppendEntriesRequest owned;
+                AppendEntriesView msg = decode_counted<AppendEntriesRequest>(payload, payload_len, [&] {
+                    if (payload_len > 0 && payload[0] == '{') {
+                        owned = AppendEntriesRequest::deserialize(std::string(payload, payload_len));
+                        return AppendEntriesView::of(owned);
+                    }
+                    return AppendEntriesView::decode(payload, payload_len);
+                });
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id 
+                          << " | AppendEntries: entries=" << msg.entry_count());
+                handle<AppendEntriesRequest>(h.append_entries, sender, msg);
+            }
+            else if (header == "APPRES") {
+                auto msg = decode_payload<AppendEntriesResponse>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id 
+                          << " | AppendResponse: success=" << msg.success);
+                handle<AppendEntriesResponse>(h.append_response, sender, msg);
+            }
+            else if (header == "SNPREQ") {
+                auto msg = decode_payload<InstallSnapshotRequest>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id
+                          << " | InstallSnapshot: offset=" << msg.offset);
+                handle<InstallSnapshotRequest>(h.snapshot_request, sender, msg);
+            }
+            else if (header == "SNPRES") {
+                auto msg = decode_payload<InstallSnapshotResponse>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id
+                          << " | SnapshotResponse: next_offset=" << msg.next_offset);
+                handle<InstallSnapshotResponse>(h.snapshot_response, sender, msg);
+            }
+            else if (header == "RIXREQ") {
+                auto msg = decode_payload<ReadIndexRequest>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id
+                          << " | ReadIndex: batch=" << msg.batch);
+                handle<ReadIndexRequest>(h.read_index_request, sender, msg);
+            }
+            else if (header == "RIXRES") {
+                auto msg = decode_payload<ReadIndexResponse>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id
+                          << " | ReadIndexResponse: read_index=" << msg.read_index);
+                handle<ReadIndexResponse>(h.read_index_response, sender, msg);
+            }
+            else if (header == "CLIREQ") {
+                auto msg = decode_payload<ClientRequest>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id 
+                          << " | ClientRequest: " << msg.key << "=" << msg.value);
+                handle<ClientRequest>(h.client_request, sender, msg);
+            }
+            else if (header == "CLIRES") {
+                auto msg = decode_payload<ClientResponse>(payload, payload_len);
+                LOG_TRACE("Node " << node_id << " <- Node " << sender_id 
+                          << " | ClientResponse: " << (msg.success ? "OK" : "ERROR"));
+                handle<ClientResponse>(h.client_response, sender, msg);
+            }
+            else {
+                m.dropped.add();
+            }
+        } catch (const std::exception& e) {
+            m.errors.add();
+            LOG_WARN("Message processing error: " << e.what());
         }
     }
-};
\ No newline at end of file
+};
+
+//--------------------------------------------------
+// Group Channel
+//--------------------------------------------------
+// One Raft group's view of a shared NetworkManager: the same calls, with
+// the group id stamped on everything sent and handlers registered for that
+// group alone. Group 0 is what a lone RaftNode uses.
+class GroupChannel {
+    NetworkManager* network;
+    uint32_t group_id;
+
+public:
+    GroupChannel(NetworkManager& network, uint32_t group) : network(&network), group_id(group) {}
+
+    uint32_t group() const { return group_id; }
+    NetworkManager& manager() { return *network; }
+
+    EventLoop& loop() { return network->loop(); }
+    const ClusterConfig& config() const { return network->config(); }
+    int id() const { return network->id(); }
+    int slot() const { return network->slot(); }
+    const std::vector<int>& peers() const { return network->peers(); }
+    int id_of(int slot) const { return network->id_of(slot); }
+    size_t max_message_size() const { return network->max_message_size(); }
+    void flush() { network->flush(); }
+
+    template <typename T>
+    void send_to(int slot, const T& msg) { network->send_to(slot, msg, group_id); }
+
+    template <typename T>
+    void broadcast(const std::vector<int>& peers, const T& msg) { network->broadcast(peers, msg, group_id); }
+
+    template <typename F> void set_on_request_vote(F&& f) { network->set_on_request_vote(f, group_id); }
+    template <typename F> void set_on_vote_reply(F&& f) { network->set_on_vote_reply(f, group_id); }
+    template <typename F> void set_on_append_entries(F&& f) { network->set_on_append_entries(f, group_id); }
+    template <typename F> void set_on_append_reply(F&& f) { network->set_on_append_reply(f, group_id); }
+    template <typename F> void set_on_install_snapshot(F&& f) { network->set_on_install_snapshot(f, group_id); }
+    template <typename F> void set_on_snapshot_reply(F&& f) { network->set_on_snapshot_reply(f, group_id); }
+    template <typename F> void set_on_read_index(F&& f) { network->set_on_read_index(f, group_id); }
+    template <typename F> void set_on_read_index_reply(F&& f) { network->set_on_read_index_reply(f, group_id); }
+    template <typename F> void set_on_client_request(F&& f) { network->set_on_client_request(f, group_id); }
+    template <typename F> void set_on_client_response(F&& f) { network->set_on_client_response(f, group_id); }
+};
@@ -0,0 +1,314 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "buffer_pool.cpp"
+
+//--------------------------------------------------
+// Slotted Page
+//--------------------------------------------------
+// Variable-length records in one PAGE_SIZE page:
+//   u32 crc | u16 slots | u16 free_end | 8 reserved | slot array ... free ... records
+// Slot i is {u16 offset, u16 length}; records are packed from the end of
+// the page down, in slot order, so free_end is where the last one starts.
+// All fields little-endian.
+namespace slotted_page {
+    constexpr size_t HEADER = 16;
+    constexpr size_t SLOT = 4;
+
+    inline uint16_t get_u16(const char* p) {
+        uint16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return wire::to_le(v);
+    }
+
+    inline void put_u16(char* p, uint16_t v) {
+        v = wire::to_le(v);
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    // A zeroed page is an empty one
+    inline uint16_t slot_count(const char* page) { return get_u16(page + 4); }
+    inline uint16_t free_end(const char* page) {
+        uint16_t end = get_u16(page + 6);
+        return end == 0 ? static_cast<uint16_t>(PAGE_SIZE) : end;
+    }
+
+    inline size_t free_space(const char* page) {
+        size_t used = HEADER + SLOT * slot_count(page);
+        size_t end = free_end(page);
+        return end > used + SLOT ? end - used - SLOT : 0;
+    }
+
+    inline std::string_view record(const char* page, uint16_t slot) {
+        const char* s = page + HEADER + SLOT * slot;
+        return std::string_view(page + get_u16(s), get_u16(s + 2));
+    }
+
+    // Room for a `length`-byte record (its slot included)?
+    inline bool fits(const char* page, size_t length) { return length <= free_space(page); }
+
+    // Appends the record; check fits() first. Returns its slot.
+    inline uint16_t append(char* page, const char* data, size_t length) {
+        uint16_t slot = slot_count(page);
+        uint16_t offset = static_cast<uint16_t>(free_end(page) - length);
+        std::memcpy(page + offset, data, length);
+        char* s = page + HEADER + SLOT * slot;
+        put_u16(s, offset);
+        put_u16(s + 2, static_cast<uint16_t>(length));
+        put_u16(page + 4, static_cast<uint16_t>(slot + 1));
+        put_u16(page + 6, offset);
+        return slot;
+    }
+
+    // Drops slots from `count` on
+    inline void truncate(char* page, uint16_t count) {
+        if (count >= slot_count(page)) return;
+        uint16_t end = count == 0 ? static_cast<uint16_t>(PAGE_SIZE) : get_u16(page + HEADER + SLOT * (count - 1));
+        put_u16(page + 4, count);
+        put_u16(page + 6, end);
+    }
+}
+
+//--------------------------------------------------
+// Paged Table
+//--------------------------------------------------
+// BuzzDB rows (key, value, score, tag) in slotted pages of a file, read and
+// written through a BufferPool, so the table can be far larger than the
+// pool. A record is
+//   i32 key | i32 value | f32 score | tag bytes
+// Page 0 is the table header:
+//   u32 crc | u32 magic | u32 pages | u32 last_page | u32 last_slots | u64 rows
+// Rows are appended to the last page; a full one gets a successor.
+//
+// flush() is the durability point: it writes every dirty page and syncs,
+// then writes and syncs the header. Reopening the file restores the table
+// as of the last flush(); pages written after it (by eviction) are dropped.
+// A page is never written again once a flush() covers it: the rows after a
+// flush, or a reopen, start a fresh page, so a torn eviction can only hit
+// pages the header doesn't count. The header's fields fit in its first
+// sector and the rest of the page stays zero, so a torn header write leaves
+// the old header or the new one. Page checksums catch any other damage.
+//
+// Inserts take turns on one mutex and latch only the last page, so scans
+// run alongside them and see a prefix of the rows.
+class PagedTable {
+public:
+    static constexpr uint32_t MAGIC = 0x42445A50;     // "PZDB"
+    static constexpr size_t RECORD_FIXED = 12;
+    static constexpr size_t MAX_TAG = PAGE_SIZE - slotted_page::HEADER - slotted_page::SLOT - RECORD_FIXED;
+    static constexpr size_t READ_AHEAD_PAGES = 32;
+
+    // Upper bound on rows in one page, for callers' buffers
+    static constexpr size_t MAX_PAGE_ROWS = (PAGE_SIZE - slotted_page::HEADER) / (slotted_page::SLOT + RECORD_FIXED);
+
+private:
+    PageFile file;
+    BufferPool pool;
+    std::mutex append_mutex;
+    std::atomic<PageId> pages{1};       // header included
+    std::atomic<PageId> last_page{INVALID_PAGE};
+    std::atomic<uint64_t> row_count{0};
+    bool last_flushed = true;           // append mutex held: last_page is covered by the header
+
+    static uint32_t get_u32(const char* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return wire::to_le(v);
+    }
+
+    static void put_u32(char* p, uint32_t v) {
+        v = wire::to_le(v);
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    static size_t encode(char* out, int32_t key, int32_t value, float score, std::string_view tag) {
+        uint32_t bits;
+        std::memcpy(&bits, &score, sizeof(bits));
+        put_u32(out, static_cast<uint32_t>(key));
+        put_u32(out + 4, static_cast<uint32_t>(value));
+        put_u32(out + 8, bits);
+        std::memcpy(out + RECORD_FIXED, tag.data(), tag.size());
+        return RECORD_FIXED + tag.size();
+    }
+
+    // Append mutex held: the last page, latched exclusive, with room for
+    // `length` bytes
+    BufferPool::PageGuard page_for(size_t length) {
+        if (last_page != INVALID_PAGE && !last_flushed) {
+            BufferPool::PageGuard page = pool.fetch(last_page, true);
+            if (slotted_page::fits(page.data(), length)) return page;
+        }
+        BufferPool::PageGuard page = pool.create();
+        last_flushed = false;
+        last_page = page.id();
+        pages = page.id() + 1;
+        return page;
+    }
+
+    void read_header() {
+        BufferPool::PageGuard header = pool.fetch(0);
+        const char* h = header.data();
+        if (get_u32(h + 4) != MAGIC) {
+            throw std::runtime_error(file.name() + " is not a BuzzDB table");
+        }
+        pages = get_u32(h + 8);
+        last_page = get_u32(h + 12);
+        uint16_t last_slots = static_cast<uint16_t>(get_u32(h + 16));
+        uint64_t rows;
+        std::memcpy(&rows, h + 20, sizeof(rows));
+        row_count = wire::to_le(rows);
+        header.reset();
+
+        // Forget what was written after the last flush
+        if (file.page_count() > pages) file.truncate(pages);
+        if (last_page != INVALID_PAGE) {
+            BufferPool::PageGuard last = pool.fetch(last_page, true);
+            if (slotted_page::slot_count(last.data()) > last_slots) {
+                slotted_page::truncate(last.mutable_data(), last_slots);
+            }
+        }
+    }
+
+    void write_header() {
+        uint16_t last_slots = 0;
+        if (last_page != INVALID_PAGE) {
+            last_slots = slotted_page::slot_count(pool.fetch(last_page).data());
+        }
+        BufferPool::PageGuard header = pool.fetch(0, true);
+        char* h = header.mutable_data();
+        put_u32(h + 4, MAGIC);
+        put_u32(h + 8, pages);
+        put_u32(h + 12, last_page);
+        put_u32(h + 16, last_slots);
+        uint64_t rows = wire::to_le(static_cast<uint64_t>(row_count));
+        std::memcpy(h + 20, &rows, sizeof(rows));
+    }
+
+    // fn(page) for data pages [first, end), shared latched, reading ahead
+    template <typename F>
+    void for_each_page(PageId first, PageId end, F&& fn) {
+        for (PageId id = first; id < end; id++) {
+            if ((id - first) % READ_AHEAD_PAGES == 0) pool.read_ahead(id, READ_AHEAD_PAGES);
+            BufferPool::PageGuard page = pool.fetch(id);
+            fn(page.data());
+        }
+    }
+
+public:
+    // Opens the table in `path`, or creates it, caching `pool_pages` pages
+    PagedTable(const std::string& path, size_t pool_pages) : file(path), pool(file, pool_pages) {
+        if (file.page_count() == 0) {
+            BufferPool::PageGuard header = pool.create();
+            header.reset();
+            write_header();
+            pool.flush();
+        } else {
+            read_header();
+        }
+    }
+
+    ~PagedTable() {
+        try {
+            flush();
+        } catch (const std::exception&) {
+            // Rows since the last flush() are lost, as after a crash
+        }
+    }
+
+    PagedTable(const PagedTable&) = delete;
+    PagedTable& operator=(const PagedTable&) = delete;
+
+    uint64_t rows() const { return row_count.load(std::memory_order_acquire); }
+
+    // Data pages, the header excluded
+    size_t data_pages() const { return pages.load(std::memory_order_acquire) - 1; }
+
+    BufferPool& buffer_pool() { return pool; }
+
+    void insert(int32_t key, int32_t value, float score, std::string_view tag) {
+        if (tag.size() > MAX_TAG) {
+            throw std::length_error("Tag of " + std::to_string(tag.size()) + " bytes does not fit in a page");
+        }
+        char record[PAGE_SIZE];
+        size_t length = encode(record, key, value, score, tag);
+        std::lock_guard<std::mutex> lock(append_mutex);
+        BufferPool::PageGuard page = page_for(length);
+        slotted_page::append(page.mutable_data(), record, length);
+        row_count.fetch_add(1, std::memory_order_release);
+    }
+
+    // n rows that share score and tag; each page is latched once
+    void insert_batch(const int32_t* keys, const int32_t* values, size_t n, float score, std::string_view tag) {
+        if (tag.size() > MAX_TAG) {
+            throw std::length_error("Tag of " + std::to_string(tag.size()) + " bytes does not fit in a page");
+        }
+        char record[PAGE_SIZE];
+        size_t length = RECORD_FIXED + tag.size();
+        std::lock_guard<std::mutex> lock(append_mutex);
+        size_t i = 0;
+        while (i < n) {
+            BufferPool::PageGuard page = page_for(length);
+            char* data = page.mutable_data();
+            size_t added = 0;
+            for (; i < n && slotted_page::fits(data, length); i++, added++) {
+                encode(record, keys[i], values[i], score, tag);
+                slotted_page::append(data, record, length);
+            }
+            row_count.fetch_add(added, std::memory_order_release);
+        }
+    }
+
+    // fn(key, value, score, tag) per row, in insertion order, for the first
+    // `limit` rows
+    template <typename F>
+    void scan(F&& fn, uint64_t limit = UINT64_MAX) {
+        limit = std::min(limit, rows());
+        uint64_t seen = 0;
+        for_each_page(1, pages.load(std::memory_order_acquire), [&](const char* page) {
+            uint16_t n = slotted_page::slot_count(page);
+            for (uint16_t slot = 0; slot < n && seen < limit; slot++, seen++) {
+                std::string_view r = slotted_page::record(page, slot);
+                uint32_t bits = get_u32(r.data() + 8);
+                float score;
+                std::memcpy(&score, &bits, sizeof(score));
+                fn(static_cast<int32_t>(get_u32(r.data())), static_cast<int32_t>(get_u32(r.data() + 4)), score,
+                   r.substr(RECORD_FIXED));
+            }
+        });
+    }
+
+    // fn(keys, values, n) once per page, for data pages [first, end) (0 and
+    // data_pages() for all). Pages are decoded into arrays so aggregates
+    // run over columns; several threads may scan disjoint ranges at once.
+    template <typename F>
+    void scan_columns(F&& fn, size_t first = 0, size_t end = SIZE_MAX) {
+        end = std::min(end, data_pages());
+        int32_t keys[MAX_PAGE_ROWS];
+        int32_t values[MAX_PAGE_ROWS];
+        for_each_page(static_cast<PageId>(first + 1), static_cast<PageId>(end + 1), [&](const char* page) {
+            uint16_t n = slotted_page::slot_count(page);
+            for (uint16_t slot = 0; slot < n; slot++) {
+                const char* r = slotted_page::record(page, slot).data();
+                keys[slot] = static_cast<int32_t>(get_u32(r));
+                values[slot] = static_cast<int32_t>(get_u32(r + 4));
+            }
+            if (n > 0) fn(keys, values, static_cast<size_t>(n));
+        });
+    }
+
+    // Durable up to here; see above
+    void flush() {
+        std::lock_guard<std::mutex> lock(append_mutex);
+        pool.flush();
+        write_header();
+        pool.flush();
+        last_flushed = true;
+    }
+};
@@ -0,0 +1,1446 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "network_manager.cpp"
+#include "raft_log.cpp"
+#include "session_table.cpp"
+#include "snapshot.cpp"
+#include "wal.cpp"
+
+//--------------------------------------------------
+// Raft Node
+//--------------------------------------------------
+// Leader election and log replication on top of a NetworkManager. All state
+// lives on the network's event loop thread; other threads go through the
+// thread-safe calls (campaign, submit, status).
+//
+// Write throughput comes from two knobs:
+//  - Batching: client requests are appended to the leader's log as they
+//    arrive and replication runs once at the end of the event loop tick, so
+//    every request from one receive batch shares one AppendEntries per peer
+//    (bounded by max_batch_entries / max_batch_bytes).
+//  - Pipelining: up to max_inflight AppendEntries may be outstanding per
+//    follower. next_index advances when a batch is sent, match_index when it
+//    is acked. A failed consistency check drops the pipeline and resumes at
+//    the follower's conflict_index, one request at a time until the logs
+//    agree again.
+//
+// With a data_dir the term, vote and log go to a write-ahead log. Entries
+// appended during a tick are made durable with one sync at the end of the
+// tick; a follower acks only after that sync, and the leader counts itself
+// toward a quorum only up to its durable index. Term and vote changes are
+// synced before anyone is told about them.
+//
+// Every snapshot_threshold applied entries the state machine is streamed
+// to a temporary file on the loop thread; a background thread syncs it,
+// and once it is durable the loop installs it and compacts the log (and
+// WAL) behind it, keeping a short tail for followers that are only
+// slightly behind. The state is never held in memory as a whole, but the
+// loop stalls for as long as the save handler runs. A follower whose
+// next entry is gone gets the snapshot file in chunks (InstallSnapshot),
+// pipelined like AppendEntries. Restart loads the latest snapshot and
+// replays only the WAL after it.
+//
+// Reads (GET) never touch the log. Under READ_INDEX the leader notes its
+// commit index and confirms it is still leader: every AppendEntries carries
+// the leader's heartbeat round and every response echoes it. Once a
+// majority has acked a round that began after the read arrived, the read
+// is answered as soon as the noted index is applied. Reads arriving in the
+// same tick share one round. Under LEASE each confirmed round also grants a
+// lease. It runs for lease_base_ms - lease_clock_skew_ms from the round's
+// start, and reads inside it are answered without a round. For the lease to
+// be safe, nodes refuse votes for lease_base_ms after hearing from a leader,
+// so no new leader can be elected before the lease expires. lease_base_ms
+// must be the same on every node and no longer than any node's minimum
+// election timeout.
+//
+// Followers serve reads too. A follower collects the GETs of a tick into a
+// batch and asks the leader for one read index for all of them
+// (ReadIndexRequest). The leader confirms it is still leader the same way
+// it does for its own reads and answers with the index. The follower
+// answers the batch from its own state once it has applied that far. A GET
+// with a max_lag instead accepts bounded staleness: a follower that has
+// heard from the leader within lease_base_ms, and has applied to
+// within max_lag entries of the commit index the leader sent it, answers
+// at once; so does a leader that a majority acked within lease_base_ms. Every answer reports the index it reflects.
+//
+// Writes are applied at most once per (client_id, request_id): a
+// SessionTable, updated as entries are applied and saved at the front of
+// every snapshot, skips entries whose request was applied before. The
+// leader answers a retry of an applied request from the table without
+// appending it, and a retry of one still in its log once that entry
+// applies. A skipped entry's client is told what the table found: a
+// duplicate succeeds, an expired request fails. Request id 0 opts out.
+//
+// Metrics (raft.*, see metrics.cpp) are shared by every node in the
+// process: commit_ns runs from propose to the client's answer at the
+// leader, read_ns from a GET's arrival to its answer.
+//
+// A node belongs to one Raft group (options.group, 0 by default) and talks
+// through that group's channel of the NetworkManager, so several groups
+// can share one process and network (see multi_raft.cpp). With a
+// shared_wal, the group's records go to that log, tagged with the group,
+// and data_dir holds only its snapshots.
+enum class ReadMode { READ_INDEX, LEASE };
+
+struct RaftOptions {
+    int election_timeout_min_ms = 150;
+    int election_timeout_max_ms = 300;
+    int heartbeat_interval_ms = 50;
+    size_t max_batch_entries = 512;
+    size_t max_batch_bytes = 1 << 20;   // also capped by the transport
+    int max_inflight = 8;
+    std::string data_dir;               // empty: nothing is persisted
+    size_t wal_segment_size = Wal::DEFAULT_SEGMENT_SIZE;
+    uint64_t snapshot_threshold = 100000;   // 0: never snapshot; the loop stalls while the state is written
+    uint64_t snapshot_trailing_entries = 1000;
+    size_t snapshot_chunk_bytes = 256 << 10;  // also capped by the transport
+    size_t max_apply_batch = 1024;          // entries per apply batch call
+    ReadMode read_mode = ReadMode::READ_INDEX;
+    int lease_clock_skew_ms = 30;           // LEASE: margin for clock drift
+    int lease_base_ms = 0;                  // LEASE: lease and vote refusal window; 0: election_timeout_min_ms
+    size_t max_sessions = 1 << 16;          // clients whose requests are deduplicated; at least 1
+    uint64_t session_ttl_entries = 1 << 20; // idle sessions expire after this many entries
+    uint32_t group = 0;                     // Raft group, carried in every message header
+    Wal* shared_wal = nullptr;              // log shared with other groups; needs data_dir
+    bool external_heartbeats = false;       // the host calls heartbeat() instead of a timer
+};
+
+struct RaftStatus {
+    int node_id;
+    bool leader;
+    uint64_t term;
+    int leader_id;
+    uint64_t last_index;
+    uint64_t commit_index;
+    uint64_t last_applied;
+    uint64_t snapshot_index;
+};
+
+class RaftNode {
+public:
+    // Called in log order for every committed entry. Entries with empty data
+    // are the no-ops a new leader appends and carry no command.
+    using ApplyHandler = std::function<void(uint64_t index, const LogEntry&)>;
+
+    // The same, a run of consecutive committed entries at a time:
+    // entries[i] is at index first_index + i
+    using ApplyBatchHandler =
+        std::function<void(uint64_t first_index, const LogEntry* const* entries, size_t count)>;
+
+    // Looks `key` up in the state machine as of the last applied entry;
+    // false if it is absent
+    using ReadHandler = std::function<bool(const std::string& key, std::string& value)>;
+
+    // Receives the answer to a local request, on the loop thread
+    using ResponseCallback = std::function<void(const ClientResponse&)>;
+
+private:
+    enum class Role { FOLLOWER, CANDIDATE, LEADER };
+
+    struct Peer {
+        uint64_t next_index = 1;
+        uint64_t match_index = 0;
+        int inflight = 0;
+        int idle_ticks = 0;     // heartbeats since the last response
+        bool probing = false;
+
+        // Snapshot transfer, when next_index has been compacted away
+        uint64_t snapshot_index = 0;    // snapshot being sent, 0 if none
+        uint64_t snapshot_offset = 0;   // next byte to send
+        uint64_t snapshot_acked = 0;    // bytes the follower confirmed
+
+        uint64_t sent_round = 0;        // round of the last AppendEntries sent
+        uint64_t acked_round = 0;       // highest round echoed back
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // A client waiting on its entry; slot -1 is a local proposal
+    struct Waiter {
+        uint64_t index;
+        int slot;
+        uint64_t request_id;
+        ResponseCallback done = nullptr;
+        Clock::time_point proposed{};
+        uint64_t client_id = 0;
+    };
+
+    // A GET waiting for its round to be confirmed, then for read_index to be
+    // applied. Round 0 needs no confirmation (lease and follower reads).
+    // On a follower, batch is the ReadIndex batch a forwarded read belongs
+    // to; on the leader, a nonzero batch is a follower's ReadIndexRequest
+    // and is answered with the index alone.
+    struct PendingRead {
+        uint64_t read_index;
+        uint64_t round;
+        int slot;               // -1: local, answered through done
+        uint64_t request_id;
+        std::string key;
+        ResponseCallback done;
+        uint64_t batch = 0;
+        Clock::time_point arrived{};
+    };
+
+    // Start times kept for rounds no majority has acked yet
+    static constexpr size_t MAX_OPEN_ROUNDS = 256;
+
+    // Room left in one message for entries once the header and fixed fields are in
+    static constexpr size_t APPEND_OVERHEAD = 64;
+
+    GroupChannel network;
+    RaftOptions options;
+    int node_id;
+
+    Role role = Role::FOLLOWER;
+    uint64_t current_term = 0;
+    int voted_for = -1;
+    int votes = 0;
+    int leader_id = -1;
+
+    RaftLog log;
+    std::unique_ptr<Wal> own_wal;
+    Wal* wal = nullptr;                 // own_wal or options.shared_wal
+    uint64_t durable_index = 0;
+    uint64_t commit_index = 0;
+    uint64_t last_applied = 0;
+
+    std::vector<Peer> peers;            // by slot; our own slot is unused
+    std::deque<Waiter> waiters;         // leader only, in index order
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> inflight;    // (client, request) of waiters -> index
+    std::map<uint64_t, SessionTable::Lookup> skipped;   // batch being applied: entries it skipped, and why
+    std::vector<std::pair<int, AppendEntriesResponse>> unsynced_acks;
+    bool tick_scheduled = false;
+    ApplyHandler apply_handler;
+    ApplyBatchHandler apply_batch_handler;
+    std::vector<const LogEntry*> apply_batch;   // reused across batches
+    SessionTable sessions;              // requests applied so far, per client
+
+    ReadHandler read_handler;
+    std::deque<PendingRead> reads;      // confirmed or awaiting a round, in arrival order
+    uint64_t round = 0;                 // leader: current heartbeat round
+    uint64_t confirmed_round = 0;       // highest round a majority acked
+    bool round_wanted = false;          // a read waits for a new round
+    std::deque<std::pair<uint64_t, Clock::time_point>> round_starts;   // unconfirmed rounds
+    Clock::time_point lease_expiry;     // LEASE: reads until then need no round
+    Clock::time_point leader_contact;   // last time a leader reached us
+    uint64_t term_start_index = 0;      // leader: index of our no-op
+    std::deque<PendingRead> forwarded;  // follower: waiting for the leader's read index
+    uint64_t read_batch = 1;            // follower: batch new reads join
+    bool batch_wanted = false;          // follower: read_batch must go out this tick
+    Clock::time_point batch_sent;
+    uint64_t leader_commit = 0;         // follower: highest commit index heard of
+
+    SnapshotFile::Writer save_handler;
+    SnapshotFile::Reader load_handler;
+    SnapshotMeta snapshot_meta;         // latest snapshot on disk; index 0 if none
+    std::thread snapshot_writer;        // syncs the snapshot being taken
+    bool snapshot_writing = false;
+
+    // How snapshot_writer's completion, posted to the loop, finds this node,
+    // or finds it destroyed
+    struct SnapshotLink {
+        std::mutex mutex;
+        RaftNode* node;
+        explicit SnapshotLink(RaftNode* node) : node(node) {}
+    };
+    std::shared_ptr<SnapshotLink> snapshot_link = std::make_shared<SnapshotLink>(this);
+    int snapshot_fd = -1;               // leader: open while sending chunks
+    uint64_t receiving_index = 0;       // follower: snapshot being received
+    uint64_t received_bytes = 0;
+    int receive_fd = -1;
+
+    struct RaftMetrics {
+        Metrics& r = Metrics::instance();
+        Histogram& commit_ns = r.histogram("raft.commit_ns");
+        Histogram& read_ns = r.histogram("raft.read_ns");
+        Histogram& apply_batch = r.histogram("raft.apply_batch");
+        Histogram& apply_ns = r.histogram("raft.apply_ns");
+        Histogram& waiting = r.histogram("raft.waiting");       // uncommitted proposals, per commit
+        Counter& proposed = r.counter("raft.proposed");
+        Counter& applied = r.counter("raft.applied");
+        Counter& skipped = r.counter("raft.skipped");           // duplicate or expired requests
+        Counter& elections = r.counter("raft.elections");
+        Counter& became_leader = r.counter("raft.became_leader");
+        Counter& stepped_down = r.counter("raft.stepped_down");
+    } metrics;
+
+    std::mt19937 rng;
+    EventLoop::TimerId election_timer;
+    EventLoop::TimerId heartbeat_timer;
+
+public:
+    // Registers the Raft message handlers; call before network.start()
+    RaftNode(NetworkManager& manager, RaftOptions options = RaftOptions()) :
+        network(manager, options.group), options(options), node_id(manager.id()),
+        peers(manager.config().size()),
+        sessions(options.max_sessions, options.session_ttl_entries),
+        rng(std::random_device{}() + manager.id()) {
+
+        if (options.shared_wal && options.data_dir.empty()) {
+            throw std::invalid_argument("A shared WAL needs a data_dir for the group's snapshots");
+        }
+        if (!options.data_dir.empty()) {
+            recover();
+        }
+
+        network.set_on_request_vote([this](int from, const RequestVoteRequest& req) {
+            handle_vote_request(from, req);
+        });
+        network.set_on_vote_reply([this](int from, const RequestVoteResponse& res) {
+            handle_vote_response(from, res);
+        });
+        network.set_on_append_entries([this](int from, const AppendEntriesView& req) {
+            handle_append_entries(from, req);
+        });
+        network.set_on_append_reply([this](int from, const AppendEntriesResponse& res) {
+            handle_append_response(from, res);
+        });
+        network.set_on_install_snapshot([this](int from, const InstallSnapshotRequest& req) {
+            handle_install_snapshot(from, req);
+        });
+        network.set_on_snapshot_reply([this](int from, const InstallSnapshotResponse& res) {
+            handle_snapshot_response(from, res);
+        });
+        network.set_on_read_index([this](int from, const ReadIndexRequest& req) {
+            handle_read_index(from, req);
+        });
+        network.set_on_read_index_reply([this](int from, const ReadIndexResponse& res) {
+            handle_read_index_response(from, res);
+        });
+        network.set_on_client_request([this](int from, const ClientRequest& req) {
+            handle_client_request(from, req);
+        });
+
+        // Election timeout is armed from the start; heartbeats only while leading
+        auto& loop = network.loop();
+        election_timer = loop.add_timer(election_timeout(), EventLoop::Millis(0),
+                                        [this] { start_election(); });
+        heartbeat_timer = loop.add_timer(EventLoop::Millis(0), EventLoop::Millis(0),
+                                         [this] { send_heartbeats(); });
+    }
+
+    ~RaftNode() {
+        {
+            std::lock_guard<std::mutex> lock(snapshot_link->mutex);
+            snapshot_link->node = nullptr;
+        }
+        if (snapshot_writer.joinable()) snapshot_writer.join();
+        if (snapshot_fd >= 0) close(snapshot_fd);
+        if (receive_fd >= 0) close(receive_fd);
+    }
+
+    // Set before the network starts
+    void set_on_apply(ApplyHandler handler) { apply_handler = std::move(handler); }
+
+    // Set before the network starts; replaces set_on_apply
+    void set_on_apply_batch(ApplyBatchHandler handler) { apply_batch_handler = std::move(handler); }
+
+    // Set before the network starts; serves GETs
+    void set_read_handler(ReadHandler handler) { read_handler = std::move(handler); }
+
+    // Set before the network starts. `save` streams the state machine as of
+    // the last applied entry, `load` replaces it with a snapshot's contents.
+    // The latest snapshot on disk is loaded right away.
+    void set_snapshot_handlers(SnapshotFile::Writer save, SnapshotFile::Reader load) {
+        save_handler = [this, save = std::move(save)](std::ostream& out) {
+            sessions.save(out);
+            save(out);
+        };
+        load_handler = [this, load = std::move(load)](std::istream& in) {
+            sessions.load(in);
+            load(in);
+        };
+        if (snapshot_meta.index > 0) {
+            SnapshotFile::load(snapshot_path(), load_handler);
+        }
+    }
+
+    // Loop thread only; with external_heartbeats, the host's heartbeat timer
+    void heartbeat() {
+        if (role == Role::LEADER) send_heartbeats();
+    }
+
+    uint32_t group() const { return options.group; }
+
+    // Safe to call from any thread
+    void campaign() {
+        network.loop().post([this] { start_election(); });
+    }
+
+    // Safe to call from any thread. GETs are read here; writes are proposed
+    // here when leading, otherwise forwarded to the leader, whose
+    // ClientResponse comes back to this node. With `done`, the answer goes
+    // there instead, and a write reaching a follower is refused with the
+    // leader's id rather than forwarded.
+    void submit(ClientRequest req, ResponseCallback done = nullptr) {
+        network.loop().post([this, req = std::move(req), done = std::move(done)] {
+            if (req.type == ClientRequest::Type::GET) {
+                read(req, -1, done);
+            } else if (role == Role::LEADER || done) {
+                propose(req, -1, done);
+            } else if (leader_id >= 0) {
+                network.send_to(network.config().slot_of(leader_id), req);
+            } else {
+                LOG_WARN("[Node " << node_id << "] No leader known, dropping request "
+                         << req.request_id);
+            }
+        });
+    }
+
+    // Safe to call from any thread. GET of `key`, linearizable unless
+    // max_lag is given; `done` gets the answer on the loop thread
+    void get(std::string key, ResponseCallback done, uint64_t max_lag = ClientRequest::LINEARIZABLE) {
+        network.loop().post([this, key = std::move(key), done = std::move(done), max_lag] {
+            ClientRequest req{ClientRequest::Type::GET, key, "", static_cast<uint64_t>(node_id), 0, max_lag};
+            read(req, -1, done);
+        });
+    }
+
+    // Safe to call from any thread while the loop is running
+    RaftStatus status() {
+        if (network.loop().in_loop_thread()) {
+            return current_status();
+        }
+        std::promise<RaftStatus> result;
+        network.loop().post([&] { result.set_value(current_status()); });
+        return result.get_future().get();
+    }
+
+    // Loop thread only. Appends the request to the log and schedules
+    // replication; the client at `slot` is answered once it commits.
+    // Returns the entry's index, or 0 if nothing was appended.
+    uint64_t propose(const ClientRequest& req, int slot, ResponseCallback done = nullptr) {
+        if (role != Role::LEADER) {
+            reply(Waiter{0, slot, req.request_id, std::move(done)}, false, "not leader");
+            return 0;
+        }
+        if (req.request_id != 0) {
+            // A retry of something already applied gets the cached answer
+            SessionTable::Lookup seen = sessions.check(req.client_id, req.request_id);
+            if (seen.status == SessionTable::Status::DUPLICATE) {
+                reply(Waiter{seen.index, slot, req.request_id, std::move(done)}, true, "");
+                return 0;
+            }
+            if (seen.status == SessionTable::Status::EXPIRED) {
+                reply(Waiter{0, slot, req.request_id, std::move(done)}, false, "request expired");
+                return 0;
+            }
+            // A retry of something still in the log waits on the same entry
+            auto it = inflight.find({req.client_id, req.request_id});
+            if (it != inflight.end()) {
+                Waiter waiter{it->second, slot, req.request_id, std::move(done), Clock::now(), req.client_id};
+                auto at = std::upper_bound(waiters.begin(), waiters.end(), waiter.index,
+                                           [](uint64_t index, const Waiter& w) { return index < w.index; });
+                waiters.insert(at, std::move(waiter));
+                return it->second;
+            }
+        }
+
+        std::string data(wire_encoded_size(req), '\0');
+        wire_encode(req, &data[0], data.size());
+        LogEntry entry{current_term, std::move(data), req.client_id, req.request_id};
+        if (entry.wire_size() > batch_budget()) {
+            reply(Waiter{0, slot, req.request_id, std::move(done)}, false, "request too large");
+            return 0;
+        }
+
+        uint64_t index = append(std::move(entry));
+        waiters.push_back(Waiter{index, slot, req.request_id, std::move(done), Clock::now(), req.client_id});
+        if (req.request_id != 0) inflight[{req.client_id, req.request_id}] = index;
+        metrics.proposed.add();
+        schedule_tick();
+        return index;
+    }
+
+    // Loop thread only. Answers a GET from `slot` (or through `done`) once
+    // it is known to be linearizable, or at once if it may be stale and
+    // this node is within its max_lag; nothing is appended to the log.
+    void read(const ClientRequest& req, int slot, ResponseCallback done) {
+        PendingRead pending{0, 0, slot, req.request_id, req.key, std::move(done)};
+        pending.arrived = Clock::now();
+        if (req.max_lag != ClientRequest::LINEARIZABLE && within_lag(req.max_lag)) {
+            answer(pending, true, "");
+        } else if (role == Role::LEADER) {
+            confirm_read(std::move(pending));
+        } else if (leader_id >= 0) {
+            pending.batch = read_batch;
+            forwarded.push_back(std::move(pending));
+            batch_wanted = true;
+            schedule_tick();
+        } else {
+            answer(pending, false, "no leader");
+        }
+    }
+
+private:
+    //--------------------------------------------------
+    // Message handlers
+    //--------------------------------------------------
+    void handle_vote_request(int from, const RequestVoteRequest& req) {
+        LOG_DEBUG("[Node " << node_id << "] Received vote request from node "
+                  << network.id_of(from) << " (term " << req.term << ")");
+
+        uint64_t term = req.term;
+        if (term > current_term && options.read_mode == ReadMode::LEASE && leader_alive()) {
+            // Leave the term alone: a leader may still hold a read lease
+            network.send_to(from, RequestVoteResponse{current_term, false});
+            return;
+        }
+        if (term > current_term) {
+            step_down(term);
+        }
+
+        RequestVoteResponse res;
+        res.term = current_term;
+        res.vote_granted = term == current_term &&
+                           (voted_for == -1 || voted_for == req.candidate_id) &&
+                           log.up_to_date(req.last_log_index, req.last_log_term);
+        if (res.vote_granted) {
+            voted_for = req.candidate_id;
+            persist_state();
+            reset_election_timer();
+        }
+        network.send_to(from, res);
+    }
+
+    void handle_vote_response(int from, const RequestVoteResponse& res) {
+        LOG_DEBUG("[Node " << node_id << "] Received vote response from node "
+                  << network.id_of(from) << ": " << (res.vote_granted ? "GRANTED" : "DENIED")
+                  << " for term " << res.term);
+
+        if (res.term > current_term) {
+            step_down(res.term);
+            return;
+        }
+        if (role != Role::CANDIDATE || res.term != current_term || !res.vote_granted) {
+            return;
+        }
+        if (has_quorum(++votes)) {
+            become_leader();
+        }
+    }
+
+    void handle_append_entries(int from, const AppendEntriesView& req) {
+        AppendEntriesResponse res{current_term, false, 0, 0, req.round, req.pipelined};
+        if (req.term < current_term) {
+            network.send_to(from, res);
+            return;
+        }
+        if (req.term > current_term || role != Role::FOLLOWER) {
+            step_down(req.term);
+        }
+        leader_id = static_cast<int>(req.leader_id);
+        leader_contact = Clock::now();
+        leader_commit = std::max(leader_commit, req.leader_commit);
+        reset_election_timer();
+        res.term = current_term;
+
+        // Reads asked for two heartbeats ago and still unanswered: the
+        // request or its answer was lost, or went to an old leader
+        if (!forwarded.empty() && !batch_wanted &&
+            leader_contact - batch_sent >= EventLoop::Millis(2 * options.heartbeat_interval_ms)) {
+            batch_wanted = true;
+            schedule_tick();
+        }
+
+        if (!log.matches(req.prev_log_index, req.prev_log_term)) {
+            res.conflict_index = log.conflict_index(req.prev_log_index);
+            LOG_DEBUG("[Node " << node_id << "] Log mismatch at " << req.prev_log_index
+                      << ", resume from " << res.conflict_index);
+            network.send_to(from, res);
+            return;
+        }
+
+        // Entries we already hold are skipped; only a term conflict truncates,
+        // so duplicated or reordered requests never drop acked entries
+        uint64_t index = req.prev_log_index;
+        req.for_each_entry([&](const LogEntryView& entry) {
+            index++;
+            if (index <= log.base_index()) return;     // covered by our snapshot
+            if (index <= log.last_index()) {
+                if (log.term_at(index) == entry.term) return;
+                log.truncate_after(index - 1);
+            }
+            append(entry.to_entry());
+        });
+
+        // Acked once the entries are durable, at the end of the tick
+        res.success = true;
+        res.match_index = index;
+        unsynced_acks.emplace_back(from, res);
+        schedule_tick();
+
+        uint64_t commit = std::min(req.leader_commit, index);
+        if (commit > commit_index) {
+            commit_index = commit;
+            apply_committed();
+        }
+    }
+
+    void handle_append_response(int from, const AppendEntriesResponse& res) {
+        if (res.term > current_term) {
+            step_down(res.term);
+            return;
+        }
+        if (role != Role::LEADER || res.term != current_term) {
+            return;
+        }
+
+        Peer& peer = peers[from];
+        if (res.round > peer.acked_round) {
+            peer.acked_round = res.round;
+            confirm_rounds();
+        }
+        if (peer.snapshot_index != 0) {
+            return;     // answers to batches sent before the snapshot took over
+        }
+        if (res.pipelined) {
+            // Heartbeats were never counted, and don't show batches arriving
+            peer.idle_ticks = 0;
+            if (peer.inflight > 0) peer.inflight--;
+        }
+        if (res.success) {
+            peer.probing = false;
+            peer.match_index = std::max(peer.match_index, res.match_index);
+            peer.next_index = std::max(peer.next_index, peer.match_index + 1);
+            advance_commit();
+        } else {
+            // Drop the pipeline and resume where the follower's log diverges
+            peer.next_index = std::max(peer.match_index + 1,
+                                       std::min(res.conflict_index, log.last_index() + 1));
+            peer.inflight = 0;
+            peer.probing = true;
+        }
+        replicate(from);
+    }
+
+    void handle_client_request(int from, const ClientRequest& req) {
+        LOG_DEBUG("[Node " << node_id << "] Received client request from node "
+                  << network.id_of(from) << ": " << req.key << " = " << req.value);
+        if (req.type == ClientRequest::Type::GET) {
+            read(req, from, nullptr);
+        } else {
+            propose(req, from);
+        }
+    }
+
+    // A follower's batch of reads: answered with our read index once a
+    // round confirms we are still leader
+    void handle_read_index(int from, const ReadIndexRequest& req) {
+        if (req.term > current_term) {
+            step_down(req.term);
+        }
+        PendingRead pending{0, 0, from, 0, "", nullptr, req.batch};
+        if (role != Role::LEADER) {
+            answer(pending, false, "not leader");
+            return;
+        }
+        confirm_read(std::move(pending));
+    }
+
+    // Answers every forwarded read up to the batch, including those of
+    // earlier batches whose answers were lost: a later index serves them too
+    void handle_read_index_response(int from, const ReadIndexResponse& res) {
+        (void)from;
+        if (res.term > current_term) {
+            step_down(res.term);
+        }
+        while (!forwarded.empty() && forwarded.front().batch <= res.batch) {
+            PendingRead read = std::move(forwarded.front());
+            forwarded.pop_front();
+            read.batch = 0;
+            if (!res.success) {
+                answer(read, false, "leadership lost");
+                continue;
+            }
+            read.read_index = res.read_index;
+            reads.push_back(std::move(read));
+        }
+        serve_reads();
+    }
+
+    // Chunks are written to snapshot.recv in order; anything out of order is
+    // answered with the offset we actually need
+    void handle_install_snapshot(int from, const InstallSnapshotRequest& req) {
+        InstallSnapshotResponse res{current_term, req.last_included_index, 0};
+        if (req.term < current_term) {
+            network.send_to(from, res);
+            return;
+        }
+        if (req.term > current_term || role != Role::FOLLOWER) {
+            step_down(req.term);
+        }
+        leader_id = static_cast<int>(req.leader_id);
+        leader_contact = Clock::now();
+        reset_election_timer();
+        res.term = current_term;
+
+        if (!wal) {
+            LOG_ERROR("[Node " << node_id << "] Cannot install a snapshot without a data_dir");
+            return;
+        }
+        if (req.last_included_index <= commit_index) {
+            // Already have everything it covers
+            res.next_offset = std::numeric_limits<uint64_t>::max();
+            network.send_to(from, res);
+            return;
+        }
+
+        if (req.last_included_index != receiving_index) {
+            if (req.offset != 0) {
+                network.send_to(from, res);     // ask for the start
+                return;
+            }
+            if (receive_fd >= 0) close(receive_fd);
+            receive_fd = ::open(receive_path().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (receive_fd < 0) {
+                LOG_ERROR("[Node " << node_id << "] Cannot create " << receive_path());
+                return;
+            }
+            receiving_index = req.last_included_index;
+            received_bytes = 0;
+            LOG_INFO("[Node " << node_id << "] Receiving snapshot at index " << receiving_index
+                     << " from node " << req.leader_id);
+        }
+
+        if (req.offset == received_bytes) {
+            if (pwrite(receive_fd, req.data.data(), req.data.size(),
+                       static_cast<off_t>(received_bytes)) != static_cast<ssize_t>(req.data.size())) {
+                LOG_ERROR("[Node " << node_id << "] Writing snapshot chunk failed: " << strerror(errno));
+                return;
+            }
+            received_bytes += req.data.size();
+            if (req.done && !finish_snapshot(req)) {
+                received_bytes = 0;             // corrupt: start over
+            }
+        }
+        res.next_offset = received_bytes;
+        network.send_to(from, res);
+    }
+
+    void handle_snapshot_response(int from, const InstallSnapshotResponse& res) {
+        if (res.term > current_term) {
+            step_down(res.term);
+            return;
+        }
+        Peer& peer = peers[from];
+        if (role != Role::LEADER || res.term != current_term ||
+            peer.snapshot_index == 0 || res.last_included_index != peer.snapshot_index) {
+            return;
+        }
+
+        peer.idle_ticks = 0;
+        if (peer.inflight > 0) {
+            peer.inflight--;
+        }
+        if (res.next_offset >= snapshot_meta.size) {
+            LOG_INFO("[Node " << node_id << "] Node " << network.id_of(from)
+                     << " installed snapshot at index " << peer.snapshot_index);
+            peer.match_index = std::max(peer.match_index, peer.snapshot_index);
+            peer.next_index = peer.match_index + 1;
+            peer.snapshot_index = 0;
+            peer.inflight = 0;
+            peer.probing = false;
+            advance_commit();
+        } else {
+            // Every chunk answered but the follower is short: some were lost
+            peer.snapshot_acked = std::max(peer.snapshot_acked, res.next_offset);
+            if (peer.inflight == 0 && peer.snapshot_acked < peer.snapshot_offset) {
+                peer.snapshot_offset = peer.snapshot_acked;
+            }
+        }
+        replicate(from);
+    }
+
+    //--------------------------------------------------
+    // Replication
+    //--------------------------------------------------
+    size_t batch_budget() const {
+        return std::min(options.max_batch_bytes, network.max_message_size() - APPEND_OVERHEAD);
+    }
+
+    uint64_t append(LogEntry entry) {
+        uint64_t index = log.append(std::move(entry));
+        if (wal) {
+            wal->append_entry(index, log.at(index), options.group);
+        }
+        return index;
+    }
+
+    // End of tick: replicate everything appended during the tick in one go,
+    // then make it durable with a single sync (group commit). The leader's
+    // sends go out before its own sync so the two overlap; coalesced sends
+    // are flushed from the outbox first rather than after the tick.
+    void schedule_tick() {
+        if (tick_scheduled) return;
+        tick_scheduled = true;
+        network.loop().defer([this] {
+            tick_scheduled = false;
+            if (role == Role::LEADER) {
+                if (round_wanted) {
+                    begin_round();
+                }
+                for (int slot : network.peers()) {
+                    replicate(slot);
+                    // Peers that got no batch still need to see the new round
+                    if (peers[slot].sent_round < round && peers[slot].snapshot_index == 0) {
+                        send_heartbeat(slot);
+                    }
+                }
+                confirm_rounds();
+            } else if (batch_wanted) {
+                send_read_index();
+            }
+            if (wal) {
+                if (role == Role::LEADER && wal->pending()) {
+                    network.flush();
+                }
+                wal->sync();
+            }
+            durable_index = log.last_index();
+            for (const auto& ack : unsynced_acks) {
+                network.send_to(ack.first, ack.second);
+            }
+            unsynced_acks.clear();
+            if (role == Role::LEADER) {
+                advance_commit();
+            }
+        });
+    }
+
+    // Fill the peer's pipeline with batches from next_index on
+    void replicate(int slot) {
+        Peer& peer = peers[slot];
+        if (peer.next_index <= log.base_index()) {
+            send_snapshot(slot);
+            return;
+        }
+        int limit = peer.probing ? 1 : options.max_inflight;
+        while (peer.inflight < limit && peer.next_index <= log.last_index()) {
+            send_append(slot, peer.next_index - 1, true);
+        }
+    }
+
+    void send_append(int slot, uint64_t prev_index, bool with_entries) {
+        Peer& peer = peers[slot];
+        AppendEntriesBatch req(network.loop().arena().resource());
+        req.term = current_term;
+        req.leader_id = node_id;
+        req.prev_log_index = prev_index;
+        req.prev_log_term = log.term_at(prev_index);
+        req.leader_commit = commit_index;
+        req.round = round;
+        peer.sent_round = round;
+
+        if (with_entries) {
+            size_t budget = batch_budget();
+            size_t bytes = 0;
+            req.entries.reserve(std::min<uint64_t>(options.max_batch_entries, log.last_index() - prev_index));
+            for (uint64_t i = prev_index + 1; i <= log.last_index(); i++) {
+                const LogEntry& entry = log.at(i);
+                if (req.entries.size() == options.max_batch_entries ||
+                    bytes + entry.wire_size() > budget) {
+                    break;
+                }
+                bytes += entry.wire_size();
+                req.entries.emplace_back(entry);
+            }
+            // A probe keeps next_index where it is until the follower agrees
+            if (!peer.probing) {
+                peer.next_index = prev_index + 1 + req.entries.size();
+            }
+            req.pipelined = true;
+            peer.inflight++;
+        }
+        network.send_to(slot, req);
+    }
+
+    // Stream the snapshot file to a follower, max_inflight chunks at a time
+    void send_snapshot(int slot) {
+        Peer& peer = peers[slot];
+        if (peer.snapshot_index != snapshot_meta.index) {
+            // New transfer, or a newer snapshot replaced the one being sent
+            peer.snapshot_index = snapshot_meta.index;
+            peer.snapshot_offset = 0;
+            peer.snapshot_acked = 0;
+            peer.inflight = 0;
+            LOG_INFO("[Node " << node_id << "] Sending snapshot at index " << snapshot_meta.index
+                     << " (" << snapshot_meta.size << " bytes) to node " << network.id_of(slot));
+        }
+        if (snapshot_fd < 0) {
+            snapshot_fd = ::open(snapshot_path().c_str(), O_RDONLY | O_CLOEXEC);
+            if (snapshot_fd < 0) {
+                LOG_ERROR("[Node " << node_id << "] Cannot open " << snapshot_path());
+                return;
+            }
+        }
+
+        size_t chunk = std::min(options.snapshot_chunk_bytes, batch_budget());
+        while (peer.inflight < options.max_inflight && peer.snapshot_offset < snapshot_meta.size) {
+            InstallSnapshotRequest req;
+            req.term = current_term;
+            req.leader_id = node_id;
+            req.last_included_index = snapshot_meta.index;
+            req.last_included_term = snapshot_meta.term;
+            req.offset = peer.snapshot_offset;
+            req.data.resize(std::min<uint64_t>(chunk, snapshot_meta.size - req.offset));
+            ssize_t n = pread(snapshot_fd, &req.data[0], req.data.size(), static_cast<off_t>(req.offset));
+            if (n != static_cast<ssize_t>(req.data.size())) {
+                LOG_ERROR("[Node " << node_id << "] Reading snapshot failed");
+                return;
+            }
+            req.done = req.offset + req.data.size() == snapshot_meta.size;
+            peer.snapshot_offset += req.data.size();
+            peer.inflight++;
+            network.send_to(slot, req);
+        }
+    }
+
+    void send_heartbeats() {
+        begin_round();
+        for (int slot : network.peers()) {
+            Peer& peer = peers[slot];
+            if (peer.inflight > 0 && ++peer.idle_ticks >= 2) {
+                // No answer for a whole interval: assume the batches were lost
+                if (peer.snapshot_index != 0) {
+                    peer.snapshot_offset = peer.snapshot_acked;
+                } else if (!peer.probing) {
+                    peer.next_index = peer.match_index + 1;
+                }
+                peer.inflight = 0;
+                peer.idle_ticks = 0;
+            }
+
+            if (peer.next_index <= log.base_index()) {
+                send_snapshot(slot);            // chunks double as heartbeats
+            } else if (peer.next_index <= log.last_index() &&
+                peer.inflight < (peer.probing ? 1 : options.max_inflight)) {
+                replicate(slot);
+            } else {
+                send_heartbeat(slot);
+            }
+        }
+        confirm_rounds();
+    }
+
+    void send_heartbeat(int slot) {
+        // With batches in flight, heartbeat from the acked prefix so a
+        // heartbeat overtaking them can't fail the consistency check
+        const Peer& peer = peers[slot];
+        uint64_t prev = peer.inflight > 0 ? peer.match_index : peer.next_index - 1;
+        send_append(slot, std::max(prev, log.base_index()), false);
+    }
+
+    //--------------------------------------------------
+    // Reads
+    //--------------------------------------------------
+    // Leader only
+    void confirm_read(PendingRead pending) {
+        // Entries committed by earlier leaders count once our no-op commits
+        pending.read_index = std::max(commit_index, term_start_index);
+        if (options.read_mode != ReadMode::LEASE || Clock::now() >= lease_expiry) {
+            pending.round = round + 1;
+            round_wanted = true;
+            schedule_tick();
+        }
+        reads.push_back(std::move(pending));
+        serve_reads();
+    }
+
+    // One ReadIndexRequest for every read forwarded since the last one;
+    // without a leader it goes out once one is heard from
+    void send_read_index() {
+        if (leader_id < 0) return;
+        network.send_to(network.config().slot_of(leader_id), ReadIndexRequest{current_term, read_batch});
+        read_batch++;
+        batch_wanted = false;
+        batch_sent = Clock::now();
+    }
+
+    // Bounded staleness: we applied to within max_lag of the newest commit
+    // index we know of, and a leader was heard from (or, leading, a majority
+    // acked us) recently enough that there is unlikely to be a newer one
+    bool within_lag(uint64_t max_lag) const {
+        if (role == Role::LEADER) return leader_alive() && commit_index - last_applied <= max_lag;
+        if (leader_id < 0 || Clock::now() - leader_contact >= lease_base()) return false;
+        return leader_commit <= last_applied || leader_commit - last_applied <= max_lag;
+    }
+
+    // Every AppendEntries sent from here on carries the new round
+    void begin_round() {
+        round++;
+        round_wanted = false;
+        round_starts.emplace_back(round, Clock::now());
+        if (round_starts.size() > MAX_OPEN_ROUNDS) {
+            round_starts.pop_front();   // cut off from a majority; just no lease from it
+        }
+    }
+
+    // The highest round a majority (us included) has acked confirms our
+    // leadership as of that round's start, and under LEASE extends the lease
+    void confirm_rounds() {
+        std::vector<uint64_t> acked;
+        acked.reserve(peers.size());
+        acked.push_back(round);
+        for (int slot : network.peers()) {
+            acked.push_back(peers[slot].acked_round);
+        }
+        size_t quorum = acked.size() / 2;
+        std::nth_element(acked.begin(), acked.begin() + quorum, acked.end(), std::greater<uint64_t>());
+        uint64_t confirmed = acked[quorum];
+        if (confirmed <= confirmed_round) return;
+
+        confirmed_round = confirmed;
+        while (!round_starts.empty() && round_starts.front().first < confirmed) {
+            round_starts.pop_front();
+        }
+        if (!round_starts.empty() && round_starts.front().first == confirmed) {
+            lease_expiry = round_starts.front().second + lease_base() -
+                           EventLoop::Millis(options.lease_clock_skew_ms);
+        }
+        serve_reads();
+    }
+
+    void serve_reads() {
+        while (!reads.empty() && reads.front().round <= confirmed_round &&
+               reads.front().read_index <= last_applied) {
+            answer(reads.front(), true, "");
+            reads.pop_front();
+        }
+    }
+
+    // A successful read carries the value and the index it reflects; a
+    // missing key is an error. A follower's ReadIndexRequest gets the index.
+    void answer(const PendingRead& read, bool success, const std::string& error) {
+        if (read.batch != 0) {
+            network.send_to(read.slot, ReadIndexResponse{current_term, read.batch, success, read.read_index});
+            return;
+        }
+        ClientResponse res{success, false, static_cast<uint64_t>(std::max(leader_id, 0)), error,
+                           read.request_id, "", last_applied};
+        if (success && !(read_handler && read_handler(read.key, res.value))) {
+            res.success = false;
+            res.error = "not found";
+        }
+        res.leader_hint = !success && leader_id >= 0 && leader_id != node_id;
+        if (read.arrived != Clock::time_point()) metrics.read_ns.record_since(read.arrived);
+        if (read.done) {
+            read.done(res);
+        } else if (read.slot >= 0) {
+            network.send_to(read.slot, res);
+        } else {
+            LOG_DEBUG("[Node " << node_id << "] Read " << read.key << ": "
+                      << (res.success ? res.value : res.error));
+        }
+    }
+
+    EventLoop::Millis lease_base() const {
+        return EventLoop::Millis(options.lease_base_ms > 0 ? options.lease_base_ms : options.election_timeout_min_ms);
+    }
+
+    // A leader reached us within lease_base(), or we are the leader and our
+    // lease holds
+    bool leader_alive() const {
+        auto now = Clock::now();
+        if (role == Role::LEADER) return now < lease_expiry;
+        return leader_id >= 0 && now - leader_contact < lease_base();
+    }
+
+    // Commit the highest index stored on a majority, if it is from our term
+    void advance_commit() {
+        std::vector<uint64_t> matched;
+        matched.reserve(peers.size());
+        matched.push_back(durable_index);
+        for (int slot : network.peers()) {
+            matched.push_back(peers[slot].match_index);
+        }
+        size_t quorum = matched.size() / 2;
+        std::nth_element(matched.begin(), matched.begin() + quorum, matched.end(),
+                         std::greater<uint64_t>());
+        uint64_t index = matched[quorum];
+        if (index > commit_index && log.term_at(index) == current_term) {
+            commit_index = index;
+            apply_committed();
+        }
+    }
+
+    // Committed entries go to the state machine max_apply_batch at a time;
+    // their clients are answered after each batch. Requests applied before
+    // are left out, which splits a batch around them.
+    void apply_committed() {
+        while (last_applied < commit_index) {
+            uint64_t first = last_applied + 1;
+            uint64_t last = std::min<uint64_t>(commit_index,
+                                               last_applied + std::max<size_t>(options.max_apply_batch, 1));
+            uint64_t run = first;
+            apply_batch.clear();
+            auto flush = [&] {
+                if (!apply_batch.empty()) {
+                    auto start = Clock::now();
+                    apply_batch_handler(run, apply_batch.data(), apply_batch.size());
+                    metrics.apply_ns.record_since(start);
+                    metrics.apply_batch.record(apply_batch.size());
+                    metrics.applied.add(apply_batch.size());
+                    apply_batch.clear();
+                }
+            };
+            for (uint64_t i = first; i <= last; i++) {
+                const LogEntry& entry = log.at(i);
+                if (!first_application(i, entry)) {
+                    if (apply_batch_handler) flush();
+                    continue;
+                }
+                if (apply_batch_handler) {
+                    if (apply_batch.empty()) run = i;
+                    apply_batch.push_back(&entry);
+                } else if (apply_handler) {
+                    apply_handler(i, entry);
+                    metrics.applied.add();
+                }
+            }
+            if (apply_batch_handler) flush();
+            last_applied = last;
+            if (!waiters.empty()) metrics.waiting.record(waiters.size());
+            while (!waiters.empty() && waiters.front().index <= last_applied) {
+                Waiter& waiter = waiters.front();
+                metrics.commit_ns.record_since(waiter.proposed);
+                if (waiter.request_id != 0) inflight.erase({waiter.client_id, waiter.request_id});
+                auto it = skipped.find(waiter.index);
+                if (it == skipped.end()) {
+                    reply(waiter, true, "");
+                } else if (it->second.status == SessionTable::Status::DUPLICATE) {
+                    // Applied earlier: answer with where
+                    waiter.index = it->second.index;
+                    reply(waiter, true, "");
+                } else {
+                    reply(waiter, false, "request expired");
+                }
+                waiters.pop_front();
+            }
+            skipped.clear();
+        }
+        serve_reads();
+        maybe_snapshot();
+    }
+
+    void maybe_snapshot() {
+        if (wal && save_handler && options.snapshot_threshold > 0 && !snapshot_writing &&
+            last_applied - snapshot_meta.index >= options.snapshot_threshold) {
+            take_snapshot();
+        }
+    }
+
+    bool first_application(uint64_t index, const LogEntry& entry) {
+        if (entry.request_id == 0 || entry.data.empty()) return true;
+        SessionTable::Status status = sessions.record(entry.client_id, entry.request_id, index);
+        if (status == SessionTable::Status::NEW) return true;
+        skipped[index] = status == SessionTable::Status::DUPLICATE
+                              ? sessions.check(entry.client_id, entry.request_id)
+                              : SessionTable::Lookup{status, 0};
+        metrics.skipped.add();
+        LOG_DEBUG("[Node " << node_id << "] Skipped entry " << index << ": request "
+                  << entry.request_id << " of client " << entry.client_id
+                  << (status == SessionTable::Status::DUPLICATE ? " already applied" : " expired"));
+        return false;
+    }
+
+    void reply(const Waiter& waiter, bool success, const std::string& error) {
+        if (waiter.slot < 0 && !waiter.done) {
+            LOG_DEBUG("[Node " << node_id << "] Request " << waiter.request_id << " "
+                      << (success ? "committed at " + std::to_string(waiter.index) : error));
+            return;
+        }
+        ClientResponse res;
+        res.success = success;
+        res.leader_hint = !success && leader_id >= 0 && leader_id != node_id;
+        res.leader_id = leader_id >= 0 ? leader_id : 0;
+        res.error = error;
+        res.request_id = waiter.request_id;
+        res.applied_index = waiter.index;
+        if (waiter.done) {
+            waiter.done(res);
+        } else {
+            network.send_to(waiter.slot, res);
+        }
+    }
+
+    //--------------------------------------------------
+    // Elections
+    //--------------------------------------------------
+    bool has_quorum(int count) const {
+        return count * 2 > static_cast<int>(network.config().size());
+    }
+
+    EventLoop::Millis election_timeout() {
+        std::uniform_int_distribution<int> dist(options.election_timeout_min_ms,
+                                                options.election_timeout_max_ms);
+        return EventLoop::Millis(dist(rng));
+    }
+
+    void reset_election_timer() {
+        network.loop().reset_timer(election_timer, election_timeout());
+    }
+
+    void start_election() {
+        if (role == Role::LEADER) return;
+        role = Role::CANDIDATE;
+        current_term++;
+        voted_for = node_id;
+        votes = 1;
+        leader_id = -1;
+        persist_state();
+        reset_election_timer();
+        metrics.elections.add();
+
+        RequestVoteRequest req;
+        req.term = current_term;
+        req.candidate_id = node_id;
+        req.last_log_index = log.last_index();
+        req.last_log_term = log.last_term();
+
+        LOG_DEBUG("[Node " << node_id << "] Starting election for term " << current_term);
+        if (has_quorum(votes)) {
+            become_leader();
+            return;
+        }
+        network.broadcast(network.peers(), req);
+    }
+
+    void become_leader() {
+        role = Role::LEADER;
+        leader_id = node_id;
+        for (Peer& peer : peers) {
+            peer = Peer();
+            peer.next_index = log.last_index() + 1;
+        }
+        // Rounds and leases from an earlier term prove nothing now
+        confirmed_round = round;
+        round_starts.clear();
+        lease_expiry = Clock::time_point();
+        network.loop().reset_timer(election_timer, EventLoop::Millis(0));
+        if (!options.external_heartbeats) {
+            network.loop().reset_timer(heartbeat_timer, EventLoop::Millis(options.heartbeat_interval_ms),
+                                       EventLoop::Millis(options.heartbeat_interval_ms));
+        }
+        LOG_INFO("[Node " << node_id << "] Became leader for term " << current_term);
+        metrics.became_leader.add();
+
+        // A no-op from our own term lets earlier entries commit (Raft 5.4.2)
+        term_start_index = append(LogEntry{current_term, "", 0, 0});
+        schedule_tick();
+
+        // Reads still waiting on the old leader are ours to confirm now
+        for (PendingRead& read : forwarded) {
+            read.batch = 0;
+            confirm_read(std::move(read));
+        }
+        forwarded.clear();
+        batch_wanted = false;
+    }
+
+    void step_down(uint64_t term) {
+        bool was_follower = role == Role::FOLLOWER;
+        if (role == Role::LEADER) {
+            network.loop().reset_timer(heartbeat_timer, EventLoop::Millis(0));
+            LOG_INFO("[Node " << node_id << "] Stepping down in term " << term);
+            metrics.stepped_down.add();
+            leader_id = -1;
+            for (const Waiter& waiter : waiters) {
+                reply(waiter, false, "leadership lost");
+            }
+            waiters.clear();
+            inflight.clear();
+            for (const PendingRead& read : reads) {
+                answer(read, false, "leadership lost");
+            }
+            reads.clear();
+            lease_expiry = Clock::time_point();
+        }
+        if (term > current_term) {
+            current_term = term;
+            voted_for = -1;
+            leader_id = -1;
+            persist_state();
+        }
+        role = Role::FOLLOWER;
+        // A follower's timeout keeps running: a candidate whose log is too
+        // old to win must not hold off the nodes that could
+        if (!was_follower) reset_election_timer();
+    }
+
+    //--------------------------------------------------
+    // Persistence
+    //--------------------------------------------------
+    std::string snapshot_path() const { return options.data_dir + "/snapshot"; }
+    std::string receive_path() const { return options.data_dir + "/snapshot.recv"; }
+
+    // Latest snapshot first, then the WAL entries after it
+    void recover() {
+        if (options.shared_wal) {
+            if (mkdir(options.data_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+                throw std::runtime_error("Cannot create '" + options.data_dir + "': " + strerror(errno));
+            }
+            wal = options.shared_wal;
+        } else {
+            own_wal = std::make_unique<Wal>(options.data_dir, options.wal_segment_size);
+            wal = own_wal.get();
+        }
+        Wal::Recovery rec = wal->recover(options.group);
+        unlink(receive_path().c_str());
+
+        if (SnapshotFile::inspect(snapshot_path(), snapshot_meta)) {
+            log.reset(snapshot_meta.index, snapshot_meta.term);
+            commit_index = last_applied = snapshot_meta.index;
+        } else {
+            snapshot_meta = SnapshotMeta();
+        }
+
+        uint64_t index = rec.first_index;
+        if ((rec.reset || !rec.entries.empty()) && index > log.last_index() + 1) {
+            throw std::runtime_error("WAL in '" + options.data_dir + "' starts at index " +
+                                     std::to_string(index) + " but the snapshot ends at " +
+                                     std::to_string(log.base_index()));
+        }
+        for (auto& entry : rec.entries) {
+            if (index++ > log.base_index()) {
+                log.append(std::move(entry));
+            }
+        }
+        current_term = rec.term;
+        voted_for = rec.voted_for;
+        durable_index = log.last_index();
+        LOG_INFO("[Node " << node_id << "] Recovered term " << current_term << ", snapshot at "
+                 << snapshot_meta.index << ", log up to " << log.last_index()
+                 << " from " << options.data_dir);
+    }
+
+    // Stream the state machine to disk and compact the log behind it
+    // Streams the state as of last_applied to a temporary file, then has
+    // snapshot_writer sync it and post it back to install_snapshot()
+    void take_snapshot() {
+        auto start = Clock::now();
+        std::string tmp = snapshot_path() + ".tmp";
+        SnapshotFile::Unsynced file;
+        try {
+            file = SnapshotFile::stream_file(tmp, last_applied, log.term_at(last_applied), save_handler);
+        } catch (const std::exception& e) {
+            LOG_ERROR("[Node " << node_id << "] Snapshot at index " << last_applied << " failed: " << e.what());
+            return;
+        }
+
+        snapshot_writing = true;
+        if (snapshot_writer.joinable()) snapshot_writer.join();     // done: it posted its result
+        snapshot_writer = std::thread([&loop = network.loop(), link = snapshot_link, file, tmp, start] {
+            std::string error;
+            try {
+                SnapshotFile::sync_file(file, tmp);
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+            loop.post([link, meta = file.meta, error, start] {
+                std::lock_guard<std::mutex> lock(link->mutex);
+                if (link->node) link->node->install_snapshot(meta, error, start);
+            });
+        });
+    }
+
+    void install_snapshot(const SnapshotMeta& meta, const std::string& error, Clock::time_point start) {
+        snapshot_writing = false;
+        std::string tmp = snapshot_path() + ".tmp";
+        if (!error.empty()) {
+            LOG_ERROR("[Node " << node_id << "] Snapshot at index " << meta.index << " failed: " << error);
+            maybe_snapshot();
+            return;
+        }
+        if (meta.index <= snapshot_meta.index) {
+            unlink(tmp.c_str());        // a snapshot from the leader got ahead of it
+            maybe_snapshot();
+            return;
+        }
+        SnapshotFile::install(tmp, snapshot_path());
+        snapshot_meta = meta;
+        if (snapshot_fd >= 0) {
+            close(snapshot_fd);         // transfers in progress restart with the new one
+            snapshot_fd = -1;
+        }
+
+        uint64_t keep = options.snapshot_trailing_entries;
+        uint64_t compact_to = snapshot_meta.index > keep ? snapshot_meta.index - keep : 0;
+        if (compact_to > log.base_index()) {
+            log.compact(compact_to);
+            wal->release_before(compact_to + 1, options.group);
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+        LOG_INFO("[Node " << node_id << "] Snapshot at index " << snapshot_meta.index << ", "
+                 << snapshot_meta.size << " bytes in " << ms << " ms; log starts at "
+                 << log.first_index());
+        maybe_snapshot();               // entries applied while writing may be due already
+    }
+
+    // Verify and install a fully received snapshot
+    bool finish_snapshot(const InstallSnapshotRequest& req) {
+        fsync(receive_fd);
+        close(receive_fd);
+        receive_fd = -1;
+        receiving_index = 0;
+
+        SnapshotMeta meta;
+        if (!SnapshotFile::inspect(receive_path(), meta) ||
+            meta.index != req.last_included_index || meta.term != req.last_included_term) {
+            LOG_WARN("[Node " << node_id << "] Received snapshot failed verification");
+            return false;
+        }
+        SnapshotFile::install(receive_path(), snapshot_path());
+        snapshot_meta = meta;
+        if (snapshot_fd >= 0) {
+            close(snapshot_fd);
+            snapshot_fd = -1;
+        }
+
+        // Keep a matching suffix; otherwise the snapshot replaces the whole log
+        if (log.matches(meta.index, meta.term) && meta.index <= log.last_index()) {
+            log.compact(meta.index);
+        } else {
+            log.reset(meta.index, meta.term);
+            wal->append_reset(meta.index, meta.term, options.group);
+            wal->sync();
+            durable_index = log.last_index();
+        }
+        if (meta.index > last_applied) {
+            if (load_handler) {
+                SnapshotFile::load(snapshot_path(), load_handler);
+            }
+            last_applied = meta.index;
+        }
+        commit_index = std::max(commit_index, meta.index);
+        wal->release_before(log.base_index() + 1, options.group);
+        LOG_INFO("[Node " << node_id << "] Installed snapshot at index " << meta.index);
+        apply_committed();
+        return true;
+    }
+
+    // Term and vote must be on disk before anyone hears about them
+    void persist_state() {
+        if (wal) {
+            wal->append_state(current_term, voted_for, options.group);
+            wal->sync();
+        }
+    }
+
+    RaftStatus current_status() const {
+        return RaftStatus{node_id, role == Role::LEADER, current_term, leader_id,
+                          log.last_index(), commit_index, last_applied, snapshot_meta.index};
+    }
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include "messages.cpp"
+
+//--------------------------------------------------
+// Raft Log
+//--------------------------------------------------
+// In-memory replicated log. Indices are 1-based as in the Raft paper. The
+// log starts after a base entry: index 0 / term 0 for a fresh log, or the
+// last entry covered by a snapshot once compacted. The base's term is kept so
+// every AppendEntries has a prev entry to check against.
+class RaftLog {
+    std::deque<LogEntry> entries;   // entries[i] holds index base + i + 1
+    uint64_t base = 0;
+    uint64_t base_term = 0;
+
+public:
+    uint64_t base_index() const { return base; }
+
+    uint64_t first_index() const { return base + 1; }
+
+    uint64_t last_index() const { return base + entries.size(); }
+
+    uint64_t last_term() const { return entries.empty() ? base_term : entries.back().term; }
+
+    uint64_t term_at(uint64_t index) const {
+        if (index == base) return base_term;
+        if (index < base || index > last_index()) {
+            throw std::out_of_range("Log index " + std::to_string(index) + " not in log");
+        }
+        return entries[index - base - 1].term;
+    }
+
+    const LogEntry& at(uint64_t index) const {
+        if (index <= base || index > last_index()) {
+            throw std::out_of_range("Log index " + std::to_string(index) + " not in log");
+        }
+        return entries[index - base - 1];
+    }
+
+    // Returns the index of the new entry
+    uint64_t append(LogEntry entry) {
+        entries.push_back(std::move(entry));
+        return last_index();
+    }
+
+    // Drop every entry after `index`
+    void truncate_after(uint64_t index) {
+        if (index < last_index()) {
+            entries.resize(index - base);
+        }
+    }
+
+    // Drop every entry up to and including `index`, which becomes the base
+    void compact(uint64_t index) {
+        if (index <= base) return;
+        uint64_t term = term_at(index);
+        entries.erase(entries.begin(), entries.begin() + (index - base));
+        base = index;
+        base_term = term;
+    }
+
+    // Discard everything; the log continues after (index, term)
+    void reset(uint64_t index, uint64_t term) {
+        entries.clear();
+        base = index;
+        base_term = term;
+    }
+
+    // Does our log contain an entry at `index` with term `term`? Entries
+    // below the base are committed, so they match by definition.
+    bool matches(uint64_t index, uint64_t term) const {
+        if (index < base) return true;
+        return index <= last_index() && term_at(index) == term;
+    }
+
+    // Where the leader should resume after a failed consistency check at
+    // prev_index: just past our end if we are short, otherwise the first
+    // index of the conflicting term so the whole term is skipped in one round
+    uint64_t conflict_index(uint64_t prev_index) const {
+        if (prev_index > last_index()) {
+            return last_index() + 1;
+        }
+        uint64_t term = term_at(prev_index);
+        uint64_t index = prev_index;
+        while (index > base + 1 && term_at(index - 1) == term) {
+            index--;
+        }
+        return index;
+    }
+
+    // Is a candidate's log at least as up to date as ours (Raft 5.4.1)?
+    bool up_to_date(uint64_t index, uint64_t term) const {
+        return term > last_term() || (term == last_term() && index >= last_index());
+    }
+};
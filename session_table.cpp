@@ -0,0 +1,183 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "snapshot.cpp"
+
+//--------------------------------------------------
+// Session Table
+//--------------------------------------------------
+// Which client requests have been applied, so a command is applied once
+// however many times retries put it in the log. A client's request ids must
+// increase. Per client the table keeps the highest id applied, the index it
+// was applied at (the cached answer for a retry of it) and a bitmap of the
+// WINDOW ids below it, since pipelined requests can commit out of order.
+// Anything older than the window is EXPIRED: it may or may not have been
+// applied, so it never is again.
+//
+// The table changes only as entries are applied, and sessions are aged by
+// log index rather than by clock, so every replica holds the same table.
+// Sessions idle for ttl_entries entries are dropped, and so is the least
+// recently used one when there are more than max_sessions; a retry from a
+// dropped session counts as new.
+class SessionTable {
+public:
+    enum class Status { NEW, DUPLICATE, EXPIRED };
+
+    struct Lookup {
+        Status status;
+        uint64_t index;     // DUPLICATE of the latest request: where it was applied; else 0
+    };
+
+    static constexpr uint64_t WINDOW = 64;
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Session {
+        uint64_t client_id;
+        uint64_t high;          // highest request id applied
+        uint64_t seen;          // bit i set: request high - i applied
+        uint64_t index;         // where `high` was applied
+        uint64_t last_used;     // index of the client's latest entry
+        uint32_t prev, next;    // LRU list, most recent first
+    };
+
+    std::vector<Session> sessions;
+    std::vector<uint32_t> free_slots;
+    std::unordered_map<uint64_t, uint32_t> by_client;
+    uint32_t head = NIL;
+    uint32_t tail = NIL;
+    size_t max_sessions;
+    uint64_t ttl_entries;
+
+    void unlink(uint32_t slot) {
+        Session& s = sessions[slot];
+        (s.prev == NIL ? head : sessions[s.prev].next) = s.next;
+        (s.next == NIL ? tail : sessions[s.next].prev) = s.prev;
+    }
+
+    void push_front(uint32_t slot) {
+        Session& s = sessions[slot];
+        s.prev = NIL;
+        s.next = head;
+        (head == NIL ? tail : sessions[head].prev) = slot;
+        head = slot;
+    }
+
+    void evict(uint32_t slot) {
+        unlink(slot);
+        by_client.erase(sessions[slot].client_id);
+        free_slots.push_back(slot);
+    }
+
+    uint32_t insert(uint64_t client_id) {
+        uint32_t slot;
+        if (free_slots.empty()) {
+            slot = static_cast<uint32_t>(sessions.size());
+            sessions.emplace_back();
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        sessions[slot] = Session{client_id, 0, 0, 0, 0, NIL, NIL};
+        by_client.emplace(client_id, slot);
+        push_front(slot);
+        return slot;
+    }
+
+    static Lookup classify(const Session& s, uint64_t request_id) {
+        if (request_id > s.high) return Lookup{Status::NEW, 0};
+        uint64_t age = s.high - request_id;
+        if (age >= WINDOW) return Lookup{Status::EXPIRED, 0};
+        if (!(s.seen >> age & 1)) return Lookup{Status::NEW, 0};
+        return Lookup{Status::DUPLICATE, age == 0 ? s.index : 0};
+    }
+
+public:
+    explicit SessionTable(size_t max_sessions = 1 << 16, uint64_t ttl_entries = 1 << 20) :
+        max_sessions(max_sessions), ttl_entries(ttl_entries) {
+        if (max_sessions == 0) {
+            throw std::invalid_argument("A session table needs room for at least one session");
+        }
+    }
+
+    size_t size() const { return by_client.size(); }
+
+    // Would a request be applied now? Changes nothing.
+    Lookup check(uint64_t client_id, uint64_t request_id) const {
+        auto it = by_client.find(client_id);
+        if (it == by_client.end()) return Lookup{Status::NEW, 0};
+        return classify(sessions[it->second], request_id);
+    }
+
+    // Called for every entry in log order: records a NEW request as applied
+    // at `index` and ages out idle sessions. Only NEW requests are applied.
+    Status record(uint64_t client_id, uint64_t request_id, uint64_t index) {
+        while (tail != NIL && index - sessions[tail].last_used > ttl_entries) {
+            evict(tail);
+        }
+
+        auto it = by_client.find(client_id);
+        uint32_t slot;
+        if (it == by_client.end()) {
+            if (by_client.size() >= max_sessions) evict(tail);
+            slot = insert(client_id);
+        } else {
+            slot = it->second;
+            unlink(slot);
+            push_front(slot);
+        }
+        Session& s = sessions[slot];
+        s.last_used = index;
+
+        Status status = classify(s, request_id).status;
+        if (status != Status::NEW) return status;
+        if (request_id > s.high) {
+            uint64_t shift = request_id - s.high;
+            s.seen = shift >= WINDOW ? 0 : s.seen << shift;
+            s.high = request_id;
+            s.index = index;
+        }
+        s.seen |= uint64_t(1) << (s.high - request_id);
+        return Status::NEW;
+    }
+
+    void clear() {
+        sessions.clear();
+        free_slots.clear();
+        by_client.clear();
+        head = tail = NIL;
+    }
+
+    //   u64 sessions | per session, least recently used first:
+    //   u64 client_id | u64 high | u64 seen | u64 index | u64 last_used
+    void save(std::ostream& out) const {
+        snapshot_io::put_u64(out, by_client.size());
+        for (uint32_t slot = tail; slot != NIL; slot = sessions[slot].prev) {
+            const Session& s = sessions[slot];
+            snapshot_io::put_u64(out, s.client_id);
+            snapshot_io::put_u64(out, s.high);
+            snapshot_io::put_u64(out, s.seen);
+            snapshot_io::put_u64(out, s.index);
+            snapshot_io::put_u64(out, s.last_used);
+        }
+    }
+
+    // Replaces the contents
+    void load(std::istream& in) {
+        clear();
+        uint64_t count = snapshot_io::get_u64(in);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t client_id = snapshot_io::get_u64(in);
+            Session& s = sessions[insert(client_id)];
+            s.high = snapshot_io::get_u64(in);
+            s.seen = snapshot_io::get_u64(in);
+            s.index = snapshot_io::get_u64(in);
+            s.last_used = snapshot_io::get_u64(in);
+        }
+    }
+};
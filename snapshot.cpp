@@ -0,0 +1,272 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "crc32c.cpp"
+#include "wire.cpp"
+
+//--------------------------------------------------
+// Snapshot Stream Helpers
+//--------------------------------------------------
+// Little-endian fixed-width fields on std streams, for state machines that
+// serialize themselves into a snapshot
+namespace snapshot_io {
+    inline void put_u8(std::ostream& out, uint8_t v) {
+        out.put(static_cast<char>(v));
+    }
+
+    inline void put_u32(std::ostream& out, uint32_t v) {
+        v = wire::to_le(v);
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    inline void put_u64(std::ostream& out, uint64_t v) {
+        v = wire::to_le(v);
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    inline void put_bytes(std::ostream& out, const char* data, uint32_t len) {
+        put_u32(out, len);
+        out.write(data, len);
+    }
+
+    inline void require(std::istream& in) {
+        if (!in) {
+            throw std::runtime_error("Truncated snapshot");
+        }
+    }
+
+    inline uint8_t get_u8(std::istream& in) {
+        char c = 0;
+        in.get(c);
+        require(in);
+        return static_cast<uint8_t>(c);
+    }
+
+    inline uint32_t get_u32(std::istream& in) {
+        uint32_t v = 0;
+        in.read(reinterpret_cast<char*>(&v), sizeof(v));
+        require(in);
+        return wire::to_le(v);
+    }
+
+    inline uint64_t get_u64(std::istream& in) {
+        uint64_t v = 0;
+        in.read(reinterpret_cast<char*>(&v), sizeof(v));
+        require(in);
+        return wire::to_le(v);
+    }
+
+    inline std::string get_bytes(std::istream& in) {
+        std::string s(get_u32(in), '\0');
+        in.read(&s[0], s.size());
+        require(in);
+        return s;
+    }
+}
+
+//--------------------------------------------------
+// Snapshot Files
+//--------------------------------------------------
+// The state machine's state as of a log index, streamed to disk:
+//
+//     u32 magic | u64 last_included_index | u64 last_included_term | state | u32 crc32c
+//
+// The state machine writes its state through a std::ostream, so a snapshot
+// is never held in memory as a whole. The CRC covers everything before it.
+// Files are written under a temporary name, fsynced and renamed into place,
+// so a crash mid-snapshot leaves the previous one intact. Followers receive
+// the raw file bytes in chunks and verify them before installing.
+struct SnapshotMeta {
+    uint64_t index = 0;
+    uint64_t term = 0;
+    uint64_t size = 0;      // whole file, header and CRC included
+};
+
+class SnapshotFile {
+public:
+    using Writer = std::function<void(std::ostream&)>;
+    using Reader = std::function<void(std::istream&)>;
+
+    static constexpr uint32_t MAGIC = 0x4e535a42;   // "BZSN"
+    static constexpr size_t HEADER_SIZE = sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+private:
+    // Buffered writes to an fd, CRC computed on the way through
+    class CrcFileBuf : public std::streambuf {
+        int fd;
+        std::vector<char> buffer;
+        uint32_t crc = 0;
+        uint64_t written = 0;
+
+    public:
+        explicit CrcFileBuf(int fd) : fd(fd), buffer(64 << 10) {
+            setp(buffer.data(), buffer.data() + buffer.size());
+        }
+
+        uint32_t checksum() const { return crc; }
+        uint64_t size() const { return written; }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!flush_buffer()) return traits_type::eof();
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        int sync() override { return flush_buffer() ? 0 : -1; }
+
+    private:
+        bool flush_buffer() {
+            size_t n = pptr() - pbase();
+            crc = crc32c::compute(pbase(), n, crc);
+            size_t done = 0;
+            while (done < n) {
+                ssize_t w = ::write(fd, pbase() + done, n - done);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                done += static_cast<size_t>(w);
+            }
+            written += n;
+            setp(buffer.data(), buffer.data() + buffer.size());
+            return true;
+        }
+    };
+
+public:
+    // Write a snapshot through `save` and atomically replace `path`
+    static SnapshotMeta write(const std::string& path, uint64_t index, uint64_t term,
+                              const Writer& save) {
+        SnapshotMeta meta = write_file(path + ".tmp", index, term, save);
+        install(path + ".tmp", path);
+        return meta;
+    }
+
+    // A snapshot streamed to its temporary file but not yet synced
+    struct Unsynced {
+        int fd = -1;
+        SnapshotMeta meta;
+    };
+
+    // Writes and syncs a complete snapshot at `tmp` without installing it
+    static SnapshotMeta write_file(const std::string& tmp, uint64_t index, uint64_t term,
+                                   const Writer& save) {
+        Unsynced file = stream_file(tmp, index, term, save);
+        sync_file(file, tmp);
+        return file.meta;
+    }
+
+    // Streams a complete snapshot through `save` to `tmp`; the caller owns
+    // the returned fd and passes it to sync_file()
+    static Unsynced stream_file(const std::string& tmp, uint64_t index, uint64_t term,
+                                const Writer& save) {
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create snapshot " + tmp + ": " + strerror(errno));
+        }
+
+        CrcFileBuf buf(fd);
+        std::ostream out(&buf);
+        try {
+            snapshot_io::put_u32(out, MAGIC);
+            snapshot_io::put_u64(out, index);
+            snapshot_io::put_u64(out, term);
+            save(out);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        out.flush();
+        uint32_t crc = wire::to_le(buf.checksum());
+        if (!out || ::write(fd, &crc, sizeof(crc)) != sizeof(crc)) {
+            close(fd);
+            throw std::runtime_error("Writing snapshot " + tmp + " failed");
+        }
+        return Unsynced{fd, SnapshotMeta{index, term, buf.size() + sizeof(crc)}};
+    }
+
+    // Makes a streamed snapshot durable and closes its fd
+    static void sync_file(const Unsynced& file, const std::string& tmp) {
+        bool ok = fsync(file.fd) == 0;
+        close(file.fd);
+        if (!ok) {
+            throw std::runtime_error("Syncing snapshot " + tmp + " failed");
+        }
+    }
+
+    // Atomically move a complete, verified snapshot file into place
+    static void install(const std::string& from, const std::string& path) {
+        if (rename(from.c_str(), path.c_str()) < 0) {
+            throw std::runtime_error("Cannot install snapshot " + path + ": " + strerror(errno));
+        }
+        std::string dir = path.substr(0, path.find_last_of('/') + 1);
+        int d = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (d >= 0) {
+            fsync(d);
+            close(d);
+        }
+    }
+
+    // Read the header and verify the CRC; false if missing or corrupt
+    static bool inspect(const std::string& path, SnapshotMeta& meta) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < HEADER_SIZE + sizeof(uint32_t)) {
+            close(fd);
+            return false;
+        }
+        uint64_t body = static_cast<uint64_t>(st.st_size) - sizeof(uint32_t);
+
+        std::vector<char> buf(64 << 10);
+        uint32_t crc = 0;
+        char header[HEADER_SIZE];
+        uint64_t pos = 0;
+        while (pos < body) {
+            size_t want = static_cast<size_t>(std::min<uint64_t>(buf.size(), body - pos));
+            ssize_t n = pread(fd, buf.data(), want, static_cast<off_t>(pos));
+            if (n <= 0) break;
+            if (pos == 0) std::memcpy(header, buf.data(), HEADER_SIZE);
+            crc = crc32c::compute(buf.data(), static_cast<size_t>(n), crc);
+            pos += static_cast<uint64_t>(n);
+        }
+        uint32_t stored = 0;
+        bool ok = pos == body &&
+                  pread(fd, &stored, sizeof(stored), static_cast<off_t>(body)) == sizeof(stored);
+        close(fd);
+        if (!ok || wire::to_le(stored) != crc) return false;
+
+        WireReader r(header, HEADER_SIZE);
+        if (r.get_u32() != MAGIC) return false;
+        meta.index = r.get_u64();
+        meta.term = r.get_u64();
+        meta.size = static_cast<uint64_t>(st.st_size);
+        return true;
+    }
+
+    // Stream the state part of a snapshot into `load`
+    static void load(const std::string& path, const Reader& load) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open snapshot " + path);
+        }
+        in.seekg(HEADER_SIZE);
+        load(in);
+    }
+};
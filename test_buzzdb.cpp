@@ -0,0 +1,712 @@
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include "arena.cpp"
+#include "kv_state_machine.cpp"
+
+// BuzzDB checks: Field copy/move semantics on inline and heap values,
+// tuples built in an arena reuse it across resets, rows
+// land in typed columns, bad rows are rejected whole,
+// GROUP BY matches a std::map reference on both the dense and hash paths,
+// serially and morsel-parallel,
+// the bulk loader agrees with iostream parsing at any chunk size, the
+// key-value store matches a std::map through growth, erases and
+// compaction, the B+-tree matches a std::multimap through inserts, bulk
+// loads and range scans, BuzzDB's key index answers range and ordered
+// queries, slotted pages pack and read back records, the paged table
+// matches the in-memory one through a pool of a few frames, survives a
+// reopen, drops unflushed rows, catches a corrupt page and lets scans run
+// alongside inserts, the state machine applies INSERT/UPDATE/DELETE batches, save()
+// and load() round-trip the table and pairs, and a truncated stream is
+// rejected.
+// Exits non-zero on failure.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    std::cout << (ok ? "PASS " : "FAIL ") << what << "\n";
+    if (!ok) failures++;
+}
+
+static std::string dump(const BuzzDB& db) {
+    std::ostringstream out;
+    db.save(out);
+    return out.str();
+}
+
+static void test_fields() {
+    std::string inline_str(Field::INLINE_CAPACITY, 'a');
+    std::string heap_str(Field::INLINE_CAPACITY + 1, 'b');
+    check(sizeof(Field) <= 24, "field: " + std::to_string(sizeof(Field)) + " bytes");
+
+    Field i(42), f(1.5f), s(inline_str), h(heap_str);
+    Field i2 = i, s2 = s, h2 = h;
+    check(i2.asInt() == 42 && s2.asString() == inline_str && h2.asString() == heap_str &&
+          h2.c_str() != h.c_str(), "field: copies are deep");
+
+    Field moved(std::move(h2));
+    check(moved.asString() == heap_str && h2.getType() == INT && h2.asInt() == 0,
+          "field: move steals the buffer and leaves an empty INT");
+
+    // Assignment across every combination of inline and heap storage
+    std::vector<Field> values{i, f, s, h};
+    bool assigned = true;
+    for (const auto& from : values) {
+        for (const auto& to : values) {
+            Field a = to;
+            a = from;
+            Field b = to;
+            Field c = from;
+            b = std::move(c);
+            assigned = assigned && a == from && b == from;
+        }
+    }
+    Field& self = moved;
+    moved = self;
+    moved = std::move(self);
+    check(assigned && moved.asString() == heap_str, "field: copy and move assignment, self included");
+
+    Tuple tuple(2);
+    tuple.addField(7);
+    tuple.addField("buzzdb");
+    std::vector<Tuple> tuples;
+    for (int n = 0; n < 100; n++) tuples.push_back(tuple);   // regrowth moves the Fields
+    check(tuples[99].getField(1).asStringView() == "buzzdb" && tuples[0].getField(0) == Field(7),
+          "field: tuples hold fields by value");
+
+    Arena arena(1024);
+    std::string long_str(100, 'y');
+    size_t warm = 0;
+    bool same = true;
+    for (int round = 0; round < 3; round++) {
+        for (int n = 0; n < 200; n++) {
+            Tuple scratch(2, arena.resource());
+            scratch.addField(n);
+            scratch.addField(long_str);
+            same = same && scratch.getField(0) == Field(n) && scratch.getField(1).asStringView() == long_str;
+        }
+        arena.reset();
+        if (round == 0) warm = arena.upstream().allocations;
+    }
+    check(same && warm > 0 && arena.upstream().allocations == warm,
+          "field: arena tuples, no heap calls once the arena is warm");
+}
+
+static void test_columns() {
+    ColumnTable table(Schema{{"id", INT}, {"name", STRING}, {"weight", FLOAT}});
+    table.append(1, "one", 1.5f);
+    table.append(2, "", 2.5f);
+    table.append(3, std::string("three"), 3.5f);
+    check(table.rows() == 3 && table.ints(0)[2] == 3 && table.floats(2)[1] == 2.5f,
+          "columns: values stored by column");
+    check(table.strings(1)[0] == "one" && table.strings(1)[1].empty() &&
+          table.strings(1)[2] == "three" && table.strings(1).arena_bytes() == 8,
+          "columns: strings packed into one arena");
+
+    bool threw = false;
+    try {
+        table.append(4, 5, 6.0f);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw && table.rows() == 3 && table.ints(0).size() == 3 && table.strings(1).size() == 3,
+          "columns: mistyped row rejected without partial writes");
+}
+
+static GroupByResult reference(const std::vector<int32_t>& keys, const std::vector<int32_t>& values) {
+    std::map<int32_t, GroupAggregate> groups;
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto it = groups.try_emplace(keys[i], GroupAggregate{keys[i], 0, 0, INT_MAX, INT_MIN}).first;
+        it->second.sum += values[i];
+        it->second.count++;
+        it->second.min = std::min(it->second.min, values[i]);
+        it->second.max = std::max(it->second.max, values[i]);
+    }
+    GroupByResult result;
+    for (auto& pair : groups) result.groups.push_back(pair.second);
+    return result;
+}
+
+static void test_group_by(const std::string& name, int32_t lo, uint32_t span, bool dense,
+                          GroupByOptions options = GroupByOptions()) {
+    std::mt19937 rng(42);
+    std::vector<int32_t> keys(100000), values(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = static_cast<int32_t>(static_cast<uint32_t>(lo) + rng() % span);
+        values[i] = static_cast<int32_t>(rng());
+    }
+    GroupByResult result = group_by(keys.data(), values.data(), keys.size(), options);
+    GroupByResult expected = reference(keys, values);
+    check(result.dense == dense, "group by " + name + ": took the " + (dense ? "dense" : "hash") + " path");
+    check(result.groups == expected.groups, "group by " + name + ": matches reference");
+
+    WorkerPool pool(4);
+    options.morsel_rows = 1000;
+    result = parallel_group_by(pool, keys.data(), values.data(), keys.size(), options);
+    check(result.dense == dense && result.groups == expected.groups,
+          "group by " + name + ": parallel matches reference");
+}
+
+static void test_aggregates() {
+    test_group_by("small range", -50, 100, true);
+    test_group_by("wide range", INT_MIN, UINT32_MAX, false);
+    test_group_by("many keys", 0, 60000, true);
+    GroupByOptions no_dense;
+    no_dense.dense_max_span = 0;
+    test_group_by("hash only", -50, 100, false, no_dense);
+
+    BuzzDB db;
+    for (int i = 0; i < 4; i++) {
+        db.insert(7, INT_MAX);
+        db.insert(-3, i - 2);
+    }
+    GroupByResult result = db.selectGroupBySum();
+    const GroupAggregate* seven = result.find(7);
+    const GroupAggregate* minus3 = result.find(-3);
+    check(result.groups.size() == 2 && seven && seven->sum == 4ll * INT_MAX && seven->count == 4,
+          "group by: 64-bit sums don't overflow");
+    check(minus3 && minus3->min == -2 && minus3->max == 1 && minus3->avg() == -0.5 &&
+          !result.find(0), "group by: min, max and avg");
+    check(BuzzDB().selectGroupBySum().groups.empty(), "group by: empty table");
+
+    WorkerPool pool(3);
+    bool threw = false;
+    try {
+        pool.run([](size_t worker) {
+            if (worker == 2) throw std::runtime_error("worker failed");
+        });
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    std::atomic<size_t> ran{0};
+    pool.run([&](size_t) { ran++; });
+    check(threw && ran == 3, "worker pool: errors reach the caller, pool stays usable");
+}
+
+static void test_bulk_load() {
+    char path[] = "/tmp/buzz_load_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        check(false, "bulk load: temp file");
+        return;
+    }
+    close(fd);
+    {
+        std::ofstream out(path);
+        std::mt19937 rng(7);
+        for (int i = 0; i < 20000; i++) {
+            int key = static_cast<int>(rng() % 2000) - 1000;
+            int value = static_cast<int>(rng());
+            switch (i % 4) {
+                case 0: out << key << " " << value << "\n"; break;
+                case 1: out << "  " << key << "\t" << value << "\r\n"; break;
+                case 2: out << key << "   " << value << "\n\n"; break;
+                default: out << (key >= 0 ? "+" : "") << key << " " << value << "\n"; break;
+            }
+        }
+        out << INT_MIN << " " << INT_MAX;     // no trailing newline
+    }
+
+    std::vector<int32_t> keys, values;
+    {
+        std::ifstream in(path);
+        std::string a, b;
+        while (in >> a >> b) {
+            keys.push_back(std::stoi(a));
+            values.push_back(std::stoi(b));
+        }
+    }
+
+    WorkerPool pool(4);
+    for (size_t chunk : {size_t(1), size_t(100), size_t(4096), BulkLoader::DEFAULT_CHUNK_BYTES}) {
+        for (WorkerPool* p : {static_cast<WorkerPool*>(nullptr), &pool}) {
+            BuzzDB db;
+            LoadStats stats = BulkLoader::load(
+                path, [&](const int32_t* k, const int32_t* v, size_t n) { db.insertBatch(k, v, n); },
+                p, chunk);
+            check(stats.rows == keys.size() && db.table.ints(0) == keys && db.table.ints(1) == values &&
+                  db.table.strings(3).size() == keys.size(),
+                  "bulk load: " + std::string(p ? "parallel" : "serial") + " chunk=" +
+                  std::to_string(chunk) + " matches iostream");
+        }
+    }
+
+    {
+        std::ofstream out(path);
+        out << "1 2\n3 x4\n";
+    }
+    bool threw = false;
+    try {
+        BuzzDB().loadFile(path);
+    } catch (const std::runtime_error& e) {
+        threw = std::string(e.what()).find("byte 6") != std::string::npos;
+    }
+    check(threw, "bulk load: malformed line reported with its offset");
+    std::remove(path);
+}
+
+// Small nodes, so a few thousand keys make a tree several levels deep
+template <size_t NodeBytes>
+static void test_btree(const std::string& name) {
+    using Tree = BTree<int32_t, uint32_t, NodeBytes>;
+    std::multimap<int32_t, uint32_t> reference;
+    std::mt19937 rng(5);
+    auto matches = [&](const Tree& tree) {
+        bool same = tree.size() == reference.size();
+        auto it = reference.begin();
+        tree.for_each([&](int32_t key, uint32_t value) {
+            same = same && it != reference.end() && it->first == key && it->second == value;
+            ++it;
+        });
+        for (int q = 0; q < 500 && same; q++) {
+            int32_t lo = static_cast<int32_t>(rng() % 2200) - 100;
+            int32_t hi = lo + static_cast<int32_t>(rng() % 300);
+            auto ref = reference.lower_bound(lo);
+            size_t n = tree.scan(lo, hi, [&](int32_t key, uint32_t value) {
+                same = same && ref != reference.end() && ref->first == key && ref->second == value;
+                ++ref;
+            });
+            same = same && n == static_cast<size_t>(std::distance(reference.lower_bound(lo),
+                                                                  reference.upper_bound(hi)));
+            const uint32_t* found = tree.find(lo);
+            auto first = reference.find(lo);
+            same = same && (first == reference.end() ? !found : found && *found == first->second);
+        }
+        return same;
+    };
+
+    // Random keys with many duplicates
+    Tree tree;
+    for (uint32_t i = 0; i < 20000; i++) {
+        int32_t key = static_cast<int32_t>(rng() % 2000);
+        tree.insert(key, i);
+        reference.emplace(key, i);
+    }
+    check(matches(tree) && tree.height() > 2, "btree " + name + ": random inserts match std::multimap (height " +
+          std::to_string(tree.height()) + ")");
+
+    // Bulk load, then inserts on top
+    std::vector<int32_t> keys;
+    std::vector<uint32_t> values;
+    for (const auto& kv : reference) {
+        keys.push_back(kv.first);
+        values.push_back(kv.second);
+    }
+    Tree loaded;
+    loaded.bulk_load(keys.data(), values.data(), keys.size());
+    bool same = matches(loaded);
+    for (uint32_t i = 20000; i < 30000; i++) {
+        int32_t key = static_cast<int32_t>(rng() % 2200) - 100;
+        loaded.insert(key, i);
+        reference.emplace(key, i);
+    }
+    check(same && matches(loaded), "btree " + name + ": bulk load, then inserts, match std::multimap");
+
+    // Ascending keys leave full nodes
+    Tree ascending;
+    for (uint32_t i = 0; i < 100000; i++) ascending.insert(static_cast<int32_t>(i), i);
+    size_t leaf_bytes = 100000 / Tree::LEAF_CAPACITY * (sizeof(int32_t) + sizeof(uint32_t)) * Tree::LEAF_CAPACITY;
+    auto c = ascending.lower_bound(99990);
+    size_t tail = 0;
+    for (; c.valid(); c.next()) tail++;
+    check(ascending.memory_bytes() < leaf_bytes * 3 / 2 && tail == 10 && !ascending.find(100000),
+          "btree " + name + ": ascending inserts fill nodes");
+
+    bool threw = false;
+    int32_t unsorted[] = {1, 3, 2};
+    uint32_t rows[] = {0, 1, 2};
+    try {
+        loaded.bulk_load(unsorted, rows, 3);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "btree " + name + ": unsorted bulk load rejected");
+}
+
+static void test_key_index() {
+    BuzzDB db;
+    std::mt19937 rng(9);
+    std::vector<std::pair<int32_t, int32_t>> rows;
+    for (int i = 0; i < 5000; i++) {
+        rows.emplace_back(static_cast<int32_t>(rng() % 400) - 200, i);
+        db.insert(rows.back().first, rows.back().second);
+    }
+    bool threw = false;
+    try {
+        db.selectRange(0, 1, [](int32_t, int32_t) {});
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "key index: range query without an index rejected");
+
+    db.createKeyIndex();
+    for (int i = 5000; i < 6000; i++) {
+        rows.emplace_back(static_cast<int32_t>(rng() % 400) - 200, i);
+        db.insert(rows.back().first, rows.back().second);
+    }
+    // Rows in key order, equal keys in insertion order
+    std::stable_sort(rows.begin(), rows.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    auto expect_range = [&](int32_t lo, int32_t hi) {
+        std::vector<std::pair<int32_t, int32_t>> got, want;
+        db.selectRange(lo, hi, [&](int32_t key, int32_t value) { got.emplace_back(key, value); });
+        for (const auto& row : rows) {
+            if (row.first >= lo && row.first <= hi) want.push_back(row);
+        }
+        return got == want;
+    };
+    check(expect_range(-10, 10) && expect_range(-500, -150) && expect_range(199, 199) && expect_range(5, 4),
+          "key index: range queries in key order, with rows inserted after it was built");
+
+    std::vector<std::pair<int32_t, int32_t>> ordered;
+    db.scanOrdered([&](int32_t key, int32_t value) { ordered.emplace_back(key, value); });
+    check(ordered == rows, "key index: ordered iteration covers every row");
+
+    std::ostringstream out;
+    db.save(out);
+    BuzzDB copy;
+    copy.createKeyIndex();
+    std::istringstream in(out.str());
+    copy.load(in);
+    size_t n = copy.selectRange(INT32_MIN, INT32_MAX, [](int32_t, int32_t) {});
+    check(n == rows.size() && copy.keyIndex().size() == rows.size(), "key index: rebuilt on snapshot load");
+}
+
+static void test_slotted_page() {
+    std::vector<char> page(PAGE_SIZE, 0);
+    std::vector<std::string> records;
+    std::mt19937 rng(5);
+    while (true) {
+        std::string r(rng() % 200, static_cast<char>('a' + records.size() % 26));
+        if (!slotted_page::fits(page.data(), r.size())) break;
+        slotted_page::append(page.data(), r.data(), r.size());
+        records.push_back(r);
+    }
+    bool same = slotted_page::slot_count(page.data()) == records.size();
+    for (uint16_t i = 0; same && i < records.size(); i++) same = slotted_page::record(page.data(), i) == records[i];
+    check(same && slotted_page::free_space(page.data()) < 200, "slotted page: " + std::to_string(records.size()) +
+          " records fill the page and read back");
+
+    slotted_page::truncate(page.data(), 3);
+    std::string next(50, 'z');
+    slotted_page::append(page.data(), next.data(), next.size());
+    check(slotted_page::slot_count(page.data()) == 4 && slotted_page::record(page.data(), 2) == records[2] &&
+          slotted_page::record(page.data(), 3) == next, "slotted page: truncate, then append reuses the space");
+}
+
+static std::string temp_path(const char* what) {
+    char path[] = "/tmp/buzz_pages_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        check(false, std::string(what) + ": temp file");
+        return "";
+    }
+    close(fd);
+    std::remove(path);
+    return path;
+}
+
+// A pool of a few pages over a table of hundreds, so nearly every page
+// read is a miss and every page written is evicted
+static void test_paged_table() {
+    std::string path = temp_path("paged");
+    if (path.empty()) return;
+    std::vector<int32_t> keys, values;
+    std::mt19937 rng(11);
+    for (int i = 0; i < 100000; i++) {
+        keys.push_back(static_cast<int32_t>(rng() % 3000) - 1500);
+        values.push_back(static_cast<int32_t>(rng()));
+    }
+    BuzzDB memory;
+    memory.insertBatch(keys.data(), values.data(), keys.size());
+
+    {
+        BuzzDB db;
+        db.open(path, 8);
+        db.insertBatch(keys.data(), values.data(), 60000);
+        for (size_t i = 60000; i < keys.size(); i++) db.insert(keys[i], values[i]);
+        BufferPool::Stats stats = db.pagedTable()->buffer_pool().stats();
+        check(db.rows() == keys.size() && db.pagedTable()->data_pages() > 200 && stats.evictions > 200,
+              "paged table: " + std::to_string(db.pagedTable()->data_pages()) + " pages through 8 frames");
+
+        std::vector<int32_t> scanned_keys, scanned_values;
+        bool tags = true;
+        db.pagedTable()->scan([&](int32_t key, int32_t value, float score, std::string_view tag) {
+            scanned_keys.push_back(key);
+            scanned_values.push_back(value);
+            tags = tags && score == 132.04f && tag == "buzzdb";
+        });
+        check(scanned_keys == keys && scanned_values == values && tags, "paged table: scan returns rows in order");
+        check(db.selectGroupBySum().groups == memory.selectGroupBySum().groups,
+              "paged table: group by matches the in-memory table");
+        check(db.pagedTable()->buffer_pool().stats().read_ahead > 0, "paged table: sequential scans read ahead");
+
+        std::ostringstream paged_out, memory_out;
+        db.save(paged_out);
+        memory.save(memory_out);
+        check(paged_out.str() == memory_out.str(), "paged table: snapshot matches the in-memory one");
+
+        // Loaded back in chunks, through a stream that is read out of order
+        std::string copy_path = temp_path("paged snapshot");
+        if (!copy_path.empty()) {
+            BuzzDB copy;
+            copy.open(copy_path, 8);
+            std::istringstream in(paged_out.str());
+            copy.load(in);
+            std::ostringstream copy_out;
+            copy.save(copy_out);
+            check(copy.rows() == keys.size() && copy_out.str() == memory_out.str() &&
+                  copy.selectGroupBySum().groups == memory.selectGroupBySum().groups,
+                  "paged table: snapshot loads back into an empty paged table");
+            copy.close();
+            std::remove(copy_path.c_str());
+        }
+
+        bool threw = false;
+        try {
+            db.createKeyIndex();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        check(threw, "paged table: key index rejected");
+    }
+
+    // Warm restart, with more threads than the pool has spare frames
+    {
+        BuzzDB db;
+        db.setThreads(4);
+        db.open(path, 16);
+        check(db.rows() == keys.size() && db.selectGroupBySum().groups == memory.selectGroupBySum().groups,
+              "paged table: rows back after reopening");
+    }
+
+    // Rows written after the last flush are forgotten, even if evicted
+    {
+        auto* crashed = new PagedTable(path, 4);
+        for (int i = 0; i < 20000; i++) crashed->insert(i, i, 1.0f, "lost");
+        // No flush and no destructor, as after a crash
+        PagedTable reopened(path, 4);
+        uint64_t seen = 0;
+        bool same = true;
+        reopened.scan([&](int32_t key, int32_t value, float, std::string_view) {
+            same = same && seen < keys.size() && key == keys[seen] && value == values[seen];
+            seen++;
+        });
+        check(reopened.rows() == keys.size() && seen == keys.size() && same,
+              "paged table: unflushed rows dropped on reopen");
+    }
+
+    // A torn write of the rows after a flush costs only those rows
+    {
+        auto* crashed = new PagedTable(path, 4);
+        for (int i = 0; i < 10; i++) crashed->insert(i, i, 1.0f, "torn");
+        crashed->buffer_pool().flush();     // as eviction might, any time
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(0, std::ios::end);
+        file.seekp(static_cast<std::streamoff>(file.tellg()) - PAGE_SIZE / 2);
+        file.put('\x7f');
+    }
+    try {
+        PagedTable reopened(path, 4);
+        uint64_t seen = 0;
+        bool same = true;
+        reopened.scan([&](int32_t key, int32_t value, float, std::string_view) {
+            same = same && seen < keys.size() && key == keys[seen] && value == values[seen];
+            seen++;
+        });
+        check(reopened.rows() == keys.size() && seen == keys.size() && same,
+              "paged table: torn page after a flush dropped on reopen");
+    } catch (const std::exception& e) {
+        check(false, std::string("paged table: torn page after a flush dropped on reopen (") + e.what() + ")");
+    }
+
+    // Corrupt one byte of a data page: reported, not parsed
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(5 * PAGE_SIZE + 100);
+        file.put('\x7f');
+    }
+    {
+        PagedTable table(path, 4);
+        bool threw = false;
+        try {
+            table.scan([](int32_t, int32_t, float, std::string_view) {});
+        } catch (const std::runtime_error& e) {
+            threw = std::string(e.what()).find("corrupt") != std::string::npos;
+        }
+        check(threw, "paged table: checksum mismatch detected");
+    }
+    std::remove(path.c_str());
+}
+
+// One thread appending while others scan: every scan sees a prefix of
+// the rows, in order
+static void test_paged_concurrency() {
+    std::string path = temp_path("paged concurrency");
+    if (path.empty()) return;
+    PagedTable table(path, 16);
+    const int total = 60000;
+    std::atomic<bool> done{false};
+    std::atomic<int> bad{0}, scans{0};
+    std::thread writer([&] {
+        int32_t keys[100], values[100];
+        for (int base = 0; base < total; base += 100) {
+            for (int i = 0; i < 100; i++) keys[i] = values[i] = base + i;
+            table.insert_batch(keys, values, 100, 0.5f, "concurrent");
+        }
+        done = true;
+    });
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 2; r++) {
+        readers.emplace_back([&] {
+            while (!done) {
+                int32_t expect = 0;
+                table.scan([&](int32_t key, int32_t value, float, std::string_view tag) {
+                    if (key != expect || value != expect || tag != "concurrent") bad++;
+                    expect++;
+                });
+                scans++;
+            }
+        });
+    }
+    writer.join();
+    for (auto& t : readers) t.join();
+    uint64_t sum = 0;
+    table.scan_columns([&](const int32_t* keys, const int32_t*, size_t n) {
+        for (size_t i = 0; i < n; i++) sum += keys[i];
+    });
+    check(bad == 0 && table.rows() == total && sum == uint64_t(total) * (total - 1) / 2,
+          "paged table: " + std::to_string(scans.load()) + " scans alongside inserts saw consistent prefixes");
+    std::remove(path.c_str());
+}
+
+static void test_kv() {
+    KvStore kv(4);
+    std::map<std::string, std::string> reference;
+    std::mt19937 rng(11);
+    bool same = true;
+    size_t peak_arena = 0;
+    for (int i = 0; i < 300000; i++) {
+        std::string key = "key" + std::to_string(rng() % 3000);
+        switch (rng() % 4) {
+            case 0:
+            case 1: {
+                std::string value(rng() % 48, static_cast<char>('a' + i % 26));
+                bool fresh = kv.put(key, value);
+                same = same && fresh == (reference.count(key) == 0);
+                reference[key] = value;
+                break;
+            }
+            case 2:
+                same = same && kv.erase(key) == (reference.erase(key) == 1);
+                break;
+            default: {
+                auto value = kv.get(key);
+                auto it = reference.find(key);
+                same = same && (it == reference.end() ? !value : value && *value == it->second);
+            }
+        }
+        peak_arena = std::max(peak_arena, kv.arena_bytes());
+    }
+    same = same && kv.size() == reference.size();
+    size_t visited = 0;
+    kv.for_each([&](std::string_view key, std::string_view value) {
+        auto it = reference.find(std::string(key));
+        same = same && it != reference.end() && it->second == value;
+        visited++;
+    });
+    check(same && visited == reference.size(), "kv: matches std::map through puts, erases and growth");
+    check(peak_arena < 4u << 20, "kv: overwritten records are compacted away");
+
+    std::ostringstream out;
+    kv.save(out);
+    KvStore copy;
+    copy.put("stale", "x");
+    std::istringstream in(out.str());
+    copy.load(in);
+    bool restored = copy.size() == kv.size() && !copy.get("stale");
+    kv.for_each([&](std::string_view key, std::string_view value) {
+        restored = restored && copy.get(key) == value;
+    });
+    check(restored, "kv: save and load round-trip");
+
+    // Commands as they arrive from the log, one leader no-op included
+    auto entry = [](ClientRequest::Type type, const std::string& key, const std::string& value) {
+        ClientRequest req{type, key, value, 1, 1};
+        std::string data(wire_encoded_size(req), '\0');
+        wire_encode(req, &data[0], data.size());
+        return LogEntry{1, data, 1, 1};
+    };
+    std::vector<LogEntry> log{
+        LogEntry{1, "", 0, 0},
+        entry(ClientRequest::Type::INSERT, "a", "1"),
+        entry(ClientRequest::Type::INSERT, "b", "2"),
+        entry(ClientRequest::Type::UPDATE, "a", "one"),
+        entry(ClientRequest::Type::UPDATE, "zz", "3"),
+        entry(ClientRequest::Type::DELETE, "b", ""),
+        entry(ClientRequest::Type::DELETE, "b", ""),
+        LogEntry{1, "\x01\x09", 1, 1},
+    };
+    std::vector<const LogEntry*> batch;
+    for (const auto& e : log) batch.push_back(&e);
+    BuzzDB db;
+    KvStateMachine state(db);
+    state.apply(1, batch.data(), 4);
+    state.apply(5, batch.data() + 4, batch.size() - 4);
+    const auto& stats = state.stats();
+    check(state.get("a") == std::string_view("one") && !state.get("b") && !state.get("zz") &&
+          db.kv.size() == 1, "kv state machine: insert, update and delete applied");
+    check(stats.applied == 6 && stats.inserts == 2 && stats.updates == 1 && stats.deletes == 1 &&
+          stats.misses == 2 && stats.malformed == 1, "kv state machine: no-ops, misses and bad entries counted");
+}
+
+int main() {
+    test_fields();
+    test_columns();
+    test_aggregates();
+    test_bulk_load();
+    test_btree<128>("small nodes");
+    test_btree<512>("default nodes");
+    test_key_index();
+    test_slotted_page();
+    test_paged_table();
+    test_paged_concurrency();
+    test_kv();
+
+    BuzzDB db;
+    for (int i = 0; i < 1000; i++) {
+        db.insert(i % 37, i * 3 - 500);
+        db.kv.put("k" + std::to_string(i % 50), std::to_string(i));
+    }
+    std::string saved = dump(db);
+
+    BuzzDB copy;
+    copy.insert(99, 99);
+    std::istringstream in(saved);
+    copy.load(in);
+    check(copy.table.rows() == 1000 && copy.kv.size() == 50 && copy.kv.get("k7") == std::string_view("957"),
+          "buzzdb: table and pairs restored");
+    check(dump(copy) == saved, "buzzdb: identical state after a round trip");
+    check(copy.getTuple(5).getField(3).asString() == "buzzdb" &&
+          copy.getTuple(5).getField(1).asInt() == 15 - 500 && copy.table.floats(2)[5] == 132.04f,
+          "buzzdb: field types and values restored");
+
+    bool threw = false;
+    try {
+        std::istringstream cut(saved.substr(0, saved.size() / 2));
+        BuzzDB partial;
+        partial.load(cut);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "buzzdb: truncated snapshot rejected");
+
+    std::cout << (failures == 0 ? "All BuzzDB checks passed\n" : "BuzzDB checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -1,132 +1,136 @@
+#include <atomic>
 #include <iostream>
+#include <random>
 #include <thread>
 #include <functional>
-#include "network_manager.cpp"
+#include "kv_state_machine.cpp"
+#include "raft.cpp"
 
+// Interactive cluster member: a RaftNode replicating key-value commands
+// into a BuzzDB, plus a few console commands
 class Node {
     int node_id;
     NetworkManager network;
+    RaftNode raft;
+    BuzzDB db;      // touched only on the loop thread
+    KvStateMachine state{db};
+    uint64_t client_id;     // fresh per run: request ids restart at 1
+    std::atomic<uint64_t> next_request{1};
 
 public:
-    Node(int id) : node_id(id), network(id, 5000) {
-        // Register message handlers with sender IDs
-        network.set_on_request_vote([this](int sender_id, const RequestVoteRequest& req) {
-            handle_vote_request(sender_id, req);
-        });
+    Node(const ClusterConfig& config, int id, TransportKind transport) :
+        node_id(id), network(config, id, WireFormat::BINARY, transport),
+        raft(network, options_for(id)), client_id(std::random_device{}() ^ (uint64_t(std::random_device{}()) << 32)) {
 
-        network.set_on_vote_reply([this](int sender_id, const RequestVoteResponse& res) {
-            handle_vote_response(sender_id, res);
+        raft.set_on_apply_batch([this](uint64_t first, const LogEntry* const* entries, size_t count) {
+            state.apply(first, entries, count);
+            LOG_DEBUG("[Node " << node_id << "] Applied " << first << ".." << first + count - 1);
         });
-
-        network.set_on_append_entries([this](int sender_id, const AppendEntriesRequest& req) {
-            handle_append_entries(sender_id, req);
+        raft.set_read_handler([this](const std::string& key, std::string& value) {
+            auto found = state.get(key);
+            if (found) value.assign(*found);
+            return found.has_value();
         });
-
-        network.set_on_client_request([this](int sender_id, const ClientRequest& req) {
-            handle_client_request(sender_id, req);
+        raft.set_snapshot_handlers([this](std::ostream& out) { db.save(out); },
+                                   [this](std::istream& in) { db.load(in); });
+
+        // Answers to requests this node forwarded to the leader
+        network.set_on_client_response([this](int from, const ClientResponse& res) {
+            LOG_INFO("[Node " << node_id << "] Request " << res.request_id << " from node "
+                     << network.id_of(from) << ": "
+                     << (res.success ? (res.value.empty() ? "OK" : "\"" + res.value + "\"") : res.error));
         });
 
         network.start();
     }
 
-    void handle_vote_request(int sender_id, const RequestVoteRequest& req) {
-        std::cout << "[Node " << node_id << "] Received vote request from node "
-                  << sender_id << " (term " << req.term << ")\n";
-
-        RequestVoteResponse res;
-        res.term = req.term + 1;  // Simplified term handling
-        res.vote_granted = true;
-
-        // Send response back to the requesting node
-        network.send_to(sender_id, res);
+    // Safe to call from any thread
+    void send_vote_request() {
+        raft.campaign();
     }
 
-    void handle_vote_response(int sender_id, const RequestVoteResponse& res) {
-        std::cout << "[Node " << node_id << "] Received vote response from node "
-                  << sender_id << ": " << (res.vote_granted ? "GRANTED" : "DENIED")
-                  << " for term " << res.term << "\n";
+    // Safe to call from any thread
+    void send_client_request(ClientRequest::Type type, const std::string& key, const std::string& value) {
+        ClientRequest req;
+        req.type = type;
+        req.key = key;
+        req.value = value;
+        req.client_id = client_id;
+        req.request_id = next_request++;
+        raft.submit(req);
     }
 
-    void handle_append_entries(int sender_id, const AppendEntriesRequest& req) {
-        std::cout << "[Node " << node_id << "] Received append entries from node "
-                  << sender_id << " (term " << req.term << ") with "
-                  << req.entries.size() << " entries\n";
-
-        // Process entries and send response
-        AppendEntriesResponse res;
-        res.term = req.term;
-        res.success = true;
-        network.send_to(sender_id, res);
+    RaftStatus status() {
+        return raft.status();
     }
 
-    void handle_client_request(int sender_id, const ClientRequest& req) {
-        std::cout << "[Node " << node_id << "] Received client request from node "
-                  << sender_id << ": " << req.key << " = " << req.value << "\n";
+    // Served by this node: linearizable, or within max_lag entries of the
+    // leader's commit index if one is given
+    std::string get(const std::string& key, uint64_t max_lag = ClientRequest::LINEARIZABLE) {
+        std::promise<ClientResponse> result;
+        raft.get(key, [&](const ClientResponse& res) { result.set_value(res); }, max_lag);
+        ClientResponse res = result.get_future().get();
+        if (!res.success) return res.error;
+        return "\"" + res.value + "\" (applied index " + std::to_string(res.applied_index) + ")";
+    }
 
-        // Process client request and send response
-        ClientResponse res;
-        res.success = true;
-        res.leader_hint = false;
-        network.send_to(sender_id, res);
+    ~Node() {
+        network.stop();
     }
 
-    void send_vote_request() {
-        RequestVoteRequest req;
-        req.term = 1;
-        req.candidate_id = node_id;
-        req.last_log_index = 0;
-        req.last_log_term = 0;
-
-        // Send to all other nodes
-        for(int i = 0; i < 3; i++) {
-            if(i != node_id) {
-                std::cout << "[Node " << node_id << "] Sending vote request to node " << i << "\n";
-                network.send_to(i, req);
-            }
-        }
+private:
+    // Term, vote, log and snapshots survive restarts in ./node<id>_wal
+    static RaftOptions options_for(int id) {
+        RaftOptions options;
+        options.data_dir = "node" + std::to_string(id) + "_wal";
+        options.snapshot_threshold = 1000;
+        return options;
     }
+};
 
-    void send_client_request(const std::string& key, const std::string& value) {
-        ClientRequest req;
-        req.type = ClientRequest::Type::INSERT;
-        req.key = key;
-        req.value = value;
-        req.client_id = 1;
-        req.request_id = time(nullptr);
-
-        // Broadcast to all nodes
-        for(int i = 0; i < 3; i++) {
-            if(i != node_id) {
-                std::cout << "[Node " << node_id << "] Sending client request to node " << i << "\n";
-                network.send_to(i, req);
-            }
-        }
+int main(int argc, char* argv[]) {
+    if(argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <node_id> [udp|tcp] [cluster_config]\n";
+        return 1;
     }
 
-    ~Node() {
-        network.stop();
+    TransportKind transport = TransportKind::UDP;
+    if(argc >= 3) {
+        std::string kind = argv[2];
+        if(kind == "tcp") transport = TransportKind::STREAM;
+        else if(kind != "udp") {
+            std::cerr << "Unknown transport '" << kind << "'. Use udp or tcp\n";
+            return 1;
+        }
     }
-};
 
-int main(int argc, char* argv[]) {
-    if(argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <node_id(0-2)>\n";
+    // Without a config file: three local nodes on ports 5000-5002
+    ClusterConfig config;
+    try {
+        config = argc == 4 ? ClusterConfig::load(argv[3]) : ClusterConfig::local(3);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
         return 1;
     }
 
     int node_id = std::stoi(argv[1]);
-    if(node_id < 0 || node_id > 2) {
-        std::cerr << "Invalid node ID. Must be 0-2\n";
+    if(config.slot_of(node_id) < 0) {
+        std::cerr << "Invalid node ID. Not a member of the cluster config\n";
         return 1;
     }
 
-    Node node(node_id);
+    Node node(config, node_id, transport);
 
     std::cout << "\n=== Node " << node_id << " Operational ===\n"
               << "Commands:\n"
               << "1. vote    - Request votes from other nodes\n"
               << "2. insert <key> <value> - Store key-value pair\n"
-              << "3. exit    - Shutdown node\n\n";
+              << "3. update <key> <value> - Overwrite an existing key\n"
+              << "4. delete <key> - Remove a key\n"
+              << "5. get <key> [max_lag] - Read on this node, stale by at most max_lag entries if given\n"
+              << "6. status  - Show role, term and log indices\n"
+              << "7. stats   - Dump counters and latency histograms\n"
+              << "8. exit    - Shutdown node\n\n";
 
     std::string command;
     while(true) {
@@ -138,17 +142,39 @@ int main(int argc, char* argv[]) {
         if(command == "vote") {
             node.send_vote_request();
         }
-        else if(command.find("insert ") == 0) {
+        else if(command == "status") {
+            RaftStatus st = node.status();
+            std::cout << (st.leader ? "leader" : "follower") << " term=" << st.term
+                      << " leader=" << st.leader_id << " last=" << st.last_index
+                      << " commit=" << st.commit_index << " applied=" << st.last_applied
+                      << " snapshot=" << st.snapshot_index << "\n";
+        }
+        else if(command == "stats") {
+            Metrics::instance().dump(std::cout);
+        }
+        else if(command.find("insert ") == 0 || command.find("update ") == 0) {
             size_t space1 = command.find(' ');
             size_t space2 = command.find(' ', space1 + 1);
 
             if(space1 != std::string::npos && space2 != std::string::npos) {
                 std::string key = command.substr(space1 + 1, space2 - space1 - 1);
                 std::string value = command.substr(space2 + 1);
-                node.send_client_request(key, value);
+                auto type = command[0] == 'i' ? ClientRequest::Type::INSERT : ClientRequest::Type::UPDATE;
+                node.send_client_request(type, key, value);
             }
             else {
-                std::cerr << "Invalid format. Use: insert <key> <value>\n";
+                std::cerr << "Invalid format. Use: " << command.substr(0, 6) << " <key> <value>\n";
+            }
+        }
+        else if(command.find("delete ") == 0) {
+            node.send_client_request(ClientRequest::Type::DELETE, command.substr(7), "");
+        }
+        else if(command.find("get ") == 0) {
+            size_t space = command.find(' ', 4);
+            if (space == std::string::npos) {
+                std::cout << node.get(command.substr(4)) << "\n";
+            } else {
+                std::cout << node.get(command.substr(4, space - 4), std::stoull(command.substr(space + 1))) << "\n";
             }
         }
         else {
@@ -0,0 +1,743 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include "multi_raft.cpp"
+
+// Log replication checks. A three-node cluster runs in this process on base
+// port 7200: two members commit a batch, the third joins late and must be
+// caught up through conflict_index backtracking, then all three must have
+// applied the same entries in the same order, whether they take them one at
+// a time or in batches. A cluster restarted from its
+// write-ahead logs must come back with the same log. With snapshots on, a
+// late node must be caught up through InstallSnapshot and a restart must
+// resume from the snapshot. Reads under ReadIndex and under leases, on the
+// leader and on followers, must see every write committed before them
+// without appending to the log; bounded-staleness reads are served by the
+// follower alone. A partitioned leader whose election timeout is staggered
+// above the others' must lose its lease before they elect a new leader,
+// and serve no bounded-staleness reads either.
+// Client retries must be applied once and must not grow
+// the log, and a request that expires in the log must be answered as
+// failed. Under Multi-Raft, group leaders must be spread over the nodes and
+// stay spread when one fails, every shard must apply the same writes in the
+// same order everywhere, and a restart must recover all groups from the one
+// shared WAL. Exits non-zero on failure.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    std::cout << (ok ? "PASS " : "FAIL ") << what << "\n";
+    if (!ok) failures++;
+}
+
+template <typename Pred>
+static bool wait_for(Pred pred, int timeout_ms = 10000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (pred()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return pred();
+}
+
+static void test_log() {
+    RaftLog log;
+    for (uint64_t term : {1, 1, 2, 2, 2, 3}) {
+        log.append(LogEntry{term, "x", 0, 0});
+    }
+    check(log.last_index() == 6 && log.last_term() == 3, "log: append");
+    check(log.matches(0, 0) && log.matches(4, 2) && !log.matches(4, 1) && !log.matches(7, 3),
+          "log: consistency check");
+    check(log.conflict_index(9) == 7, "log: short follower resumes past its end");
+    check(log.conflict_index(5) == 3, "log: conflict skips back a whole term");
+    check(log.up_to_date(6, 3) && log.up_to_date(1, 4) && !log.up_to_date(9, 2),
+          "log: candidate up-to-date check");
+    log.truncate_after(2);
+    check(log.last_index() == 2 && log.last_term() == 1, "log: truncate");
+
+    for (uint64_t term : {2, 2, 3}) {
+        log.append(LogEntry{term, "x", 0, 0});
+    }
+    log.compact(3);
+    check(log.base_index() == 3 && log.term_at(3) == 2 && log.last_index() == 5 &&
+          log.at(4).term == 2, "log: compact keeps the suffix");
+    check(log.matches(1, 9) && log.matches(3, 2) && !log.matches(3, 1),
+          "log: compacted entries match, the base checks its term");
+    check(log.conflict_index(5) == 5 && log.conflict_index(4) == 4,
+          "log: conflict search stops at the base");
+    log.reset(10, 4);
+    check(log.last_index() == 10 && log.last_term() == 4 && log.first_index() == 11,
+          "log: reset to a snapshot");
+}
+
+static void test_sessions() {
+    using Status = SessionTable::Status;
+    SessionTable table(2, 100);
+    check(table.record(1, 5, 10) == Status::NEW && table.record(1, 7, 11) == Status::NEW &&
+          table.record(1, 6, 12) == Status::NEW, "sessions: requests pipelined out of order apply");
+    check(table.record(1, 7, 13) == Status::DUPLICATE && table.record(1, 5, 14) == Status::DUPLICATE,
+          "sessions: retries are duplicates");
+    SessionTable::Lookup latest = table.check(1, 7);
+    check(latest.status == Status::DUPLICATE && latest.index == 11,
+          "sessions: latest request's index is cached");
+    table.record(1, 7 + SessionTable::WINDOW, 15);
+    check(table.check(1, 7).status == Status::EXPIRED && table.check(1, 8).status == Status::NEW,
+          "sessions: ids below the window expire");
+
+    table.record(2, 1, 16);
+    table.record(1, 100, 17);
+    table.record(3, 1, 18);     // over max_sessions: client 2 is least recently used
+    check(table.size() == 2 && table.check(2, 1).status == Status::NEW &&
+          table.check(1, 100).status == Status::DUPLICATE, "sessions: LRU eviction");
+    table.record(3, 2, 200);    // client 1 idle for more than the TTL
+    check(table.size() == 1 && table.check(1, 100).status == Status::NEW, "sessions: TTL eviction");
+
+    SessionTable single(1, 100);
+    single.record(1, 1, 1);
+    single.record(2, 1, 2);
+    check(single.size() == 1 && single.check(2, 1).status == Status::DUPLICATE &&
+          single.check(1, 1).status == Status::NEW, "sessions: a one-session table keeps the newest client");
+    bool threw = false;
+    try {
+        SessionTable empty(0, 100);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "sessions: a table with no room for sessions is refused");
+
+    std::stringstream buf;
+    table.save(buf);
+    SessionTable copy;
+    copy.load(buf);
+    check(copy.size() == 1 && copy.check(3, 2).status == Status::DUPLICATE &&
+          copy.check(3, 2).index == 200, "sessions: save and load");
+}
+
+struct Member {
+    NetworkManager network;
+    RaftNode raft;
+    std::atomic<uint64_t> applied{0};
+    std::atomic<uint64_t> digest{14695981039346656037ull};
+    std::vector<std::string> commands;  // loop thread only; gives snapshots some bulk
+
+    Member(const ClusterConfig& config, int id, TransportKind kind, RaftOptions options) :
+        network(config, id, WireFormat::BINARY, kind), raft(network, options) {
+        // Odd ids apply batches, even ids one entry at a time; digests must agree
+        if (id % 2) {
+            raft.set_on_apply_batch([this](uint64_t, const LogEntry* const* entries, size_t count) {
+                for (size_t i = 0; i < count; i++) apply(*entries[i]);
+            });
+        } else {
+            raft.set_on_apply([this](uint64_t, const LogEntry& entry) { apply(entry); });
+        }
+        // GET "applied" reads the apply count, so stale reads show up
+        raft.set_read_handler([this](const std::string& key, std::string& value) {
+            if (key != "applied") return false;
+            value = std::to_string(applied.load());
+            return true;
+        });
+        raft.set_snapshot_handlers(
+            [this](std::ostream& out) {
+                snapshot_io::put_u64(out, applied);
+                snapshot_io::put_u64(out, digest);
+                for (const auto& command : commands) {
+                    snapshot_io::put_bytes(out, command.data(), static_cast<uint32_t>(command.size()));
+                }
+            },
+            [this](std::istream& in) {
+                applied = snapshot_io::get_u64(in);
+                digest = snapshot_io::get_u64(in);
+                commands.clear();
+                for (uint64_t i = 0; i < applied; i++) {
+                    commands.push_back(snapshot_io::get_bytes(in));
+                }
+            });
+    }
+
+    ~Member() { network.stop(); }
+
+    // Order-sensitive FNV-1a over every applied command
+    void apply(const LogEntry& entry) {
+        if (entry.data.empty()) return;
+        uint64_t h = digest.load(std::memory_order_relaxed);
+        for (char c : entry.data) {
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        digest.store(h, std::memory_order_relaxed);
+        applied.fetch_add(1, std::memory_order_relaxed);
+        commands.push_back(entry.data);
+    }
+};
+
+static int find_leader(std::vector<std::unique_ptr<Member>>& members, size_t running) {
+    for (size_t i = 0; i < running; i++) {
+        if (members[i]->raft.status().leader) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+static void submit(Member& leader, uint64_t from, uint64_t count) {
+    for (uint64_t i = from; i < from + count; i++) {
+        leader.raft.submit(ClientRequest{ClientRequest::Type::INSERT, "key" + std::to_string(i),
+                                         std::string(32, 'a' + i % 26), 1, i});
+    }
+}
+
+static void test_cluster(TransportKind kind, int max_inflight, uint64_t count) {
+    std::string name = std::string(transport_kind_name(kind)) +
+                       " inflight=" + std::to_string(max_inflight);
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    RaftOptions options;
+    options.max_inflight = max_inflight;
+
+    std::vector<std::unique_ptr<Member>> members;
+    for (int id = 0; id < 3; id++) {
+        members.push_back(std::make_unique<Member>(config, id, kind, options));
+    }
+    members[0]->network.start();
+    members[1]->network.start();
+
+    int leader = -1;
+    check(wait_for([&] { return (leader = find_leader(members, 2)) >= 0; }),
+          name + ": leader elected with two of three nodes");
+    if (leader < 0) return;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t half = count / 2;
+    submit(*members[leader], 0, half);
+    check(wait_for([&] { return members[0]->applied == half && members[1]->applied == half; }),
+          name + ": first half committed on a bare quorum");
+
+    // The late node is behind by the whole log and is caught up by backtracking
+    members[2]->network.start();
+    submit(*members[leader], half, count - half);
+    bool all = wait_for([&] {
+        return members[0]->applied == count && members[1]->applied == count &&
+               members[2]->applied == count;
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    check(all, name + ": late node caught up, " + std::to_string(count) + " entries applied everywhere");
+    check(members[0]->digest == members[1]->digest && members[1]->digest == members[2]->digest,
+          name + ": identical apply order on every node");
+    std::cout << "     " << name << ": " << static_cast<uint64_t>(count / secs) << " entries/s\n";
+}
+
+static void test_restart(uint64_t count) {
+    char path[] = "/tmp/buzz_raft_XXXXXX";
+    if (!mkdtemp(path)) {
+        check(false, "restart: temp dir");
+        return;
+    }
+    std::string base = path;
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    auto start_cluster = [&](std::vector<std::unique_ptr<Member>>& members) {
+        for (int id = 0; id < 3; id++) {
+            RaftOptions options;
+            options.data_dir = base + "/node" + std::to_string(id);
+            members.push_back(std::make_unique<Member>(config, id, TransportKind::UDP, options));
+        }
+        for (auto& m : members) m->network.start();
+    };
+
+    uint64_t digest = 0;
+    uint64_t term = 0;
+    {
+        std::vector<std::unique_ptr<Member>> members;
+        start_cluster(members);
+        int leader = -1;
+        wait_for([&] { return (leader = find_leader(members, 3)) >= 0; });
+        if (leader < 0) {
+            check(false, "restart: leader elected");
+            return;
+        }
+        submit(*members[leader], 0, count);
+        check(wait_for([&] {
+            for (auto& m : members) if (m->applied != count) return false;
+            return true;
+        }), "restart: " + std::to_string(count) + " durable entries applied");
+        digest = members[0]->digest;
+        term = members[leader]->raft.status().term;
+    }
+
+    std::vector<std::unique_ptr<Member>> members;
+    start_cluster(members);
+    RaftStatus st = members[0]->raft.status();
+    check(st.last_index >= count && st.term >= term, "restart: term and log recovered from the WAL");
+    // The next leader's first commit replays the recovered log into the state machine
+    check(wait_for([&] {
+        for (auto& m : members) if (m->applied != count) return false;
+        return true;
+    }), "restart: recovered log re-applied on every node");
+    check(members[1]->digest == digest && members[2]->digest == digest,
+          "restart: same apply order as before the restart");
+    members.clear();
+
+    std::string cleanup = "rm -rf '" + base + "'";
+    if (std::system(cleanup.c_str()) != 0) {
+        std::cerr << "could not remove " << base << "\n";
+    }
+}
+
+static void test_snapshot(uint64_t count) {
+    char path[] = "/tmp/buzz_raft_XXXXXX";
+    if (!mkdtemp(path)) {
+        check(false, "snapshot: temp dir");
+        return;
+    }
+    std::string base = path;
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    auto make_cluster = [&](std::vector<std::unique_ptr<Member>>& members) {
+        for (int id = 0; id < 3; id++) {
+            RaftOptions options;
+            options.data_dir = base + "/node" + std::to_string(id);
+            options.wal_segment_size = 256 << 10;
+            options.snapshot_threshold = 500;
+            options.snapshot_trailing_entries = 100;
+            options.snapshot_chunk_bytes = 8 << 10;
+            members.push_back(std::make_unique<Member>(config, id, TransportKind::UDP, options));
+        }
+    };
+    auto all_applied = [](std::vector<std::unique_ptr<Member>>& members, uint64_t n) {
+        for (auto& m : members) if (m->applied != n) return false;
+        return true;
+    };
+
+    uint64_t digest = 0;
+    {
+        std::vector<std::unique_ptr<Member>> members;
+        make_cluster(members);
+        members[0]->network.start();
+        members[1]->network.start();
+        int leader = -1;
+        wait_for([&] { return (leader = find_leader(members, 2)) >= 0; });
+        if (leader < 0) {
+            check(false, "snapshot: leader elected");
+            return;
+        }
+        uint64_t half = count / 2;
+        submit(*members[leader], 0, half);
+        check(wait_for([&] { return members[0]->applied == half && members[1]->applied == half; }),
+              "snapshot: first half committed on a bare quorum");
+        // Written off the loop, then installed
+        RaftStatus st;
+        wait_for([&] { return (st = members[leader]->raft.status()).snapshot_index >= half - 500; });
+        check(st.snapshot_index >= half - 500, "snapshot: leader compacted its log to " +
+              std::to_string(st.snapshot_index));
+
+        // The late node's next entry is gone from the leader's log
+        members[2]->network.start();
+        submit(*members[leader], half, count - half);
+        check(wait_for([&] { return all_applied(members, count); }),
+              "snapshot: late node caught up through InstallSnapshot");
+        check(members[0]->digest == members[1]->digest && members[1]->digest == members[2]->digest,
+              "snapshot: identical state on every node");
+        check(members[2]->raft.status().snapshot_index > 0, "snapshot: late node holds a snapshot");
+        digest = members[0]->digest;
+    }
+
+    // Restart: each node loads its snapshot and replays the WAL after it
+    std::vector<std::unique_ptr<Member>> members;
+    make_cluster(members);
+    bool loaded = true;
+    for (auto& m : members) {
+        loaded = loaded && m->applied >= 500;     // nothing can commit before start()
+    }
+    check(loaded, "snapshot: restart loads the snapshot into the state machine");
+    for (auto& m : members) m->network.start();
+    check(wait_for([&] { return all_applied(members, count); }) &&
+          members[0]->digest == digest && members[1]->digest == digest && members[2]->digest == digest,
+          "snapshot: restarted cluster reaches the same state");
+    members.clear();
+
+    std::string cleanup = "rm -rf '" + base + "'";
+    if (std::system(cleanup.c_str()) != 0) {
+        std::cerr << "could not remove " << base << "\n";
+    }
+}
+
+// Issues `count` GETs on `member` at once; returns how many succeeded with
+// `expect` and reported an applied index of at least `min_index`
+static uint64_t read_all(Member& member, const std::string& key, const std::string& expect,
+                         uint64_t count, std::string* error = nullptr,
+                         uint64_t max_lag = ClientRequest::LINEARIZABLE, uint64_t min_index = 0) {
+    uint64_t done = 0;          // loop thread only
+    uint64_t matched = 0;
+    std::promise<void> finished;
+    for (uint64_t i = 0; i < count; i++) {
+        member.raft.get(key, [&, error](const ClientResponse& res) {
+            if (res.success && res.value == expect && res.applied_index >= min_index) matched++;
+            if (!res.success && error) *error = res.error;
+            if (++done == count) finished.set_value();
+        }, max_lag);
+    }
+    finished.get_future().wait();    // every read is answered, if only with an error
+    return matched;
+}
+
+static void test_reads(ReadMode mode, uint64_t count) {
+    std::string name = mode == ReadMode::LEASE ? "lease reads" : "read index";
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    RaftOptions options;
+    options.read_mode = mode;
+
+    std::vector<std::unique_ptr<Member>> members;
+    for (int id = 0; id < 3; id++) {
+        members.push_back(std::make_unique<Member>(config, id, TransportKind::UDP, options));
+    }
+    for (auto& m : members) m->network.start();
+    int leader = -1;
+    wait_for([&] { return (leader = find_leader(members, 3)) >= 0; });
+    if (leader < 0) {
+        check(false, name + ": leader elected");
+        return;
+    }
+    Member& lead = *members[leader];
+    Member& follower = *members[(leader + 1) % 3];
+
+    submit(lead, 0, 1000);
+    wait_for([&] { return lead.applied == 1000; });
+    uint64_t last = lead.raft.status().last_index;
+    check(read_all(lead, "applied", "1000", 1, nullptr, ClientRequest::LINEARIZABLE, last) == 1,
+          name + ": read sees every committed write");
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t served = read_all(lead, "applied", "1000", count);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    check(served == count && lead.raft.status().last_index == last,
+          name + ": " + std::to_string(count) + " reads served without touching the log");
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 200; i++) read_all(lead, "applied", "1000", 1);
+    double one = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 200;
+    std::cout << "     " << name << ": " << static_cast<uint64_t>(count / secs) << " reads/s batched, "
+              << static_cast<uint64_t>(one * 1e6) << " us per read one at a time\n";
+
+    std::string error;
+    read_all(lead, "missing", "", 1, &error);
+    check(error == "not found", name + ": missing key reported");
+
+    // Followers confirm a read index with the leader, a tick's reads at a time
+    check(read_all(follower, "applied", "1000", 1, nullptr, ClientRequest::LINEARIZABLE, last) == 1,
+          name + ": follower read sees every committed write");
+    start = std::chrono::steady_clock::now();
+    served = read_all(follower, "applied", "1000", count);
+    secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    check(served == count && follower.raft.status().last_index == last,
+          name + ": " + std::to_string(count) + " follower reads served without touching the log");
+    std::cout << "     " << name << ": " << static_cast<uint64_t>(count / secs)
+              << " follower reads/s batched\n";
+
+    // Bounded staleness: answered from local state, reporting how current it is
+    check(read_all(follower, "applied", "1000", count, nullptr, 0, last) == count,
+          name + ": stale reads within max_lag served locally with their applied index");
+    submit(lead, 1000, 1);
+    wait_for([&] { return follower.applied == 1001; });
+    check(read_all(follower, "applied", "1001", 1, nullptr, 10, last + 1) == 1,
+          name + ": stale read catches up with the follower");
+
+    if (mode == ReadMode::LEASE) {
+        // While the leader's lease holds its followers turn candidates away
+        Member& candidate = *members[(leader + 2) % 3];
+        RaftStatus before = follower.raft.status();
+        candidate.raft.campaign();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        check(!candidate.raft.status().leader && follower.raft.status().term == before.term,
+              name + ": candidates get no votes while the lease holds");
+    }
+}
+
+// Leases under staggered election timeouts, as Multi-Raft sets them: a
+// high-rank leader cut off from the others must not answer reads from its
+// lease, or as bounded-staleness reads, once they have elected a new
+// leader and moved on
+static void test_lease_failover() {
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    RaftOptions base;
+    base.read_mode = ReadMode::LEASE;
+    std::vector<std::unique_ptr<Member>> members;
+    for (int id = 0; id < 3; id++) {
+        RaftOptions options = base;
+        options.lease_base_ms = base.election_timeout_min_ms;
+        options.election_timeout_min_ms += id * base.election_timeout_max_ms;
+        options.election_timeout_max_ms += id * base.election_timeout_max_ms;
+        members.push_back(std::make_unique<Member>(config, id, TransportKind::UDP, options));
+    }
+    for (auto& m : members) m->network.start();
+    Member& old_leader = *members[2];
+    old_leader.raft.campaign();
+    if (!wait_for([&] { return old_leader.raft.status().leader; })) {
+        check(false, "lease failover: rank-2 node elected");
+        return;
+    }
+    submit(old_leader, 0, 100);
+    wait_for([&] { return members[0]->applied == 100 && members[1]->applied == 100 && old_leader.applied == 100; });
+    check(read_all(old_leader, "applied", "100", 1) == 1, "lease failover: leader reads from its lease");
+
+    // Node 0 asks for votes until node 1 stops refusing them
+    old_leader.network.set_isolated(true);
+    int leader = -1;
+    wait_for([&] {
+        leader = find_leader(members, 2);
+        if (leader < 0) members[0]->raft.campaign();
+        return leader >= 0;
+    });
+    if (leader < 0) {
+        check(false, "lease failover: new leader elected");
+        return;
+    }
+    submit(*members[leader], 100, 1);
+    wait_for([&] { return members[leader]->applied == 101; });
+
+    // Unanswered is fine; answered from the old state is a stale read
+    auto answer = std::make_shared<std::string>();
+    auto stale_answer = std::make_shared<std::string>();
+    old_leader.raft.get("applied", [answer](const ClientResponse& res) {
+        *answer = res.success ? res.value : "error";
+    });
+    old_leader.raft.get("applied", [stale_answer](const ClientResponse& res) {
+        *stale_answer = res.success ? res.value : "error";
+    }, 1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    old_leader.raft.status();   // orders the callbacks' writes before the checks
+    check(members[leader]->applied == 101 && *answer != "100",
+          "lease failover: partitioned leader's lease expires before a new leader is elected");
+    check(*stale_answer != "100", "lease failover: partitioned leader serves no bounded-staleness reads");
+}
+
+// Client retries, after commit and while the original is in flight, must
+// apply once; retries of applied requests must not reach the log
+static void test_retries(uint64_t count) {
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    std::vector<std::unique_ptr<Member>> members;
+    for (int id = 0; id < 3; id++) {
+        members.push_back(std::make_unique<Member>(config, id, TransportKind::UDP, RaftOptions()));
+    }
+    for (auto& m : members) m->network.start();
+    int leader = -1;
+    wait_for([&] { return (leader = find_leader(members, 3)) >= 0; });
+    if (leader < 0) {
+        check(false, "retries: leader elected");
+        return;
+    }
+    Member& lead = *members[leader];
+    Member& follower = *members[(leader + 1) % 3];
+
+    // Retries of requests still in flight wait on the first copy's entry
+    uint64_t first = lead.raft.status().last_index;
+    std::atomic<uint64_t> answered{0};
+    std::atomic<uint64_t> succeeded{0};
+    for (uint64_t i = 1; i <= count; i++) {
+        for (int copy = 0; copy < 2; copy++) {
+            lead.raft.submit(ClientRequest{ClientRequest::Type::INSERT, "key" + std::to_string(i),
+                                           std::string(32, 'a' + i % 26), 1, i},
+                             [&](const ClientResponse& res) {
+                                 succeeded += res.success;
+                                 answered++;
+                             });
+        }
+    }
+    check(wait_for([&] {
+        for (auto& m : members) if (m->applied != count) return false;
+        return answered == 2 * count;
+    }), "retries: in-flight duplicates applied once on every node");
+    uint64_t last = lead.raft.status().last_index;
+    check(succeeded == 2 * count && last == first + count,
+          "retries: in-flight duplicates answered without growing the log");
+
+    // Request 1 reaches the log right behind request 100, outside its window
+    std::atomic<int> expired{0};
+    lead.network.loop().post([&] {
+        lead.raft.propose(ClientRequest{ClientRequest::Type::INSERT, "late", "x", 2, 100}, -1);
+        lead.raft.propose(ClientRequest{ClientRequest::Type::INSERT, "late", "y", 2, 1}, -1,
+                          [&](const ClientResponse& res) {
+                              expired = !res.success && res.error == "request expired" ? 1 : -1;
+                          });
+    });
+    check(wait_for([&] { return expired != 0; }) && expired == 1,
+          "retries: expired request answered as failed");
+    check(wait_for([&] {
+        for (auto& m : members) if (m->applied != count + 1) return false;
+        return true;
+    }), "retries: expired request not applied");
+    last = lead.raft.status().last_index;
+    submit(lead, 1, count);
+    submit(follower, 1, count); // forwarded to the leader
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    bool same = true;
+    for (auto& m : members) same = same && m->applied == count + 1 && m->raft.status().last_index == last;
+    check(same, "retries: applied requests answered without touching the log");
+    check(members[1]->digest == members[0]->digest && members[2]->digest == members[0]->digest,
+          "retries: identical state on every node");
+}
+
+// A Multi-Raft node: one apply count and digest per group
+struct MultiMember {
+    struct Shard {
+        std::atomic<uint64_t> applied{0};
+        std::atomic<uint64_t> digest{14695981039346656037ull};
+    };
+
+    NetworkManager network;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::unique_ptr<MultiRaft> raft;
+
+    MultiMember(const ClusterConfig& config, int id, const MultiRaftOptions& options) :
+        network(config, id) {
+        for (size_t g = 0; g < options.groups; g++) shards.push_back(std::make_unique<Shard>());
+        raft = std::make_unique<MultiRaft>(network, options, [this](uint32_t g, RaftNode& node) {
+            Shard& shard = *shards[g];
+            node.set_on_apply([&shard](uint64_t, const LogEntry& entry) {
+                if (entry.data.empty()) return;
+                uint64_t h = shard.digest.load(std::memory_order_relaxed);
+                for (char c : entry.data) {
+                    h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+                }
+                shard.digest.store(h, std::memory_order_relaxed);
+                shard.applied.fetch_add(1, std::memory_order_relaxed);
+            });
+        });
+    }
+
+    ~MultiMember() { network.stop(); }
+};
+
+// Leader of each group among members[from..], -1 where a group has none
+static std::vector<int> group_leaders(std::vector<std::unique_ptr<MultiMember>>& members, size_t from) {
+    std::vector<int> leaders;
+    for (size_t i = from; i < members.size(); i++) {
+        std::vector<RaftStatus> st = members[i]->raft->status();
+        leaders.resize(st.size(), -1);
+        for (size_t g = 0; g < st.size(); g++) {
+            if (st[g].leader) leaders[g] = static_cast<int>(i);
+        }
+    }
+    return leaders;
+}
+
+static size_t leading(const std::vector<int>& leaders, int node) {
+    return static_cast<size_t>(std::count(leaders.begin(), leaders.end(), node));
+}
+
+static void test_multi_raft(size_t groups, uint64_t count) {
+    char path[] = "/tmp/buzz_multi_XXXXXX";
+    if (!mkdtemp(path)) {
+        check(false, "multi-raft: temp dir");
+        return;
+    }
+    std::string base = path;
+    ClusterConfig config = ClusterConfig::local(3, 7200);
+    auto start_cluster = [&](std::vector<std::unique_ptr<MultiMember>>& members) {
+        for (int id = 0; id < 3; id++) {
+            MultiRaftOptions options;
+            options.groups = groups;
+            options.raft.data_dir = base + "/node" + std::to_string(id);
+            members.push_back(std::make_unique<MultiMember>(config, id, options));
+        }
+        for (auto& m : members) m->network.start();
+    };
+
+    std::vector<uint64_t> expect(groups, 0);
+    for (uint64_t i = 0; i < count; i++) {
+        expect[MultiRaft::group_of("key" + std::to_string(i), groups)]++;
+    }
+    auto applied_everywhere = [&](std::vector<std::unique_ptr<MultiMember>>& members) {
+        for (auto& m : members) {
+            for (size_t g = 0; g < groups; g++) {
+                if (m->shards[g]->applied != expect[g]) return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<uint64_t> digests(groups);
+    {
+        std::vector<std::unique_ptr<MultiMember>> members;
+        start_cluster(members);
+        std::vector<int> leaders;
+        check(wait_for([&] {
+            leaders = group_leaders(members, 0);
+            return leading(leaders, -1) == 0;
+        }), "multi-raft: every group elected a leader");
+        check(leading(leaders, 0) == groups / 3 && leading(leaders, 1) == groups / 3 &&
+              leading(leaders, 2) == groups / 3,
+              "multi-raft: leaders spread evenly over the nodes");
+
+        Counter& bundles = Metrics::instance().counter("net.bundles");
+        Counter& bundled = Metrics::instance().counter("net.bundled");
+        uint64_t bundles_before = bundles.value();
+        uint64_t bundled_before = bundled.value();
+
+        // All through node 0, which forwards each write to its group's leader
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < count; i++) {
+            members[0]->raft->submit(ClientRequest{ClientRequest::Type::INSERT, "key" + std::to_string(i),
+                                                   std::string(32, 'a' + i % 26), 1, i});
+        }
+        bool all = wait_for([&] { return applied_everywhere(members); });
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        check(all, "multi-raft: " + std::to_string(count) + " writes applied to their shards everywhere");
+        bool same = true;
+        for (size_t g = 0; g < groups; g++) {
+            digests[g] = members[0]->shards[g]->digest;
+            same = same && members[1]->shards[g]->digest == digests[g] &&
+                   members[2]->shards[g]->digest == digests[g];
+        }
+        check(same, "multi-raft: identical apply order per shard on every node");
+        uint64_t sent = bundles.value() - bundles_before;
+        uint64_t parts = bundled.value() - bundled_before;
+        check(sent > 0 && parts > sent, "multi-raft: messages to a peer coalesced into bundles");
+        std::cout << "     multi-raft " << groups << " groups: " << static_cast<uint64_t>(count / secs)
+                  << " entries/s, " << (sent ? parts / sent : 0) << " messages per bundle\n";
+
+        // Node 0's groups fail over to both survivors, not just one
+        members[0]->network.stop();
+        check(wait_for([&] {
+            leaders = group_leaders(members, 1);
+            return leading(leaders, -1) == 0;
+        }), "multi-raft: groups of a failed node elected new leaders");
+        check(leading(leaders, 1) == groups / 2 && leading(leaders, 2) == groups / 2,
+              "multi-raft: failed node's groups split between the survivors");
+    }
+
+    std::vector<std::unique_ptr<MultiMember>> members;
+    start_cluster(members);
+    bool recovered = true;
+    std::vector<RaftStatus> st = members[0]->raft->status();
+    for (size_t g = 0; g < groups; g++) recovered = recovered && st[g].last_index >= expect[g];
+    check(recovered, "multi-raft restart: every group's log recovered from the shared WAL");
+    check(wait_for([&] { return applied_everywhere(members); }),
+          "multi-raft restart: every group re-applied on every node");
+    bool same = true;
+    for (auto& m : members) {
+        for (size_t g = 0; g < groups; g++) same = same && m->shards[g]->digest == digests[g];
+    }
+    check(same, "multi-raft restart: same apply order as before the restart");
+    members.clear();
+
+    std::string cleanup = "rm -rf '" + base + "'";
+    if (std::system(cleanup.c_str()) != 0) {
+        std::cerr << "could not remove " << base << "\n";
+    }
+}
+
+int main() {
+    test_log();
+    test_sessions();
+    test_cluster(TransportKind::UDP, 8, 20000);
+    test_cluster(TransportKind::STREAM, 1, 20000);
+    test_cluster(TransportKind::STREAM, 8, 20000);
+    test_restart(2000);
+    test_snapshot(6000);
+    test_reads(ReadMode::READ_INDEX, 20000);
+    test_reads(ReadMode::LEASE, 20000);
+    test_lease_failover();
+    test_retries(5000);
+    test_multi_raft(6, 6000);
+
+    std::cout << (failures == 0 ? "All raft checks passed\n" : "Raft checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
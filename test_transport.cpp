@@ -0,0 +1,203 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "network_manager.cpp"
+
+// Loopback checks for the UDP and stream transports. Nodes 0 and 1 run in
+// this process on base port 7100. Messages sent in one tick with coalescing
+// on must arrive as one bundle. Both transports deliver a node's messages
+// to itself. Exits non-zero on failure.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    std::cout << (ok ? "PASS " : "FAIL ") << what << "\n";
+    if (!ok) failures++;
+}
+
+template <typename Pred>
+static bool wait_for(Pred pred, int timeout_ms = 3000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (pred()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return pred();
+}
+
+static void test_round_trip(TransportKind kind, size_t count) {
+    std::string name = transport_kind_name(kind);
+    NetworkManager a(0, 7100, WireFormat::BINARY, kind);
+    NetworkManager b(1, 7100, WireFormat::BINARY, kind);
+
+    std::atomic<size_t> requests{0};
+    std::atomic<size_t> responses{0};
+    std::atomic<bool> in_order{true};
+    b.set_on_client_request([&](int sender, const ClientRequest& req) {
+        if (req.request_id != requests.load()) in_order = false;
+        requests++;
+        b.send_to(sender, ClientResponse{true, false, 1, "", req.request_id, ""});
+    });
+    a.set_on_client_response([&](int, const ClientResponse&) { responses++; });
+    a.start();
+    b.start();
+
+    for (size_t i = 0; i < count; i++) {
+        a.send_to(1, ClientRequest{ClientRequest::Type::INSERT, "k", "v", 1, i});
+    }
+
+    // UDP may legitimately drop on a loaded loopback; the stream may not
+    bool all = wait_for([&] { return responses.load() == count; });
+    if (kind == TransportKind::STREAM) {
+        check(all, name + ": " + std::to_string(count) + " pipelined requests answered");
+        check(in_order, name + ": requests delivered in order");
+    } else {
+        check(responses.load() > 0, name + ": requests answered (" +
+              std::to_string(responses.load()) + "/" + std::to_string(count) + ")");
+    }
+}
+
+static void test_large_batch() {
+    NetworkManager a(0, 7100, WireFormat::BINARY, TransportKind::STREAM);
+    NetworkManager b(1, 7100, WireFormat::BINARY, TransportKind::STREAM);
+
+    AppendEntriesRequest req{3, 0, 10, 2, {}, 9};
+    for (uint64_t i = 0; i < 4096; i++) {
+        req.entries.push_back(LogEntry{3, std::string(1024, 'a' + i % 26), 7, i});
+    }
+
+    std::atomic<bool> received{false};
+    std::atomic<bool> intact{false};
+    b.set_on_append_entries([&](int, const AppendEntriesView& view) {
+        size_t i = 0;
+        bool ok = view.entry_count() == req.entries.size();
+        view.for_each_entry([&](const LogEntryView& e) {
+            ok = ok && e.to_entry() == req.entries[i++];
+        });
+        intact = ok;
+        received = true;
+    });
+    a.start();
+    b.start();
+    a.send_to(1, req);
+
+    check(wait_for([&] { return received.load(); }) && intact,
+          "tcp: 4 MiB AppendEntries delivered intact");
+}
+
+static void test_self_send(TransportKind kind) {
+    std::string name = transport_kind_name(kind);
+    NetworkManager a(0, 7100, WireFormat::BINARY, kind);
+    std::atomic<int> from{-1};
+    a.set_on_client_request([&](int sender, const ClientRequest&) { from = sender; });
+    a.start();
+    a.send_to(a.slot(), ClientRequest{ClientRequest::Type::INSERT, "k", "v", 1, 1});
+    check(wait_for([&] { return from.load() == a.slot(); }), name + ": message to self delivered");
+}
+
+static void test_udp_limit() {
+    NetworkManager a(0, 7100, WireFormat::BINARY, TransportKind::UDP);
+    AppendEntriesRequest req{1, 0, 0, 0, {LogEntry{1, std::string(70000, 'x'), 1, 1}}, 0};
+    bool threw = false;
+    try {
+        a.send_to(1, req);
+    } catch (const std::length_error&) {
+        threw = true;
+    }
+    check(threw, "udp: oversized message rejected instead of truncated");
+}
+
+static void test_histogram() {
+    // Every value lands in a bucket whose range holds it, within 12.5%
+    std::mt19937_64 rng(7);
+    bool bounded = true;
+    for (int i = 0; i < 100000; i++) {
+        uint64_t v = rng() >> (rng() % 64);
+        size_t b = Histogram::bucket_of(v);
+        uint64_t lo = Histogram::bucket_floor(b);
+        uint64_t hi = b + 1 < Histogram::BUCKETS ? Histogram::bucket_floor(b + 1) - 1 : UINT64_MAX;
+        bounded = bounded && lo <= v && v <= hi && (hi - lo) <= lo / 8;
+    }
+    check(bounded, "histogram: buckets bound their values within 12.5%");
+
+    Histogram h;
+    for (uint64_t v = 1; v <= 100000; v++) h.record(v);
+    Histogram::Summary s = h.summary();
+    auto near = [](uint64_t got, uint64_t want) { return got >= want && got <= want + want / 8; };
+    check(s.count == 100000 && s.max == 100000 && s.sum == 5000050000ull,
+          "histogram: count, sum and max exact");
+    check(near(s.p50, 50000) && near(s.p99, 99000) && near(s.p999, 99900),
+          "histogram: percentiles within a bucket (p50=" + std::to_string(s.p50) +
+          " p99=" + std::to_string(s.p99) + " p999=" + std::to_string(s.p999) + ")");
+}
+
+static void test_counters() {
+    Counter& c = Metrics::instance().counter("test.threads");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&c] {
+            for (int i = 0; i < 100000; i++) c.add();
+        });
+    }
+    for (auto& t : threads) t.join();
+    check(c.value() == 800000 && &Metrics::instance().counter("test.threads") == &c,
+          "metrics: counter adds from 8 threads all counted");
+
+    // Round trips through the network are counted per message type
+    Metrics& m = Metrics::instance();
+    uint64_t sent = m.counter("net.sent.CLIREQ").value();
+    uint64_t received = m.counter("net.received.CLIRES").value();
+    test_round_trip(TransportKind::STREAM, 100);
+    check(m.counter("net.sent.CLIREQ").value() - sent == 100 &&
+          m.counter("net.received.CLIRES").value() - received == 100 &&
+          m.histogram("net.handle_ns.CLIREQ").count() >= 100,
+          "metrics: messages counted by type");
+    std::string dump = m.dump();
+    check(dump.find("counter net.sent.CLIREQ ") != std::string::npos &&
+          dump.find("histogram net.handle_ns.CLIREQ count=") != std::string::npos,
+          "metrics: dump lists them");
+}
+
+static void test_coalescing() {
+    NetworkManager a(0, 7100, WireFormat::BINARY, TransportKind::STREAM);
+    NetworkManager b(1, 7100, WireFormat::BINARY, TransportKind::STREAM);
+    a.set_coalescing(true);
+    std::atomic<size_t> requests{0};
+    b.set_on_client_request([&](int, const ClientRequest&) { requests++; });
+    a.start();
+    b.start();
+
+    Metrics& m = Metrics::instance();
+    uint64_t bundles = m.counter("net.bundles").value();
+    uint64_t sent = m.counter("net.sent_bytes").value();
+    uint64_t received = m.counter("net.received_bytes").value();
+    // Sent in one tick, so all twenty leave as one bundle
+    a.loop().post([&] {
+        for (uint64_t i = 0; i < 10; i++) {
+            a.send_to(1, ClientRequest{ClientRequest::Type::INSERT, "k", "v", 1, i});
+            a.broadcast({1}, ClientRequest{ClientRequest::Type::INSERT, "k", "v", 2, i});
+        }
+    });
+    check(wait_for([&] { return requests.load() == 20; }) && m.counter("net.bundles").value() == bundles + 1,
+          "coalescing: twenty messages in one tick sent as one bundle");
+    check(m.counter("net.sent_bytes").value() - sent == m.counter("net.received_bytes").value() - received,
+          "coalescing: bundle bytes counted once on each end");
+}
+
+int main() {
+    test_round_trip(TransportKind::UDP, 200);
+    test_round_trip(TransportKind::STREAM, 2000);
+    test_large_batch();
+    test_self_send(TransportKind::UDP);
+    test_self_send(TransportKind::STREAM);
+    test_udp_limit();
+    test_coalescing();
+    test_histogram();
+    test_counters();
+
+    std::cout << (failures == 0 ? "All transport checks passed\n" : "Transport checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
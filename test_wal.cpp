@@ -0,0 +1,265 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "wal.cpp"
+
+// Write-ahead log checks: round trip, truncation replay, snapshot resets,
+// torn-write recovery, segment recycling, and groups sharing one log. Runs in a fresh temporary directory per check.
+// Exits non-zero on failure.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    std::cout << (ok ? "PASS " : "FAIL ") << what << "\n";
+    if (!ok) failures++;
+}
+
+static std::string temp_dir() {
+    char path[] = "/tmp/buzz_wal_XXXXXX";
+    if (!mkdtemp(path)) {
+        throw std::runtime_error("mkdtemp failed");
+    }
+    return path;
+}
+
+static void remove_dir(const std::string& dir) {
+    std::string cmd = "rm -rf '" + dir + "'";
+    if (std::system(cmd.c_str()) != 0) {
+        std::cerr << "could not remove " << dir << "\n";
+    }
+}
+
+static LogEntry entry(uint64_t term, uint64_t i) {
+    return LogEntry{term, "value-" + std::to_string(i), 7, i};
+}
+
+static size_t count_files(const std::string& dir) {
+    size_t n = 0;
+    DIR* d = opendir(dir.c_str());
+    while (dirent* e = readdir(d)) {
+        if (e->d_name[0] != '.') n++;
+    }
+    closedir(d);
+    return n;
+}
+
+static void test_round_trip() {
+    std::string dir = temp_dir();
+    {
+        Wal wal(dir);
+        wal.recover();
+        wal.append_state(3, 1);
+        for (uint64_t i = 1; i <= 1000; i++) {
+            wal.append_entry(i, entry(3, i));
+            if (i % 100 == 0) wal.sync();
+        }
+        check(wal.syncs() == 10, "wal: one fdatasync per group");
+    }
+    Wal wal(dir);
+    Wal::Recovery rec = wal.recover();
+    bool same = rec.entries.size() == 1000 && rec.first_index == 1;
+    for (uint64_t i = 0; same && i < rec.entries.size(); i++) {
+        same = rec.entries[i] == entry(3, i + 1);
+    }
+    check(same, "wal: 1000 entries recovered intact");
+    check(rec.term == 3 && rec.voted_for == 1, "wal: term and vote recovered");
+    remove_dir(dir);
+}
+
+static void test_truncation() {
+    std::string dir = temp_dir();
+    {
+        Wal wal(dir);
+        wal.recover();
+        for (uint64_t i = 1; i <= 10; i++) {
+            wal.append_entry(i, entry(1, i));
+        }
+        // A new leader overwrote the suffix from index 6
+        wal.append_entry(6, entry(2, 60));
+        wal.append_entry(7, entry(2, 70));
+        wal.sync();
+    }
+    Wal wal(dir);
+    Wal::Recovery rec = wal.recover();
+    check(rec.entries.size() == 7 && rec.entries[5] == entry(2, 60) && rec.entries[6] == entry(2, 70),
+          "wal: overwritten suffix replayed as a truncation");
+    remove_dir(dir);
+}
+
+static void test_reset() {
+    std::string dir = temp_dir();
+    {
+        Wal wal(dir);
+        wal.recover();
+        for (uint64_t i = 1; i <= 10; i++) {
+            wal.append_entry(i, entry(1, i));
+        }
+        // A snapshot up to 40 replaced the log; replication resumes at 41
+        wal.append_reset(40, 2);
+        wal.append_entry(41, entry(2, 41));
+        wal.append_entry(42, entry(2, 42));
+        wal.sync();
+    }
+    Wal wal(dir);
+    Wal::Recovery rec = wal.recover();
+    check(rec.reset && rec.first_index == 41 && rec.entries.size() == 2 &&
+          rec.entries[1] == entry(2, 42), "wal: reset drops the log before the snapshot");
+    remove_dir(dir);
+}
+
+static void test_torn_write() {
+    std::string dir = temp_dir();
+    std::string segment = dir + "/0000000000000001.wal";
+    size_t good_end;
+    {
+        Wal wal(dir);
+        wal.recover();
+        for (uint64_t i = 1; i <= 50; i++) {
+            wal.append_entry(i, entry(1, i));
+        }
+        wal.sync();
+        good_end = wal.bytes();
+        wal.append_entry(51, entry(1, 51));
+        wal.sync();
+    }
+
+    // Tear the last record: keep its header, lose the end of its payload
+    int fd = open(segment.c_str(), O_RDWR);
+    std::string torn(10, '\0');
+    check(pwrite(fd, torn.data(), torn.size(), good_end + 20) == 10, "wal: tore last record");
+    close(fd);
+
+    {
+        Wal wal(dir);
+        Wal::Recovery rec = wal.recover();
+        check(rec.entries.size() == 50 && rec.entries.back() == entry(1, 50),
+              "wal: recovery stops before the torn record");
+        // Appending after recovery reuses the torn space
+        wal.append_entry(51, entry(2, 510));
+        wal.append_entry(52, entry(2, 520));
+        wal.sync();
+    }
+    Wal wal(dir);
+    Wal::Recovery rec = wal.recover();
+    check(rec.entries.size() == 52 && rec.entries[50] == entry(2, 510),
+          "wal: appends after a torn write recover cleanly");
+    remove_dir(dir);
+}
+
+static void test_corrupt_byte() {
+    std::string dir = temp_dir();
+    {
+        Wal wal(dir);
+        wal.recover();
+        for (uint64_t i = 1; i <= 20; i++) {
+            wal.append_entry(i, entry(1, i));
+        }
+        wal.sync();
+    }
+    // Flip one byte inside record 11's payload
+    std::string segment = dir + "/0000000000000001.wal";
+    size_t record = 17 + 8 + entry(1, 1).wire_size();
+    int fd = open(segment.c_str(), O_RDWR);
+    char c;
+    check(pread(fd, &c, 1, record * 10 + 30) == 1, "wal: read record to corrupt");
+    c ^= 0x40;
+    check(pwrite(fd, &c, 1, record * 10 + 30) == 1, "wal: corrupted record");
+    close(fd);
+
+    Wal wal(dir);
+    Wal::Recovery rec = wal.recover();
+    check(rec.entries.size() == 10, "wal: crc mismatch ends the log");
+    remove_dir(dir);
+}
+
+static void test_recycling() {
+    std::string dir = temp_dir();
+    const size_t segment_size = 16 << 10;
+    uint64_t last = 0;
+    {
+        Wal wal(dir, segment_size);
+        wal.recover();
+        wal.append_state(4, 2);
+        for (last = 1; last <= 2000; last++) {
+            wal.append_entry(last, entry(4, last));
+            if (last % 50 == 0) wal.sync();
+        }
+        last--;
+        wal.sync();
+        size_t before = wal.segment_count();
+        check(before > 5, "wal: rolled over " + std::to_string(before) + " segments");
+
+        wal.release_before(1900);
+        check(wal.segment_count() < before && wal.spare_count() == Wal::MAX_SPARES,
+              "wal: released segments kept as spares");
+        size_t files = count_files(dir);
+        for (uint64_t i = 0; i < 200; i++, last++) {
+            wal.append_entry(last + 1, entry(4, last + 1));
+            wal.sync();
+        }
+        check(count_files(dir) == files, "wal: new segments come from the spares");
+    }
+
+    Wal wal(dir, segment_size);
+    Wal::Recovery rec = wal.recover();
+    check(rec.term == 4 && rec.voted_for == 2, "wal: state survives releasing old segments");
+    check(!rec.entries.empty() && rec.first_index + rec.entries.size() - 1 == last &&
+          rec.entries.back() == entry(4, last),
+          "wal: recycled segments don't resurrect stale records");
+    remove_dir(dir);
+}
+
+// Three groups interleaved in one log: each recovers only its own entries
+// and state, and a segment goes only once every group has released it
+static void test_groups() {
+    std::string dir = temp_dir();
+    const size_t segment_size = 16 << 10;
+    {
+        Wal wal(dir, segment_size);
+        for (uint32_t g = 0; g < 3; g++) wal.recover(g);
+        for (uint32_t g = 0; g < 3; g++) wal.append_state(g + 1, static_cast<int>(g), g);
+        for (uint64_t i = 1; i <= 600; i++) {
+            for (uint32_t g = 0; g < 3; g++) wal.append_entry(i, entry(g + 1, i * 10 + g), g);
+            if (i % 20 == 0) wal.sync();
+        }
+        uint64_t syncs = wal.syncs();
+        wal.append_entry(600, entry(9, 6009), 2);   // group 2 alone truncates
+        wal.append_state(5, 1, 1);
+        wal.sync();
+        check(wal.syncs() == syncs + 1, "wal groups: one sync covers every group");
+
+        size_t before = wal.segment_count();
+        wal.release_before(500, 0);
+        wal.release_before(500, 1);
+        bool kept = wal.segment_count() == before;
+        wal.release_before(500, 2);
+        check(kept && wal.segment_count() < before,
+              "wal groups: segments released only when every group is past them");
+    }
+
+    Wal wal(dir, segment_size);
+    bool same = true;
+    for (uint32_t g = 0; g < 3; g++) {
+        Wal::Recovery rec = wal.recover(g);
+        uint64_t last = rec.first_index + rec.entries.size() - 1;
+        same = same && rec.term == (g == 1 ? 5 : g + 1) && rec.voted_for == static_cast<int>(g) && last == 600 &&
+               rec.entries.front() == entry(g + 1, rec.first_index * 10 + g) &&
+               rec.entries.back() == (g == 2 ? entry(9, 6009) : entry(g + 1, 6000 + g));
+    }
+    check(same, "wal groups: each group recovers its own log, term and vote");
+    check(wal.recover(7).entries.empty() && wal.recover(7).term == 0, "wal groups: unknown group starts empty");
+    remove_dir(dir);
+}
+
+int main() {
+    test_round_trip();
+    test_truncation();
+    test_reset();
+    test_torn_write();
+    test_corrupt_byte();
+    test_recycling();
+    test_groups();
+
+    std::cout << (failures == 0 ? "All WAL checks passed\n" : "WAL checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
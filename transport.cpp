@@ -0,0 +1,627 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "cluster_config.cpp"
+#include "event_loop.cpp"
+#include "logger.cpp"
+#include "metrics.cpp"
+#include "wire.cpp"
+
+//--------------------------------------------------
+// Transport Interface
+//--------------------------------------------------
+// A transport moves opaque messages between cluster nodes, addressed by
+// peer slot (see ClusterConfig). The sender travels in NetworkManager's
+// message header, so transports don't need to identify it. Transports are
+// driven by NetworkManager's EventLoop; send() may be called from any thread.
+
+enum class TransportKind { UDP, STREAM };
+
+inline const char* transport_kind_name(TransportKind k) {
+    return k == TransportKind::UDP ? "udp" : "tcp";
+}
+
+class Transport {
+public:
+    using ReceiveHandler = std::function<void(const char* data, size_t len)>;
+
+    virtual ~Transport() = default;
+
+    // Register sockets with the loop; handler runs on the loop thread
+    virtual void start(EventLoop& loop, ReceiveHandler handler) = 0;
+
+    // Unregister from the loop; call once the loop thread has stopped
+    virtual void stop() = 0;
+
+    // Queue or send one message; throws if len exceeds max_message_size()
+    virtual void send(int slot, const char* data, size_t len) = 0;
+
+    virtual void send_many(const std::vector<int>& slots, const char* data, size_t len) {
+        for (int peer : slots) {
+            send(peer, data, len);
+        }
+    }
+
+    virtual size_t max_message_size() const = 0;
+
+    // Hint for transports that batch syscalls; ignored by the others
+    virtual void set_batch_depth(size_t) {}
+    virtual size_t get_batch_depth() const { return 1; }
+};
+
+//--------------------------------------------------
+// UDP Transport
+//--------------------------------------------------
+// One datagram per message. With batch_depth > 1 the receiver pulls up to
+// batch_depth datagrams per recvmmsg() into a ring of preallocated slots, and
+// replies sent while a batch is being dispatched are queued and flushed with
+// one sendmmsg(). A depth of 1 is the classic recvfrom()/sendto() path.
+class UdpTransport : public Transport {
+    int sockfd;
+    EventLoop* loop = nullptr;
+    std::vector<sockaddr_in> addresses;     // indexed by peer slot
+    ReceiveHandler handler;
+
+    // Largest payload an IPv4 UDP datagram can carry
+    static constexpr size_t MAX_DATAGRAM = 65507;
+    static constexpr size_t SLOT_SIZE = 65536;
+    static constexpr size_t DEFAULT_BATCH_DEPTH = 16;
+    // Receive batches drained per wakeup before yielding to timers
+    static constexpr int MAX_BATCHES_PER_WAKE = 8;
+
+    size_t batch_depth = DEFAULT_BATCH_DEPTH;
+    std::vector<char> recv_ring;
+    std::vector<sockaddr_in> recv_addrs;
+    std::vector<size_t> recv_lens;
+    std::vector<char> send_ring;
+    std::vector<size_t> send_lens;
+    std::vector<int> send_dests;
+    size_t send_queued = 0;
+    bool deferring_sends = false;   // loop thread only
+
+public:
+    UdpTransport(const ClusterConfig& config, int self_slot) {
+        for (size_t slot = 0; slot < config.size(); slot++) {
+            addresses.push_back(config.at(slot).address);
+        }
+
+        // Create and configure UDP socket
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd < 0) {
+            throw std::runtime_error("Socket creation failed");
+        }
+
+        // Bind to configured port
+        sockaddr_in servaddr = addresses.at(self_slot);
+        if (bind(sockfd, (sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
+            close(sockfd);
+            throw std::runtime_error("Bind failed");
+        }
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    ~UdpTransport() override {
+        stop();
+        close(sockfd);
+    }
+
+    void start(EventLoop& event_loop, ReceiveHandler h) override {
+        loop = &event_loop;
+        handler = std::move(h);
+        recv_ring.assign(batch_depth * SLOT_SIZE, 0);
+        recv_addrs.assign(batch_depth, sockaddr_in{});
+        recv_lens.assign(batch_depth, 0);
+        send_ring.assign(batch_depth * SLOT_SIZE, 0);
+        send_lens.assign(batch_depth, 0);
+        send_dests.assign(batch_depth, 0);
+        loop->add_fd(sockfd, EPOLLIN, [this](uint32_t) { on_readable(); });
+    }
+
+    void stop() override {
+        if (loop) {
+            loop->remove_fd(sockfd);
+            loop = nullptr;
+        }
+    }
+
+    void send(int peer, const char* data, size_t len) override {
+        check_size(len);
+        if (on_loop_thread() && deferring_sends) {
+            queue_send(peer, data, len);
+            return;
+        }
+        const auto& dest = addresses[peer];
+        sendto(sockfd, data, len, 0,
+              (sockaddr*)&dest, sizeof(dest));
+    }
+
+    void send_many(const std::vector<int>& targets, const char* data, size_t len) override {
+        check_size(len);
+        if ((on_loop_thread() && deferring_sends) || batch_depth == 1) {
+            for (int peer : targets) {
+                send(peer, data, len);
+            }
+            return;
+        }
+        // Same payload for every peer, so all headers share one iovec
+        thread_local std::vector<mmsghdr> msgs;
+        iovec iov{const_cast<char*>(data), len};
+        msgs.assign(targets.size(), mmsghdr{});
+        for (size_t i = 0; i < targets.size(); i++) {
+            auto& dest = addresses[targets[i]];
+            msgs[i].msg_hdr.msg_name = &dest;
+            msgs[i].msg_hdr.msg_namelen = sizeof(dest);
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        send_mmsg(msgs.data(), msgs.size());
+    }
+
+    size_t max_message_size() const override { return MAX_DATAGRAM; }
+
+    // Must be set before start(); 1 disables batching
+    void set_batch_depth(size_t depth) override {
+        if (loop) {
+            throw std::logic_error("Batch depth must be set before start()");
+        }
+        batch_depth = depth == 0 ? 1 : depth;
+    }
+
+    size_t get_batch_depth() const override { return batch_depth; }
+
+private:
+    void check_size(size_t len) const {
+        if (len > MAX_DATAGRAM) {
+            throw std::length_error("Message of " + std::to_string(len) +
+                                    " bytes exceeds UDP datagram limit");
+        }
+    }
+
+    bool on_loop_thread() const {
+        return loop && loop->in_loop_thread();
+    }
+
+    // Copy an outbound datagram into the send ring; flushed after the batch
+    void queue_send(int peer, const char* data, size_t len) {
+        if (send_queued == batch_depth) {
+            flush_sends();
+        }
+        std::memcpy(send_ring.data() + send_queued * SLOT_SIZE, data, len);
+        send_lens[send_queued] = len;
+        send_dests[send_queued] = peer;
+        send_queued++;
+    }
+
+    void flush_sends() {
+        if (send_queued == 0) return;
+        thread_local std::vector<mmsghdr> msgs;
+        thread_local std::vector<iovec> iovs;
+        msgs.assign(send_queued, mmsghdr{});
+        iovs.resize(send_queued);
+        for (size_t i = 0; i < send_queued; i++) {
+            iovs[i] = iovec{send_ring.data() + i * SLOT_SIZE, send_lens[i]};
+            auto& dest = addresses[send_dests[i]];
+            msgs[i].msg_hdr.msg_name = &dest;
+            msgs[i].msg_hdr.msg_namelen = sizeof(dest);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        send_mmsg(msgs.data(), send_queued);
+        send_queued = 0;
+    }
+
+    // sendmmsg() may stop short; keep going until everything is handed off
+    void send_mmsg(mmsghdr* msgs, size_t count) {
+        size_t sent = 0;
+        while (sent < count) {
+            int n = sendmmsg(sockfd, msgs + sent, count - sent, 0);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                break;
+            }
+            sent += n;
+        }
+    }
+
+    // Fill up to batch_depth ring slots; returns the number of datagrams read
+    size_t receive_batch() {
+        if (batch_depth > 1) {
+            thread_local std::vector<mmsghdr> msgs;
+            thread_local std::vector<iovec> iovs;
+            msgs.assign(batch_depth, mmsghdr{});
+            iovs.resize(batch_depth);
+            for (size_t i = 0; i < batch_depth; i++) {
+                iovs[i] = iovec{recv_ring.data() + i * SLOT_SIZE, SLOT_SIZE};
+                msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(sockfd, msgs.data(), batch_depth, MSG_DONTWAIT, nullptr);
+            if (n <= 0) return 0;
+            for (int i = 0; i < n; i++) {
+                recv_lens[i] = msgs[i].msg_len;
+            }
+            return n;
+        }
+        socklen_t len = sizeof(sockaddr_in);
+        ssize_t n = recvfrom(sockfd, recv_ring.data(), SLOT_SIZE, 0,
+                            (sockaddr*)&recv_addrs[0], &len);
+        if (n <= 0) return 0;
+        recv_lens[0] = n;
+        return 1;
+    }
+
+    // Drain the socket in batches; level-triggered epoll brings us back if
+    // datagrams are left after MAX_BATCHES_PER_WAKE
+    void on_readable() {
+        for (int batch = 0; batch < MAX_BATCHES_PER_WAKE; batch++) {
+            size_t count = receive_batch();
+            if (count == 0) break;
+
+            deferring_sends = batch_depth > 1;
+            for (size_t i = 0; i < count; i++) {
+                handler(recv_ring.data() + i * SLOT_SIZE, recv_lens[i]);
+            }
+            deferring_sends = false;
+            flush_sends();
+        }
+    }
+};
+
+
+//--------------------------------------------------
+// Stream Transport
+//--------------------------------------------------
+// Persistent TCP connections with u32 length-prefixed frames. Each node
+// dials one outbound connection per peer for sending (TCP_NODELAY) and reads
+// from the connections its peers dialed in. Sends append to a per-peer queue, so
+// large batches and pipelined RPCs just stream out. Sends made on the loop
+// thread are flushed once at the end of the tick; other threads write
+// directly when the queue is empty. Messages queued for a peer whose
+// connection fails are dropped, the same way UDP would lose them. Messages
+// to our own slot are posted straight back to the receive handler.
+class StreamTransport : public Transport {
+    using Clock = std::chrono::steady_clock;
+
+    struct Peer {
+        sockaddr_in address;
+        std::mutex mutex;
+        int fd = -1;
+        bool connecting = false;
+        bool failed = false;        // write error seen off the loop thread
+        bool write_armed = false;   // EPOLLOUT registered
+        bool flush_scheduled = false;
+        Clock::time_point retry_at;
+        std::vector<char> queue;    // framed bytes not yet written
+        size_t queue_head = 0;
+
+        size_t pending() const { return queue.size() - queue_head; }
+    };
+
+    struct Inbound {
+        std::vector<char> buffer;
+        size_t used = 0;
+    };
+
+    static constexpr size_t FRAME_HEADER = sizeof(uint32_t);
+    static constexpr size_t MAX_FRAME = 64u << 20;
+    static constexpr size_t MAX_QUEUE = 256u << 20;
+    static constexpr int RETRY_MS = 100;
+
+    int listen_fd = -1;
+    EventLoop* loop = nullptr;
+    std::vector<std::unique_ptr<Peer>> peers;   // indexed by slot; null for self
+    std::unordered_map<int, Inbound> inbound;   // keyed by fd
+    ReceiveHandler handler;
+
+    Histogram& queue_bytes = Metrics::instance().histogram("tcp.send_queue_bytes");
+    Counter& dropped = Metrics::instance().counter("tcp.send_dropped");
+
+public:
+    StreamTransport(const ClusterConfig& config, int self_slot) {
+        peers.resize(config.size());
+        for (size_t slot = 0; slot < config.size(); slot++) {
+            if (static_cast<int>(slot) == self_slot) continue;
+            peers[slot] = std::make_unique<Peer>();
+            peers[slot]->address = config.at(slot).address;
+        }
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            throw std::runtime_error("Socket creation failed");
+        }
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in servaddr = config.at(self_slot).address;
+        if (bind(listen_fd, (sockaddr*)&servaddr, sizeof(servaddr)) < 0 ||
+            listen(listen_fd, 64) < 0) {
+            close(listen_fd);
+            throw std::runtime_error("Bind failed");
+        }
+        set_nonblocking(listen_fd);
+    }
+
+    ~StreamTransport() override {
+        stop();
+        for (auto& peer : peers) {
+            if (peer && peer->fd >= 0) close(peer->fd);
+        }
+        for (auto& [fd, conn] : inbound) {
+            close(fd);
+        }
+        close(listen_fd);
+    }
+
+    void start(EventLoop& event_loop, ReceiveHandler h) override {
+        loop = &event_loop;
+        handler = std::move(h);
+        loop->add_fd(listen_fd, EPOLLIN, [this](uint32_t) { on_accept(); });
+    }
+
+    void stop() override {
+        if (!loop) return;
+        loop->remove_fd(listen_fd);
+        for (auto& [fd, conn] : inbound) {
+            loop->remove_fd(fd);
+        }
+        for (auto& peer : peers) {
+            if (peer && peer->fd >= 0) loop->remove_fd(peer->fd);
+        }
+        loop = nullptr;
+    }
+
+    void send(int slot, const char* data, size_t len) override {
+        if (len > MAX_FRAME) {
+            throw std::length_error("Message of " + std::to_string(len) +
+                                    " bytes exceeds stream frame limit");
+        }
+        if (!peers.at(slot)) {
+            // Ourselves: delivered on the loop, as UDP delivers a datagram
+            // sent to our own address
+            if (loop) loop->post([this, msg = std::string(data, len)] { handler(msg.data(), msg.size()); });
+            return;
+        }
+        Peer& peer = *peers.at(slot);
+        bool on_loop = loop && loop->in_loop_thread();
+        bool needs_service;
+        {
+            std::lock_guard<std::mutex> lock(peer.mutex);
+            if (peer.pending() + FRAME_HEADER + len > MAX_QUEUE) {
+                LOG_WARN("Send queue to slot " << slot << " full, dropping message");
+                dropped.add();
+                return;
+            }
+            append_frame(peer, data, len);
+            queue_bytes.record(peer.pending());
+
+            if (on_loop) {
+                // Coalesce everything sent this tick into one write per peer
+                if (!peer.flush_scheduled) {
+                    peer.flush_scheduled = true;
+                    loop->defer([this, &peer] { service(peer); });
+                }
+                return;
+            }
+
+            if (peer.fd >= 0 && !peer.connecting && !peer.failed && peer.pending() == len + FRAME_HEADER) {
+                if (!flush_locked(peer)) peer.failed = true;
+            }
+            needs_service = peer.pending() > 0 || peer.failed;
+        }
+        if (needs_service && loop) {
+            loop->post([this, &peer] { service(peer); });
+        }
+    }
+
+    size_t max_message_size() const override { return MAX_FRAME; }
+
+private:
+    static void set_nonblocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    static void append_frame(Peer& peer, const char* data, size_t len) {
+        char header[FRAME_HEADER];
+        uint32_t n = wire::to_le(static_cast<uint32_t>(len));
+        std::memcpy(header, &n, sizeof(n));
+        peer.queue.insert(peer.queue.end(), header, header + FRAME_HEADER);
+        peer.queue.insert(peer.queue.end(), data, data + len);
+    }
+
+    // Loop thread only
+    void disconnect_locked(Peer& peer) {
+        loop->remove_fd(peer.fd);
+        close(peer.fd);
+        peer.fd = -1;
+        peer.connecting = false;
+        peer.failed = false;
+        peer.write_armed = false;
+        peer.queue.clear();
+        peer.queue_head = 0;
+        peer.retry_at = Clock::now() + std::chrono::milliseconds(RETRY_MS);
+    }
+
+    // Write as much of the queue as the socket takes without blocking.
+    // Returns false on a connection error.
+    bool flush_locked(Peer& peer) {
+        while (peer.pending() > 0) {
+            ssize_t n = ::send(peer.fd, peer.queue.data() + peer.queue_head, peer.pending(),
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                peer.queue_head += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        if (peer.queue_head == peer.queue.size()) {
+            peer.queue.clear();
+            peer.queue_head = 0;
+        } else if (peer.queue_head > peer.queue.size() / 2) {
+            peer.queue.erase(peer.queue.begin(), peer.queue.begin() + peer.queue_head);
+            peer.queue_head = 0;
+        }
+        return true;
+    }
+
+    // Start a non-blocking connect; queued data goes out once it completes
+    void connect_locked(Peer& peer) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return;
+        set_nonblocking(fd);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        int rc = connect(fd, (sockaddr*)&peer.address, sizeof(peer.address));
+        if (rc < 0 && errno != EINPROGRESS) {
+            close(fd);
+            peer.queue.clear();
+            peer.queue_head = 0;
+            peer.retry_at = Clock::now() + std::chrono::milliseconds(RETRY_MS);
+            return;
+        }
+        peer.fd = fd;
+        peer.connecting = rc < 0;
+        peer.write_armed = false;
+        loop->add_fd(fd, 0, [this, &peer](uint32_t events) { on_peer_event(peer, events); });
+    }
+
+    // Bring a peer's connection and EPOLLOUT interest in line with its queue
+    void service(Peer& peer) {
+        if (!loop) return;
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        peer.flush_scheduled = false;
+
+        if (peer.failed) {
+            disconnect_locked(peer);
+            return;
+        }
+        if (peer.fd < 0) {
+            if (peer.pending() == 0) return;
+            if (Clock::now() < peer.retry_at) {
+                // Peer recently unreachable: drop rather than buffer unboundedly
+                peer.queue.clear();
+                peer.queue_head = 0;
+                return;
+            }
+            connect_locked(peer);
+            if (peer.fd < 0) return;
+        }
+        if (!peer.connecting && !flush_locked(peer)) {
+            disconnect_locked(peer);
+            return;
+        }
+        bool want_write = peer.connecting || peer.pending() > 0;
+        if (want_write != peer.write_armed) {
+            loop->modify_fd(peer.fd, want_write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+            peer.write_armed = want_write;
+        }
+    }
+
+    void on_peer_event(Peer& peer, uint32_t events) {
+        {
+            std::lock_guard<std::mutex> lock(peer.mutex);
+            if (peer.fd < 0) return;
+            if (peer.connecting) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(peer.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                    disconnect_locked(peer);
+                    return;
+                }
+                peer.connecting = false;
+            } else if (events & (EPOLLERR | EPOLLHUP)) {
+                disconnect_locked(peer);
+                return;
+            }
+        }
+        service(peer);
+    }
+
+    void on_accept() {
+        int fd;
+        while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+            set_nonblocking(fd);
+            inbound[fd] = Inbound{};
+            loop->add_fd(fd, EPOLLIN, [this, fd](uint32_t) { on_inbound(fd); });
+        }
+    }
+
+    void on_inbound(int fd) {
+        auto it = inbound.find(fd);
+        if (it == inbound.end()) return;
+        if (!read_inbound(fd, it->second)) {
+            loop->remove_fd(fd);
+            close(fd);
+            inbound.erase(fd);
+        }
+    }
+
+    // Returns false when the connection should be closed
+    bool read_inbound(int fd, Inbound& conn) {
+        while (true) {
+            if (conn.buffer.size() - conn.used < 65536) {
+                conn.buffer.resize(conn.used + 65536);
+            }
+            ssize_t n = recv(fd, conn.buffer.data() + conn.used,
+                             conn.buffer.size() - conn.used, MSG_DONTWAIT);
+            if (n == 0) return false;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            conn.used += n;
+            if (!deliver_frames(conn)) return false;
+        }
+    }
+
+    bool deliver_frames(Inbound& conn) {
+        size_t offset = 0;
+        while (conn.used - offset >= FRAME_HEADER) {
+            uint32_t len;
+            std::memcpy(&len, conn.buffer.data() + offset, sizeof(len));
+            len = wire::to_le(len);
+            if (len > MAX_FRAME) {
+                LOG_WARN("Oversized stream frame of " << len << " bytes");
+                return false;
+            }
+            if (conn.used - offset < FRAME_HEADER + len) break;
+
+            handler(conn.buffer.data() + offset + FRAME_HEADER, len);
+            offset += FRAME_HEADER + len;
+        }
+        if (offset > 0) {
+            std::memmove(conn.buffer.data(), conn.buffer.data() + offset, conn.used - offset);
+            conn.used -= offset;
+        }
+        return true;
+    }
+};
+
+inline std::unique_ptr<Transport> make_transport(TransportKind kind, const ClusterConfig& config,
+                                                 int self_slot) {
+    if (kind == TransportKind::STREAM) {
+        return std::make_unique<StreamTransport>(config, self_slot);
+    }
+    return std::make_unique<UdpTransport>(config, self_slot);
+}
@@ -0,0 +1,498 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "crc32c.cpp"
+#include "logger.cpp"
+#include "messages.cpp"
+#include "metrics.cpp"
+
+//--------------------------------------------------
+// Write-Ahead Log
+//--------------------------------------------------
+// Durable Raft state: the log entries plus the current term and vote.
+//
+// The log is a directory of fixed-size segment files named by a sequence
+// number (0000000000000001.wal, ...). Records are appended back to back:
+//
+//     u32 crc32c | u32 length | u64 segment seq | u8 type | payload
+//
+// The CRC covers everything after itself. Each record carries the number of
+// the segment it was written to, so bytes left over from a segment's
+// previous life are rejected after it is recycled. A zero header marks the
+// end of the log: every write is followed by one, and preallocated space
+// reads as zeros.
+//
+// Appends only go to a memory buffer. sync() writes the buffer with one
+// write() and makes it durable with one fdatasync(), so everything appended
+// during one event loop tick shares a single flush (group commit). Segments
+// are preallocated to full size up front, so a sync never changes the file
+// size and fdatasync has no metadata to flush. Released segments are kept
+// as spares and renamed into place instead of allocating new ones.
+//
+// Recovery mmaps each segment and scans it sequentially. It stops at the
+// first torn or corrupt record, zeroes the bad tail and turns any later
+// segments into spares. An ENTRY record at an index at or below the current
+// end replaces that suffix, which is how follower truncation is replayed; a
+// RESET record (written when a follower installs a snapshot) drops every
+// entry before it.
+//
+// Several Raft groups can share one log, and so one sync per tick between
+// them. Each keeps its own entries, term and vote: records of groups other
+// than 0 set the GROUPED bit in their type and start with the u32 group id
+// (group 0 records are unchanged). recover(group) hands each group its
+// share of one scan, and a segment is released once every group with
+// entries in it has released them.
+class Wal {
+public:
+    static constexpr size_t DEFAULT_SEGMENT_SIZE = 64 << 20;
+    static constexpr size_t MAX_SPARES = 2;
+
+    struct Recovery {
+        uint64_t term = 0;
+        int voted_for = -1;
+        uint64_t first_index = 1;       // index of entries[0]
+        bool reset = false;             // entries follow a RESET at first_index - 1
+        std::vector<LogEntry> entries;
+    };
+
+private:
+    enum RecordType : uint8_t { ENTRY = 1, STATE = 2, RESET = 3, GROUPED = 0x80 };
+
+    struct Segment {
+        uint64_t seq;
+        std::map<uint32_t, uint64_t> last_index;    // per group: highest entry index it holds
+    };
+
+    struct GroupState {
+        uint64_t term = 0;
+        int voted_for = -1;
+        uint64_t released = 0;          // entries before this are covered by a snapshot
+    };
+
+    static constexpr size_t HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t) + 1;
+
+    std::string dir;
+    size_t segment_size;
+
+    std::vector<Segment> segments;      // oldest first; back() is being written
+    std::vector<std::string> spares;
+    int fd = -1;
+    size_t offset = 0;                  // durable end of the active segment
+    std::vector<char> buffer;           // appended but not yet written
+
+    std::map<uint32_t, GroupState> states;
+    std::map<uint32_t, Recovery> unclaimed;     // scanned, not yet handed to recover()
+    bool recovered = false;
+
+    uint64_t sync_count = 0;
+    uint64_t bytes_written = 0;
+
+    Histogram& sync_ns = Metrics::instance().histogram("wal.sync_ns");
+    Histogram& sync_bytes = Metrics::instance().histogram("wal.sync_bytes");
+
+public:
+    explicit Wal(std::string dir, size_t segment_size = DEFAULT_SEGMENT_SIZE) :
+        dir(std::move(dir)), segment_size(segment_size) {
+        if (mkdir(this->dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create WAL directory '" + this->dir + "': " +
+                                     strerror(errno));
+        }
+    }
+
+    ~Wal() {
+        if (fd >= 0) {
+            try {
+                sync();
+            } catch (const std::exception& e) {
+                LOG_ERROR("WAL sync on close failed: " << e.what());
+            }
+            close(fd);
+        }
+    }
+
+    Wal(const Wal&) = delete;
+    Wal& operator=(const Wal&) = delete;
+
+    // The group's log, term and vote. The directory is replayed on the
+    // first call, which must come before any appending.
+    Recovery recover(uint32_t group = 0) {
+        if (!recovered) scan();
+        Recovery rec;
+        auto it = unclaimed.find(group);
+        if (it != unclaimed.end()) {
+            rec = std::move(it->second);
+            unclaimed.erase(it);
+        }
+        return rec;
+    }
+
+    void append_entry(uint64_t index, const LogEntry& entry, uint32_t group = 0) {
+        size_t payload = sizeof(uint64_t) + entry.wire_size();
+        char* p = reserve_record(ENTRY, payload, group);
+        WireWriter w(p, payload);
+        w.put_u64(index);
+        entry.write(w);
+        seal_record(p, payload, group);
+        segments.back().last_index[group] = index;
+    }
+
+    // The log was replaced by a snapshot ending at `index`
+    void append_reset(uint64_t index, uint64_t term, uint32_t group = 0) {
+        size_t payload = 2 * sizeof(uint64_t);
+        char* p = reserve_record(RESET, payload, group);
+        WireWriter w(p, payload);
+        w.put_u64(index);
+        w.put_u64(term);
+        seal_record(p, payload, group);
+        segments.back().last_index[group] = index;
+    }
+
+    void append_state(uint64_t new_term, int new_voted_for, uint32_t group = 0) {
+        GroupState& state = states[group];
+        state.term = new_term;
+        state.voted_for = new_voted_for;
+        write_state(group);
+    }
+
+    // Write everything appended so far and make it durable
+    void sync() {
+        if (buffer.empty()) return;
+        auto start = std::chrono::steady_clock::now();
+        sync_bytes.record(buffer.size());
+        write_buffer();
+        if (fdatasync(fd) < 0) {
+            throw std::runtime_error(std::string("WAL fdatasync failed: ") + strerror(errno));
+        }
+        sync_ns.record_since(start);
+        sync_count++;
+    }
+
+    // Recycle segments whose entries all precede `index` (they're covered by
+    // a snapshot), for every group with entries in them. The active segment
+    // is never released.
+    void release_before(uint64_t index, uint32_t group = 0) {
+        GroupState& state = states[group];
+        state.released = std::max(state.released, index);
+        auto releasable = [this](const Segment& segment) {
+            for (const auto& [g, last] : segment.last_index) {
+                auto it = states.find(g);
+                if (it == states.end() || last >= it->second.released) return false;
+            }
+            return true;
+        };
+        while (segments.size() > 1 && releasable(segments.front())) {
+            add_spare(segment_path(segments.front().seq));
+            segments.erase(segments.begin());
+        }
+    }
+
+    // Whether sync() has anything to write
+    bool pending() const { return !buffer.empty(); }
+    uint64_t syncs() const { return sync_count; }
+    uint64_t bytes() const { return bytes_written; }
+    size_t segment_count() const { return segments.size(); }
+    size_t spare_count() const { return spares.size(); }
+
+private:
+    std::string segment_path(uint64_t seq) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.wal", static_cast<unsigned long long>(seq));
+        return dir + "/" + name;
+    }
+
+    void list_segments(std::vector<uint64_t>& found) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            throw std::runtime_error("Cannot open WAL directory '" + dir + "'");
+        }
+        while (dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() == 20 && name.compare(16, 4, ".wal") == 0) {
+                found.push_back(std::stoull(name.substr(0, 16), nullptr, 16));
+            } else if (name.compare(0, 6, "spare-") == 0) {
+                spares.push_back(dir + "/" + name);
+            }
+        }
+        closedir(d);
+        std::sort(found.begin(), found.end());
+    }
+
+    void scan() {
+        std::vector<uint64_t> found;
+        list_segments(found);
+
+        bool valid = true;
+        for (uint64_t seq : found) {
+            if (!valid) {
+                add_spare(segment_path(seq));
+                continue;
+            }
+            size_t end = 0;
+            segments.push_back(Segment{seq, {}});
+            valid = scan_segment(segments.back(), end);
+            offset = end;
+            if (!valid) {
+                LOG_WARN("WAL: torn or corrupt record in segment " << seq << " at offset "
+                         << end << ", discarding the rest of the log");
+                zero_tail(segment_path(seq), end);
+            }
+        }
+
+        for (const auto& [group, rec] : unclaimed) {
+            states[group].term = rec.term;
+            states[group].voted_for = rec.voted_for;
+        }
+        recovered = true;
+
+        if (segments.empty()) {
+            open_segment(1);
+        } else {
+            fd = open_file(segment_path(segments.back().seq));
+        }
+    }
+
+    // Returns false if the scan stopped at a torn or corrupt record; `end`
+    // is the offset just past the last good record
+    bool scan_segment(Segment& segment, size_t& end) {
+        uint64_t seq = segment.seq;
+        int rfd = ::open(segment_path(seq).c_str(), O_RDONLY | O_CLOEXEC);
+        if (rfd < 0) {
+            throw std::runtime_error("Cannot open WAL segment " + segment_path(seq));
+        }
+        struct stat st;
+        fstat(rfd, &st);
+        size_t size = static_cast<size_t>(st.st_size);
+        end = 0;
+        if (size == 0) {
+            close(rfd);
+            return true;
+        }
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, rfd, 0);
+        close(rfd);
+        if (map == MAP_FAILED) {
+            throw std::runtime_error("Cannot mmap WAL segment " + segment_path(seq));
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        const char* data = static_cast<const char*>(map);
+
+        bool valid = true;
+        while (size - end >= HEADER_SIZE) {
+            WireReader header(data + end, HEADER_SIZE);
+            uint32_t crc = header.get_u32();
+            uint32_t length = header.get_u32();
+            uint64_t record_seq = header.get_u64();
+            uint8_t type = header.get_u8();
+
+            if (length == 0 && crc == 0) break;    // preallocated tail
+            if (length > size - end - HEADER_SIZE ||
+                crc != crc32c::compute(data + end + 4, HEADER_SIZE - 4 + length)) {
+                valid = false;
+                break;
+            }
+            if (record_seq != seq) break;          // a recycled segment's previous life
+            if (!replay(type, data + end + HEADER_SIZE, length, segment)) {
+                valid = false;
+                break;
+            }
+            end += HEADER_SIZE + length;
+        }
+        munmap(map, size);
+        return valid;
+    }
+
+    bool replay(uint8_t type, const char* payload, size_t length, Segment& segment) {
+        try {
+            WireReader r(payload, length);
+            uint32_t group = 0;
+            if (type & GROUPED) {
+                group = r.get_u32();
+                type &= static_cast<uint8_t>(~GROUPED);
+            }
+            Recovery& rec = unclaimed[group];
+            if (type == STATE) {
+                rec.term = r.get_u64();
+                rec.voted_for = static_cast<int32_t>(r.get_u32());
+                return true;
+            }
+            if (type == RESET) {
+                rec.entries.clear();
+                rec.first_index = r.get_u64() + 1;
+                rec.reset = true;
+                segment.last_index[group] = rec.first_index - 1;
+                return true;
+            }
+            if (type != ENTRY) return false;
+
+            uint64_t index = r.get_u64();
+            LogEntry entry = LogEntry::read(r);
+            if (rec.entries.empty() && !rec.reset) {
+                rec.first_index = index;
+            } else if (rec.entries.empty() && index != rec.first_index) {
+                return false;
+            } else if (index < rec.first_index || index > rec.first_index + rec.entries.size()) {
+                return false;   // gap: the log can't be trusted past here
+            } else {
+                rec.entries.resize(index - rec.first_index);
+            }
+            rec.entries.push_back(std::move(entry));
+            segment.last_index[group] = index;
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    static size_t group_prefix(uint32_t group) { return group == 0 ? 0 : sizeof(uint32_t); }
+
+    // Room for a record of `payload` bytes (after the group prefix)
+    char* reserve_record(RecordType type, size_t payload, uint32_t group) {
+        if (!recovered) {
+            throw std::logic_error("WAL appended to before recover()");
+        }
+        size_t prefix = group_prefix(group);
+        size_t record = HEADER_SIZE + prefix + payload;
+        if (record > segment_size) {
+            throw std::length_error("WAL record larger than a segment");
+        }
+        if (offset + buffer.size() + record > segment_size) {
+            roll();
+        }
+        size_t at = buffer.size();
+        buffer.resize(at + record);
+        char* p = buffer.data() + at;
+        p[HEADER_SIZE - 1] = static_cast<char>(prefix ? type | GROUPED : type);
+        if (prefix) WireWriter(p + HEADER_SIZE, prefix).put_u32(group);
+        return p + HEADER_SIZE + prefix;
+    }
+
+    void seal_record(char* payload, size_t length, uint32_t group) {
+        size_t prefix = group_prefix(group);
+        char* record = payload - prefix - HEADER_SIZE;
+        length += prefix;
+        WireWriter w(record, HEADER_SIZE - 1);
+        w.put_u32(0);
+        w.put_u32(static_cast<uint32_t>(length));
+        w.put_u64(segments.back().seq);
+        uint32_t crc = crc32c::compute(record + 4, HEADER_SIZE - 4 + length);
+        WireWriter(record, 4).put_u32(crc);
+    }
+
+    void write_state(uint32_t group) {
+        const GroupState& state = states[group];
+        size_t payload = sizeof(uint64_t) + sizeof(uint32_t);
+        char* p = reserve_record(STATE, payload, group);
+        WireWriter w(p, payload);
+        w.put_u64(state.term);
+        w.put_u32(static_cast<uint32_t>(state.voted_for));
+        seal_record(p, payload, group);
+    }
+
+    // Writes the buffer followed by a zero header. The next write overwrites
+    // the marker; until then it tells recovery the log ends cleanly here
+    // rather than in leftovers from a recycled segment's previous life.
+    void write_buffer() {
+        size_t length = buffer.size();
+        if (offset + length + HEADER_SIZE <= segment_size) {
+            buffer.resize(length + HEADER_SIZE, '\0');
+        }
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t n = pwrite(fd, buffer.data() + done, buffer.size() - done, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("WAL write failed: ") + strerror(errno));
+            }
+            done += static_cast<size_t>(n);
+        }
+        offset += length;
+        bytes_written += length;
+        buffer.clear();
+    }
+
+    // Seal the active segment and continue in a fresh one
+    void roll() {
+        sync();
+        close(fd);
+        open_segment(segments.back().seq + 1);
+        // Every segment restates each group's term and vote, so releasing
+        // old segments never loses them
+        if (states.empty()) states[0];
+        for (const auto& state : states) write_state(state.first);
+    }
+
+    void open_segment(uint64_t seq) {
+        std::string path = segment_path(seq);
+        if (!spares.empty()) {
+            if (rename(spares.back().c_str(), path.c_str()) < 0) {
+                throw std::runtime_error("Cannot recycle WAL segment: " + std::string(strerror(errno)));
+            }
+            spares.pop_back();
+            fd = open_file(path);
+        } else {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw std::runtime_error("Cannot create WAL segment " + path);
+            }
+            int err = posix_fallocate(fd, 0, static_cast<off_t>(segment_size));
+            if (err != 0) {
+                throw std::runtime_error("Cannot preallocate WAL segment: " + std::string(strerror(err)));
+            }
+            fsync(fd);
+        }
+        sync_dir();
+        segments.push_back(Segment{seq, {}});
+        offset = 0;
+    }
+
+    int open_file(const std::string& path) {
+        int f = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (f < 0) {
+            throw std::runtime_error("Cannot open WAL segment " + path);
+        }
+        return f;
+    }
+
+    void add_spare(const std::string& path) {
+        if (spares.size() >= MAX_SPARES) {
+            unlink(path.c_str());
+            return;
+        }
+        std::string spare = dir + "/spare-" + std::to_string(spares.size()) + "-" +
+                            path.substr(path.size() - 20, 16);
+        rename(path.c_str(), spare.c_str());
+        spares.push_back(spare);
+    }
+
+    // Drop the bytes past `end` so nothing stale can follow records written there
+    void zero_tail(const std::string& path, size_t end) {
+        int f = open_file(path);
+        if (ftruncate(f, static_cast<off_t>(end)) < 0 ||
+            posix_fallocate(f, 0, static_cast<off_t>(segment_size)) != 0) {
+            close(f);
+            throw std::runtime_error("Cannot repair WAL segment " + path);
+        }
+        fsync(f);
+        close(f);
+    }
+
+    void sync_dir() {
+        int d = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (d >= 0) {
+            fsync(d);
+            close(d);
+        }
+    }
+};
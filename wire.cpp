@@ -0,0 +1,189 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+//--------------------------------------------------
+// Wire Format
+//--------------------------------------------------
+// Every RPC payload can travel either as JSON text (handy when debugging with
+// tcpdump) or as a compact binary record. The binary form is little-endian,
+// strings are u32 length-prefixed, and the payload starts with WIRE_VERSION so
+// the receiver can tell the two apart (a JSON payload always starts with '{').
+enum class WireFormat { JSON, BINARY };
+
+constexpr uint8_t WIRE_VERSION = 3;
+
+inline const char* wire_format_name(WireFormat f) {
+    return f == WireFormat::JSON ? "json" : "binary";
+}
+
+namespace wire {
+    inline uint16_t to_le(uint16_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap16(v);
+#else
+        return v;
+#endif
+    }
+
+    inline uint32_t to_le(uint32_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap32(v);
+#else
+        return v;
+#endif
+    }
+
+    inline uint64_t to_le(uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return __builtin_bswap64(v);
+#else
+        return v;
+#endif
+    }
+}
+
+//--------------------------------------------------
+// Wire Writer
+//--------------------------------------------------
+// Appends fields into a caller-provided buffer. Never allocates; throws if the
+// buffer is too small so callers can size it with wire_encoded_size().
+class WireWriter {
+    char* buf;
+    size_t cap;
+    size_t pos = 0;
+
+    void reserve(size_t n) {
+        if (cap - pos < n) {
+            throw std::length_error("Wire buffer too small");
+        }
+    }
+
+public:
+    WireWriter(char* buf, size_t cap) : buf(buf), cap(cap) {}
+
+    void put_u8(uint8_t v) {
+        reserve(1);
+        buf[pos++] = static_cast<char>(v);
+    }
+
+    void put_bool(bool v) { put_u8(v ? 1 : 0); }
+
+    void put_u32(uint32_t v) {
+        reserve(sizeof(v));
+        v = wire::to_le(v);
+        std::memcpy(buf + pos, &v, sizeof(v));
+        pos += sizeof(v);
+    }
+
+    void put_u64(uint64_t v) {
+        reserve(sizeof(v));
+        v = wire::to_le(v);
+        std::memcpy(buf + pos, &v, sizeof(v));
+        pos += sizeof(v);
+    }
+
+    void put_i64(int64_t v) { put_u64(static_cast<uint64_t>(v)); }
+
+    void put_string(std::string_view s) {
+        put_u32(static_cast<uint32_t>(s.size()));
+        reserve(s.size());
+        std::memcpy(buf + pos, s.data(), s.size());
+        pos += s.size();
+    }
+
+    size_t size() const { return pos; }
+};
+
+//--------------------------------------------------
+// Wire Reader
+//--------------------------------------------------
+// Reads fields straight out of the receive buffer. Strings come back as views
+// into that buffer, so nothing is copied unless the caller asks for it.
+class WireReader {
+    const char* data;
+    size_t len;
+    size_t pos = 0;
+
+    void require(size_t n) {
+        if (len - pos < n) {
+            throw std::runtime_error("Truncated wire message");
+        }
+    }
+
+public:
+    WireReader(const char* data, size_t len) : data(data), len(len) {}
+
+    uint8_t get_u8() {
+        require(1);
+        return static_cast<uint8_t>(data[pos++]);
+    }
+
+    bool get_bool() { return get_u8() != 0; }
+
+    uint32_t get_u32() {
+        uint32_t v;
+        require(sizeof(v));
+        std::memcpy(&v, data + pos, sizeof(v));
+        pos += sizeof(v);
+        return wire::to_le(v);
+    }
+
+    uint64_t get_u64() {
+        uint64_t v;
+        require(sizeof(v));
+        std::memcpy(&v, data + pos, sizeof(v));
+        pos += sizeof(v);
+        return wire::to_le(v);
+    }
+
+    int64_t get_i64() { return static_cast<int64_t>(get_u64()); }
+
+    std::string_view get_string() {
+        uint32_t n = get_u32();
+        require(n);
+        std::string_view s(data + pos, n);
+        pos += n;
+        return s;
+    }
+
+    void expect_version() {
+        uint8_t v = get_u8();
+        if (v != WIRE_VERSION) {
+            throw std::runtime_error("Unsupported wire version " + std::to_string(v));
+        }
+    }
+
+    size_t remaining() const { return len - pos; }
+};
+
+// Encoded size of a length-prefixed string field
+inline size_t wire_string_size(std::string_view s) {
+    return sizeof(uint32_t) + s.size();
+}
+
+// Encode a message (version byte + body) into buf. Returns bytes written.
+template <typename T>
+size_t wire_encode(const T& msg, char* buf, size_t cap) {
+    WireWriter w(buf, cap);
+    w.put_u8(WIRE_VERSION);
+    msg.write(w);
+    return w.size();
+}
+
+// Full encoded size of a message, version byte included
+template <typename T>
+size_t wire_encoded_size(const T& msg) {
+    return 1 + msg.wire_size();
+}
+
+// Decode a message produced by wire_encode
+template <typename T>
+T wire_decode(const char* data, size_t len) {
+    WireReader r(data, len);
+    r.expect_version();
+    return T::read(r);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------
+// Worker Pool
+//--------------------------------------------------
+// A fixed set of threads that run one job at a time: run(job) calls
+// job(worker) on every worker, the calling thread acting as worker 0, and
+// returns once all of them have finished. Work inside a job is divided by
+// the job itself (e.g. by grabbing morsels off a shared counter).
+class WorkerPool {
+    using Job = std::function<void(size_t worker)>;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const Job* job = nullptr;
+    uint64_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void work(size_t worker) {
+        uint64_t seen = 0;
+        while (true) {
+            const Job* current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                current = job;
+            }
+            run_one(*current, worker);
+        }
+    }
+
+    void run_one(const Job& current, size_t worker) {
+        try {
+            current(worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0) done_cv.notify_one();
+    }
+
+public:
+    explicit WorkerPool(size_t workers) {
+        for (size_t i = 1; i < std::max<size_t>(workers, 1); i++) {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    size_t size() const { return threads.size() + 1; }
+
+    // Not reentrant; rethrows the first exception any worker threw
+    void run(const Job& fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            running = size();
+            error = nullptr;
+            generation++;
+        }
+        start_cv.notify_all();
+        run_one(fn, 0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&] { return running == 0; });
+        job = nullptr;
+        if (error) std::rethrow_exception(error);
+    }
+};